@@ -138,6 +138,9 @@ namespace AVI {
   constexpr std::uint32_t AVISF_VIDEO_PALCHANGES = 0x00010000;
   constexpr std::uint32_t AVIIF_LIST             = 0x00000001;
   constexpr std::uint32_t AVIIF_KEYFRAME         = 0x00000010;
+
+  // set in AVISTDINDEXENTRY::dwSize for a chunk which is not a keyframe
+  constexpr std::uint32_t AVISTDINDEX_DELTAFRAME = 0x80000000;
 }
 
 #endif
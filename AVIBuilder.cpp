@@ -80,6 +80,11 @@ namespace {
 //
 
 
+std::optional<std::uint_fast32_t> AVIBuilder::AVIStream::GetReferencedBlock(std::uint_fast32_t index) const {
+  return std::nullopt;
+}
+
+
 bool AVIBuilder::AVIStream::FixSuggestedBufferSize() const {
   return true;
 }
@@ -104,10 +109,19 @@ AVIBuilder::AVIBuilder(BuilderFlags builderFlags) :
   mPrimaryVideoStreamIndex(),
   mAvihFlags(DefaultAvihFlags),
   mJunkSize(DefaultJunkSize),
-  mListInfo()
+  mListInfo(),
+  mChunkAlignment(0),
+  mAlignmentPaddingSize(0),
+  mIndexSize(0),
+  mBlockLayout()
 {}
 
 
+std::uint32_t AVIBuilder::GetChunkId(std::size_t streamIndex, std::uint32_t fourCC) {
+  return (fourCC & 0xFFFF0000) | IndexToFourCC(static_cast<unsigned int>(streamIndex));
+}
+
+
 void AVIBuilder::SetAvihFlags(std::uint32_t avihFlags) {
   mAvihFlags = avihFlags;
 }
@@ -123,6 +137,14 @@ void AVIBuilder::SetListInfo(std::shared_ptr<RIFFList> listInfo) {
 }
 
 
+void AVIBuilder::SetChunkAlignment(std::uint_fast32_t chunkAlignment) {
+  if (chunkAlignment & (chunkAlignment - 1)) {
+    throw std::runtime_error("chunk alignment must be a power of two");
+  }
+  mChunkAlignment = chunkAlignment;
+}
+
+
 void AVIBuilder::AddStream(std::shared_ptr<AVIStream> stream, bool primaryVideoStream) {
   if (primaryVideoStream) {
     assert(!mPrimaryVideoStreamIndex);
@@ -207,10 +229,16 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
       std::vector<PerBlockInfo> blocks;
     };
 
+    struct PerChunkInfo {
+      std::shared_ptr<RIFFChunk> chunk;
+      std::shared_ptr<RIFFList> listMovi;
+    };
+
     std::shared_ptr<AVIStream> stream;
     std::size_t numBlocks;
     std::uint32_t fourCC;
     Fraction<std::uint_fast64_t> timeCoef;    // seconds / frame
+    Fraction<std::uint_fast64_t> skew;        // seconds by which the chunks are placed ahead of their time (dwInitialFrames)
     std::size_t currentBlockIndex;
     //
     std::shared_ptr<RIFFList> listStrl;
@@ -228,6 +256,8 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     std::uint_fast32_t maxBytesPerSec;
     //
     std::vector<PerRIFFInfo> riffs;
+    //
+    std::vector<PerChunkInfo> chunks;   // indexed by block index, for GetReferencedBlock
   };
 
 
@@ -252,7 +282,7 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
       throw std::runtime_error("dwRate must not be zero");
     }
 
-    const std::uint32_t fourCC = (stream.GetFourCC() & 0xFFFF0000) | IndexToFourCC(static_cast<unsigned int>(i));
+    const std::uint32_t fourCC = GetChunkId(i, stream.GetFourCC());
 
     std::uint_fast32_t maxBlocksPerSec = (strh.dwRate + strh.dwScale - 1) / strh.dwScale;
     if (maxBlocksPerSec == 0) {
@@ -265,6 +295,7 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
       fourCC,
       Fraction<std::uint_fast64_t>(strh.dwScale, strh.dwRate),
       0,
+      0,
       nullptr,
       nullptr,
       nullptr,
@@ -278,9 +309,24 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
       0,
       0,
       {},
+      {},
     });
   }
 
+  // records need another stream to interleave with the primary video stream
+  const bool groupRecords = (mBuilderFlags & GroupRecords) && mPrimaryVideoStreamIndex && mStreams.size() > 1;
+
+  // dwInitialFrames is in frames of the primary video stream
+  std::uint32_t initialFrames = 0;
+  if (mPrimaryVideoStreamIndex) {
+    const auto frameTime = streamInfoArray[mPrimaryVideoStreamIndex.value()].timeCoef;
+    for (auto& streamInfo : streamInfoArray) {
+      const auto streamInitialFrames = streamInfo.stream->GetStrh().dwInitialFrames;
+      streamInfo.skew = frameTime * Fraction<std::uint_fast64_t>(streamInitialFrames);
+      initialFrames = std::max(initialFrames, streamInitialFrames);
+    }
+  }
+
   // ## RIFF-AVI
   auto riffAvi = std::make_shared<RIFFList>(AVI::GetFourCC("RIFF"), AVI::GetFourCC("AVI "));
   riffRoot.AppendChild(riffAvi);
@@ -294,9 +340,9 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     GetAvihMicroSecPerFrame(),
     0u,   // filled later
     0u,
-    mAvihFlags,
+    mAvihFlags | (groupRecords ? AVI::AVIF_ISINTERLEAVED : 0u),
     0u,   // filled later
-    0u,
+    initialFrames,
     static_cast<std::uint32_t>(mStreams.size()),
     0u,   // filled later
     GetAvihWidth(),
@@ -370,9 +416,11 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
 
   //
 
+  std::shared_ptr<RIFFChunk> junk;
+
   // ### JUNK (prepend)
   if (mJunkSize && (mBuilderFlags & PrependJunk)) {
-    auto junk = std::make_shared<RIFFChunk>(AVI::GetFourCC("JUNK"), std::make_shared<NullSource>(mJunkSize));
+    junk = std::make_shared<RIFFChunk>(AVI::GetFourCC("JUNK"), std::make_shared<NullSource>(mJunkSize));
     riffAvi->AppendChild(junk);
   }
 
@@ -382,8 +430,9 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
   }
 
   // ### JUNK
-  if (mJunkSize && !(mBuilderFlags & PrependJunk)) {
-    auto junk = std::make_shared<RIFFChunk>(AVI::GetFourCC("JUNK"), std::make_shared<NullSource>(mJunkSize));
+  // always present for the chunk alignment, as it aligns LIST-movi
+  if ((mJunkSize && !(mBuilderFlags & PrependJunk)) || mChunkAlignment) {
+    junk = std::make_shared<RIFFChunk>(AVI::GetFourCC("JUNK"), std::make_shared<NullSource>(mJunkSize));
     riffAvi->AppendChild(junk);
   }
 
@@ -410,13 +459,43 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     std::size_t streamIndex;
     std::size_t blockIndex;
     std::shared_ptr<RIFFChunk> chunk;
+    bool reference;
+    std::shared_ptr<RIFFList> record;   // set instead of the others for the index entry of a LIST-rec
+    std::size_t idx1EntryIndex;         // for mBlockLayout
+    std::size_t riffIndex;
+    std::size_t ixxxEntryIndex;
   };
+  std::vector<BlockInfo> allBlocks;   // for mBlockLayout
   std::vector<BlockInfo> blocks;    // idx1\zp
 
   std::uint_fast32_t sizeCount = 0;
 
   std::uint_fast32_t maxChunkSize = 0;
 
+  // for GroupRecords
+  // a record is an interleave period: it is closed before a chunk of another stream once it has a chunk of the primary video stream
+  std::shared_ptr<RIFFList> record;
+  bool recordHasPrimaryChunk = false;
+  std::uint_fast32_t maxRecordSize = 0;
+
+  const auto closeRecord = [&record, &maxRecordSize] () {
+    if (record) {
+      maxRecordSize = std::max(maxRecordSize, static_cast<std::uint_fast32_t>(record->GetSize()));
+      record.reset();
+    }
+  };
+
+  // for the chunk alignment
+  // offsets are relative to the first LIST-movi, as the size of the headers before it is not fixed yet
+  // (LIST-movi itself is aligned later by the JUNK before it)
+  std::vector<bool> alignStreamChunks;
+  for (const auto& stream : mStreams) {
+    alignStreamChunks.push_back(mChunkAlignment && stream->GetStrh().fccType == AVIStream::FourCCvids);
+  }
+  std::uint_fast64_t moviBaseOffset = 0;
+  std::uint_fast64_t moviContentSize = 0;
+  mAlignmentPaddingSize = 0;
+
   bool initializeRiff = true;
 
   // Xg[`NǉĂ
@@ -443,17 +522,24 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     const auto maxRiffSize = isAvix ? MaxRiffSizeAVIX : MaxRiffSizeAVI;
 
     // ̃`Ńĩ`N̎ɔzujXg[ĩ`NōŌȂK0j
+    // a skewed stream is compared as if the other one was delayed by its skew, which keeps the times unsigned
     const std::size_t nextStreamIndex = finished ? 0 : *std::min_element(remainingStreams.cbegin(), remainingStreams.cend(), [this, &streamInfoArray] (std::size_t a, std::size_t b) {
       const auto timeA = streamInfoArray[a].timeCoef * mStreams[a]->GetBlockInfo(static_cast<std::uint_fast32_t>(streamInfoArray[a].currentBlockIndex)).startTime;
       const auto timeB = streamInfoArray[b].timeCoef * mStreams[b]->GetBlockInfo(static_cast<std::uint_fast32_t>(streamInfoArray[b].currentBlockIndex)).startTime;
-      return timeA == timeB ? a < b : timeA < timeB;
+      const auto skewedTimeA = timeA + streamInfoArray[b].skew;
+      const auto skewedTimeB = timeB + streamInfoArray[a].skew;
+      return skewedTimeA == skewedTimeB ? a < b : skewedTimeA < skewedTimeB;
     });
 
     // ̃`N̑傫ĩ`NōŌȂ0j
-    const std::uint_fast32_t nextChunkSize = finished ? 0 : 8 + mStreams[nextStreamIndex]->GetBlockInfo(static_cast<std::uint_fast32_t>(streamInfoArray[nextStreamIndex].currentBlockIndex)).size;
+    // (including the header of a LIST-rec which may be started for it)
+    const std::uint_fast32_t nextChunkSize = finished ? 0 : (groupRecords ? 12 : 0) + 8 + mStreams[nextStreamIndex]->GetBlockInfo(static_cast<std::uint_fast32_t>(streamInfoArray[nextStreamIndex].currentBlockIndex)).size;
 
     // finish this RIFF-AVI or RIFF-AVIX list
     if ((blocks.size() >= maxBlocks || sizeCount + nextChunkSize >= maxRiffSize || finished) && !initializeRiff) {
+      // a record does not span RIFF lists
+      closeRecord();
+
       // AVI-RIFFXgォLIST-moviXgÖ̗̑傫܂\̂ŁA
       // AVI-RIFFXgɂꍇ͍ŌɃCfbNXŜ̃ItZbgKv
       // łLIST-moviXgɂ邱Ƃł̖Ă
@@ -477,10 +563,11 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
         const auto ixxxEntries = reinterpret_cast<AVI::AVISTDINDEXENTRY*>(ixxxData.get() + sizeof(AVI::AVISTDINDEX));
         const auto baseOffset = baseRiff->GetOffset();
         for (std::size_t j = 0; j < perRIFFInfoArray[i]->blocks.size(); j++) {
-          auto& chunk = *perRIFFInfoArray[i]->blocks[j].chunk;
+          const auto& block = perRIFFInfoArray[i]->blocks[j];
+          auto& chunk = *block.chunk;
           ixxxEntries[j] = AVI::AVISTDINDEXENTRY{
             static_cast<std::uint32_t>(chunk.GetOffset() - baseOffset + 8),
-            static_cast<std::uint32_t>(chunk.GetSize() - 8),
+            static_cast<std::uint32_t>(chunk.GetSize() - 8) | (block.info.indexFlags & AVI::AVIIF_KEYFRAME ? 0 : AVI::AVISTDINDEX_DELTAFRAME),
           };
         }
         auto ixxxMemorySource = std::make_shared<MemorySource>(std::move(ixxxData), ixxxSize);
@@ -498,6 +585,15 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
         const auto baseOffset = avixListMovi->GetOffset() + 8;    // I don't know why +8, but FFmpeg does
         for (std::size_t i = 0; i < blocks.size(); i++) {
           const auto& block = blocks[i];
+          if (block.record) {
+            indexEntries[i] = AVI::AVIINDEXENTRY{
+              AVI::GetFourCC("rec "),
+              AVI::AVIIF_LIST,
+              static_cast<std::uint32_t>(block.record->GetOffset() - baseOffset),
+              static_cast<std::uint32_t>(block.record->GetSize() - 8),
+            };
+            continue;
+          }
           indexEntries[i] = AVI::AVIINDEXENTRY{
             streamInfoArray[block.streamIndex].fourCC,
             mStreams[block.streamIndex]->GetBlockInfo(static_cast<std::uint_fast32_t>(block.blockIndex)).indexFlags,
@@ -539,6 +635,9 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
 
       sizeCount = static_cast<std::uint_fast32_t>(riffAvix->GetSize());
 
+      moviBaseOffset = mChunkAlignment ? static_cast<std::uint_fast64_t>(avixListMovi->GetOffset() - listMovi->GetOffset()) : 0;
+      moviContentSize = 0;
+
       for (std::size_t i = 0; i < mStreams.size(); i++) {
         streamInfoArray[i].riffs.push_back(StreamInfo::PerRIFFInfo{
           true,
@@ -561,15 +660,84 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     auto& streamInfo = streamInfoArray[nextStreamIndex];
     auto& perRIFFInfo = *perRIFFInfoArray[nextStreamIndex];
 
-    auto chunkSource = stream->GetBlockData(static_cast<std::uint_fast32_t>(streamInfo.currentBlockIndex));
-    auto chunk = std::make_shared<RIFFChunk>(streamInfo.fourCC, chunkSource);
-    avixListMovi->AppendChild(chunk);
+    // reuse the chunk of an identical earlier block if it is in the same LIST-movi
+    // (the offsets of ix## and idx1 are relative to LIST-movi and cannot point backward to another RIFF)
+    std::shared_ptr<RIFFChunk> referencedChunk;
+    if (const auto referencedBlockIndex = stream->GetReferencedBlock(static_cast<std::uint_fast32_t>(streamInfo.currentBlockIndex))) {
+      assert(referencedBlockIndex.value() < streamInfo.currentBlockIndex);
+      const auto& referencedChunkInfo = streamInfo.chunks[referencedBlockIndex.value()];
+      if (referencedChunkInfo.listMovi == avixListMovi) {
+        referencedChunk = referencedChunkInfo.chunk;
+      }
+    }
+
+    // start the next record
+    // references add no data, so they stay out of it (their index entries point to the chunks elsewhere anyway)
+    if (groupRecords && !referencedChunk) {
+      if (record && recordHasPrimaryChunk && nextStreamIndex != mPrimaryVideoStreamIndex.value()) {
+        closeRecord();
+      }
+      if (!record) {
+        record = std::make_shared<RIFFList>(AVI::GetFourCC("LIST"), AVI::GetFourCC("rec "));
+        avixListMovi->AppendChild(record);
+        moviContentSize += 12;
+        sizeCount += 12;
+        recordHasPrimaryChunk = false;
+
+        // the index entry of the record precedes those of its chunks
+        blocks.push_back(BlockInfo{
+          0,
+          0,
+          nullptr,
+          false,
+          record,
+          0,
+          0,
+          0,
+        });
+      }
+      if (nextStreamIndex == mPrimaryVideoStreamIndex.value()) {
+        recordHasPrimaryChunk = true;
+      }
+    }
+    const auto& parentList = record ? record : avixListMovi;
+
+    auto chunkSource = referencedChunk ? nullptr : stream->GetBlockData(static_cast<std::uint_fast32_t>(streamInfo.currentBlockIndex));
+    auto chunk = referencedChunk ? referencedChunk : std::make_shared<RIFFChunk>(streamInfo.fourCC, chunkSource);
+    if (!referencedChunk) {
+      if (alignStreamChunks[nextStreamIndex]) {
+        // 12 bytes for the header of LIST-movi and 8 bytes for that of the chunk
+        const auto dataOffset = moviBaseOffset + 12 + moviContentSize + 8;
+        if (dataOffset % mChunkAlignment) {
+          // the JUNK itself takes 8 bytes of header
+          const auto paddingSize = (mChunkAlignment - (dataOffset + 8) % mChunkAlignment) % mChunkAlignment;
+          auto padding = std::make_shared<RIFFChunk>(AVI::GetFourCC("JUNK"), std::make_shared<NullSource>(paddingSize));
+          parentList->AppendChild(padding);
+          moviContentSize += 8 + paddingSize;
+          sizeCount += static_cast<std::uint_fast32_t>(8 + paddingSize);
+          mAlignmentPaddingSize += 8 + paddingSize;
+        }
+      }
+
+      parentList->AppendChild(chunk);
+    }
+
+    streamInfo.chunks.push_back(StreamInfo::PerChunkInfo{
+      chunk,
+      avixListMovi,
+    });
 
     blocks.push_back(BlockInfo{
       nextStreamIndex,
       streamInfo.currentBlockIndex,
       chunk,
+      static_cast<bool>(referencedChunk),
+      nullptr,
+      blocks.size(),
+      streamInfo.riffs.size() - 1,
+      perRIFFInfo.blocks.size(),
     });
+    allBlocks.push_back(blocks.back());
 
     const auto blockInfo = stream->GetBlockInfo(static_cast<std::uint_fast32_t>(streamInfo.currentBlockIndex));
     perRIFFInfo.blocks.push_back(StreamInfo::PerBlockInfo{
@@ -581,6 +749,11 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     perRIFFInfo.duration += blockInfo.duration;
     streamInfo.currentBlockIndex++;
 
+    if (referencedChunk) {
+      // no data is added
+      continue;
+    }
+
     // őTCY`FbN
     const auto chunkSize = chunk->GetSize();
 
@@ -604,6 +777,7 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     //
 
     sizeCount += static_cast<std::uint_fast32_t>(chunk->GetSize());
+    moviContentSize += chunkSize;
   }
 
   // set indx chunks
@@ -637,6 +811,17 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
     streamInfo.indxMemorySource = indxMemorySource;
   }
 
+  // align the end of JUNK now that the size of the headers is fixed
+  // ix## and idx1 are relative to LIST-movi, so they are not affected
+  if (junk && ((mBuilderFlags & AlignJunk) || mChunkAlignment)) {
+    // both are powers of two
+    const auto alignment = std::max<std::uint_fast64_t>(mBuilderFlags & AlignJunk ? JunkAlignment : 1, mChunkAlignment);
+    const auto junkEnd = static_cast<std::uint_fast64_t>(junk->GetOffset() + junk->GetSize());
+    const auto padding = (alignment - junkEnd % alignment) % alignment;
+    // the offsets are always even, so is the padding
+    junk->SetContentSource(std::make_shared<NullSource>(junk->GetSize() - 8 + padding));
+  }
+
   // g݊
 
   // fix offsets
@@ -672,7 +857,8 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
 
   // fix avih
   auto ptrAvihData = reinterpret_cast<AVI::MainAVIHeader*>(avihMemorySource->GetData().get());
-  ptrAvihData->dwSuggestedBufferSize = maxChunkSize;
+  // large enough to read a whole record at once
+  ptrAvihData->dwSuggestedBufferSize = std::max(maxChunkSize, maxRecordSize);
   ptrAvihData->dwMaxBytesPerSec = 0;
   for (const auto& streamInfo : streamInfoArray) {
     ptrAvihData->dwMaxBytesPerSec += streamInfo.maxBytesPerSec;
@@ -680,9 +866,56 @@ std::shared_ptr<SourceBase> AVIBuilder::BuildAVI() {
 
   // 
 
+  // index size
+  mIndexSize = mBuilderFlags & NoIdx1 ? 0 : static_cast<std::uint_fast64_t>(idx1->GetSize());
+  for (const auto& streamInfo : streamInfoArray) {
+    mIndexSize += static_cast<std::uint_fast64_t>(streamInfo.indx->GetSize());
+    for (const auto& perRiffInfo : streamInfo.riffs) {
+      mIndexSize += static_cast<std::uint_fast64_t>(perRiffInfo.ixxx->GetSize());
+    }
+  }
+
+  // block layout
+  mBlockLayout.clear();
+  mBlockLayout.reserve(allBlocks.size());
+  for (const auto& block : allBlocks) {
+    const auto blockInfo = mStreams[block.streamIndex]->GetBlockInfo(static_cast<std::uint_fast32_t>(block.blockIndex));
+    const auto chunkOffset = static_cast<std::uint64_t>(block.chunk->GetOffset());
+    // idx1 is in the first RIFF, and so are the first ix## of the streams
+    const auto idx1EntryOffset = block.riffIndex || (mBuilderFlags & NoIdx1) ? 0 : static_cast<std::uint64_t>(idx1->GetOffset()) + 8 + sizeof(AVI::AVIINDEXENTRY) * block.idx1EntryIndex;
+    const auto ixxxEntryOffset = static_cast<std::uint64_t>(streamInfoArray[block.streamIndex].riffs[block.riffIndex].ixxx->GetOffset()) + 8 + sizeof(AVI::AVISTDINDEX) + sizeof(AVI::AVISTDINDEXENTRY) * block.ixxxEntryIndex;
+    mBlockLayout.push_back(BlockLayout{
+      static_cast<std::uint_fast32_t>(block.streamIndex),
+      static_cast<std::uint_fast32_t>(block.blockIndex),
+      chunkOffset,
+      chunkOffset + 8,
+      blockInfo.size,
+      blockInfo.startTime,
+      blockInfo.indexFlags,
+      block.reference,
+      idx1EntryOffset,
+      ixxxEntryOffset,
+    });
+  }
+
   OnFinishAll(riffRoot);
 
   riffRoot.CreateSource();
 
   return riffRoot.GetSource();
 }
+
+
+const std::vector<AVIBuilder::BlockLayout>& AVIBuilder::GetBlockLayout() const {
+  return mBlockLayout;
+}
+
+
+std::uint_fast64_t AVIBuilder::GetAlignmentPaddingSize() const {
+  return mAlignmentPaddingSize;
+}
+
+
+std::uint_fast64_t AVIBuilder::GetIndexSize() const {
+  return mIndexSize;
+}
@@ -1,3 +1,6 @@
+#ifndef ML_AVIBUILDER_HPP
+#define ML_AVIBUILDER_HPP
+
 #include <cstddef>
 #include <cstdint>
 #include <memory>
@@ -23,6 +26,26 @@ public:
   static constexpr BuilderFlags NoIdx1 = 0x0001;
   static constexpr BuilderFlags NoOdml = 0x0002;
   static constexpr BuilderFlags PrependJunk = 0x0004;
+  static constexpr BuilderFlags AlignJunk = 0x0008;     // pads JUNK so that it ends at a multiple of JunkAlignment, for sparse files
+  static constexpr BuilderFlags GroupRecords = 0x0010;  // wraps each interleave period in LIST-rec, for the readers to read it at once
+
+  // the unit in which NTFS deallocates the ranges of sparse files, so a JUNK of at least this size which ends at a multiple
+  // of it covers a whole unit and can be left as a hole
+  static constexpr std::uint_fast32_t JunkAlignment = 64 * 1024;
+
+  // where each block ended up in the file
+  struct BlockLayout {
+    std::uint_fast32_t streamIndex;
+    std::uint_fast32_t blockIndex;
+    std::uint64_t chunkOffset;      // absolute offset of the chunk header (of the SimpleBlock element for Matroska)
+    std::uint64_t dataOffset;       // absolute offset of the data
+    std::uint_fast32_t size;        // size of the data
+    std::uint_fast32_t startTime;
+    std::uint32_t indexFlags;
+    bool reference;                 // the block shares the chunk of an earlier block
+    std::uint64_t idx1EntryOffset;  // absolute offset of the idx1 entry, 0 if there is none (RIFF-AVIX, NoIdx1 or Matroska)
+    std::uint64_t ixxxEntryOffset;  // absolute offset of the ix## entry, 0 for Matroska
+  };
 
   class AVIStream {
   public:
@@ -50,6 +73,10 @@ public:
     virtual BlockInfo GetBlockInfo(std::uint_fast32_t index) const = 0;
     virtual std::shared_ptr<SourceBase> GetBlockData(std::uint_fast32_t index) const = 0;
 
+    // returns the index of an earlier block that has exactly the same data as the block
+    // AVIBuilder may then let the index entries point to the chunk of the earlier block instead of appending a new chunk
+    virtual std::optional<std::uint_fast32_t> GetReferencedBlock(std::uint_fast32_t index) const;
+
     virtual bool FixSuggestedBufferSize() const;
 
     virtual AVI::AVIStreamHeader GetStrh() = 0;
@@ -66,12 +93,23 @@ protected:
   std::uint32_t mAvihFlags;
   std::uint_fast32_t mJunkSize;
   std::shared_ptr<RIFFList> mListInfo;
+  std::uint_fast32_t mChunkAlignment;
+  std::uint_fast64_t mAlignmentPaddingSize;
+  std::uint_fast64_t mIndexSize;
+  std::vector<BlockLayout> mBlockLayout;
 
 public:
+  // chunk id of the data chunks of a stream, e.g. "00db" for stream 0 with FourCCdb
+  static std::uint32_t GetChunkId(std::size_t streamIndex, std::uint32_t fourCC);
+
   void SetAvihFlags(std::uint32_t avihFlags);
   void SetJunkSize(std::uint_fast32_t junkSize);
   void SetListInfo(std::shared_ptr<RIFFList> listInfo);
+  // inserts JUNK chunks into LIST-movi so that the data of every video chunk starts at a multiple of chunkAlignment
+  // chunkAlignment must be a power of two, or 0 to disable
+  void SetChunkAlignment(std::uint_fast32_t chunkAlignment);
 
+  // the chunks of a stream whose strh has dwInitialFrames are placed that many frames of the primary video stream ahead of their time
   void AddStream(std::shared_ptr<AVIStream> stream, bool primaryVideoStream);
 
   virtual std::uint_fast32_t CountTotalFrames() const;
@@ -88,4 +126,16 @@ public:
   AVIBuilder(BuilderFlags builderFlags = 0);
 
   std::shared_ptr<SourceBase> BuildAVI();
+
+  // blocks of all streams in the order of the index entries (which is the order of the chunks, except for references)
+  // available after BuildAVI
+  const std::vector<BlockLayout>& GetBlockLayout() const;
+  // total size of the JUNK chunks inserted for SetChunkAlignment, including their headers
+  // available after BuildAVI
+  std::uint_fast64_t GetAlignmentPaddingSize() const;
+  // total size of idx1, ix## and indx, including their headers
+  // available after BuildAVI
+  std::uint_fast64_t GetIndexSize() const;
 };
+
+#endif
@@ -0,0 +1,278 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "AudioDecoder.hpp"
+#include "AudioTransform.hpp"
+#include "Movie.hpp"
+#include "ThreadPool.hpp"
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+using namespace std::literals;
+
+
+namespace {
+  // decodes size bytes into data and then guardSize bytes into guard from the current position of soundFilePlayer
+  void DecodeInto(ERISA::SGLSoundFilePlayer& soundFilePlayer, std::uint8_t* data, std::size_t size, std::uint8_t* guard, std::size_t guardSize, const std::atomic<bool>& cancelled) {
+    SSystem::SArray<std::uint8_t> buffer;
+    const auto totalSize = size + guardSize;
+    std::size_t offset = 0;
+    while (offset < totalSize) {
+      if (cancelled) {
+        throw std::runtime_error("AudioDecoder: cancelled");
+      }
+
+      soundFilePlayer.GetNextWaveBuffer(buffer);
+      const std::size_t length = buffer.GetLength();
+      if (!length) {
+        throw std::runtime_error("AudioDecoder: the audio ended early");
+      }
+
+      // the last buffer may reach beyond what is wanted
+      const auto source = buffer.GetArray();
+      const auto copySize = std::min(length, totalSize - offset);
+      if (offset < size) {
+        const auto dataCopySize = std::min(copySize, size - offset);
+        std::memcpy(data + offset, source, dataCopySize);
+        if (dataCopySize < copySize) {
+          std::memcpy(guard, source + dataCopySize, copySize - dataCopySize);
+        }
+      } else {
+        std::memcpy(guard + (offset - size), source, copySize);
+      }
+      offset += copySize;
+    }
+  }
+}
+
+
+AudioDecoder::AudioDecoder(const std::wstring& filePath, std::size_t maxParts, std::uint_fast32_t minPartSamples) :
+  mFilePath(filePath),
+  mSourceFormat{},
+  mNumSamples(0),
+  mBlockSize(0),
+  mDataSize(0),
+  mTransform(),
+  mData(),
+  mParts(),
+  mClaimed(false),
+  mCancelled(false),
+  mMutex(),
+  mCondition(),
+  mDone(false),
+  mException(),
+  mStats{}
+{
+  mParts.emplace_back();
+  mParts[0].player = std::make_unique<ERISA::SGLSoundFilePlayer>();
+  Movie::OpenSound(filePath, mParts[0].file, *mParts[0].player);
+
+  mSourceFormat = AudioTransform::Format{
+    mParts[0].player->GetBitsPerSample(),
+    mParts[0].player->GetChannelCount(),
+    mParts[0].player->GetFrequency(),
+    false,
+  };
+  mNumSamples = mParts[0].player->GetTotalSampleCount();
+  mBlockSize = mSourceFormat.GetBlockSize();
+  mDataSize = static_cast<std::size_t>(mNumSamples) * mBlockSize;
+
+  if (!mDataSize) {
+    mParts.clear();
+    mClaimed = true;
+    mDone = true;
+    return;
+  }
+
+  mData = std::shared_ptr<std::uint8_t[]>(std::make_unique<std::uint8_t[]>(mDataSize));
+
+  // the parts are opened here rather than in Decode, as Movie::OpenSound is serialized anyway and its errors belong to
+  // the caller
+  const auto numParts = static_cast<std::size_t>(std::clamp<std::uint_fast32_t>(mNumSamples / std::max<std::uint_fast32_t>(minPartSamples, 1), 1, static_cast<std::uint_fast32_t>(std::max<std::size_t>(maxParts, 1))));
+  for (std::size_t i = 1; i < numParts; i++) {
+    auto& part = mParts.emplace_back();
+    part.player = std::make_unique<ERISA::SGLSoundFilePlayer>();
+    Movie::OpenSound(filePath, part.file, *part.player);
+  }
+  for (std::size_t i = 0; i < numParts; i++) {
+    mParts[i].beginSample = static_cast<std::uint_fast32_t>(static_cast<std::uint64_t>(mNumSamples) * i / numParts);
+    mParts[i].endSample = static_cast<std::uint_fast32_t>(static_cast<std::uint64_t>(mNumSamples) * (i + 1) / numParts);
+  }
+  mStats.numParts = numParts;
+}
+
+
+void AudioDecoder::Decode() {
+  const auto startTime = std::chrono::steady_clock::now();
+
+  const auto numParts = mParts.size();
+  std::vector<std::vector<std::uint8_t>> guards(numParts);
+  ThreadPool::GetShared().ParallelFor(numParts, numParts, ThreadPool::Priority::High, [&](std::size_t i) {
+    auto& part = mParts[i];
+    // the first part is decoded from where the player was opened, exactly as a single player would
+    if (part.beginSample) {
+      part.player->SeekToSample(part.beginSample);
+    }
+    if (i + 1 < numParts) {
+      const auto& nextPart = mParts[i + 1];
+      guards[i].resize(std::min<std::uint_fast32_t>(GuardSamples, nextPart.endSample - nextPart.beginSample) * mBlockSize);
+    }
+    DecodeInto(*part.player, mData.get() + part.beginSample * mBlockSize, (part.endSample - part.beginSample) * mBlockSize, guards[i].data(), guards[i].size(), mCancelled);
+    part.player->Close();
+  });
+
+  bool partsMatch = true;
+  for (std::size_t i = 0; i + 1 < numParts; i++) {
+    if (std::memcmp(guards[i].data(), mData.get() + mParts[i + 1].beginSample * mBlockSize, guards[i].size()) != 0) {
+      partsMatch = false;
+      break;
+    }
+  }
+  mParts.clear();
+
+  if (!partsMatch) {
+    std::unique_ptr<SSystem::SFileInterface> file;
+    ERISA::SGLSoundFilePlayer soundFilePlayer;
+    Movie::OpenSound(mFilePath, file, soundFilePlayer);
+    DecodeInto(soundFilePlayer, mData.get(), mDataSize, nullptr, 0, mCancelled);
+    soundFilePlayer.Close();
+    mStats.serialFallback = true;
+  }
+
+  if (mTransform) {
+    const auto data = std::shared_ptr<std::uint8_t[]>(std::make_unique<std::uint8_t[]>(GetDataSize()));
+    mTransform->Apply(mData.get(), mNumSamples, data.get());
+    mData = data;
+  }
+
+  mStats.time = std::chrono::steady_clock::now() - startTime;
+}
+
+
+const AudioTransform::Format& AudioDecoder::GetFormat() const {
+  return mTransform ? mTransform->GetFormat() : mSourceFormat;
+}
+
+
+std::size_t AudioDecoder::GetDataSize() const {
+  if (!mTransform) {
+    return mDataSize;
+  }
+  return static_cast<std::size_t>(mTransform->CountSamples(mNumSamples) * mTransform->GetFormat().GetBlockSize());
+}
+
+
+void AudioDecoder::SetTransform(const AudioTransform::Parameters& parameters) {
+  AudioTransform transform(mSourceFormat, parameters);
+  if (transform.IsIdentity()) {
+    mTransform.reset();
+  } else {
+    mTransform.emplace(std::move(transform));
+  }
+}
+
+
+void AudioDecoder::Run() {
+  if (mClaimed.exchange(true)) {
+    return;
+  }
+
+  std::exception_ptr exception;
+  try {
+    Decode();
+  } catch (...) {
+    exception = std::current_exception();
+  }
+
+  std::lock_guard lock(mMutex);
+  mException = exception;
+  mDone = true;
+  mCondition.notify_all();
+}
+
+
+void AudioDecoder::Start() {
+  ThreadPool::GetShared().Submit([self = shared_from_this()]() {
+    self->Run();
+  }, ThreadPool::Priority::Normal);
+}
+
+
+void AudioDecoder::Wait() {
+  // decoding here rather than waiting for a task which may be queued behind the caller itself (e.g. in -batch)
+  Run();
+
+  std::unique_lock lock(mMutex);
+  mCondition.wait(lock, [this]() {
+    return mDone;
+  });
+  if (mException) {
+    std::rethrow_exception(mException);
+  }
+}
+
+
+bool AudioDecoder::WaitUntil(std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock lock(mMutex);
+  return mCondition.wait_until(lock, deadline, [this]() {
+    return mDone;
+  });
+}
+
+
+void AudioDecoder::Cancel() {
+  mCancelled = true;
+}
+
+
+std::shared_ptr<std::uint8_t[]> AudioDecoder::GetData() const {
+  return mData;
+}
+
+
+AudioDecoder::Stats AudioDecoder::GetStats() const {
+  return mStats;
+}
+
+
+bool AudioDecoder::Check(const std::wstring& filePath, std::size_t maxParts) {
+  const auto serial = std::make_shared<AudioDecoder>(filePath, 1);
+  serial->Wait();
+  const auto serialStats = serial->GetStats();
+
+  // parts as small as the guards allow, so that even a short track is split at several points
+  const auto parallel = std::make_shared<AudioDecoder>(filePath, maxParts, GuardSamples * 4);
+  parallel->Wait();
+  const auto parallelStats = parallel->GetStats();
+
+  const bool identical = serial->GetDataSize() == parallel->GetDataSize() && (!serial->GetDataSize() || std::memcmp(serial->GetData().get(), parallel->GetData().get(), serial->GetDataSize()) == 0);
+
+  const auto ToSeconds = [](std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  };
+
+  std::wcerr << std::fixed << std::setprecision(3);
+  std::wcerr << L"[check] audio: "sv << serial->GetDataSize() << L" bytes"sv << std::endl;
+  std::wcerr << L"[check]   1 part: "sv << ToSeconds(serialStats.time) << L" s"sv << std::endl;
+  std::wcerr << L"[check]   "sv << parallelStats.numParts << L" parts: "sv << ToSeconds(parallelStats.time) << L" s"sv << (parallelStats.serialFallback ? L" (seams differed, decoded again with 1 part)"sv : L""sv) << std::endl;
+  std::wcerr << L"[check]   "sv << (identical ? L"identical"sv : L"DIFFERENT"sv) << std::endl;
+
+  return identical;
+}
@@ -0,0 +1,102 @@
+#ifndef ML_AUDIODECODER_HPP
+#define ML_AUDIODECODER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AudioTransform.hpp"
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+
+// decodes the whole audio track of an MEI file into memory, in the background on the shared thread pool
+// the track is split into parts of at least minPartSamples, each decoded by a player of its own which seeks to the
+// start of its part; every part but the last also decodes GuardSamples beyond its end, and if that differs from the
+// start of the next part (the format could not seek there exactly), the whole track is decoded again by one player,
+// so the result is always exactly what a single player produces
+// an AudioTransform, if set, is applied in the same background job
+class AudioDecoder : public std::enable_shared_from_this<AudioDecoder> {
+public:
+  static constexpr std::uint_fast32_t DefaultMinPartSamples = 1024 * 1024;
+  static constexpr std::uint_fast32_t GuardSamples = 4096;
+
+  struct Stats {
+    std::size_t numParts;
+    bool serialFallback;          // the parts did not agree and the track was decoded again by one player
+    std::chrono::steady_clock::duration time;
+  };
+
+private:
+  struct Part {
+    std::unique_ptr<SSystem::SFileInterface> file;
+    std::unique_ptr<ERISA::SGLSoundFilePlayer> player;
+    std::uint_fast32_t beginSample;
+    std::uint_fast32_t endSample;
+  };
+
+  std::wstring mFilePath;
+  AudioTransform::Format mSourceFormat;
+  std::uint_fast32_t mNumSamples;
+  std::size_t mBlockSize;
+  std::size_t mDataSize;                      // decoded
+  std::optional<AudioTransform> mTransform;
+  std::shared_ptr<std::uint8_t[]> mData;
+  std::vector<Part> mParts;
+  std::atomic<bool> mClaimed;
+  std::atomic<bool> mCancelled;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mDone;
+  std::exception_ptr mException;
+  Stats mStats;
+
+  void Decode();
+  // decodes unless another thread has already started to, and records the outcome for Wait; never throws
+  void Run();
+
+public:
+  // opens the players on the calling thread; at most maxParts are used
+  AudioDecoder(const std::wstring& filePath, std::size_t maxParts, std::uint_fast32_t minPartSamples = DefaultMinPartSamples);
+
+  AudioDecoder(const AudioDecoder&) = delete;
+  AudioDecoder& operator=(const AudioDecoder&) = delete;
+
+  // format and size of GetData(), after the transform
+  const AudioTransform::Format& GetFormat() const;
+  std::size_t GetDataSize() const;
+
+  // converts the decoded audio with parameters; must be called before Start or Wait, and throws if the conversion is not
+  // supported (see AudioTransform)
+  void SetTransform(const AudioTransform::Parameters& parameters);
+
+  // queues the decoding on the shared thread pool; must be called on an object owned by a std::shared_ptr
+  void Start();
+  // decodes on the calling thread unless the decoding has already started, and waits for it; rethrows its exception
+  void Wait();
+  // waits for the decoding queued by Start until deadline, without decoding on the calling thread
+  // returns true once it has finished, after which Wait returns (or throws) at once
+  bool WaitUntil(std::chrono::steady_clock::time_point deadline);
+  // stops the decoding early; Wait throws afterwards
+  void Cancel();
+
+  // valid after Wait
+  std::shared_ptr<std::uint8_t[]> GetData() const;
+  Stats GetStats() const;
+
+
+  // decodes filePath with one player and in parts as small as allowed, and compares the results
+  // the results are written to std::wcerr; returns false if they differ
+  static bool Check(const std::wstring& filePath, std::size_t maxParts);
+};
+
+#endif
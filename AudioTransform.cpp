@@ -0,0 +1,368 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "AudioTransform.hpp"
+#include "ThreadPool.hpp"
+#include "Kernel/Audio.hpp"
+
+
+namespace {
+  // passband edge relative to the Nyquist frequency of the lower rate
+  constexpr double Rolloff = 0.94;
+  constexpr double Pi = 3.14159265358979323846;
+  // -3 dB, for the center and the surround channels folded into the front ones
+  constexpr float FoldGain = 0.70710678f;
+
+
+  enum class Speaker {
+    FrontLeft,
+    FrontRight,
+    FrontCenter,
+    LowFrequency,
+    BackLeft,
+    BackRight,
+    BackCenter,
+    SideLeft,
+    SideRight,
+  };
+
+
+  // the default order of WAVE files without a channel mask
+  std::vector<Speaker> GetDefaultLayout(std::uint_fast32_t numChannels) {
+    switch (numChannels) {
+      case 1:
+        return {Speaker::FrontCenter};
+
+      case 2:
+        return {Speaker::FrontLeft, Speaker::FrontRight};
+
+      case 3:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::FrontCenter};
+
+      case 4:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::BackLeft, Speaker::BackRight};
+
+      case 5:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::FrontCenter, Speaker::BackLeft, Speaker::BackRight};
+
+      case 6:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::FrontCenter, Speaker::LowFrequency, Speaker::BackLeft, Speaker::BackRight};
+
+      case 7:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::FrontCenter, Speaker::LowFrequency, Speaker::BackCenter, Speaker::SideLeft, Speaker::SideRight};
+
+      case 8:
+        return {Speaker::FrontLeft, Speaker::FrontRight, Speaker::FrontCenter, Speaker::LowFrequency, Speaker::BackLeft, Speaker::BackRight, Speaker::SideLeft, Speaker::SideRight};
+    }
+    throw std::runtime_error("AudioTransform: unsupported number of channels to mix down");
+  }
+
+
+  // left and right coefficients of a speaker in a stereo downmix; the low frequency channel is dropped
+  std::pair<float, float> GetStereoCoefficients(Speaker speaker) {
+    switch (speaker) {
+      case Speaker::FrontLeft:
+        return {1.f, 0.f};
+
+      case Speaker::FrontRight:
+        return {0.f, 1.f};
+
+      case Speaker::FrontCenter:
+      case Speaker::BackCenter:
+        return {FoldGain, FoldGain};
+
+      case Speaker::BackLeft:
+      case Speaker::SideLeft:
+        return {FoldGain, 0.f};
+
+      case Speaker::BackRight:
+      case Speaker::SideRight:
+        return {0.f, FoldGain};
+
+      case Speaker::LowFrequency:
+        break;
+    }
+    return {0.f, 0.f};
+  }
+
+
+  // scales a row of the matrix down so that it cannot exceed full scale
+  void NormalizeRow(float* row, std::size_t size) {
+    float sum = 0.f;
+    for (std::size_t i = 0; i < size; i++) {
+      sum += std::abs(row[i]);
+    }
+    if (sum > 1.f) {
+      for (std::size_t i = 0; i < size; i++) {
+        row[i] /= sum;
+      }
+    }
+  }
+
+
+  double Sinc(double x) {
+    return x == 0. ? 1. : std::sin(Pi * x) / (Pi * x);
+  }
+
+
+  // x in [0, 1]
+  double Blackman(double x) {
+    return 0.42 - 0.5 * std::cos(2. * Pi * x) + 0.08 * std::cos(4. * Pi * x);
+  }
+}
+
+
+std::uint_fast32_t AudioTransform::Format::GetBlockSize() const {
+  return bitsPerSample / 8 * numChannels;
+}
+
+
+AudioTransform::AudioTransform(const Format& sourceFormat, const Parameters& parameters) :
+  mSourceFormat(sourceFormat),
+  mFormat(sourceFormat),
+  mIdentity(true),
+  mMatrix(),
+  mUpFactor(1),
+  mDownFactor(1),
+  mNumTaps(0),
+  mTaps()
+{
+  if (parameters.samplingRate) {
+    mFormat.samplingRate = parameters.samplingRate;
+  }
+  if (parameters.numChannels) {
+    mFormat.numChannels = parameters.numChannels;
+  }
+
+  auto format = parameters.format;
+  if (format == SampleFormat::Source && (mFormat.samplingRate != mSourceFormat.samplingRate || mFormat.numChannels != mSourceFormat.numChannels)) {
+    format = mSourceFormat.bitsPerSample <= 16 && !mSourceFormat.floatingPoint ? SampleFormat::Int16 : SampleFormat::Float;
+  }
+  if (format == SampleFormat::Int16) {
+    mFormat.bitsPerSample = 16;
+    mFormat.floatingPoint = false;
+  } else if (format == SampleFormat::Float) {
+    mFormat.bitsPerSample = 32;
+    mFormat.floatingPoint = true;
+  }
+
+  mIdentity =
+    mFormat.samplingRate == mSourceFormat.samplingRate &&
+    mFormat.numChannels == mSourceFormat.numChannels &&
+    mFormat.bitsPerSample == mSourceFormat.bitsPerSample &&
+    mFormat.floatingPoint == mSourceFormat.floatingPoint;
+  if (mIdentity) {
+    return;
+  }
+
+  if (mSourceFormat.floatingPoint || (mSourceFormat.bitsPerSample != 8 && mSourceFormat.bitsPerSample != 16 && mSourceFormat.bitsPerSample != 24)) {
+    throw std::runtime_error("AudioTransform: unsupported source sample format");
+  }
+  if (!mSourceFormat.numChannels || !mSourceFormat.samplingRate) {
+    throw std::runtime_error("AudioTransform: invalid source format");
+  }
+
+  BuildMatrix();
+  BuildFilter();
+}
+
+
+void AudioTransform::BuildMatrix() {
+  const std::size_t numSourceChannels = mSourceFormat.numChannels;
+  const std::size_t numChannels = mFormat.numChannels;
+  mMatrix.assign(numChannels * numSourceChannels, 0.f);
+
+  if (numChannels == numSourceChannels) {
+    for (std::size_t i = 0; i < numChannels; i++) {
+      mMatrix[i * numSourceChannels + i] = 1.f;
+    }
+    return;
+  }
+
+  if (numSourceChannels == 1) {
+    // mono goes to every channel as is
+    std::fill(mMatrix.begin(), mMatrix.end(), 1.f);
+    return;
+  }
+
+  if (numChannels != 1 && numChannels != 2) {
+    throw std::runtime_error("AudioTransform: audio can only be mixed down to 1 or 2 channels");
+  }
+
+  const auto layout = GetDefaultLayout(mSourceFormat.numChannels);
+  std::vector<float> stereo(2 * numSourceChannels);
+  for (std::size_t i = 0; i < numSourceChannels; i++) {
+    const auto [left, right] = GetStereoCoefficients(layout[i]);
+    stereo[i] = left;
+    stereo[numSourceChannels + i] = right;
+  }
+  NormalizeRow(stereo.data(), numSourceChannels);
+  NormalizeRow(stereo.data() + numSourceChannels, numSourceChannels);
+
+  if (numChannels == 2) {
+    mMatrix = stereo;
+  } else {
+    for (std::size_t i = 0; i < numSourceChannels; i++) {
+      mMatrix[i] = (stereo[i] + stereo[numSourceChannels + i]) * 0.5f;
+    }
+  }
+}
+
+
+void AudioTransform::BuildFilter() {
+  const auto divisor = std::gcd(mFormat.samplingRate, mSourceFormat.samplingRate);
+  mUpFactor = mFormat.samplingRate / divisor;
+  mDownFactor = mSourceFormat.samplingRate / divisor;
+  if (mUpFactor == 1 && mDownFactor == 1) {
+    return;
+  }
+  if (mUpFactor > MaxPhases) {
+    throw std::runtime_error("AudioTransform: unsupported ratio of sampling rates");
+  }
+
+  // when decimating, the passband narrows and the filter lengthens with the ratio, so that the transition band stays as
+  // sharp relative to the output rate
+  const std::size_t ratio = (mDownFactor + mUpFactor - 1) / mUpFactor;
+  mNumTaps = FilterTaps * std::max<std::size_t>(ratio, 1);
+
+  // prototype filter at the rate of the zero-stuffed input, centered on length / 2 with the window reaching zero at 0
+  // and length, so that it is symmetric and the delay is a whole number of samples
+  const std::size_t length = mNumTaps * mUpFactor;
+  const double center = length / 2.;
+  const double cutoff = Rolloff * 0.5 / std::max(mUpFactor, mDownFactor);   // in cycles per sample
+
+  mTaps.assign(length, 0.f);
+  for (std::uint_fast32_t phase = 0; phase < mUpFactor; phase++) {
+    std::vector<double> taps(mNumTaps);
+    double sum = 0.;
+    for (std::size_t k = 0; k < mNumTaps; k++) {
+      // the k-th older input sample
+      const double n = static_cast<double>(phase + k * mUpFactor);
+      taps[k] = 2. * cutoff * Sinc(2. * cutoff * (n - center)) * Blackman(n / length);
+      sum += taps[k];
+    }
+
+    // each phase passes DC at unity gain
+    for (std::size_t k = 0; k < mNumTaps; k++) {
+      mTaps[phase * mNumTaps + (mNumTaps - 1 - k)] = static_cast<float>(taps[k] / sum);
+    }
+  }
+}
+
+
+void AudioTransform::ApplyRange(const std::uint8_t* source, std::uint64_t numSourceSamples, std::uint8_t* output, std::uint64_t begin, std::uint64_t end) const {
+  const bool resample = !mTaps.empty();
+  const std::size_t numSourceChannels = mSourceFormat.numChannels;
+  const std::size_t numChannels = mFormat.numChannels;
+  const std::int64_t delay = static_cast<std::int64_t>(mNumTaps * mUpFactor / 2);
+
+  // input samples [first, last) needed by the output samples [begin, end)
+  std::int64_t first = static_cast<std::int64_t>(begin);
+  std::int64_t last = static_cast<std::int64_t>(end);
+  if (resample) {
+    first = (static_cast<std::int64_t>(begin * mDownFactor) + delay) / mUpFactor - static_cast<std::int64_t>(mNumTaps - 1);
+    last = (static_cast<std::int64_t>((end - 1) * mDownFactor) + delay) / mUpFactor + 1;
+  }
+  const auto count = static_cast<std::size_t>(last - first);
+
+  // the samples outside of the track are silence
+  std::vector<float> input(count * numSourceChannels, 0.f);
+  const auto validFirst = std::clamp<std::int64_t>(first, 0, static_cast<std::int64_t>(numSourceSamples));
+  const auto validLast = std::clamp<std::int64_t>(last, 0, static_cast<std::int64_t>(numSourceSamples));
+  if (validLast > validFirst) {
+    const auto src = source + static_cast<std::size_t>(validFirst) * mSourceFormat.GetBlockSize();
+    const auto dst = input.data() + static_cast<std::size_t>(validFirst - first) * numSourceChannels;
+    const auto numValues = static_cast<std::size_t>(validLast - validFirst) * numSourceChannels;
+    switch (mSourceFormat.bitsPerSample) {
+      case 8:
+        Kernel::ConvertU8ToFloat(src, dst, numValues);
+        break;
+
+      case 16:
+        Kernel::ConvertS16ToFloat(src, dst, numValues);
+        break;
+
+      case 24:
+        Kernel::ConvertS24ToFloat(src, dst, numValues);
+        break;
+    }
+  }
+
+  // planar, so that the filter reads each channel contiguously
+  std::vector<float> planes(count * numChannels);
+  for (std::size_t i = 0; i < count; i++) {
+    const auto samples = input.data() + i * numSourceChannels;
+    for (std::size_t channel = 0; channel < numChannels; channel++) {
+      const auto coefficients = mMatrix.data() + channel * numSourceChannels;
+      float value = 0.f;
+      for (std::size_t sourceChannel = 0; sourceChannel < numSourceChannels; sourceChannel++) {
+        value += coefficients[sourceChannel] * samples[sourceChannel];
+      }
+      planes[channel * count + i] = value;
+    }
+  }
+
+  const auto numSamples = static_cast<std::size_t>(end - begin);
+  std::vector<float> samples(numSamples * numChannels);
+  if (resample) {
+    for (std::size_t i = 0; i < numSamples; i++) {
+      const auto position = static_cast<std::int64_t>((begin + i) * mDownFactor) + delay;
+      const auto taps = mTaps.data() + static_cast<std::size_t>(position % mUpFactor) * mNumTaps;
+      const auto offset = static_cast<std::size_t>(position / mUpFactor - static_cast<std::int64_t>(mNumTaps - 1) - first);
+      for (std::size_t channel = 0; channel < numChannels; channel++) {
+        samples[i * numChannels + channel] = Kernel::DotProduct(taps, planes.data() + channel * count + offset, mNumTaps);
+      }
+    }
+  } else {
+    for (std::size_t i = 0; i < numSamples; i++) {
+      for (std::size_t channel = 0; channel < numChannels; channel++) {
+        samples[i * numChannels + channel] = planes[channel * count + i];
+      }
+    }
+  }
+
+  const auto dst = output + static_cast<std::size_t>(begin) * mFormat.GetBlockSize();
+  if (mFormat.floatingPoint) {
+    std::memcpy(dst, samples.data(), samples.size() * sizeof(float));
+  } else {
+    Kernel::ConvertFloatToS16(samples.data(), dst, samples.size());
+  }
+}
+
+
+bool AudioTransform::IsIdentity() const {
+  return mIdentity;
+}
+
+
+const AudioTransform::Format& AudioTransform::GetFormat() const {
+  return mFormat;
+}
+
+
+std::uint64_t AudioTransform::CountSamples(std::uint64_t numSourceSamples) const {
+  return (numSourceSamples * mUpFactor + mDownFactor - 1) / mDownFactor;
+}
+
+
+void AudioTransform::Apply(const std::uint8_t* source, std::uint64_t numSourceSamples, std::uint8_t* output) const {
+  if (mIdentity) {
+    std::memcpy(output, source, static_cast<std::size_t>(numSourceSamples * mSourceFormat.GetBlockSize()));
+    return;
+  }
+
+  const auto numSamples = CountSamples(numSourceSamples);
+  const auto numRanges = static_cast<std::size_t>((numSamples + RangeSamples - 1) / RangeSamples);
+  auto& threadPool = ThreadPool::GetShared();
+  threadPool.ParallelFor(numRanges, threadPool.GetNumWorkers() + 1, ThreadPool::Priority::High, [&](std::size_t i) {
+    const std::uint64_t begin = static_cast<std::uint64_t>(i) * RangeSamples;
+    ApplyRange(source, numSourceSamples, output, begin, std::min<std::uint64_t>(begin + RangeSamples, numSamples));
+  });
+}
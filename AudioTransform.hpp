@@ -0,0 +1,70 @@
+#ifndef ML_AUDIOTRANSFORM_HPP
+#define ML_AUDIOTRANSFORM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// converts decoded PCM to another sample format, channel count and sampling rate
+// the output is produced in independent ranges on the shared thread pool; each range converts just the input it needs to
+// float, mixes it into planar channels and resamples them with a polyphase windowed-sinc filter
+class AudioTransform {
+public:
+  enum class SampleFormat {
+    Source,   // the source format if nothing else changes, otherwise Int16 for sources of up to 16 bits and Float beyond
+    Int16,
+    Float,    // 32-bit IEEE float
+  };
+
+  struct Parameters {
+    std::uint_fast32_t samplingRate;    // 0 to keep
+    std::uint_fast32_t numChannels;     // 0 to keep; 1 or 2 to mix down, or any number to spread mono to
+    SampleFormat format;
+  };
+
+  struct Format {
+    std::uint_fast32_t bitsPerSample;   // 8 is unsigned, 16 and 24 are signed
+    std::uint_fast32_t numChannels;
+    std::uint_fast32_t samplingRate;
+    bool floatingPoint;                 // 32-bit IEEE float
+
+    std::uint_fast32_t GetBlockSize() const;
+  };
+
+  // taps of each phase of the filter when upsampling (a multiple of Kernel::DotProductBlock)
+  static constexpr std::size_t FilterTaps = 32;
+  // the ratio of the sampling rates, reduced, must not need more phases than this
+  static constexpr std::uint_fast32_t MaxPhases = 4096;
+  // output samples converted at once by a thread
+  static constexpr std::size_t RangeSamples = 65536;
+
+private:
+  Format mSourceFormat;
+  Format mFormat;
+  bool mIdentity;
+  std::vector<float> mMatrix;                 // mFormat.numChannels rows of mSourceFormat.numChannels coefficients
+  std::uint_fast32_t mUpFactor;               // output rate / input rate = mUpFactor / mDownFactor
+  std::uint_fast32_t mDownFactor;
+  std::size_t mNumTaps;                       // of each phase, 0 if the rate is kept
+  std::vector<float> mTaps;                   // mNumTaps for each of mUpFactor phases, in the order of the input
+
+  void BuildMatrix();
+  void BuildFilter();
+  void ApplyRange(const std::uint8_t* source, std::uint64_t numSourceSamples, std::uint8_t* output, std::uint64_t begin, std::uint64_t end) const;
+
+public:
+  // throws if the formats or the ratio of the rates are not supported
+  AudioTransform(const Format& sourceFormat, const Parameters& parameters);
+
+  // true if Apply is just a copy
+  bool IsIdentity() const;
+  const Format& GetFormat() const;
+  std::uint64_t CountSamples(std::uint64_t numSourceSamples) const;
+
+  // source: numSourceSamples interleaved samples of the source format
+  // output: CountSamples(numSourceSamples) samples of GetFormat()
+  void Apply(const std::uint8_t* source, std::uint64_t numSourceSamples, std::uint8_t* output) const;
+};
+
+#endif
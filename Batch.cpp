@@ -0,0 +1,407 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <ios>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Batch.hpp"
+#include "AudioTransform.hpp"
+#include "HashTree.hpp"
+#include "Movie.hpp"
+#include "OutputFile.hpp"
+#include "ParallelOutput.hpp"
+#include "ThreadPool.hpp"
+
+#include <Windows.h>
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+using namespace std::literals;
+
+
+namespace {
+  // frames of the decoded size held by a job at once: the decoder's frame and its reference, the cached chunks
+  // (CacheStorageLimit), and the outputs of the transform and the encoder
+  constexpr std::uint64_t FramesPerJob = 6;
+  // the decoder, the layout of the output and whatever else does not depend on the frame size
+  constexpr std::uint64_t BaseMemoryPerJob = 16 * 1024 * 1024;
+
+
+  struct Estimate {
+    std::uint64_t memory;
+    std::uint64_t numPixels;    // to decode
+  };
+
+
+  struct JobState {
+    std::optional<Estimate> estimate;
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point endTime;
+    std::uint64_t outputSize;
+    std::string error;          // empty if succeeded
+  };
+
+
+  std::wstring DecodeUTF8(std::string_view str) {
+    if (str.empty()) {
+      return L""s;
+    }
+    const auto size = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, str.data(), static_cast<int>(str.size()), nullptr, 0);
+    if (size <= 0) {
+      throw std::runtime_error("Batch: invalid UTF-8");
+    }
+    std::wstring wstr(static_cast<std::size_t>(size), L'\0');
+    MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, str.data(), static_cast<int>(str.size()), wstr.data(), size);
+    return wstr;
+  }
+
+
+  // nullopt for an unterminated quote
+  std::optional<std::vector<std::wstring>> SplitArgs(const std::wstring& line) {
+    std::vector<std::wstring> args;
+    std::size_t index = 0;
+    while (true) {
+      while (index < line.size() && (line[index] == L' ' || line[index] == L'\t')) {
+        index++;
+      }
+      if (index == line.size()) {
+        return args;
+      }
+
+      std::wstring arg;
+      bool quoted = false;
+      for (; index < line.size(); index++) {
+        const auto c = line[index];
+        if (quoted) {
+          if (c != L'"') {
+            arg += c;
+          } else if (index + 1 < line.size() && line[index + 1] == L'"') {
+            arg += L'"';
+            index++;
+          } else {
+            quoted = false;
+          }
+        } else if (c == L'"') {
+          quoted = true;
+        } else if (c == L' ' || c == L'\t') {
+          break;
+        } else {
+          arg += c;
+        }
+      }
+
+      if (quoted) {
+        return std::nullopt;
+      }
+      args.push_back(arg);
+    }
+  }
+
+
+  // opens the input as the conversion would, without decoding
+  Estimate EstimateJob(const Batch::Job& job) {
+    std::unique_ptr<SSystem::SFileInterface> file;
+    ERISA::SGLMovieFilePlayer movieFilePlayer;
+    Movie::Open(job.inFile, file, movieFilePlayer);
+
+    const auto size = movieFilePlayer.CurrentFrame()->GetImageSize();
+    const std::uint64_t numPixels = static_cast<std::uint64_t>(size.w) * size.h;
+    const std::uint64_t numFrames = movieFilePlayer.GetAllFrameCount();
+
+    // the whole audio is decoded into memory beforehand
+    std::uint64_t audioSize = 0;
+    if (!(job.options.flags & MEIToAVI::NoAudio) && (movieFilePlayer.GetMediaFile().m_flagsRead & ERISA::SGLMediaFile::readSoundInfo)) {
+      std::unique_ptr<SSystem::SFileInterface> fileForSound;
+      ERISA::SGLSoundFilePlayer soundFilePlayer;
+      Movie::OpenSound(job.inFile, fileForSound, soundFilePlayer);
+      const AudioTransform::Format format{
+        soundFilePlayer.GetBitsPerSample(),
+        soundFilePlayer.GetChannelCount(),
+        soundFilePlayer.GetFrequency(),
+        false,
+      };
+      const std::uint64_t numSamples = soundFilePlayer.GetTotalSampleCount();
+      audioSize = numSamples * format.GetBlockSize();
+
+      // the converted audio replaces the decoded one only once it is complete
+      const AudioTransform transform(format, job.options.audioTransform);
+      if (!transform.IsIdentity()) {
+        audioSize += transform.CountSamples(numSamples) * transform.GetFormat().GetBlockSize();
+      }
+      soundFilePlayer.Close();
+      fileForSound.reset();
+    }
+
+    std::uint64_t memory = BaseMemoryPerJob + numPixels * 4 * FramesPerJob + audioSize + job.bufferSize;
+    if (job.writeHashTree) {
+      memory += HashTree::DefaultLeafSize;
+    }
+
+    movieFilePlayer.Close();
+
+    return Estimate{
+      memory,
+      numPixels * numFrames,
+    };
+  }
+
+
+  // returns the size of the output
+  std::uint64_t RunJob(const Batch::Job& job) {
+    // the messages of concurrent jobs would be interleaved
+    auto options = job.options;
+    options.flags |= MEIToAVI::NoMessage;
+    options.flags |= MEIToAVI::SparseOutput;
+
+    OutputFile outputFile(job.outFile);
+
+    MEIToAVI meiToAvi(job.inFile, options);
+    const std::uint64_t totalSize = meiToAvi.GetSource().GetSize();
+
+    std::optional<HashTree::Builder> hashBuilder;
+    if (job.writeHashTree) {
+      hashBuilder.emplace(totalSize, HashTree::DefaultLeafSize, job.hashSHA256);
+    }
+
+    // the parallelism comes from running several jobs at once
+    WriteParallel(meiToAvi, outputFile, 1, job.bufferSize, false, nullptr, hashBuilder ? &hashBuilder.value() : nullptr);
+
+    if (hashBuilder) {
+      hashBuilder->Complete(outputFile, 1);
+      HashTree::Write(job.outFile + L".hashtree"s, hashBuilder->GetLeaves());
+    }
+
+    outputFile.Close();
+
+    if (job.writeManifest) {
+      meiToAvi.WriteManifest(job.outFile + L".manifest"s, job.outFile + L".manifest.json"s);
+    }
+
+    return totalSize;
+  }
+
+
+  std::string GetErrorMessage(std::exception_ptr exception) {
+    try {
+      std::rethrow_exception(exception);
+    } catch (const std::exception& e) {
+      return e.what();
+    } catch (...) {
+      return "an error occurred"s;
+    }
+  }
+
+
+  std::wstring ToWide(const std::string& str) {
+    // the messages of the exceptions thrown here are ASCII
+    return std::wstring(str.cbegin(), str.cend());
+  }
+}
+
+
+std::vector<Batch::JobLine> Batch::ReadJobFile(const std::wstring& filePath) {
+  std::ifstream ifs(filePath, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error("Batch: cannot open job file");
+  }
+  const std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+
+  std::string_view rest(content);
+  if (rest.substr(0, 3) == "\xEF\xBB\xBF"sv) {
+    rest.remove_prefix(3);
+  }
+
+  std::vector<JobLine> jobLines;
+  std::size_t lineNumber = 0;
+  while (!rest.empty()) {
+    lineNumber++;
+
+    const auto lineEnd = std::min(rest.find('\n'), rest.size());
+    auto line = rest.substr(0, lineEnd);
+    rest.remove_prefix(std::min(lineEnd + 1, rest.size()));
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+
+    const auto firstChar = line.find_first_not_of(" \t"sv);
+    if (firstChar == std::string_view::npos || line[firstChar] == '#') {
+      continue;
+    }
+
+    auto args = SplitArgs(DecodeUTF8(line));
+    if (!args) {
+      throw std::runtime_error("Batch: unterminated quote in line "s + std::to_string(lineNumber));
+    }
+    jobLines.push_back(JobLine{
+      lineNumber,
+      std::move(args.value()),
+    });
+  }
+
+  return jobLines;
+}
+
+
+std::uint64_t Batch::GetDefaultMemoryBudget() {
+  MEMORYSTATUSEX memoryStatus{};
+  memoryStatus.dwLength = sizeof(memoryStatus);
+  if (!GlobalMemoryStatusEx(&memoryStatus)) {
+    throw std::runtime_error("Batch: cannot get the size of the physical memory");
+  }
+  return memoryStatus.ullTotalPhys / 2;
+}
+
+
+std::size_t Batch::Run(const std::vector<Job>& jobs, std::uint_fast32_t numWorkers, std::uint64_t memoryBudget, bool showMessage) {
+  const auto batchStartTime = std::chrono::steady_clock::now();
+
+  std::vector<JobState> states(jobs.size(), JobState{
+    std::nullopt,
+    {},
+    {},
+    0,
+    ""s,
+  });
+
+  // the inputs are opened one at a time anyway (see Movie::Open)
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    try {
+      states[i].estimate = EstimateJob(jobs[i]);
+    } catch (...) {
+      states[i].error = GetErrorMessage(std::current_exception());
+    }
+  }
+
+  // longest job first; ties keep the order of the job file
+  std::vector<std::size_t> pendingJobs;
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    if (states[i].estimate) {
+      pendingJobs.push_back(i);
+    }
+  }
+  std::stable_sort(pendingJobs.begin(), pendingJobs.end(), [&states] (std::size_t a, std::size_t b) {
+    return states[a].estimate->numPixels > states[b].estimate->numPixels;
+  });
+
+  const auto estimateTime = std::chrono::steady_clock::now() - batchStartTime;
+
+  if (showMessage) {
+    std::wcerr << L"[batch] "sv << jobs.size() << L" jobs, "sv << numWorkers << L" workers, memory budget "sv << memoryBudget / (1024 * 1024)
+               << L" MiB, estimated in "sv << std::chrono::duration<double>(estimateTime).count() << L" s"sv << std::endl;
+  }
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::uint64_t usedMemory = 0;
+  std::uint64_t peakMemory = 0;
+  std::size_t numRunning = 0;
+  std::size_t numFinished = 0;
+
+  auto worker = [&] (std::size_t) {
+    std::unique_lock lock(mutex);
+
+    while (true) {
+      // the first job in the order that fits; with nothing running, the first one even if it does not fit
+      auto itrJob = std::find_if(pendingJobs.begin(), pendingJobs.end(), [&] (std::size_t jobIndex) {
+        return usedMemory + states[jobIndex].estimate->memory <= memoryBudget;
+      });
+      if (itrJob == pendingJobs.end() && numRunning == 0 && !pendingJobs.empty()) {
+        itrJob = pendingJobs.begin();
+      }
+
+      if (itrJob == pendingJobs.end()) {
+        if (pendingJobs.empty()) {
+          return;
+        }
+        condition.wait(lock);
+        continue;
+      }
+
+      const auto jobIndex = *itrJob;
+      pendingJobs.erase(itrJob);
+
+      auto& state = states[jobIndex];
+      const auto memory = state.estimate->memory;
+      usedMemory += memory;
+      peakMemory = std::max(peakMemory, usedMemory);
+      numRunning++;
+
+      lock.unlock();
+
+      state.startTime = std::chrono::steady_clock::now();
+      try {
+        state.outputSize = RunJob(jobs[jobIndex]);
+      } catch (...) {
+        state.error = GetErrorMessage(std::current_exception());
+      }
+      state.endTime = std::chrono::steady_clock::now();
+
+      lock.lock();
+
+      usedMemory -= memory;
+      numRunning--;
+      numFinished++;
+
+      if (showMessage) {
+        std::wcerr << L"[batch] "sv << numFinished << L"/"sv << jobs.size() << L" "sv << (state.error.empty() ? L"done"sv : L"failed"sv)
+                   << L": "sv << jobs[jobIndex].inFile << L" ("sv << std::chrono::duration<double>(state.endTime - state.startTime).count() << L" s)"sv << std::endl;
+      }
+
+      condition.notify_all();
+    }
+  };
+
+  // a worker waiting for memory only waits for jobs which are already running, so it cannot hold up the pool
+  ThreadPool::GetShared().ParallelFor(numWorkers, numWorkers, ThreadPool::Priority::Normal, worker);
+
+  const auto batchEndTime = std::chrono::steady_clock::now();
+
+  // summary, in the order of the job file
+  const auto toSeconds = [] (std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double>(duration).count();
+  };
+
+  std::size_t numFailed = 0;
+  std::chrono::steady_clock::duration totalRunTime{};
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    const auto& job = jobs[i];
+    const auto& state = states[i];
+
+    std::wcerr << L"[batch] line "sv << job.lineNumber << L": "sv << job.inFile << L" -> "sv << job.outFile << L": "sv;
+    if (!state.error.empty()) {
+      numFailed++;
+      std::wcerr << L"failed: "sv << ToWide(state.error);
+      if (!state.estimate) {
+        std::wcerr << L" (while estimating)"sv;
+      }
+      std::wcerr << std::endl;
+      continue;
+    }
+
+    totalRunTime += state.endTime - state.startTime;
+    std::wcerr << state.outputSize << L" bytes, started after "sv << toSeconds(state.startTime - batchStartTime) << L" s, took "sv
+               << toSeconds(state.endTime - state.startTime) << L" s, estimated "sv << state.estimate->memory / (1024 * 1024) << L" MiB"sv << std::endl;
+  }
+
+  const auto batchTime = batchEndTime - batchStartTime;
+  std::wcerr << L"[batch] "sv << (jobs.size() - numFailed) << L" succeeded, "sv << numFailed << L" failed in "sv << toSeconds(batchTime) << L" s; "sv
+             << toSeconds(totalRunTime) << L" s of jobs ("sv << (toSeconds(batchTime) > 0 ? toSeconds(totalRunTime) / toSeconds(batchTime) : 0.0)
+             << L" running on average), peak estimated memory "sv << peakMemory / (1024 * 1024) << L" MiB"sv << std::endl;
+
+  return numFailed;
+}
@@ -0,0 +1,47 @@
+#ifndef ML_BATCH_HPP
+#define ML_BATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MEIToAVI.hpp"
+
+
+// runs many conversions in one process (-batch), so that the engine is initialized once rather than for every file
+namespace Batch {
+  struct Job {
+    std::size_t lineNumber;       // in the job file, for messages
+    std::wstring inFile;
+    std::wstring outFile;
+    MEIToAVI::Options options;
+    std::size_t bufferSize;
+    bool writeManifest;
+    bool writeHashTree;
+    bool hashSHA256;
+  };
+
+  struct JobLine {
+    std::size_t lineNumber;
+    std::vector<std::wstring> args;
+  };
+
+  // splits the lines of a job file (UTF-8, with or without BOM) into arguments
+  // arguments are separated by spaces or tabs and may be enclosed in double quotes ("" inside quotes is a literal quote)
+  // empty lines and lines starting with # are skipped
+  std::vector<JobLine> ReadJobFile(const std::wstring& filePath);
+
+  // half of the physical memory
+  std::uint64_t GetDefaultMemoryBudget();
+
+  // runs the jobs on numWorkers threads of the shared pool and writes the timing of every job to std::wcerr at the end
+  // every input is opened once beforehand to estimate the memory the job needs and the pixels it decodes
+  // the jobs with the most pixels are started first, and a job is admitted only while the estimates of the running
+  // jobs stay within memoryBudget; smaller jobs fill in when the next one does not fit, and a job estimated beyond
+  // the whole budget runs alone
+  // a failed job does not stop the others; returns the number of failed jobs
+  std::size_t Run(const std::vector<Job>& jobs, std::uint_fast32_t numWorkers, std::uint64_t memoryBudget, bool showMessage);
+}
+
+#endif
@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "UtVideoEncoder.hpp"
+#include "../ThreadPool.hpp"
+
+
+// see also FFmpeg's libavcodec/utvideoenc.c and libavcodec/utvideodec.c
+
+
+namespace {
+  constexpr std::uint32_t OriginalFormatRGB  = 0x18010000;    // MKTAG(0x00, 0x00, 0x01, 0x18)
+  constexpr std::uint32_t OriginalFormatRGBA = 0x18020000;    // MKTAG(0x00, 0x00, 0x02, 0x18)
+
+  constexpr std::uint32_t FrameInfoSize = 4;
+  constexpr std::uint32_t CompressionHuffman = 0x00000001;
+  constexpr std::uint32_t PredictionMedian = 3;
+
+  constexpr unsigned int MaxCodeLength = 32;
+
+
+  inline int MidPred(int a, int b, int c) {
+    if (a > b) {
+      std::swap(a, b);
+    }
+    return std::max(a, std::min(b, c));
+  }
+
+
+  inline void WriteLE32(std::uint8_t* ptr, std::uint32_t value) {
+    ptr[0] = static_cast<std::uint8_t>(value);
+    ptr[1] = static_cast<std::uint8_t>(value >> 8);
+    ptr[2] = static_cast<std::uint8_t>(value >> 16);
+    ptr[3] = static_cast<std::uint8_t>(value >> 24);
+  }
+
+
+  // returns code lengths (255 for unused symbols) limited to maxLength bits
+  std::array<std::uint8_t, 256> GenerateCodeLengths(const std::array<std::uint64_t, 256>& counts, unsigned int maxLength) {
+    std::array<std::uint64_t, 256> currentCounts = counts;
+
+    while (true) {
+      struct Node {
+        std::uint64_t count;
+        std::size_t parent;
+      };
+
+      constexpr std::size_t NoParent = static_cast<std::size_t>(-1);
+
+      std::vector<Node> nodes;
+      nodes.reserve(512);
+
+      // (count, node index), smaller first
+      using Item = std::pair<std::uint64_t, std::size_t>;
+      std::priority_queue<Item, std::vector<Item>, std::greater<Item>> queue;
+
+      std::array<std::size_t, 256> leafNodes;
+      leafNodes.fill(NoParent);
+      for (std::size_t symbol = 0; symbol < 256; symbol++) {
+        if (!currentCounts[symbol]) {
+          continue;
+        }
+        leafNodes[symbol] = nodes.size();
+        queue.emplace(currentCounts[symbol], nodes.size());
+        nodes.push_back(Node{
+          currentCounts[symbol],
+          NoParent,
+        });
+      }
+
+      assert(queue.size() >= 2);
+
+      while (queue.size() > 1) {
+        const auto a = queue.top();
+        queue.pop();
+        const auto b = queue.top();
+        queue.pop();
+        const std::size_t index = nodes.size();
+        nodes[a.second].parent = index;
+        nodes[b.second].parent = index;
+        nodes.push_back(Node{
+          a.first + b.first,
+          NoParent,
+        });
+        queue.emplace(a.first + b.first, index);
+      }
+
+      std::array<std::uint8_t, 256> lengths;
+      lengths.fill(255);
+      unsigned int maxCurrentLength = 0;
+      for (std::size_t symbol = 0; symbol < 256; symbol++) {
+        if (leafNodes[symbol] == NoParent) {
+          continue;
+        }
+        unsigned int length = 0;
+        for (std::size_t index = leafNodes[symbol]; nodes[index].parent != NoParent; index = nodes[index].parent) {
+          length++;
+        }
+        maxCurrentLength = std::max(maxCurrentLength, length);
+        lengths[symbol] = static_cast<std::uint8_t>(std::min(length, 255u));
+      }
+
+      if (maxCurrentLength <= maxLength) {
+        return lengths;
+      }
+
+      // flatten the distribution and retry
+      for (auto& count : currentCounts) {
+        count = count ? (count + 1) / 2 : 0;
+      }
+    }
+  }
+
+
+  // assigns canonical codes in the same way as Ut Video does
+  // (symbols sorted by (length, symbol), codes assigned in reverse order starting from 0)
+  std::array<std::uint32_t, 256> GenerateCodes(const std::array<std::uint8_t, 256>& lengths) {
+    std::array<std::uint8_t, 256> symbols;
+    std::size_t numSymbols = 0;
+    for (std::size_t symbol = 0; symbol < 256; symbol++) {
+      if (lengths[symbol] != 255) {
+        symbols[numSymbols++] = static_cast<std::uint8_t>(symbol);
+      }
+    }
+    std::sort(symbols.begin(), symbols.begin() + numSymbols, [&lengths] (std::uint8_t a, std::uint8_t b) {
+      return lengths[a] != lengths[b] ? lengths[a] < lengths[b] : a < b;
+    });
+
+    std::array<std::uint32_t, 256> codes{};
+    std::uint64_t code = 0;
+    for (std::size_t i = numSymbols; i-- > 0; ) {
+      const auto symbol = symbols[i];
+      const unsigned int length = lengths[symbol];
+      codes[symbol] = static_cast<std::uint32_t>(code >> (32 - length));
+      code += static_cast<std::uint64_t>(1) << (32 - length);
+    }
+    assert(code == (static_cast<std::uint64_t>(1) << 32));
+
+    return codes;
+  }
+}
+
+
+UtVideoEncoder::UtVideoEncoder(std::uint_fast32_t width, std::uint_fast32_t height, bool hasAlpha, std::uint_fast32_t numSlices, std::uint_fast32_t numThreads) :
+  mWidth(width),
+  mHeight(height),
+  mHasAlpha(hasAlpha),
+  mNumPlanes(hasAlpha ? 4 : 3),
+  mNumSlices(std::clamp<std::uint_fast32_t>(numSlices, 1, std::min<std::uint_fast32_t>(MaxSlices, height))),
+  mNumThreads(std::max<std::uint_fast32_t>(numThreads, 1)),
+  mResiduals(),
+  mSlices()
+{
+  if (width == 0 || height == 0) {
+    throw std::runtime_error("UtVideoEncoder: invalid image size");
+  }
+
+  for (std::size_t plane = 0; plane < mNumPlanes; plane++) {
+    mResiduals[plane] = std::make_unique<std::uint8_t[]>(static_cast<std::size_t>(mWidth) * mHeight);
+  }
+
+  mSlices.resize(mNumSlices);
+  for (std::uint_fast32_t i = 0; i < mNumSlices; i++) {
+    auto& slice = mSlices[i];
+    slice.startLine = mHeight * i / mNumSlices;
+    slice.endLine = mHeight * (i + 1) / mNumSlices;
+    assert(slice.startLine < slice.endLine);
+
+    // 32 bits per sample at worst
+    const std::size_t maxBitsSize = static_cast<std::size_t>(mWidth) * (slice.endLine - slice.startLine) * 4 + 4;
+    for (std::size_t plane = 0; plane < mNumPlanes; plane++) {
+      slice.bits[plane].resize(maxBitsSize);
+    }
+  }
+}
+
+
+std::uint32_t UtVideoEncoder::GetFourCC() const {
+  return mHasAlpha ? FourCCULRA : FourCCULRG;
+}
+
+
+std::uint16_t UtVideoEncoder::GetBitCount() const {
+  return mHasAlpha ? 32 : 24;
+}
+
+
+std::array<std::uint8_t, UtVideoEncoder::ExtraDataSize> UtVideoEncoder::GetExtraData() const {
+  std::array<std::uint8_t, ExtraDataSize> extraData{};
+  // encoder version (big endian)
+  extraData[0] = 0xF0;
+  extraData[1] = 0x00;
+  extraData[2] = 0x00;
+  extraData[3] = 0x01;
+  WriteLE32(extraData.data() + 4, mHasAlpha ? OriginalFormatRGBA : OriginalFormatRGB);
+  WriteLE32(extraData.data() + 8, FrameInfoSize);
+  WriteLE32(extraData.data() + 12, static_cast<std::uint32_t>((mNumSlices - 1) << 24) | CompressionHuffman);
+  return extraData;
+}
+
+
+std::size_t UtVideoEncoder::GetMaxEncodedSize() const {
+  std::size_t size = FrameInfoSize;
+  for (const auto& slice : mSlices) {
+    size += slice.bits[0].size() * mNumPlanes;
+  }
+  size += (256 + 4 * mNumSlices) * mNumPlanes;
+  return size;
+}
+
+
+void UtVideoEncoder::PredictSlice(const std::uint8_t* bgra, SliceContext& slice) {
+  const std::size_t width = mWidth;
+  const std::size_t numLines = slice.endLine - slice.startLine;
+
+  // decorrelate (G, B-G, R-G, A) into the residual buffers first, then predict in place from the bottom line
+  for (std::size_t y = slice.startLine; y < slice.endLine; y++) {
+    const std::uint8_t* src = bgra + y * width * 4;
+    std::uint8_t* planes[4] = {
+      mResiduals[0].get() + y * width,
+      mResiduals[1].get() + y * width,
+      mResiduals[2].get() + y * width,
+      mHasAlpha ? mResiduals[3].get() + y * width : nullptr,
+    };
+    for (std::size_t x = 0; x < width; x++) {
+      const std::uint8_t b = src[x * 4 + 0];
+      const std::uint8_t g = src[x * 4 + 1];
+      const std::uint8_t r = src[x * 4 + 2];
+      planes[0][x] = g;
+      planes[1][x] = static_cast<std::uint8_t>(b - g + 0x80);
+      planes[2][x] = static_cast<std::uint8_t>(r - g + 0x80);
+      if (mHasAlpha) {
+        planes[3][x] = src[x * 4 + 3];
+      }
+    }
+  }
+
+  for (std::size_t plane = 0; plane < mNumPlanes; plane++) {
+    std::uint8_t* const base = mResiduals[plane].get() + slice.startLine * width;
+    auto& counts = slice.counts[plane];
+    counts.fill(0);
+
+    // the rest of lines use continuous median prediction
+    // (left of the first sample is the last sample of the previous line)
+    // processed from the bottom so that the original values of the line above are still available
+    for (std::size_t line = numLines - 1; line >= 1; line--) {
+      std::uint8_t* const cur = base + line * width;
+      const std::uint8_t* const top = cur - width;
+
+      int left = 0;
+      int leftTop = 0;
+      if (line >= 2) {
+        left = cur[-1];
+        leftTop = top[-1];
+      }
+
+      for (std::size_t x = 0; x < width; x++) {
+        const int prediction = MidPred(left, top[x], (left + top[x] - leftTop) & 0xFF);
+        left = cur[x];
+        leftTop = top[x];
+        cur[x] = static_cast<std::uint8_t>(left - prediction);
+        counts[cur[x]]++;
+      }
+    }
+
+    // the first line uses left neighbour prediction
+    int previous = 0x80;
+    for (std::size_t x = 0; x < width; x++) {
+      const int value = base[x];
+      base[x] = static_cast<std::uint8_t>(value - previous);
+      previous = value;
+      counts[base[x]]++;
+    }
+  }
+}
+
+
+void UtVideoEncoder::WriteSliceBits(std::uint_fast32_t plane, SliceContext& slice, const std::array<std::uint8_t, 256>& lengths, const std::array<std::uint32_t, 256>& codes) {
+  const std::size_t numSamples = static_cast<std::size_t>(mWidth) * (slice.endLine - slice.startLine);
+  const std::uint8_t* src = mResiduals[plane].get() + static_cast<std::size_t>(slice.startLine) * mWidth;
+  std::uint8_t* dst = slice.bits[plane].data();
+
+  // MSB first bit stream, stored as little endian 32-bit words
+  std::uint64_t buffer = 0;
+  unsigned int numBits = 0;
+  for (std::size_t i = 0; i < numSamples; i++) {
+    const auto symbol = src[i];
+    buffer = (buffer << lengths[symbol]) | codes[symbol];
+    numBits += lengths[symbol];
+    if (numBits >= 32) {
+      numBits -= 32;
+      WriteLE32(dst, static_cast<std::uint32_t>(buffer >> numBits));
+      dst += 4;
+      buffer &= (static_cast<std::uint64_t>(1) << numBits) - 1;
+    }
+  }
+  if (numBits) {
+    WriteLE32(dst, static_cast<std::uint32_t>(buffer << (32 - numBits)));
+    dst += 4;
+  }
+
+  slice.bitsSize[plane] = dst - slice.bits[plane].data();
+}
+
+
+std::size_t UtVideoEncoder::Encode(const std::uint8_t* bgra, std::uint8_t* output) {
+  // predict and count symbols
+  // the frame is waited for, so the slices go ahead of work queued in the background
+  ThreadPool::GetShared().ParallelFor(mNumSlices, mNumThreads, ThreadPool::Priority::High, [this, bgra] (std::size_t i) {
+    PredictSlice(bgra, mSlices[i]);
+  });
+
+  // build Huffman tables
+  std::array<std::array<std::uint8_t, 256>, 4> lengths;
+  std::array<std::array<std::uint32_t, 256>, 4> codes;
+  std::array<int, 4> singleSymbols;
+  for (std::size_t plane = 0; plane < mNumPlanes; plane++) {
+    std::array<std::uint64_t, 256> counts{};
+    for (const auto& slice : mSlices) {
+      for (std::size_t symbol = 0; symbol < 256; symbol++) {
+        counts[symbol] += slice.counts[plane][symbol];
+      }
+    }
+
+    singleSymbols[plane] = -1;
+    const auto numUsedSymbols = std::count_if(counts.cbegin(), counts.cend(), [] (std::uint64_t count) {
+      return count != 0;
+    });
+    if (numUsedSymbols == 1) {
+      singleSymbols[plane] = static_cast<int>(std::find_if(counts.cbegin(), counts.cend(), [] (std::uint64_t count) {
+        return count != 0;
+      }) - counts.cbegin());
+      continue;
+    }
+
+    lengths[plane] = GenerateCodeLengths(counts, MaxCodeLength);
+    codes[plane] = GenerateCodes(lengths[plane]);
+  }
+
+  // write bits
+  ThreadPool::GetShared().ParallelFor(mNumSlices * mNumPlanes, mNumThreads, ThreadPool::Priority::High, [this, &lengths, &codes, &singleSymbols] (std::size_t i) {
+    const auto plane = static_cast<std::uint_fast32_t>(i / mNumSlices);
+    auto& slice = mSlices[i % mNumSlices];
+    if (singleSymbols[plane] >= 0) {
+      slice.bitsSize[plane] = 0;
+      return;
+    }
+    WriteSliceBits(plane, slice, lengths[plane], codes[plane]);
+  });
+
+  // assemble
+  std::uint8_t* dst = output;
+  for (std::size_t plane = 0; plane < mNumPlanes; plane++) {
+    if (singleSymbols[plane] >= 0) {
+      // the only symbol has a code length of 0
+      std::memset(dst, 0xFF, 256);
+      dst[singleSymbols[plane]] = 0;
+    } else {
+      std::memcpy(dst, lengths[plane].data(), 256);
+    }
+    dst += 256;
+
+    std::uint32_t sliceEnd = 0;
+    for (const auto& slice : mSlices) {
+      sliceEnd += static_cast<std::uint32_t>(slice.bitsSize[plane]);
+      WriteLE32(dst, sliceEnd);
+      dst += 4;
+    }
+
+    for (const auto& slice : mSlices) {
+      std::memcpy(dst, slice.bits[plane].data(), slice.bitsSize[plane]);
+      dst += slice.bitsSize[plane];
+    }
+  }
+
+  WriteLE32(dst, PredictionMedian << 8);
+  dst += 4;
+
+  return dst - output;
+}
@@ -0,0 +1,58 @@
+#ifndef ML_UTVIDEOENCODER_HPP
+#define ML_UTVIDEOENCODER_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "../AVI.hpp"
+
+
+// Ut Video Codec Suite compatible lossless encoder (ULRG / ULRA)
+// median prediction + canonical Huffman coding, each plane is split into slices which are encoded in parallel
+// the output can be decoded by FFmpeg's utvideo decoder and the original VfW codec
+class UtVideoEncoder {
+public:
+  static constexpr std::uint32_t FourCCULRG = AVI::GetFourCC("ULRG");
+  static constexpr std::uint32_t FourCCULRA = AVI::GetFourCC("ULRA");
+
+  static constexpr std::size_t ExtraDataSize = 16;
+  static constexpr std::uint_fast32_t MaxSlices = 256;
+
+private:
+  struct SliceContext {
+    std::uint_fast32_t startLine;
+    std::uint_fast32_t endLine;
+    std::array<std::array<std::uint32_t, 256>, 4> counts;
+    std::array<std::vector<std::uint8_t>, 4> bits;
+    std::array<std::size_t, 4> bitsSize;
+  };
+
+  std::uint_fast32_t mWidth;
+  std::uint_fast32_t mHeight;
+  bool mHasAlpha;
+  std::uint_fast32_t mNumPlanes;
+  std::uint_fast32_t mNumSlices;
+  std::uint_fast32_t mNumThreads;
+  std::array<std::unique_ptr<std::uint8_t[]>, 4> mResiduals;
+  std::vector<SliceContext> mSlices;
+
+  void PredictSlice(const std::uint8_t* bgra, SliceContext& slice);
+  void WriteSliceBits(std::uint_fast32_t plane, SliceContext& slice, const std::array<std::uint8_t, 256>& lengths, const std::array<std::uint32_t, 256>& codes);
+
+public:
+  UtVideoEncoder(std::uint_fast32_t width, std::uint_fast32_t height, bool hasAlpha, std::uint_fast32_t numSlices, std::uint_fast32_t numThreads);
+
+  std::uint32_t GetFourCC() const;
+  std::uint16_t GetBitCount() const;
+  std::array<std::uint8_t, ExtraDataSize> GetExtraData() const;
+  std::size_t GetMaxEncodedSize() const;
+
+  // encodes a top-down 32bpp BGRA image and returns the size of the encoded frame
+  // output must have at least GetMaxEncodedSize() bytes
+  std::size_t Encode(const std::uint8_t* bgra, std::uint8_t* output);
+};
+
+#endif
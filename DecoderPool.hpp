@@ -0,0 +1,276 @@
+#ifndef ML_DECODERPOOL_HPP
+#define ML_DECODERPOOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+
+// pool of decoder instances shared by concurrent random-access readers
+// each instance remembers where it was left, and a request goes to the idle instance which is cheapest to move
+// to the requested position; new instances are created up to maxDecoders when every idle one would have to seek
+// far, and instances idle for longer than idleTimeout are destroyed down to minDecoders
+// T is only created by the factory and handed out, so any type (e.g. a synthetic decoder) can be pooled
+template<typename T>
+class DecoderPool {
+public:
+  using Position = std::uint64_t;
+  using Cost = std::uint64_t;
+  using Factory = std::function<std::shared_ptr<T>()>;
+  using CostFunction = std::function<Cost(Position from, Position to)>;
+  using Clock = std::chrono::steady_clock;
+
+  struct Stats {
+    std::uint64_t numAcquisitions;
+    Cost totalSeekCost;
+    Cost maxSeekCost;
+    Clock::duration totalWaitTime;
+    Clock::duration maxWaitTime;
+    std::size_t numCreated;
+    std::size_t numDestroyed;
+    std::size_t maxDecoders;      // peak number of instances
+  };
+
+private:
+  struct Entry {
+    std::shared_ptr<T> decoder;
+    Position position;
+    bool busy;
+    Clock::time_point lastUsed;
+  };
+
+  using EntryIterator = typename std::list<Entry>::iterator;
+
+  Factory mFactory;
+  CostFunction mCostFunction;
+  Cost mCreateCost;
+  std::size_t mMinDecoders;
+  std::size_t mMaxDecoders;
+  Clock::duration mIdleTimeout;
+  mutable std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::list<Entry> mEntries;      // a list, so that leases can keep iterators
+  std::size_t mNumCreating;
+  Stats mStats;
+
+  void Release(EntryIterator itrEntry, Position position) {
+    std::vector<std::shared_ptr<T>> expiredDecoders;   // destroyed outside the lock
+
+    {
+      std::lock_guard lock(mMutex);
+
+      const auto now = Clock::now();
+
+      itrEntry->busy = false;
+      itrEntry->position = position;
+      itrEntry->lastUsed = now;
+
+      // scale down
+      for (auto itr = mEntries.begin(); itr != mEntries.end() && mEntries.size() > mMinDecoders; ) {
+        if (!itr->busy && now - itr->lastUsed > mIdleTimeout) {
+          expiredDecoders.push_back(std::move(itr->decoder));
+          itr = mEntries.erase(itr);
+          mStats.numDestroyed++;
+        } else {
+          itr++;
+        }
+      }
+    }
+
+    mCondition.notify_all();
+  }
+
+public:
+  // holds a decoder until destroyed; SetPosition tells where the decoder was left
+  class Lease {
+    DecoderPool* mPool;
+    EntryIterator mEntry;
+    Position mPosition;
+
+    friend class DecoderPool;
+
+    Lease(DecoderPool& pool, EntryIterator entry, Position position) :
+      mPool(&pool),
+      mEntry(entry),
+      mPosition(position)
+    {}
+
+  public:
+    Lease(Lease&& other) noexcept :
+      mPool(other.mPool),
+      mEntry(other.mEntry),
+      mPosition(other.mPosition)
+    {
+      other.mPool = nullptr;
+    }
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+    Lease& operator=(Lease&&) = delete;
+
+    ~Lease() {
+      if (mPool) {
+        mPool->Release(mEntry, mPosition);
+      }
+    }
+
+    T& operator*() const {
+      return *mEntry->decoder;
+    }
+
+    T* operator->() const {
+      return mEntry->decoder.get();
+    }
+
+    void SetPosition(Position position) {
+      mPosition = position;
+    }
+  };
+
+  // createCost: a new instance is created rather than moving an idle one that costs at least this much
+  // minDecoders instances are created at once
+  DecoderPool(Factory factory, CostFunction costFunction, Cost createCost, std::size_t minDecoders, std::size_t maxDecoders, Clock::duration idleTimeout) :
+    mFactory(factory),
+    mCostFunction(costFunction),
+    mCreateCost(createCost),
+    mMinDecoders(minDecoders),
+    mMaxDecoders(maxDecoders),
+    mIdleTimeout(idleTimeout),
+    mMutex(),
+    mCondition(),
+    mEntries(),
+    mNumCreating(0),
+    mStats{}
+  {
+    if (maxDecoders == 0 || minDecoders > maxDecoders) {
+      throw std::runtime_error("DecoderPool: invalid number of decoders");
+    }
+
+    const auto now = Clock::now();
+    for (std::size_t i = 0; i < minDecoders; i++) {
+      mEntries.push_back(Entry{mFactory(), 0, false, now});
+      mStats.numCreated++;
+    }
+    mStats.maxDecoders = mEntries.size();
+  }
+
+  DecoderPool(const DecoderPool&) = delete;
+  DecoderPool& operator=(const DecoderPool&) = delete;
+
+  // waits until a decoder is available
+  Lease Acquire(Position position) {
+    const auto startTime = Clock::now();
+
+    std::unique_lock lock(mMutex);
+
+    while (true) {
+      std::optional<EntryIterator> itrBest;
+      Cost bestCost = 0;
+      for (auto itr = mEntries.begin(); itr != mEntries.end(); itr++) {
+        if (itr->busy) {
+          continue;
+        }
+        const auto cost = mCostFunction(itr->position, position);
+        if (!itrBest || cost < bestCost) {
+          itrBest = itr;
+          bestCost = cost;
+        }
+      }
+
+      const bool canCreate = mEntries.size() + mNumCreating < mMaxDecoders;
+
+      if (itrBest && (bestCost < mCreateCost || !canCreate)) {
+        return Take(itrBest.value(), position, bestCost, startTime);
+      }
+
+      if (canCreate) {
+        // the factory may be slow, so the others are not blocked meanwhile
+        mNumCreating++;
+        lock.unlock();
+
+        std::shared_ptr<T> decoder;
+        try {
+          decoder = mFactory();
+        } catch (...) {
+          lock.lock();
+          mNumCreating--;
+          lock.unlock();
+          mCondition.notify_all();
+          throw;
+        }
+
+        lock.lock();
+        mNumCreating--;
+        mEntries.push_back(Entry{std::move(decoder), 0, false, Clock::now()});
+        mStats.numCreated++;
+        mStats.maxDecoders = std::max(mStats.maxDecoders, mEntries.size());
+
+        const auto itrEntry = std::prev(mEntries.end());
+        return Take(itrEntry, position, mCostFunction(0, position), startTime);
+      }
+
+      mCondition.wait(lock);
+    }
+  }
+
+  // an idle instance which costs less than maxCost to move, without waiting or creating one; for work that may be skipped
+  std::optional<Lease> TryAcquire(Position position, Cost maxCost) {
+    const auto startTime = Clock::now();
+
+    std::lock_guard lock(mMutex);
+
+    std::optional<EntryIterator> itrBest;
+    Cost bestCost = 0;
+    for (auto itr = mEntries.begin(); itr != mEntries.end(); itr++) {
+      if (itr->busy) {
+        continue;
+      }
+      const auto cost = mCostFunction(itr->position, position);
+      if (!itrBest || cost < bestCost) {
+        itrBest = itr;
+        bestCost = cost;
+      }
+    }
+
+    if (!itrBest || bestCost >= maxCost) {
+      return std::nullopt;
+    }
+    return Take(itrBest.value(), position, bestCost, startTime);
+  }
+
+  Stats GetStats() const {
+    std::lock_guard lock(mMutex);
+    return mStats;
+  }
+
+  std::size_t CountDecoders() const {
+    std::lock_guard lock(mMutex);
+    return mEntries.size();
+  }
+
+private:
+  // mMutex must be held
+  Lease Take(EntryIterator itrEntry, Position position, Cost cost, Clock::time_point startTime) {
+    itrEntry->busy = true;
+
+    const auto waitTime = Clock::now() - startTime;
+    mStats.numAcquisitions++;
+    mStats.totalSeekCost += cost;
+    mStats.maxSeekCost = std::max(mStats.maxSeekCost, cost);
+    mStats.totalWaitTime += waitTime;
+    mStats.maxWaitTime = std::max(mStats.maxWaitTime, waitTime);
+
+    return Lease(*this, itrEntry, position);
+  }
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <stdexcept>
+
+#include "EBMLBase.hpp"
+#include "EBMLDirBase.hpp"
+
+
+std::size_t EBMLBase::GetIdLength(std::uint32_t id) {
+  if (id > 0xFFFFFF) {
+    return 4;
+  }
+  if (id > 0xFFFF) {
+    return 3;
+  }
+  if (id > 0xFF) {
+    return 2;
+  }
+  return 1;
+}
+
+
+std::size_t EBMLBase::GetSizeLength(std::uint64_t size) {
+  for (std::size_t length = 1; length < 8; length++) {
+    if (size < (static_cast<std::uint64_t>(1) << (7 * length)) - 1) {
+      return length;
+    }
+  }
+  if (size >= (static_cast<std::uint64_t>(1) << 56) - 1) {
+    throw std::runtime_error("EBMLBase: size too large");
+  }
+  return 8;
+}
+
+
+std::size_t EBMLBase::WriteHeader(std::uint8_t* data, std::uint32_t id, std::uint64_t size, std::size_t sizeLength) {
+  if (!sizeLength) {
+    sizeLength = GetSizeLength(size);
+  } else if (sizeLength > 8 || GetSizeLength(size) > sizeLength) {
+    throw std::runtime_error("EBMLBase: size does not fit in the specified length");
+  }
+
+  const auto idLength = GetIdLength(id);
+  for (std::size_t i = 0; i < idLength; i++) {
+    data[i] = static_cast<std::uint8_t>(id >> (8 * (idLength - 1 - i)));
+  }
+
+  // big endian, with the length marker above the value
+  const auto sizeValue = size | static_cast<std::uint64_t>(1) << (7 * sizeLength);
+  for (std::size_t i = 0; i < sizeLength; i++) {
+    data[idLength + i] = static_cast<std::uint8_t>(sizeValue >> (8 * (sizeLength - 1 - i)));
+  }
+
+  return idLength + sizeLength;
+}
+
+
+EBMLBase::EBMLBase() :
+  parent(nullptr)
+{}
+
+
+std::streamsize EBMLBase::GetOffset() const {
+  return parent->GetOffset() + parent->GetOffsetOf(this);
+}
+
+
+void EBMLBase::SetParent(EBMLDirBase* parent) {
+  assert(!this->parent);
+  assert(parent);
+  this->parent = parent;
+}
+
+
+void EBMLBase::CreateSource() {
+  // do nothing
+}
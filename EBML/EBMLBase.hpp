@@ -0,0 +1,51 @@
+#ifndef ML_EBMLBASE_HPP
+#define ML_EBMLBASE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <memory>
+
+#include "../Source/SourceBase.hpp"
+
+
+class EBMLDirBase;
+
+class EBMLBase {
+public:
+  enum class Type {
+    Element,
+    Master,
+    Root,
+  };
+
+  // element id (up to 4 bytes) and size (up to 8 bytes)
+  static constexpr std::size_t MaxHeaderSize = 12;
+
+  // the length marker is part of the id, e.g. 0x1A45DFA3 is 4 bytes long
+  static std::size_t GetIdLength(std::uint32_t id);
+  // shortest variable size integer which can hold size (all ones are reserved for unknown sizes)
+  static std::size_t GetSizeLength(std::uint64_t size);
+  // writes the id and the size of an element to data and returns the number of bytes written
+  // sizeLength: bytes used for the size, 0 for the shortest
+  static std::size_t WriteHeader(std::uint8_t* data, std::uint32_t id, std::uint64_t size, std::size_t sizeLength = 0);
+
+protected:
+  EBMLDirBase* parent;
+
+public:
+  EBMLBase();
+  virtual ~EBMLBase() = default;
+
+  virtual Type GetType() const = 0;
+
+  virtual std::streamsize GetOffset() const;
+  virtual std::streamsize GetSize() const = 0;
+  virtual std::shared_ptr<SourceBase> GetSource() = 0;
+
+  virtual void SetParent(EBMLDirBase* parent);
+
+  virtual void CreateSource();
+};
+
+#endif
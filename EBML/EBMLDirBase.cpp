@@ -0,0 +1,74 @@
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <memory>
+#include <vector>
+
+#include "EBMLDirBase.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+std::streamsize EBMLDirBase::GetContentOffsetOf(const EBMLBase* child) const {
+  std::streamsize offset = 0;
+  auto itrChildren = children.cbegin();
+  while (itrChildren->get() != child) {
+    offset += (*itrChildren)->GetSize();
+    itrChildren++;
+  }
+  return offset;
+}
+
+
+std::streamsize EBMLDirBase::GetContentSize() const {
+  std::streamsize size = 0;
+  for (const auto& child : children) {
+    size += child->GetSize();
+  }
+  return size;
+}
+
+
+void EBMLDirBase::CreateContentSource() {
+  std::vector<std::shared_ptr<SourceBase>> sources;
+  sources.reserve(children.size());
+  for (const auto& child : children) {
+    child->CreateSource();
+    sources.emplace_back(child->GetSource());
+  }
+  contentSource = std::make_shared<ConcatenatedSource>(sources);
+}
+
+
+EBMLDirBase::EBMLDirBase() :
+  EBMLBase(),
+  children(),
+  contentSource()
+{}
+
+
+std::size_t EBMLDirBase::CountChildren() const {
+  return children.size();
+}
+
+
+EBMLBase* EBMLDirBase::GetChild(std::size_t index) {
+  return children[index].get();
+}
+
+
+const EBMLBase* EBMLDirBase::GetChild(std::size_t index) const {
+  return children[index].get();
+}
+
+
+void EBMLDirBase::AppendChild(std::shared_ptr<EBMLBase> child) {
+  child->SetParent(this);
+  children.push_back(child);
+}
+
+
+void EBMLDirBase::PrependChild(std::shared_ptr<EBMLBase> child) {
+  child->SetParent(this);
+  children.push_front(child);
+}
@@ -0,0 +1,36 @@
+#ifndef ML_EBMLDIRBASE_HPP
+#define ML_EBMLDIRBASE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <ios>
+#include <memory>
+
+#include "EBMLBase.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+class EBMLDirBase : public EBMLBase {
+protected:
+  std::deque<std::shared_ptr<EBMLBase>> children;
+  std::shared_ptr<ConcatenatedSource> contentSource;
+
+  std::streamsize GetContentOffsetOf(const EBMLBase* child) const;
+  std::streamsize GetContentSize() const;
+  void CreateContentSource();
+
+public:
+  EBMLDirBase();
+
+  virtual std::streamsize GetOffsetOf(const EBMLBase* child) const = 0;
+
+  std::size_t CountChildren() const;
+  EBMLBase* GetChild(std::size_t index);
+  const EBMLBase* GetChild(std::size_t index) const;
+  void AppendChild(std::shared_ptr<EBMLBase> child);
+  void PrependChild(std::shared_ptr<EBMLBase> child);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "EBMLElement.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/MemorySource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+void EBMLElement::ElementCreateSource() {
+  std::array<std::uint8_t, MaxHeaderSize> header;
+  const auto headerSize = WriteHeader(header.data(), mId, mContentSource->GetSize(), mSizeLength);
+
+  mSource = std::make_shared<ConcatenatedSource>(std::array<std::shared_ptr<SourceBase>, 2>{
+    std::make_shared<MemorySource>(header.data(), headerSize),
+    mContentSource,
+  });
+}
+
+
+std::shared_ptr<EBMLElement> EBMLElement::CreateUInt(std::uint32_t id, std::uint64_t value, std::size_t width) {
+  if (!width) {
+    width = 1;
+    while (width < 8 && (value >> (8 * width))) {
+      width++;
+    }
+  } else if (width > 8 || (width < 8 && (value >> (8 * width)))) {
+    throw std::runtime_error("EBMLElement: value does not fit in the specified width");
+  }
+
+  std::array<std::uint8_t, 8> data;
+  for (std::size_t i = 0; i < width; i++) {
+    data[i] = static_cast<std::uint8_t>(value >> (8 * (width - 1 - i)));
+  }
+  return std::make_shared<EBMLElement>(id, std::make_shared<MemorySource>(data.data(), width));
+}
+
+
+std::shared_ptr<EBMLElement> EBMLElement::CreateFloat(std::uint32_t id, double value) {
+  static_assert(sizeof(double) == 8);
+
+  std::uint64_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+
+  std::array<std::uint8_t, 8> data;
+  for (std::size_t i = 0; i < 8; i++) {
+    data[i] = static_cast<std::uint8_t>(bits >> (8 * (7 - i)));
+  }
+  return std::make_shared<EBMLElement>(id, std::make_shared<MemorySource>(data.data(), data.size()));
+}
+
+
+std::shared_ptr<EBMLElement> EBMLElement::CreateString(std::uint32_t id, const std::string& value) {
+  return std::make_shared<EBMLElement>(id, std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(value.data()), value.size()));
+}
+
+
+EBMLElement::EBMLElement(std::uint32_t id, std::shared_ptr<SourceBase> contentSource, std::size_t sizeLength) :
+  EBMLBase(),
+  mId(id),
+  mSizeLength(sizeLength),
+  mContentSource(contentSource),
+  mSource()
+{
+  ElementCreateSource();
+}
+
+
+EBMLBase::Type EBMLElement::GetType() const {
+  return Type::Element;
+}
+
+
+std::streamsize EBMLElement::GetSize() const {
+  return mSource->GetSize();
+}
+
+
+std::shared_ptr<SourceBase> EBMLElement::GetSource() {
+  return mSource;
+}
+
+
+void EBMLElement::SetContentSource(std::shared_ptr<SourceBase> contentSource) {
+  mContentSource = contentSource;
+  ElementCreateSource();
+}
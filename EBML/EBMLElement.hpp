@@ -0,0 +1,42 @@
+#ifndef ML_EBMLELEMENT_HPP
+#define ML_EBMLELEMENT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <memory>
+#include <string>
+
+#include "EBMLBase.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+// element with data, e.g. an integer or a SimpleBlock
+class EBMLElement : public EBMLBase {
+  std::uint32_t mId;
+  std::size_t mSizeLength;
+  std::shared_ptr<SourceBase> mContentSource;
+  std::shared_ptr<ConcatenatedSource> mSource;
+
+  void ElementCreateSource();
+
+public:
+  // width: bytes used for the value, 0 for the shortest
+  // a fixed width keeps the size of the element independent of the value, so that it can be set afterwards
+  static std::shared_ptr<EBMLElement> CreateUInt(std::uint32_t id, std::uint64_t value, std::size_t width = 0);
+  static std::shared_ptr<EBMLElement> CreateFloat(std::uint32_t id, double value);
+  static std::shared_ptr<EBMLElement> CreateString(std::uint32_t id, const std::string& value);
+
+  // sizeLength: bytes used for the size, 0 for the shortest
+  EBMLElement(std::uint32_t id, std::shared_ptr<SourceBase> contentSource, std::size_t sizeLength = 0);
+
+  Type GetType() const override;
+
+  std::streamsize GetSize() const override;
+  std::shared_ptr<SourceBase> GetSource() override;
+
+  void SetContentSource(std::shared_ptr<SourceBase> contentSource);
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <memory>
+#include <stdexcept>
+
+#include "EBMLMaster.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/MemorySource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+std::size_t EBMLMaster::GetHeaderSize() const {
+  return GetIdLength(mId) + (mSizeLength ? mSizeLength : GetSizeLength(GetContentSize()));
+}
+
+
+std::streamsize EBMLMaster::GetOffsetOf(const EBMLBase* child) const {
+  return GetContentOffsetOf(child) + GetHeaderSize();
+}
+
+
+EBMLMaster::EBMLMaster(std::uint32_t id, std::size_t sizeLength) :
+  EBMLDirBase(),
+  mId(id),
+  mSizeLength(sizeLength),
+  mSource()
+{}
+
+
+EBMLBase::Type EBMLMaster::GetType() const {
+  return Type::Master;
+}
+
+
+std::streamsize EBMLMaster::GetSize() const {
+  const auto contentSize = GetContentSize();
+  return contentSize + GetIdLength(mId) + (mSizeLength ? mSizeLength : GetSizeLength(contentSize));
+}
+
+
+std::shared_ptr<SourceBase> EBMLMaster::GetSource() {
+  if (!mSource) {
+    throw std::runtime_error("EBMLMaster: call CreateSource before GetSource");
+  }
+  return mSource;
+}
+
+
+void EBMLMaster::CreateSource() {
+  CreateContentSource();
+
+  std::array<std::uint8_t, MaxHeaderSize> header;
+  const auto headerSize = WriteHeader(header.data(), mId, contentSource->GetSize(), mSizeLength);
+
+  mSource = std::make_shared<ConcatenatedSource>(std::array<std::shared_ptr<SourceBase>, 2>{
+    std::make_shared<MemorySource>(header.data(), headerSize),
+    contentSource,
+  });
+}
@@ -0,0 +1,38 @@
+#ifndef ML_EBMLMASTER_HPP
+#define ML_EBMLMASTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <memory>
+
+#include "EBMLBase.hpp"
+#include "EBMLDirBase.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+// master element, whose content is the concatenation of its children
+// the size is known as soon as the children are, so offsets can be computed before CreateSource
+class EBMLMaster : public EBMLDirBase {
+  std::uint32_t mId;
+  std::size_t mSizeLength;      // 0 for the shortest
+  std::shared_ptr<ConcatenatedSource> mSource;
+
+  std::size_t GetHeaderSize() const;
+
+protected:
+  std::streamsize GetOffsetOf(const EBMLBase* child) const override;
+
+public:
+  // sizeLength: bytes used for the size, 0 for the shortest
+  EBMLMaster(std::uint32_t id, std::size_t sizeLength = 0);
+
+  Type GetType() const override;
+
+  std::streamsize GetSize() const override;
+  std::shared_ptr<SourceBase> GetSource() override;
+  void CreateSource() override;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include <ios>
+#include <memory>
+#include <stdexcept>
+
+#include "EBMLRoot.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+std::streamsize EBMLRoot::GetOffsetOf(const EBMLBase* child) const {
+  return GetContentOffsetOf(child);
+}
+
+
+EBMLRoot::EBMLRoot() :
+  EBMLDirBase()
+{}
+
+
+EBMLBase::Type EBMLRoot::GetType() const {
+  return Type::Root;
+}
+
+
+std::streamsize EBMLRoot::GetOffset() const {
+  return 0;
+}
+
+
+std::streamsize EBMLRoot::GetSize() const {
+  return GetContentSize();
+}
+
+
+std::shared_ptr<SourceBase> EBMLRoot::GetSource() {
+  if (!contentSource) {
+    throw std::runtime_error("EBMLRoot: call CreateSource before GetSource");
+  }
+  return contentSource;
+}
+
+
+void EBMLRoot::SetParent(EBMLDirBase* parent) {
+  throw std::logic_error("EBMLRoot: root cannot have a parent");
+}
+
+
+void EBMLRoot::CreateSource() {
+  CreateContentSource();
+}
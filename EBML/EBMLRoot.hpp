@@ -0,0 +1,31 @@
+#ifndef ML_EBMLROOT_HPP
+#define ML_EBMLROOT_HPP
+
+#include <ios>
+#include <memory>
+
+#include "EBMLBase.hpp"
+#include "EBMLDirBase.hpp"
+#include "../Source/ConcatenatedSource.hpp"
+#include "../Source/SourceBase.hpp"
+
+
+class EBMLRoot : public EBMLDirBase {
+protected:
+  std::streamsize GetOffsetOf(const EBMLBase* child) const override;
+
+public:
+  EBMLRoot();
+
+  Type GetType() const override;
+
+  std::streamsize GetOffset() const override;
+  std::streamsize GetSize() const override;
+  std::shared_ptr<SourceBase> GetSource() override;
+
+  void SetParent(EBMLDirBase* parent) override;
+
+  void CreateSource() override;
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include "FrameTransform.hpp"
+#include "Kernel/Pixel.hpp"
+
+
+namespace {
+  // weights are 14-bit fixed point, filtered lines are stored with 6 extra bits of precision
+  constexpr unsigned int WeightBits = 14;
+  constexpr unsigned int FilteredBits = 6;
+  constexpr std::uint_fast32_t WeightOne = 1u << WeightBits;
+
+
+  std::uint32_t GetPixel(const std::uint8_t* image, std::uint_fast32_t width, std::uint_fast32_t x, std::uint_fast32_t y) {
+    std::uint32_t pixel;
+    std::memcpy(&pixel, image + (static_cast<std::size_t>(y) * width + x) * 4, 4);
+    return pixel;
+  }
+
+
+  std::size_t GetBGR24Stride(std::uint_fast32_t width) {
+    return (static_cast<std::size_t>(width) * 3 + 3) & ~static_cast<std::size_t>(3);
+  }
+}
+
+
+std::optional<FrameTransform::Margins> FrameTransform::DetectBorders(const std::uint8_t* image, std::uint_fast32_t width, std::uint_fast32_t height, std::uint8_t tolerance) {
+  const std::size_t stride = static_cast<std::size_t>(width) * 4;
+
+  // letterbox
+  const auto topColor = GetPixel(image, width, 0, 0);
+  std::uint_fast32_t top = 0;
+  while (top < height && Kernel::CountUniformPixelsFromStart(image + top * stride, width, topColor, tolerance) == width) {
+    top++;
+  }
+  if (top == height) {
+    return std::nullopt;
+  }
+
+  const auto bottomColor = GetPixel(image, width, 0, height - 1);
+  std::uint_fast32_t bottom = 0;
+  while (bottom < height - top && Kernel::CountUniformPixelsFromStart(image + (height - 1 - bottom) * stride, width, bottomColor, tolerance) == width) {
+    bottom++;
+  }
+
+  // pillarbox
+  // a column is a border only if every remaining line starts (or ends) with it
+  const auto leftColor = GetPixel(image, width, 0, top);
+  const auto rightColor = GetPixel(image, width, width - 1, top);
+  std::uint_fast32_t left = width;
+  std::uint_fast32_t right = width;
+  for (std::uint_fast32_t y = top; y < height - bottom && (left || right); y++) {
+    const auto line = image + y * stride;
+    if (left) {
+      left = std::min<std::uint_fast32_t>(left, static_cast<std::uint_fast32_t>(Kernel::CountUniformPixelsFromStart(line, left, leftColor, tolerance)));
+    }
+    if (right) {
+      right = std::min<std::uint_fast32_t>(right, static_cast<std::uint_fast32_t>(Kernel::CountUniformPixelsFromEnd(line + (width - right) * 4, right, rightColor, tolerance)));
+    }
+  }
+  if (left + right >= width) {
+    // each line is uniform but the lines differ (e.g. a vertical gradient)
+    left = 0;
+    right = 0;
+  }
+
+  return Margins{
+    left,
+    top,
+    right,
+    bottom,
+  };
+}
+
+
+FrameTransform::FrameTransform(std::uint_fast32_t sourceWidth, std::uint_fast32_t sourceHeight, const Parameters& parameters) :
+  mSourceWidth(sourceWidth),
+  mSourceHeight(sourceHeight),
+  mCrop(parameters.crop),
+  mCropWidth(0),
+  mCropHeight(0),
+  mWidth(parameters.width),
+  mHeight(parameters.height),
+  mFilter(parameters.filter),
+  mFormat(parameters.format),
+  mScaled(false),
+  mColumnTaps(),
+  mRowTaps(),
+  mWeights(),
+  mRingSize(0),
+  mRing(),
+  mRingTags(),
+  mAccumulator(),
+  mLineBuffers()
+{
+  if (static_cast<std::uint_fast64_t>(mCrop.left) + mCrop.right >= mSourceWidth || static_cast<std::uint_fast64_t>(mCrop.top) + mCrop.bottom >= mSourceHeight) {
+    throw std::runtime_error("FrameTransform: crop margins are larger than the frame");
+  }
+
+  mCropWidth = mSourceWidth - mCrop.left - mCrop.right;
+  mCropHeight = mSourceHeight - mCrop.top - mCrop.bottom;
+
+  if (!mWidth && !mHeight) {
+    mWidth = mCropWidth;
+    mHeight = mCropHeight;
+  } else if (!mWidth) {
+    mWidth = std::max<std::uint_fast32_t>(static_cast<std::uint_fast32_t>((static_cast<std::uint_fast64_t>(mCropWidth) * mHeight + mCropHeight / 2) / mCropHeight), 1);
+  } else if (!mHeight) {
+    mHeight = std::max<std::uint_fast32_t>(static_cast<std::uint_fast32_t>((static_cast<std::uint_fast64_t>(mCropHeight) * mWidth + mCropWidth / 2) / mCropWidth), 1);
+  }
+
+  // I420 requires even dimensions
+  // cut one more column / line rather than resampling the whole frame by a pixel
+  if (mFormat == PixelFormat::I420) {
+    if (mWidth % 2) {
+      if (mWidth == mCropWidth && mCropWidth > 1) {
+        mCrop.right++;
+        mCropWidth--;
+      }
+      mWidth = mWidth > 1 ? mWidth - 1 : 2;
+    }
+    if (mHeight % 2) {
+      if (mHeight == mCropHeight && mCropHeight > 1) {
+        mCrop.bottom++;
+        mCropHeight--;
+      }
+      mHeight = mHeight > 1 ? mHeight - 1 : 2;
+    }
+  }
+
+  mScaled = mWidth != mCropWidth || mHeight != mCropHeight;
+
+  mLineBuffers.resize(static_cast<std::size_t>(mWidth) * 4 * 2);
+
+  if (mScaled) {
+    BuildTaps(mCropWidth, mWidth, mColumnTaps);
+    BuildTaps(mCropHeight, mHeight, mRowTaps);
+
+    for (const auto& tapRange : mRowTaps) {
+      mRingSize = std::max(mRingSize, tapRange.count);
+    }
+
+    mRing.resize(static_cast<std::size_t>(mRingSize) * mWidth * 4);
+    mRingTags.assign(mRingSize, -1);
+    mAccumulator.resize(static_cast<std::size_t>(mWidth) * 4);
+  }
+}
+
+
+void FrameTransform::BuildTaps(std::uint_fast32_t sourceCount, std::uint_fast32_t outputCount, std::vector<TapRange>& taps) {
+  const double scale = static_cast<double>(sourceCount) / outputCount;
+
+  std::vector<double> realWeights;
+
+  taps.clear();
+  taps.reserve(outputCount);
+
+  for (std::uint_fast32_t i = 0; i < outputCount; i++) {
+    std::uint_fast32_t first = 0;
+    realWeights.clear();
+
+    if (mFilter == Filter::Box && scale > 1.) {
+      // weight each source pixel by the area it covers
+      const double begin = i * scale;
+      const double end = std::min((i + 1) * scale, static_cast<double>(sourceCount));
+      first = static_cast<std::uint_fast32_t>(begin);
+      const auto last = std::min(static_cast<std::uint_fast32_t>(std::ceil(end)), sourceCount);
+      for (auto j = first; j < last; j++) {
+        realWeights.push_back(std::min(end, j + 1.) - std::max(begin, static_cast<double>(j)));
+      }
+    } else if (mFilter == Filter::Box) {
+      first = std::min(static_cast<std::uint_fast32_t>((i + .5) * scale), sourceCount - 1);
+      realWeights.push_back(1.);
+    } else {
+      const double center = std::clamp((i + .5) * scale - .5, 0., static_cast<double>(sourceCount - 1));
+      first = static_cast<std::uint_fast32_t>(center);
+      const double fraction = center - first;
+      realWeights.push_back(1. - fraction);
+      if (first + 1 < sourceCount) {
+        realWeights.push_back(fraction);
+      }
+    }
+
+    // quantize so that the weights sum up to exactly WeightOne
+    double totalWeight = 0.;
+    for (const auto weight : realWeights) {
+      totalWeight += weight;
+    }
+
+    const auto weightIndex = mWeights.size();
+    std::uint_fast32_t quantizedTotal = 0;
+    std::size_t maxIndex = weightIndex;
+    for (const auto weight : realWeights) {
+      const auto quantized = static_cast<std::uint_fast32_t>(weight / totalWeight * WeightOne + .5);
+      if (mWeights.size() == weightIndex || quantized > mWeights[maxIndex]) {
+        maxIndex = mWeights.size();
+      }
+      mWeights.push_back(quantized);
+      quantizedTotal += quantized;
+    }
+    mWeights[maxIndex] += WeightOne - quantizedTotal;
+
+    taps.push_back(TapRange{
+      first,
+      static_cast<std::uint_fast32_t>(realWeights.size()),
+      weightIndex,
+    });
+  }
+}
+
+
+const std::uint16_t* FrameTransform::GetFilteredLine(const std::uint8_t* image, std::uint_fast32_t sourceLine) {
+  const auto slot = sourceLine % mRingSize;
+  const auto filteredLine = mRing.data() + static_cast<std::size_t>(slot) * mWidth * 4;
+  if (mRingTags[slot] == static_cast<std::int_fast64_t>(sourceLine)) {
+    return filteredLine;
+  }
+
+  const auto line = image + (static_cast<std::size_t>(mCrop.top + sourceLine) * mSourceWidth + mCrop.left) * 4;
+  for (std::uint_fast32_t x = 0; x < mWidth; x++) {
+    const auto& tapRange = mColumnTaps[x];
+    const auto pixels = line + static_cast<std::size_t>(tapRange.first) * 4;
+    const auto weights = mWeights.data() + tapRange.weightIndex;
+
+    std::uint_fast32_t sums[4]{};
+    for (std::uint_fast32_t i = 0; i < tapRange.count; i++) {
+      for (std::size_t c = 0; c < 4; c++) {
+        sums[c] += pixels[i * 4 + c] * weights[i];
+      }
+    }
+    for (std::size_t c = 0; c < 4; c++) {
+      filteredLine[x * 4 + c] = static_cast<std::uint16_t>((sums[c] + (1u << (WeightBits - FilteredBits - 1))) >> (WeightBits - FilteredBits));
+    }
+  }
+
+  mRingTags[slot] = sourceLine;
+
+  return filteredLine;
+}
+
+
+const std::uint8_t* FrameTransform::GetLine(const std::uint8_t* image, std::uint_fast32_t line, std::uint8_t* buffer) {
+  if (!mScaled) {
+    return image + (static_cast<std::size_t>(mCrop.top + line) * mSourceWidth + mCrop.left) * 4;
+  }
+
+  const auto& tapRange = mRowTaps[line];
+  const auto weights = mWeights.data() + tapRange.weightIndex;
+  const std::size_t count = static_cast<std::size_t>(mWidth) * 4;
+
+  std::fill(mAccumulator.begin(), mAccumulator.end(), 0);
+  for (std::uint_fast32_t i = 0; i < tapRange.count; i++) {
+    const auto filteredLine = GetFilteredLine(image, tapRange.first + i);
+    const auto weight = weights[i];
+    for (std::size_t j = 0; j < count; j++) {
+      mAccumulator[j] += filteredLine[j] * weight;
+    }
+  }
+
+  constexpr unsigned int Shift = WeightBits + FilteredBits;
+  for (std::size_t j = 0; j < count; j++) {
+    buffer[j] = static_cast<std::uint8_t>(std::min<std::uint_fast32_t>((mAccumulator[j] + (1u << (Shift - 1))) >> Shift, 255));
+  }
+
+  return buffer;
+}
+
+
+bool FrameTransform::IsIdentity() const {
+  return !mScaled && mFormat == PixelFormat::BGRA && mCropWidth == mSourceWidth && mCropHeight == mSourceHeight;
+}
+
+
+std::uint_fast32_t FrameTransform::GetWidth() const {
+  return mWidth;
+}
+
+
+std::uint_fast32_t FrameTransform::GetHeight() const {
+  return mHeight;
+}
+
+
+FrameTransform::PixelFormat FrameTransform::GetFormat() const {
+  return mFormat;
+}
+
+
+const FrameTransform::Margins& FrameTransform::GetCrop() const {
+  return mCrop;
+}
+
+
+std::size_t FrameTransform::GetOutputSize() const {
+  switch (mFormat) {
+    case PixelFormat::BGRA:
+      return static_cast<std::size_t>(mWidth) * mHeight * 4;
+
+    case PixelFormat::BGR24:
+      return GetBGR24Stride(mWidth) * mHeight;
+
+    case PixelFormat::I420:
+      return static_cast<std::size_t>(mWidth) * mHeight + static_cast<std::size_t>(mWidth / 2) * (mHeight / 2) * 2;
+  }
+  throw std::runtime_error("FrameTransform: unknown pixel format");
+}
+
+
+void FrameTransform::Apply(const std::uint8_t* image, std::uint8_t* output) {
+  const auto lineBuffer0 = mLineBuffers.data();
+  const auto lineBuffer1 = mLineBuffers.data() + static_cast<std::size_t>(mWidth) * 4;
+
+  // filtered lines of the previous frame are stale
+  std::fill(mRingTags.begin(), mRingTags.end(), -1);
+
+  switch (mFormat) {
+    case PixelFormat::BGRA: {
+      const std::size_t stride = static_cast<std::size_t>(mWidth) * 4;
+      for (std::uint_fast32_t y = 0; y < mHeight; y++) {
+        // scaled lines are rendered directly into the output
+        const auto dest = output + y * stride;
+        const auto line = GetLine(image, y, dest);
+        if (line != dest) {
+          std::memcpy(dest, line, stride);
+        }
+      }
+      break;
+    }
+
+    case PixelFormat::BGR24: {
+      const std::size_t stride = GetBGR24Stride(mWidth);
+      const std::size_t padding = stride - static_cast<std::size_t>(mWidth) * 3;
+      for (std::uint_fast32_t y = 0; y < mHeight; y++) {
+        const auto dest = output + y * stride;
+        Kernel::ConvertBGRAToBGR(GetLine(image, y, lineBuffer0), dest, mWidth);
+        std::memset(dest + stride - padding, 0, padding);
+      }
+      break;
+    }
+
+    case PixelFormat::I420: {
+      const std::size_t chromaWidth = mWidth / 2;
+      const auto planeY = output;
+      const auto planeU = planeY + static_cast<std::size_t>(mWidth) * mHeight;
+      const auto planeV = planeU + chromaWidth * (mHeight / 2);
+      for (std::uint_fast32_t y = 0; y < mHeight; y += 2) {
+        const auto line0 = GetLine(image, y, lineBuffer0);
+        const auto line1 = GetLine(image, y + 1, lineBuffer1);
+        Kernel::ConvertBGRAToI420(line0, line1, planeY + static_cast<std::size_t>(y) * mWidth, planeY + static_cast<std::size_t>(y + 1) * mWidth, planeU + y / 2 * chromaWidth, planeV + y / 2 * chromaWidth, mWidth);
+      }
+      break;
+    }
+  }
+}
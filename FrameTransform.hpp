@@ -0,0 +1,96 @@
+#ifndef ML_FRAMETRANSFORM_HPP
+#define ML_FRAMETRANSFORM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+
+// crops, scales and converts a decoded frame (top-down 32bpp BGRA) in a single pass
+// the output is produced line by line; each source line is read at most once and
+// horizontally filtered lines are kept in a small ring so that the working set stays in cache
+class FrameTransform {
+public:
+  enum class PixelFormat {
+    BGRA,     // 32bpp, top-down
+    BGR24,    // 24bpp, top-down, each line is padded to 4 bytes
+    I420,     // planar Y, U, V with 2x2 subsampled chroma, BT.601 limited range
+  };
+
+  enum class Filter {
+    Box,        // area average (nearest neighbor when enlarging)
+    Bilinear,
+  };
+
+  struct Margins {
+    std::uint_fast32_t left;
+    std::uint_fast32_t top;
+    std::uint_fast32_t right;
+    std::uint_fast32_t bottom;
+  };
+
+  struct Parameters {
+    Margins crop;
+    std::uint_fast32_t width;     // 0 to keep the cropped width (or the aspect ratio if height is given)
+    std::uint_fast32_t height;    // 0 to keep the cropped height (or the aspect ratio if width is given)
+    Filter filter;
+    PixelFormat format;
+  };
+
+  static constexpr std::uint8_t DefaultBorderTolerance = 16;
+
+  // detects constant-colored letterbox / pillarbox borders
+  // returns std::nullopt if the whole image is a single color
+  static std::optional<Margins> DetectBorders(const std::uint8_t* image, std::uint_fast32_t width, std::uint_fast32_t height, std::uint8_t tolerance = DefaultBorderTolerance);
+
+private:
+  // source pixels [first, first + count) are weighted with mWeights[weightIndex..]
+  struct TapRange {
+    std::uint_fast32_t first;
+    std::uint_fast32_t count;
+    std::size_t weightIndex;
+  };
+
+  std::uint_fast32_t mSourceWidth;
+  std::uint_fast32_t mSourceHeight;
+  Margins mCrop;
+  std::uint_fast32_t mCropWidth;
+  std::uint_fast32_t mCropHeight;
+  std::uint_fast32_t mWidth;
+  std::uint_fast32_t mHeight;
+  Filter mFilter;
+  PixelFormat mFormat;
+  bool mScaled;
+  std::vector<TapRange> mColumnTaps;
+  std::vector<TapRange> mRowTaps;
+  std::vector<std::uint_fast32_t> mWeights;
+  std::uint_fast32_t mRingSize;
+  std::vector<std::uint16_t> mRing;               // horizontally filtered lines
+  std::vector<std::int_fast64_t> mRingTags;       // source line stored in each slot, -1 if empty
+  std::vector<std::uint_fast32_t> mAccumulator;
+  std::vector<std::uint8_t> mLineBuffers;         // two output lines in BGRA
+
+  void BuildTaps(std::uint_fast32_t sourceCount, std::uint_fast32_t outputCount, std::vector<TapRange>& taps);
+  const std::uint16_t* GetFilteredLine(const std::uint8_t* image, std::uint_fast32_t sourceLine);
+  const std::uint8_t* GetLine(const std::uint8_t* image, std::uint_fast32_t line, std::uint8_t* buffer);
+
+public:
+  FrameTransform(std::uint_fast32_t sourceWidth, std::uint_fast32_t sourceHeight, const Parameters& parameters);
+
+  // true if Apply is just a copy
+  bool IsIdentity() const;
+
+  std::uint_fast32_t GetWidth() const;
+  std::uint_fast32_t GetHeight() const;
+  PixelFormat GetFormat() const;
+  const Margins& GetCrop() const;
+  std::size_t GetOutputSize() const;
+
+  // image: sourceWidth x sourceHeight top-down BGRA
+  // output: GetOutputSize() bytes
+  // not thread-safe since the work buffers are shared
+  void Apply(const std::uint8_t* image, std::uint8_t* output);
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HashTree.hpp"
+#include "ThreadPool.hpp"
+#include "Kernel/Hash.hpp"
+
+
+namespace {
+  std::uint64_t HashNode(std::uint64_t left, std::uint64_t right) {
+    std::uint8_t data[16];
+    for (std::size_t i = 0; i < 8; i++) {
+      data[i] = static_cast<std::uint8_t>(left >> (i * 8));
+      data[8 + i] = static_cast<std::uint8_t>(right >> (i * 8));
+    }
+    return Kernel::Hash(data, sizeof(data));
+  }
+
+
+  HashTree::Digest HashNode(const HashTree::Digest& left, const HashTree::Digest& right) {
+    // the prefix keeps a node from being taken for a leaf of the same content
+    constexpr std::uint8_t NodePrefix = 0x01;
+
+    Kernel::SHA256 sha256;
+    sha256.Update(&NodePrefix, 1);
+    sha256.Update(left.data(), left.size());
+    sha256.Update(right.data(), right.size());
+    return sha256.Finish();
+  }
+
+
+  std::size_t CountNodes(std::size_t numLeaves) {
+    std::size_t numNodes = numLeaves;
+    for (auto levelSize = numLeaves; levelSize > 1; levelSize = (levelSize + 1) / 2) {
+      numNodes += (levelSize + 1) / 2;
+    }
+    return numNodes;
+  }
+
+
+  // every level from the leaves up to the root, concatenated
+  template<typename T>
+  std::vector<T> BuildNodes(const std::vector<T>& leaves) {
+    std::vector<T> nodes;
+    nodes.reserve(CountNodes(leaves.size()));
+    nodes.insert(nodes.end(), leaves.cbegin(), leaves.cend());
+
+    std::size_t levelBegin = 0;
+    for (auto levelSize = leaves.size(); levelSize > 1; levelSize = (levelSize + 1) / 2) {
+      for (std::size_t i = 0; i + 1 < levelSize; i += 2) {
+        const auto node = HashNode(nodes[levelBegin + i], nodes[levelBegin + i + 1]);
+        nodes.push_back(node);
+      }
+      if (levelSize & 1) {
+        const auto node = nodes[levelBegin + levelSize - 1];
+        nodes.push_back(node);
+      }
+      levelBegin += levelSize;
+    }
+
+    return nodes;
+  }
+}
+
+
+std::uint64_t HashTree::CountLeaves(std::uint64_t fileSize, std::uint32_t leafSize) {
+  return (fileSize + leafSize - 1) / leafSize;
+}
+
+
+std::uint64_t HashTree::GetRootHash(const Leaves& leaves) {
+  if (leaves.hashes.empty()) {
+    return 0;
+  }
+  return BuildNodes(leaves.hashes).back();
+}
+
+
+void HashTree::Write(const std::wstring& filePath, const Leaves& leaves) {
+  const auto hashes = BuildNodes(leaves.hashes);
+
+  std::ofstream ofs;
+  ofs.exceptions(std::ios::failbit | std::ios::badbit);
+  ofs.open(filePath, std::ios::binary);
+
+  const FileHeader fileHeader{
+    Magic,
+    Version,
+    leaves.fileSize,
+    leaves.leafSize,
+    leaves.sha256 ? FlagSHA256 : 0u,
+    static_cast<std::uint64_t>(leaves.hashes.size()),
+  };
+  ofs.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+  ofs.write(reinterpret_cast<const char*>(hashes.data()), sizeof(std::uint64_t) * hashes.size());
+
+  if (leaves.sha256) {
+    const auto digests = BuildNodes(leaves.digests);
+    ofs.write(reinterpret_cast<const char*>(digests.data()), sizeof(Digest) * digests.size());
+  }
+
+  ofs.close();
+}
+
+
+HashTree::Leaves HashTree::Read(const std::wstring& filePath) {
+  std::ifstream ifs;
+  ifs.exceptions(std::ios::failbit | std::ios::badbit);
+  ifs.open(filePath, std::ios::binary);
+
+  FileHeader fileHeader;
+  ifs.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
+  if (fileHeader.magic != Magic || fileHeader.version != Version) {
+    throw std::runtime_error("HashTree: not a hash tree");
+  }
+  if (fileHeader.leafSize == 0 || fileHeader.numLeaves != CountLeaves(fileHeader.fileSize, fileHeader.leafSize)) {
+    throw std::runtime_error("HashTree: invalid header");
+  }
+
+  const auto numLeaves = static_cast<std::size_t>(fileHeader.numLeaves);
+  const auto numNodes = CountNodes(numLeaves);
+
+  Leaves leaves{
+    fileHeader.fileSize,
+    fileHeader.leafSize,
+    (fileHeader.flags & FlagSHA256) != 0,
+    {},
+    {},
+  };
+
+  std::vector<std::uint64_t> hashes(numNodes);
+  ifs.read(reinterpret_cast<char*>(hashes.data()), sizeof(std::uint64_t) * hashes.size());
+  leaves.hashes.assign(hashes.cbegin(), hashes.cbegin() + numLeaves);
+  if (BuildNodes(leaves.hashes) != hashes) {
+    throw std::runtime_error("HashTree: the tree is corrupted");
+  }
+
+  if (leaves.sha256) {
+    std::vector<Digest> digests(numNodes);
+    ifs.read(reinterpret_cast<char*>(digests.data()), sizeof(Digest) * digests.size());
+    leaves.digests.assign(digests.cbegin(), digests.cbegin() + numLeaves);
+    if (BuildNodes(leaves.digests) != digests) {
+      throw std::runtime_error("HashTree: the tree is corrupted");
+    }
+  }
+
+  return leaves;
+}
+
+
+std::vector<HashTree::Range> HashTree::Compare(const Leaves& expected, const Leaves& actual) {
+  if (expected.leafSize != actual.leafSize) {
+    throw std::runtime_error("HashTree: leaf sizes differ");
+  }
+
+  const std::uint64_t leafSize = expected.leafSize;
+  const auto fileSize = std::max(expected.fileSize, actual.fileSize);
+  const auto numLeaves = std::max(expected.hashes.size(), actual.hashes.size());
+  const bool compareDigests = expected.sha256 && actual.sha256;
+
+  std::vector<Range> ranges;
+  for (std::size_t i = 0; i < numLeaves; i++) {
+    const bool differs = i >= expected.hashes.size() || i >= actual.hashes.size()
+                      || expected.hashes[i] != actual.hashes[i]
+                      || (compareDigests && expected.digests[i] != actual.digests[i]);
+    if (!differs) {
+      continue;
+    }
+
+    const std::uint64_t begin = i * leafSize;
+    const std::uint64_t end = std::min(begin + leafSize, fileSize);
+    if (!ranges.empty() && ranges.back().end == begin) {
+      ranges.back().end = end;
+    } else {
+      ranges.push_back(Range{begin, end});
+    }
+  }
+
+  return ranges;
+}
+
+
+HashTree::Builder::Builder(std::uint64_t fileSize, std::uint32_t leafSize, bool sha256) :
+  mLeaves{
+    fileSize,
+    leafSize,
+    sha256,
+    {},
+    {},
+  },
+  mHashed(),
+  mMutex(),
+  mPendingLeaves()
+{
+  if (leafSize == 0) {
+    throw std::runtime_error("HashTree: invalid leaf size");
+  }
+
+  const auto numLeaves = static_cast<std::size_t>(CountLeaves(fileSize, leafSize));
+  mLeaves.hashes.resize(numLeaves);
+  if (sha256) {
+    mLeaves.digests.resize(numLeaves);
+  }
+  mHashed.resize(numLeaves);
+}
+
+
+std::uint64_t HashTree::Builder::GetLeafSize(std::uint64_t leafIndex) const {
+  return std::min<std::uint64_t>(mLeaves.leafSize, mLeaves.fileSize - leafIndex * mLeaves.leafSize);
+}
+
+
+void HashTree::Builder::HashLeaf(std::uint64_t leafIndex, const std::uint8_t* data) {
+  const auto size = static_cast<std::size_t>(GetLeafSize(leafIndex));
+  const auto index = static_cast<std::size_t>(leafIndex);
+
+  mLeaves.hashes[index] = Kernel::Hash(data, size);
+  if (mLeaves.sha256) {
+    mLeaves.digests[index] = Kernel::SHA256::Compute(data, size);
+  }
+  mHashed[index] = 1;
+}
+
+
+std::uint64_t HashTree::Builder::GetLeafEnd(std::uint64_t offset) const {
+  return std::min<std::uint64_t>((offset / mLeaves.leafSize + 1) * mLeaves.leafSize, mLeaves.fileSize);
+}
+
+
+void HashTree::Builder::Update(std::uint64_t offset, const std::uint8_t* data, std::size_t size) {
+  if (!size) {
+    return;
+  }
+
+  const std::uint64_t leafIndex = offset / mLeaves.leafSize;
+  const std::uint64_t leafBegin = leafIndex * mLeaves.leafSize;
+  const auto leafSize = GetLeafSize(leafIndex);
+  if (offset + size > leafBegin + leafSize) {
+    throw std::runtime_error("HashTree: update crosses a leaf boundary");
+  }
+
+  if (size == leafSize) {
+    HashLeaf(leafIndex, data);
+    return;
+  }
+
+  std::unique_ptr<std::uint8_t[]> completedData;
+  {
+    std::lock_guard lock(mMutex);
+
+    auto& pendingLeaf = mPendingLeaves[leafIndex];
+    if (!pendingLeaf.data) {
+      pendingLeaf.data = std::make_unique<std::uint8_t[]>(static_cast<std::size_t>(leafSize));
+    }
+    std::memcpy(pendingLeaf.data.get() + (offset - leafBegin), data, size);
+    pendingLeaf.filledSize += size;
+
+    if (pendingLeaf.filledSize == leafSize) {
+      completedData = std::move(pendingLeaf.data);
+      mPendingLeaves.erase(leafIndex);
+    }
+  }
+
+  // hashed outside the lock
+  if (completedData) {
+    HashLeaf(leafIndex, completedData.get());
+  }
+}
+
+
+std::uint64_t HashTree::Builder::Complete(OutputFile& file, std::uint_fast32_t numThreads) {
+  // parts of leaves are read again along with the rest
+  mPendingLeaves.clear();
+
+  std::vector<std::uint64_t> missingLeaves;
+  std::uint64_t readSize = 0;
+  for (std::size_t i = 0; i < mHashed.size(); i++) {
+    if (!mHashed[i]) {
+      missingLeaves.push_back(i);
+      readSize += GetLeafSize(i);
+    }
+  }
+
+  if (missingLeaves.empty()) {
+    return 0;
+  }
+
+  numThreads = static_cast<std::uint_fast32_t>(std::clamp<std::size_t>(numThreads, 1, missingLeaves.size()));
+
+  std::atomic<std::size_t> nextLeaf(0);
+
+  auto worker = [&] (std::size_t) {
+    try {
+      auto buffer = std::make_unique<std::uint8_t[]>(mLeaves.leafSize);
+
+      std::size_t index;
+      while ((index = nextLeaf++) < missingLeaves.size()) {
+        const auto leafIndex = missingLeaves[index];
+        file.Read(buffer.get(), static_cast<std::size_t>(GetLeafSize(leafIndex)), leafIndex * mLeaves.leafSize);
+        HashLeaf(leafIndex, buffer.get());
+      }
+    } catch (...) {
+      // let the other workers stop early
+      nextLeaf = missingLeaves.size();
+      throw;
+    }
+  };
+
+  ThreadPool::GetShared().ParallelFor(numThreads, numThreads, ThreadPool::Priority::Normal, worker);
+
+  return readSize;
+}
+
+
+const HashTree::Leaves& HashTree::Builder::GetLeaves() const {
+  return mLeaves;
+}
+
+
+HashTree::Leaves HashTree::HashFile(OutputFile& file, std::uint32_t leafSize, bool sha256, std::uint_fast32_t numThreads) {
+  Builder builder(file.GetSize(), leafSize, sha256);
+  builder.Complete(file, numThreads);
+  return builder.GetLeaves();
+}
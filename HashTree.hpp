@@ -0,0 +1,125 @@
+#ifndef ML_HASHTREE_HPP
+#define ML_HASHTREE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "AVI.hpp"
+#include "OutputFile.hpp"
+#include "Kernel/SHA256.hpp"
+
+
+// sidecar holding a Merkle tree over the bytes of the output, so that the output can be verified later and only the
+// leaves that differ have to be converted again
+// the output is cut into leaves of leafSize bytes (the last one may be shorter); a leaf is hashed with Kernel::Hash,
+// and optionally with SHA-256 so that a leaf can also be checked with other tools (e.g. dd | sha256sum)
+// a node is Kernel::Hash of the little endian hashes of its two children, or SHA-256 of 0x01 and the digests of its
+// two children; the last node of an odd level is carried up unchanged
+//
+// binary layout (little endian):
+//   FileHeader
+//   uint64 * numNodes          Kernel::Hash of every level, from the leaves up to the root
+//   uint8[32] * numNodes       SHA-256 in the same order, only with FlagSHA256
+namespace HashTree {
+  constexpr std::uint32_t Magic = AVI::GetFourCC("M2AH");
+  constexpr std::uint32_t Version = 1;
+
+  constexpr std::uint32_t DefaultLeafSize = 4 * 1024 * 1024;
+
+  constexpr std::uint32_t FlagSHA256 = 0x0001;
+
+
+#pragma pack(push, 1)
+
+  struct FileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t fileSize;       // of the output
+    std::uint32_t leafSize;
+    std::uint32_t flags;
+    std::uint64_t numLeaves;
+  };
+
+  static_assert(sizeof(FileHeader) == 4 * 8);
+
+#pragma pack(pop)
+
+
+  using Digest = Kernel::SHA256::Digest;
+
+  struct Leaves {
+    std::uint64_t fileSize;
+    std::uint32_t leafSize;
+    bool sha256;
+    std::vector<std::uint64_t> hashes;
+    std::vector<Digest> digests;  // empty unless sha256
+  };
+
+  struct Range {
+    std::uint64_t begin;
+    std::uint64_t end;
+  };
+
+
+  std::uint64_t CountLeaves(std::uint64_t fileSize, std::uint32_t leafSize);
+  // Kernel::Hash of the root node, or 0 for an empty output
+  std::uint64_t GetRootHash(const Leaves& leaves);
+
+  void Write(const std::wstring& filePath, const Leaves& leaves);
+  // throws if the file is not a hash tree or its upper levels do not agree with its leaves
+  Leaves Read(const std::wstring& filePath);
+
+  // byte ranges of the leaves of actual which differ from expected, adjacent ones merged
+  // the hashes are compared, and the digests too if both have them; leafSize must be the same
+  // if the sizes differ, the leaves beyond the shorter one are included
+  std::vector<Range> Compare(const Leaves& expected, const Leaves& actual);
+
+
+  // hashes the leaves as the output is written
+  class Builder {
+    struct PendingLeaf {
+      std::unique_ptr<std::uint8_t[]> data;
+      std::uint64_t filledSize;
+    };
+
+    Leaves mLeaves;
+    std::vector<std::uint8_t> mHashed;    // per leaf; only the thread which completes a leaf writes its entries
+    std::mutex mMutex;
+    std::unordered_map<std::uint64_t, PendingLeaf> mPendingLeaves;
+
+    std::uint64_t GetLeafSize(std::uint64_t leafIndex) const;
+    void HashLeaf(std::uint64_t leafIndex, const std::uint8_t* data);
+
+  public:
+    Builder(std::uint64_t fileSize, std::uint32_t leafSize, bool sha256);
+
+    Builder(const Builder&) = delete;
+    Builder& operator=(const Builder&) = delete;
+
+    // end of the leaf which contains offset
+    std::uint64_t GetLeafEnd(std::uint64_t offset) const;
+
+    // thread-safe; [offset, offset + size) must not cross a leaf boundary, and no byte may be given twice
+    // a whole leaf is hashed on the calling thread, and a part of a leaf is kept until the rest of it is given
+    void Update(std::uint64_t offset, const std::uint8_t* data, std::size_t size);
+
+    // hashes the leaves which have not been given completely by reading them from file, on numThreads threads of
+    // the shared pool
+    // returns the number of bytes read
+    std::uint64_t Complete(OutputFile& file, std::uint_fast32_t numThreads);
+
+    // valid after Complete
+    const Leaves& GetLeaves() const;
+  };
+
+
+  // hashes the whole file on numThreads threads
+  Leaves HashFile(OutputFile& file, std::uint32_t leafSize, bool sha256, std::uint_fast32_t numThreads);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "Interleave.hpp"
+
+
+namespace {
+  // rounded up
+  std::uint_fast64_t SamplesToMillis(std::uint_fast64_t numSamples, std::uint_fast64_t samplingRate) {
+    return (numSamples * 1000 + samplingRate - 1) / samplingRate;
+  }
+}
+
+
+Interleave::Plan Interleave::PlanAudio(const Parameters& parameters) {
+  const std::uint_fast64_t fpsNumerator = parameters.videoFPS.numerator;
+  const std::uint_fast64_t fpsDenominator = parameters.videoFPS.denominator;
+  const std::uint_fast64_t samplingRate = parameters.audioSamplingRate;
+  const std::uint_fast64_t maxBufferMillis = parameters.maxBufferMillis;
+
+  std::uint_fast64_t blockSamples = parameters.audioBlockSamples;
+  if (!blockSamples) {
+    // the most frames of which two blocks fit in the bound
+    const auto numFrames = std::max<std::uint_fast64_t>(maxBufferMillis * fpsNumerator / (2000 * fpsDenominator), 1);
+    blockSamples = std::max<std::uint_fast64_t>(numFrames * samplingRate * fpsDenominator / fpsNumerator, 1);
+  }
+  const auto blockMillis = SamplesToMillis(blockSamples, samplingRate);
+
+  // the preload is the frames covering one block, if it fits in the bound along with the block being played
+  std::uint_fast64_t initialFrames = (blockSamples * fpsNumerator + samplingRate * fpsDenominator - 1) / (samplingRate * fpsDenominator);
+  std::uint_fast64_t preloadMillis = (initialFrames * 1000 * fpsDenominator + fpsNumerator - 1) / fpsNumerator;
+  if (blockMillis + preloadMillis > maxBufferMillis) {
+    initialFrames = 0;
+    preloadMillis = 0;
+  }
+
+  const auto numAudioBlocks = std::max<std::uint_fast64_t>((parameters.numAudioSamples + blockSamples - 1) / blockSamples, 1);
+
+  return Plan{
+    static_cast<std::uint_fast32_t>(blockSamples),
+    static_cast<std::uint_fast32_t>(initialFrames),
+    static_cast<std::uint_fast32_t>(numAudioBlocks),
+    static_cast<std::uint_fast32_t>(blockMillis + preloadMillis),
+  };
+}
@@ -0,0 +1,34 @@
+#ifndef ML_INTERLEAVE_HPP
+#define ML_INTERLEAVE_HPP
+
+#include <cstdint>
+
+#include "Fraction.hpp"
+
+
+// plans how the audio is interleaved with the video
+// the reader is modelled as reading the file sequentially and double-buffering the audio: while an audio block is played
+// the next one has to be read already, so the audio is preloaded by one block and the reader holds up to two blocks of it
+// every chunk costs a chunk header and an entry in idx1 and ix##, so the blocks are made as long as the buffer bound allows
+namespace Interleave {
+  struct Parameters {
+    Fraction<std::uint_fast32_t> videoFPS;
+    std::uint_fast32_t audioSamplingRate;
+    std::uint_fast32_t numAudioSamples;
+    std::uint_fast32_t audioBlockSamples;   // 0 to choose
+    std::uint_fast32_t maxBufferMillis;     // 0 for blocks of one video frame without preload
+  };
+
+  struct Plan {
+    std::uint_fast32_t audioBlockSamples;
+    std::uint_fast32_t initialFrames;       // audio preload in video frames, for dwInitialFrames
+    std::uint_fast32_t numAudioBlocks;
+    std::uint_fast32_t bufferMillis;        // audio held by the reader at most
+  };
+
+  // audio blocks are whole video frames long unless audioBlockSamples is given
+  // a single video frame is the shortest block even if it exceeds the bound, which then leaves no room for the preload
+  Plan PlanAudio(const Parameters& parameters);
+}
+
+#endif
@@ -0,0 +1,297 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Audio.hpp"
+#include "Dispatch.hpp"
+#include "Intrinsics.hpp"
+
+
+// the conversions scale by powers of two, so they are exact in every variant
+// DotProduct keeps DotProductBlock partial sums in the scalar version too, so that the SIMD versions only add the same
+// products in the same order
+
+
+namespace {
+  constexpr float ScaleU8 = 1.f / 128.f;
+  constexpr float ScaleS16 = 1.f / 32768.f;
+  constexpr float ScaleS24 = 1.f / 8388608.f;
+
+
+  inline float SumLanes(const float* lanes) {
+    return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+  }
+
+
+  // same as maxps / minps: the bound is taken when value is NaN
+  inline float Saturate(float value, float low, float high) {
+    value = value > low ? value : low;
+    return value < high ? value : high;
+  }
+
+
+#ifdef ML_KERNEL_X86
+  // 8 floats -> 8 saturated 16-bit values
+  ML_KERNEL_TARGET("sse2")
+  inline __m128i ConvertToS16SSE2(__m128 low, __m128 high, __m128 scale, __m128 lowerBound, __m128 upperBound) {
+    low = _mm_min_ps(_mm_max_ps(_mm_mul_ps(low, scale), lowerBound), upperBound);
+    high = _mm_min_ps(_mm_max_ps(_mm_mul_ps(high, scale), lowerBound), upperBound);
+    return _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+  }
+#endif
+}
+
+
+void Kernel::ConvertU8ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count) {
+  for (std::size_t i = 0; i < count; i++) {
+    dst[i] = static_cast<float>(static_cast<int>(src[i]) - 128) * ScaleU8;
+  }
+}
+
+
+void Kernel::ConvertS16ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count) {
+  for (std::size_t i = 0; i < count; i++) {
+    std::int16_t value;
+    std::memcpy(&value, src + i * 2, 2);
+    dst[i] = static_cast<float>(value) * ScaleS16;
+  }
+}
+
+
+void Kernel::ConvertS24ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count) {
+  for (std::size_t i = 0; i < count; i++) {
+    const auto p = src + i * 3;
+    // shifted into the top of a 32-bit value and back for the sign
+    const auto value = static_cast<std::int32_t>(static_cast<std::uint32_t>(p[0]) << 8 | static_cast<std::uint32_t>(p[1]) << 16 | static_cast<std::uint32_t>(p[2]) << 24) >> 8;
+    dst[i] = static_cast<float>(value) * ScaleS24;
+  }
+}
+
+
+void Kernel::ConvertFloatToS16Scalar(const float* src, std::uint8_t* dst, std::size_t count) {
+  for (std::size_t i = 0; i < count; i++) {
+    // rounds to nearest even in the default rounding mode, as cvtps2dq does
+    const auto value = static_cast<std::int16_t>(std::lrint(Saturate(src[i] * 32768.f, -32768.f, 32767.f)));
+    std::memcpy(dst + i * 2, &value, 2);
+  }
+}
+
+
+float Kernel::DotProductScalar(const float* a, const float* b, std::size_t count) {
+  float lanes[DotProductBlock] = {};
+  for (std::size_t i = 0; i < count; i += DotProductBlock) {
+    for (std::size_t j = 0; j < DotProductBlock; j++) {
+      lanes[j] += a[i + j] * b[i + j];
+    }
+  }
+  return SumLanes(lanes);
+}
+
+
+#ifdef ML_KERNEL_X86
+
+ML_KERNEL_TARGET("sse2")
+void Kernel::ConvertU8ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count) {
+  const auto bias = _mm_set1_epi16(128);
+  const auto scale = _mm_set1_ps(ScaleU8);
+  const auto zero = _mm_setzero_si128();
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const auto low = _mm_sub_epi16(_mm_unpacklo_epi8(bytes, zero), bias);
+    const auto high = _mm_sub_epi16(_mm_unpackhi_epi8(bytes, zero), bias);
+    // sign extension to 32 bits
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(low, low), 16)), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(low, low), 16)), scale));
+    _mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(high, high), 16)), scale));
+    _mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(high, high), 16)), scale));
+  }
+
+  ConvertU8ToFloatScalar(src + i, dst + i, count - i);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+void Kernel::ConvertS16ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count) {
+  const auto scale = _mm_set1_ps(ScaleS16);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const auto values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(values, values), 16)), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(values, values), 16)), scale));
+  }
+
+  ConvertS16ToFloatScalar(src + i * 2, dst + i, count - i);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+void Kernel::ConvertS16ToFloatAVX2(const std::uint8_t* src, float* dst, std::size_t count) {
+  const auto scale = _mm256_set1_ps(ScaleS16);
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const auto low = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2)));
+    const auto high = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2 + 16)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(low), scale));
+    _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), scale));
+  }
+  _mm256_zeroupper();
+
+  ConvertS16ToFloatScalar(src + i * 2, dst + i, count - i);
+}
+
+
+ML_KERNEL_TARGET("ssse3")
+void Kernel::ConvertS24ToFloatSSSE3(const std::uint8_t* src, float* dst, std::size_t count) {
+  // 4 samples of 3 bytes into the top 3 bytes of each 32-bit lane
+  const auto shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  const auto scale = _mm_set1_ps(ScaleS24);
+
+  std::size_t i = 0;
+  // each load reads 16 bytes for 12, so the last samples are left to the scalar loop
+  for (; i + 6 <= count; i += 4) {
+    const auto values = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3)), shuffle);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(values, 8)), scale));
+  }
+
+  ConvertS24ToFloatScalar(src + i * 3, dst + i, count - i);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+void Kernel::ConvertFloatToS16SSE2(const float* src, std::uint8_t* dst, std::size_t count) {
+  const auto scale = _mm_set1_ps(32768.f);
+  const auto lowerBound = _mm_set1_ps(-32768.f);
+  const auto upperBound = _mm_set1_ps(32767.f);
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const auto values = ConvertToS16SSE2(_mm_loadu_ps(src + i), _mm_loadu_ps(src + i + 4), scale, lowerBound, upperBound);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2), values);
+  }
+
+  ConvertFloatToS16Scalar(src + i, dst + i * 2, count - i);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+void Kernel::ConvertFloatToS16AVX2(const float* src, std::uint8_t* dst, std::size_t count) {
+  const auto scale = _mm256_set1_ps(32768.f);
+  const auto lowerBound = _mm256_set1_ps(-32768.f);
+  const auto upperBound = _mm256_set1_ps(32767.f);
+
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const auto low = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i), scale), lowerBound), upperBound);
+    const auto high = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(src + i + 8), scale), lowerBound), upperBound);
+    // packs works within each 128-bit half, so the 64-bit quarters are put back in order
+    const auto values = _mm256_permute4x64_epi64(_mm256_packs_epi32(_mm256_cvtps_epi32(low), _mm256_cvtps_epi32(high)), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2), values);
+  }
+  _mm256_zeroupper();
+
+  ConvertFloatToS16Scalar(src + i, dst + i * 2, count - i);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+float Kernel::DotProductSSE2(const float* a, const float* b, std::size_t count) {
+  auto sum0 = _mm_setzero_ps();
+  auto sum1 = _mm_setzero_ps();
+  for (std::size_t i = 0; i < count; i += DotProductBlock) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+
+  alignas(16) float lanes[DotProductBlock];
+  _mm_store_ps(lanes, sum0);
+  _mm_store_ps(lanes + 4, sum1);
+  return SumLanes(lanes);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+float Kernel::DotProductAVX2(const float* a, const float* b, std::size_t count) {
+  // no FMA: a fused multiply-add rounds once, unlike the other variants
+  auto sum = _mm256_setzero_ps();
+  for (std::size_t i = 0; i < count; i += DotProductBlock) {
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+  }
+
+  alignas(32) float lanes[DotProductBlock];
+  _mm256_store_ps(lanes, sum);
+  _mm256_zeroupper();
+  return SumLanes(lanes);
+}
+
+#else
+
+void Kernel::ConvertU8ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count) {
+  ConvertU8ToFloatScalar(src, dst, count);
+}
+
+
+void Kernel::ConvertS16ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count) {
+  ConvertS16ToFloatScalar(src, dst, count);
+}
+
+
+void Kernel::ConvertS16ToFloatAVX2(const std::uint8_t* src, float* dst, std::size_t count) {
+  ConvertS16ToFloatScalar(src, dst, count);
+}
+
+
+void Kernel::ConvertS24ToFloatSSSE3(const std::uint8_t* src, float* dst, std::size_t count) {
+  ConvertS24ToFloatScalar(src, dst, count);
+}
+
+
+void Kernel::ConvertFloatToS16SSE2(const float* src, std::uint8_t* dst, std::size_t count) {
+  ConvertFloatToS16Scalar(src, dst, count);
+}
+
+
+void Kernel::ConvertFloatToS16AVX2(const float* src, std::uint8_t* dst, std::size_t count) {
+  ConvertFloatToS16Scalar(src, dst, count);
+}
+
+
+float Kernel::DotProductSSE2(const float* a, const float* b, std::size_t count) {
+  return DotProductScalar(a, b, count);
+}
+
+
+float Kernel::DotProductAVX2(const float* a, const float* b, std::size_t count) {
+  return DotProductScalar(a, b, count);
+}
+
+#endif
+
+
+void Kernel::ConvertU8ToFloat(const std::uint8_t* src, float* dst, std::size_t count) {
+  GetKernelSet().convertU8ToFloat(src, dst, count);
+}
+
+
+void Kernel::ConvertS16ToFloat(const std::uint8_t* src, float* dst, std::size_t count) {
+  GetKernelSet().convertS16ToFloat(src, dst, count);
+}
+
+
+void Kernel::ConvertS24ToFloat(const std::uint8_t* src, float* dst, std::size_t count) {
+  GetKernelSet().convertS24ToFloat(src, dst, count);
+}
+
+
+void Kernel::ConvertFloatToS16(const float* src, std::uint8_t* dst, std::size_t count) {
+  GetKernelSet().convertFloatToS16(src, dst, count);
+}
+
+
+float Kernel::DotProduct(const float* a, const float* b, std::size_t count) {
+  return GetKernelSet().dotProduct(a, b, count);
+}
@@ -0,0 +1,50 @@
+#ifndef ML_KERNEL_AUDIO_HPP
+#define ML_KERNEL_AUDIO_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Kernel {
+  // samples are little endian and may be unaligned; count is the number of samples (of all channels)
+  // every implementation must return exactly the same result as the scalar one
+
+  // DotProduct takes a multiple of this many elements
+  constexpr std::size_t DotProductBlock = 8;
+
+  // unsigned 8-bit -> float in [-1, 1)
+  void ConvertU8ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count);
+  void ConvertU8ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count);
+
+  void ConvertU8ToFloat(const std::uint8_t* src, float* dst, std::size_t count);
+
+  // signed 16-bit -> float in [-1, 1)
+  void ConvertS16ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count);
+  void ConvertS16ToFloatSSE2(const std::uint8_t* src, float* dst, std::size_t count);
+  void ConvertS16ToFloatAVX2(const std::uint8_t* src, float* dst, std::size_t count);
+
+  void ConvertS16ToFloat(const std::uint8_t* src, float* dst, std::size_t count);
+
+  // signed 24-bit (packed) -> float in [-1, 1)
+  void ConvertS24ToFloatScalar(const std::uint8_t* src, float* dst, std::size_t count);
+  void ConvertS24ToFloatSSSE3(const std::uint8_t* src, float* dst, std::size_t count);
+
+  void ConvertS24ToFloat(const std::uint8_t* src, float* dst, std::size_t count);
+
+  // float -> signed 16-bit, rounded to nearest even and saturated (NaN becomes -32768)
+  void ConvertFloatToS16Scalar(const float* src, std::uint8_t* dst, std::size_t count);
+  void ConvertFloatToS16SSE2(const float* src, std::uint8_t* dst, std::size_t count);
+  void ConvertFloatToS16AVX2(const float* src, std::uint8_t* dst, std::size_t count);
+
+  void ConvertFloatToS16(const float* src, std::uint8_t* dst, std::size_t count);
+
+  // sum of a[i] * b[i]; count must be a multiple of DotProductBlock
+  // the products are summed in DotProductBlock lanes which are added up at the end, in the same order in every variant
+  float DotProductScalar(const float* a, const float* b, std::size_t count);
+  float DotProductSSE2(const float* a, const float* b, std::size_t count);
+  float DotProductAVX2(const float* a, const float* b, std::size_t count);
+
+  float DotProduct(const float* a, const float* b, std::size_t count);
+}
+
+#endif
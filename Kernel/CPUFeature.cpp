@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+
+#include "CPUFeature.hpp"
+#include "Intrinsics.hpp"
+
+#if defined(ML_KERNEL_X86) && defined(_MSC_VER)
+# include <intrin.h>
+#elif defined(ML_KERNEL_X86)
+# include <cpuid.h>
+#endif
+
+using namespace std::literals;
+
+
+namespace {
+#ifdef ML_KERNEL_X86
+  struct CPUIDResult {
+    std::uint32_t eax;
+    std::uint32_t ebx;
+    std::uint32_t ecx;
+    std::uint32_t edx;
+  };
+
+
+  CPUIDResult CPUID(std::uint32_t leaf, std::uint32_t subleaf) {
+#ifdef _MSC_VER
+    int registers[4];
+    __cpuidex(registers, static_cast<int>(leaf), static_cast<int>(subleaf));
+    return CPUIDResult{
+      static_cast<std::uint32_t>(registers[0]),
+      static_cast<std::uint32_t>(registers[1]),
+      static_cast<std::uint32_t>(registers[2]),
+      static_cast<std::uint32_t>(registers[3]),
+    };
+#else
+    CPUIDResult result{};
+    __cpuid_count(leaf, subleaf, result.eax, result.ebx, result.ecx, result.edx);
+    return result;
+#endif
+  }
+
+
+  // XCR0: which register states the OS saves on context switches
+  ML_KERNEL_TARGET("xsave")
+  std::uint64_t GetXCR0() {
+    return _xgetbv(0);
+  }
+#endif
+
+
+  constexpr struct {
+    Kernel::ISA isa;
+    std::wstring_view name;
+  } ISANames[] = {
+    {Kernel::ISA::Scalar, L"scalar"sv},
+    {Kernel::ISA::SSE2,   L"sse2"sv},
+    {Kernel::ISA::SSSE3,  L"ssse3"sv},
+    {Kernel::ISA::AVX2,   L"avx2"sv},
+    {Kernel::ISA::AVX512, L"avx512"sv},
+  };
+}
+
+
+Kernel::ISA Kernel::DetectISA() {
+#ifdef ML_KERNEL_X86
+  const auto maxLeaf = CPUID(0, 0).eax;
+  const auto leaf1 = CPUID(1, 0);
+
+  if (!(leaf1.edx & (1u << 26))) {
+    return ISA::Scalar;
+  }
+  if (!(leaf1.ecx & (1u << 9))) {
+    return ISA::SSE2;
+  }
+
+  // AVX requires OSXSAVE and the OS saving XMM and YMM states
+  const bool hasAVX = (leaf1.ecx & (1u << 27)) && (leaf1.ecx & (1u << 28));
+  if (!hasAVX || maxLeaf < 7) {
+    return ISA::SSSE3;
+  }
+  const auto xcr0 = GetXCR0();
+  if ((xcr0 & 0x06) != 0x06) {
+    return ISA::SSSE3;
+  }
+
+  const auto leaf7 = CPUID(7, 0);
+  if (!(leaf7.ebx & (1u << 5))) {
+    return ISA::SSSE3;
+  }
+
+  // AVX-512 F and BW, and the OS saving opmask and ZMM states
+  if ((leaf7.ebx & (1u << 16)) && (leaf7.ebx & (1u << 30)) && (xcr0 & 0xE6) == 0xE6) {
+    return ISA::AVX512;
+  }
+  return ISA::AVX2;
+#else
+  return ISA::Scalar;
+#endif
+}
+
+
+std::size_t Kernel::DetectLastLevelCacheSize() {
+#ifdef ML_KERNEL_X86
+  // deterministic cache parameters: leaf 4 on Intel, leaf 0x8000001D on AMD (with TOPOEXT)
+  const auto leaf0 = CPUID(0, 0);
+  char vendor[12];
+  std::memcpy(vendor, &leaf0.ebx, 4);
+  std::memcpy(vendor + 4, &leaf0.edx, 4);
+  std::memcpy(vendor + 8, &leaf0.ecx, 4);
+
+  std::uint32_t leaf = 0;
+  if (std::memcmp(vendor, "GenuineIntel", 12) == 0 && leaf0.eax >= 4) {
+    leaf = 4;
+  } else if (CPUID(0x80000000u, 0).eax >= 0x8000001Du && (CPUID(0x80000001u, 0).ecx & (1u << 22))) {
+    leaf = 0x8000001Du;
+  }
+  if (!leaf) {
+    return 0;
+  }
+
+  std::size_t result = 0;
+  for (std::uint32_t subleaf = 0; subleaf < 16; subleaf++) {
+    const auto info = CPUID(leaf, subleaf);
+    const auto type = info.eax & 0x1F;
+    if (type == 0) {
+      break;
+    }
+    // data or unified caches
+    if (type != 1 && type != 3) {
+      continue;
+    }
+    const std::size_t ways = ((info.ebx >> 22) & 0x3FF) + 1;
+    const std::size_t partitions = ((info.ebx >> 12) & 0x3FF) + 1;
+    const std::size_t lineSize = (info.ebx & 0xFFF) + 1;
+    const std::size_t sets = static_cast<std::size_t>(info.ecx) + 1;
+    result = std::max(result, ways * partitions * lineSize * sets);
+  }
+  return result;
+#else
+  return 0;
+#endif
+}
+
+
+const wchar_t* Kernel::GetISAName(ISA isa) {
+  for (const auto& entry : ISANames) {
+    if (entry.isa == isa) {
+      return entry.name.data();
+    }
+  }
+  return L"unknown";
+}
+
+
+std::optional<Kernel::ISA> Kernel::ParseISAName(std::wstring_view name) {
+  for (const auto& entry : ISANames) {
+    if (entry.name == name) {
+      return entry.isa;
+    }
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,29 @@
+#ifndef ML_KERNEL_CPUFEATURE_HPP
+#define ML_KERNEL_CPUFEATURE_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+
+namespace Kernel {
+  // instruction set levels, each one implies all the previous ones
+  enum class ISA {
+    Scalar,
+    SSE2,
+    SSSE3,
+    AVX2,
+    AVX512,     // AVX-512 F + BW
+  };
+
+  // returns the best level supported by both the CPU and the OS
+  ISA DetectISA();
+
+  // returns the size of the largest cache in bytes, or 0 if unknown
+  std::size_t DetectLastLevelCacheSize();
+
+  const wchar_t* GetISAName(ISA isa);
+  std::optional<ISA> ParseISAName(std::wstring_view name);
+}
+
+#endif
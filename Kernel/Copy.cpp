@@ -0,0 +1,215 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Copy.hpp"
+#include "Dispatch.hpp"
+#include "Intrinsics.hpp"
+
+
+// the SIMD versions align the destination and copy several vectors per iteration
+// the unaligned head and the tail are left to memcpy
+// the streaming versions differ only in the store instruction and the final sfence
+
+
+namespace {
+  // returns the number of bytes to copy before dest is aligned to alignment
+  inline std::size_t GetHeadSize(const void* dest, std::size_t size, std::size_t alignment) {
+    const auto misalignment = reinterpret_cast<std::uintptr_t>(dest) & (alignment - 1);
+    const std::size_t headSize = misalignment ? alignment - misalignment : 0;
+    return headSize < size ? headSize : size;
+  }
+
+
+#ifdef ML_KERNEL_X86
+  template<bool Stream>
+  ML_KERNEL_TARGET("sse2")
+  void CopySSE2Impl(void* dest, const void* src, std::size_t size) {
+    auto d = static_cast<std::uint8_t*>(dest);
+    auto s = static_cast<const std::uint8_t*>(src);
+
+    const auto headSize = GetHeadSize(d, size, 16);
+    std::memcpy(d, s, headSize);
+    d += headSize;
+    s += headSize;
+    size -= headSize;
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+      __m128i v[4];
+      for (std::size_t i = 0; i < 4; i++) {
+        v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s) + i);
+      }
+      for (std::size_t i = 0; i < 4; i++) {
+        if constexpr (Stream) {
+          _mm_stream_si128(reinterpret_cast<__m128i*>(d) + i, v[i]);
+        } else {
+          _mm_store_si128(reinterpret_cast<__m128i*>(d) + i, v[i]);
+        }
+      }
+    }
+
+    if constexpr (Stream) {
+      _mm_sfence();
+    }
+
+    std::memcpy(d, s, size);
+  }
+
+
+  template<bool Stream>
+  ML_KERNEL_TARGET("avx2")
+  void CopyAVX2Impl(void* dest, const void* src, std::size_t size) {
+    auto d = static_cast<std::uint8_t*>(dest);
+    auto s = static_cast<const std::uint8_t*>(src);
+
+    const auto headSize = GetHeadSize(d, size, 32);
+    std::memcpy(d, s, headSize);
+    d += headSize;
+    s += headSize;
+    size -= headSize;
+
+    for (; size >= 128; size -= 128, d += 128, s += 128) {
+      __m256i v[4];
+      for (std::size_t i = 0; i < 4; i++) {
+        v[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s) + i);
+      }
+      for (std::size_t i = 0; i < 4; i++) {
+        if constexpr (Stream) {
+          _mm256_stream_si256(reinterpret_cast<__m256i*>(d) + i, v[i]);
+        } else {
+          _mm256_store_si256(reinterpret_cast<__m256i*>(d) + i, v[i]);
+        }
+      }
+    }
+
+    if constexpr (Stream) {
+      _mm_sfence();
+    }
+
+    _mm256_zeroupper();
+
+    std::memcpy(d, s, size);
+  }
+
+
+  template<bool Stream>
+  ML_KERNEL_TARGET("avx512f")
+  void CopyAVX512Impl(void* dest, const void* src, std::size_t size) {
+    auto d = static_cast<std::uint8_t*>(dest);
+    auto s = static_cast<const std::uint8_t*>(src);
+
+    const auto headSize = GetHeadSize(d, size, 64);
+    std::memcpy(d, s, headSize);
+    d += headSize;
+    s += headSize;
+    size -= headSize;
+
+    for (; size >= 256; size -= 256, d += 256, s += 256) {
+      __m512i v[4];
+      for (std::size_t i = 0; i < 4; i++) {
+        v[i] = _mm512_loadu_si512(s + i * 64);
+      }
+      for (std::size_t i = 0; i < 4; i++) {
+        if constexpr (Stream) {
+          _mm512_stream_si512(reinterpret_cast<__m512i*>(d + i * 64), v[i]);
+        } else {
+          _mm512_store_si512(d + i * 64, v[i]);
+        }
+      }
+    }
+
+    if constexpr (Stream) {
+      _mm_sfence();
+    }
+
+    _mm256_zeroupper();
+
+    std::memcpy(d, s, size);
+  }
+#endif
+}
+
+
+void Kernel::CopyScalar(void* dest, const void* src, std::size_t size) {
+  std::memcpy(dest, src, size);
+}
+
+
+#ifdef ML_KERNEL_X86
+
+void Kernel::CopySSE2(void* dest, const void* src, std::size_t size) {
+  CopySSE2Impl<false>(dest, src, size);
+}
+
+
+void Kernel::CopyAVX2(void* dest, const void* src, std::size_t size) {
+  CopyAVX2Impl<false>(dest, src, size);
+}
+
+
+void Kernel::CopyAVX512(void* dest, const void* src, std::size_t size) {
+  CopyAVX512Impl<false>(dest, src, size);
+}
+
+
+void Kernel::CopyStreamSSE2(void* dest, const void* src, std::size_t size) {
+  CopySSE2Impl<true>(dest, src, size);
+}
+
+
+void Kernel::CopyStreamAVX2(void* dest, const void* src, std::size_t size) {
+  CopyAVX2Impl<true>(dest, src, size);
+}
+
+
+void Kernel::CopyStreamAVX512(void* dest, const void* src, std::size_t size) {
+  CopyAVX512Impl<true>(dest, src, size);
+}
+
+#else
+
+void Kernel::CopySSE2(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+
+void Kernel::CopyAVX2(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+
+void Kernel::CopyAVX512(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+
+void Kernel::CopyStreamSSE2(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+
+void Kernel::CopyStreamAVX2(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+
+void Kernel::CopyStreamAVX512(void* dest, const void* src, std::size_t size) {
+  CopyScalar(dest, src, size);
+}
+
+#endif
+
+
+void Kernel::Copy(void* dest, const void* src, std::size_t size) {
+  const auto& kernelSet = GetKernelSet();
+  if (size >= GetStreamingCopyThreshold()) {
+    kernelSet.copyStream(dest, src, size);
+  } else {
+    kernelSet.copy(dest, src, size);
+  }
+}
+
+
+void Kernel::CopyStream(void* dest, const void* src, std::size_t size) {
+  GetKernelSet().copyStream(dest, src, size);
+}
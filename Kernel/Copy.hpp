@@ -0,0 +1,26 @@
+#ifndef ML_KERNEL_COPY_HPP
+#define ML_KERNEL_COPY_HPP
+
+#include <cstddef>
+
+
+namespace Kernel {
+  // memcpy for large buffers (frames)
+  void CopyScalar(void* dest, const void* src, std::size_t size);
+  void CopySSE2(void* dest, const void* src, std::size_t size);
+  void CopyAVX2(void* dest, const void* src, std::size_t size);
+  void CopyAVX512(void* dest, const void* src, std::size_t size);
+
+  // same as above but with non-temporal stores, which bypass the caches
+  // so that copying a whole frame does not evict everything else
+  // only pays off when dest is not read again soon
+  void CopyStreamSSE2(void* dest, const void* src, std::size_t size);
+  void CopyStreamAVX2(void* dest, const void* src, std::size_t size);
+  void CopyStreamAVX512(void* dest, const void* src, std::size_t size);
+
+  // uses the streaming version if size is at least GetStreamingCopyThreshold() (see Dispatch.hpp)
+  void Copy(void* dest, const void* src, std::size_t size);
+  void CopyStream(void* dest, const void* src, std::size_t size);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+
+#include "Dispatch.hpp"
+#include "Audio.hpp"
+#include "CPUFeature.hpp"
+#include "Copy.hpp"
+#include "Hash.hpp"
+#include "Pixel.hpp"
+
+
+namespace {
+  // used when the cache size cannot be detected
+  constexpr std::size_t DefaultStreamingCopyThreshold = 4 * 1024 * 1024;
+
+
+  std::size_t GetDefaultStreamingCopyThreshold() {
+    const auto cacheSize = Kernel::DetectLastLevelCacheSize();
+    return cacheSize ? cacheSize / 2 : DefaultStreamingCopyThreshold;
+  }
+
+
+  Kernel::KernelSet gKernelSet = Kernel::GetKernelSet(Kernel::DetectISA());
+  std::size_t gStreamingCopyThreshold = GetDefaultStreamingCopyThreshold();
+}
+
+
+Kernel::KernelSet Kernel::GetKernelSet(ISA isa) {
+  KernelSet kernelSet{
+    isa,
+    HashScalar,
+    CopyScalar,
+    CopyScalar,
+    ConvertBGRAToBGRScalar,
+    ConvertBGRAToI420Scalar,
+    CountUniformPixelsFromStartScalar,
+    CountUniformPixelsFromEndScalar,
+    ConvertU8ToFloatScalar,
+    ConvertS16ToFloatScalar,
+    ConvertS24ToFloatScalar,
+    ConvertFloatToS16Scalar,
+    DotProductScalar,
+  };
+
+  if (isa >= ISA::SSE2) {
+    kernelSet.hash = HashSSE2;
+    kernelSet.copy = CopySSE2;
+    kernelSet.copyStream = CopyStreamSSE2;
+    kernelSet.convertBGRAToI420 = ConvertBGRAToI420SSE2;
+    kernelSet.countUniformPixelsFromStart = CountUniformPixelsFromStartSSE2;
+    kernelSet.countUniformPixelsFromEnd = CountUniformPixelsFromEndSSE2;
+    kernelSet.convertU8ToFloat = ConvertU8ToFloatSSE2;
+    kernelSet.convertS16ToFloat = ConvertS16ToFloatSSE2;
+    kernelSet.convertFloatToS16 = ConvertFloatToS16SSE2;
+    kernelSet.dotProduct = DotProductSSE2;
+  }
+
+  if (isa >= ISA::SSSE3) {
+    kernelSet.convertBGRAToBGR = ConvertBGRAToBGRSSSE3;
+    kernelSet.convertS24ToFloat = ConvertS24ToFloatSSSE3;
+  }
+
+  if (isa >= ISA::AVX2) {
+    kernelSet.hash = HashAVX2;
+    kernelSet.copy = CopyAVX2;
+    kernelSet.copyStream = CopyStreamAVX2;
+    kernelSet.countUniformPixelsFromStart = CountUniformPixelsFromStartAVX2;
+    kernelSet.countUniformPixelsFromEnd = CountUniformPixelsFromEndAVX2;
+    kernelSet.convertS16ToFloat = ConvertS16ToFloatAVX2;
+    kernelSet.convertFloatToS16 = ConvertFloatToS16AVX2;
+    kernelSet.dotProduct = DotProductAVX2;
+  }
+
+  if (isa >= ISA::AVX512) {
+    kernelSet.hash = HashAVX512;
+    kernelSet.copy = CopyAVX512;
+    kernelSet.copyStream = CopyStreamAVX512;
+  }
+
+  return kernelSet;
+}
+
+
+const Kernel::KernelSet& Kernel::GetKernelSet() {
+  return gKernelSet;
+}
+
+
+std::size_t Kernel::GetStreamingCopyThreshold() {
+  return gStreamingCopyThreshold;
+}
+
+
+Kernel::ISA Kernel::Initialize(std::optional<ISA> isa, std::optional<std::size_t> streamingCopyThreshold) {
+  const auto detectedISA = DetectISA();
+  const auto actualISA = isa ? std::min(isa.value(), detectedISA) : detectedISA;
+  gKernelSet = GetKernelSet(actualISA);
+  gStreamingCopyThreshold = streamingCopyThreshold ? streamingCopyThreshold.value() : GetDefaultStreamingCopyThreshold();
+  return actualISA;
+}
@@ -0,0 +1,47 @@
+#ifndef ML_KERNEL_DISPATCH_HPP
+#define ML_KERNEL_DISPATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "CPUFeature.hpp"
+
+
+namespace Kernel {
+  // the implementations bound for an instruction set level
+  // entries without a variant for the level use the best one of the lower levels
+  struct KernelSet {
+    ISA isa;
+    std::uint64_t (*hash)(const std::uint8_t* data, std::size_t size);
+    void (*copy)(void* dest, const void* src, std::size_t size);
+    void (*copyStream)(void* dest, const void* src, std::size_t size);
+    void (*convertBGRAToBGR)(const std::uint8_t* src, std::uint8_t* dst, std::size_t width);
+    void (*convertBGRAToI420)(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width);
+    std::size_t (*countUniformPixelsFromStart)(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+    std::size_t (*countUniformPixelsFromEnd)(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+    void (*convertU8ToFloat)(const std::uint8_t* src, float* dst, std::size_t count);
+    void (*convertS16ToFloat)(const std::uint8_t* src, float* dst, std::size_t count);
+    void (*convertS24ToFloat)(const std::uint8_t* src, float* dst, std::size_t count);
+    void (*convertFloatToS16)(const float* src, std::uint8_t* dst, std::size_t count);
+    float (*dotProduct)(const float* a, const float* b, std::size_t count);
+  };
+
+  KernelSet GetKernelSet(ISA isa);
+
+  // the set used by Kernel::Hash, Kernel::Copy, etc.
+  // bound to DetectISA() until Initialize is called
+  const KernelSet& GetKernelSet();
+
+  // Kernel::Copy switches to non-temporal stores from this size
+  // half of the last level cache by default: a copy that large would evict most of it anyway
+  std::size_t GetStreamingCopyThreshold();
+
+  // binds the set for isa (or DetectISA() if not specified)
+  // isa is lowered to what the CPU supports; returns the level actually bound
+  // streamingCopyThreshold overrides the default threshold (SIZE_MAX disables streaming)
+  // must be called before any other thread uses the kernels
+  ISA Initialize(std::optional<ISA> isa = std::nullopt, std::optional<std::size_t> streamingCopyThreshold = std::nullopt);
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Hash.hpp"
+#include "Dispatch.hpp"
+#include "Intrinsics.hpp"
+
+
+// XXH3-like construction:
+//   8 lanes of 64-bit accumulators consume 64-byte stripes,
+//   and the accumulators are scrambled every 16 stripes (1 KiB block)
+// the scalar version is the reference; SIMD versions only process several lanes at once
+
+
+namespace {
+  constexpr std::size_t StripeSize = 64;
+  constexpr std::size_t StripesPerBlock = 16;
+  constexpr std::size_t BlockSize = StripeSize * StripesPerBlock;
+
+  constexpr std::uint64_t Prime32_1 = 0x9E3779B1u;
+  constexpr std::uint64_t Prime32_2 = 0x85EBCA77u;
+  constexpr std::uint64_t Prime32_3 = 0xC2B2AE3Du;
+  constexpr std::uint64_t Prime64_1 = 0x9E3779B185EBCA87u;
+  constexpr std::uint64_t Prime64_2 = 0xC2B2AE3D27D4EB4Fu;
+  constexpr std::uint64_t Prime64_3 = 0x165667B19E3779F9u;
+  constexpr std::uint64_t Prime64_4 = 0x85EBCA77C2B2AE63u;
+  constexpr std::uint64_t Prime64_5 = 0x27D4EB2F165667C5u;
+
+  alignas(64) constexpr std::uint64_t Secret[8] = {
+    0xBE4BA423396CFEB8u, 0x1CAD21F72C81017Cu, 0xDB979083E96DD4DEu, 0x1F67B3B7A4A44072u,
+    0x78E5C0CC4EE679CBu, 0x2172FFCC7DD05A82u, 0x8E2443F7744608B8u, 0x4C263A81E69035E0u,
+  };
+
+  constexpr std::uint64_t InitialAcc[8] = {
+    Prime32_3, Prime64_1, Prime64_2, Prime64_3,
+    Prime64_4, Prime32_2, Prime64_5, Prime32_1,
+  };
+
+
+  inline std::uint64_t Load64(const std::uint8_t* ptr) {
+    std::uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+  }
+
+
+  inline std::uint64_t RotL64(std::uint64_t value, unsigned int shift) {
+    return (value << shift) | (value >> (64 - shift));
+  }
+
+
+  inline void AccumulateStripeScalar(std::uint64_t* acc, const std::uint8_t* data) {
+    for (std::size_t i = 0; i < 8; i++) {
+      const auto value = Load64(data + i * 8);
+      const auto key = value ^ Secret[i];
+      acc[i ^ 1] += value;
+      acc[i] += (key & 0xFFFFFFFFu) * (key >> 32);
+    }
+  }
+
+
+  inline void ScrambleScalar(std::uint64_t* acc) {
+    for (std::size_t i = 0; i < 8; i++) {
+      auto value = acc[i];
+      value ^= value >> 47;
+      value ^= Secret[i];
+      acc[i] = value * Prime32_1;
+    }
+  }
+
+
+  // the remaining bytes (less than a block) are handled in the same way by every implementation
+  std::uint64_t Finalize(std::uint64_t* acc, const std::uint8_t* data, std::size_t remaining, std::size_t totalSize) {
+    while (remaining >= StripeSize) {
+      AccumulateStripeScalar(acc, data);
+      data += StripeSize;
+      remaining -= StripeSize;
+    }
+
+    if (remaining) {
+      std::uint8_t lastStripe[StripeSize]{};
+      std::memcpy(lastStripe, data, remaining);
+      AccumulateStripeScalar(acc, lastStripe);
+    }
+
+    std::uint64_t hash = static_cast<std::uint64_t>(totalSize) * Prime64_1;
+    for (std::size_t i = 0; i < 8; i++) {
+      hash ^= acc[i] * Prime64_2;
+      hash = RotL64(hash, 27) * Prime64_1 + Prime64_4;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime64_2;
+    hash ^= hash >> 29;
+    hash *= Prime64_3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+}
+
+
+std::uint64_t Kernel::HashScalar(const std::uint8_t* data, std::size_t size) {
+  std::uint64_t acc[8];
+  std::memcpy(acc, InitialAcc, sizeof(acc));
+
+  const std::size_t numBlocks = size / BlockSize;
+  for (std::size_t block = 0; block < numBlocks; block++) {
+    for (std::size_t stripe = 0; stripe < StripesPerBlock; stripe++) {
+      AccumulateStripeScalar(acc, data + stripe * StripeSize);
+    }
+    ScrambleScalar(acc);
+    data += BlockSize;
+  }
+
+  return Finalize(acc, data, size - numBlocks * BlockSize, size);
+}
+
+
+#ifdef ML_KERNEL_X86
+
+ML_KERNEL_TARGET("sse2")
+std::uint64_t Kernel::HashSSE2(const std::uint8_t* data, std::size_t size) {
+  __m128i acc[4];
+  for (std::size_t i = 0; i < 4; i++) {
+    acc[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(InitialAcc) + i);
+  }
+
+  const auto prime32_1 = _mm_set1_epi32(static_cast<int>(Prime32_1));
+
+  const std::size_t numBlocks = size / BlockSize;
+  for (std::size_t block = 0; block < numBlocks; block++) {
+    for (std::size_t stripe = 0; stripe < StripesPerBlock; stripe++) {
+      const auto ptr = reinterpret_cast<const __m128i*>(data + stripe * StripeSize);
+      for (std::size_t i = 0; i < 4; i++) {
+        const auto value = _mm_loadu_si128(ptr + i);
+        const auto key = _mm_xor_si128(value, _mm_load_si128(reinterpret_cast<const __m128i*>(Secret) + i));
+        const auto keyHigh = _mm_shuffle_epi32(key, _MM_SHUFFLE(3, 3, 1, 1));
+        const auto product = _mm_mul_epu32(key, keyHigh);
+        const auto swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm_add_epi64(acc[i], _mm_add_epi64(product, swapped));
+      }
+    }
+
+    // scramble
+    for (std::size_t i = 0; i < 4; i++) {
+      auto value = _mm_xor_si128(acc[i], _mm_srli_epi64(acc[i], 47));
+      value = _mm_xor_si128(value, _mm_load_si128(reinterpret_cast<const __m128i*>(Secret) + i));
+      const auto productLow = _mm_mul_epu32(value, prime32_1);
+      const auto productHigh = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime32_1);
+      acc[i] = _mm_add_epi64(productLow, _mm_slli_epi64(productHigh, 32));
+    }
+
+    data += BlockSize;
+  }
+
+  alignas(16) std::uint64_t scalarAcc[8];
+  for (std::size_t i = 0; i < 4; i++) {
+    _mm_store_si128(reinterpret_cast<__m128i*>(scalarAcc) + i, acc[i]);
+  }
+
+  return Finalize(scalarAcc, data, size - numBlocks * BlockSize, size);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+std::uint64_t Kernel::HashAVX2(const std::uint8_t* data, std::size_t size) {
+  __m256i acc[2];
+  for (std::size_t i = 0; i < 2; i++) {
+    acc[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(InitialAcc) + i);
+  }
+
+  const auto prime32_1 = _mm256_set1_epi32(static_cast<int>(Prime32_1));
+
+  const std::size_t numBlocks = size / BlockSize;
+  for (std::size_t block = 0; block < numBlocks; block++) {
+    for (std::size_t stripe = 0; stripe < StripesPerBlock; stripe++) {
+      const auto ptr = reinterpret_cast<const __m256i*>(data + stripe * StripeSize);
+      for (std::size_t i = 0; i < 2; i++) {
+        const auto value = _mm256_loadu_si256(ptr + i);
+        const auto key = _mm256_xor_si256(value, _mm256_load_si256(reinterpret_cast<const __m256i*>(Secret) + i));
+        const auto keyHigh = _mm256_shuffle_epi32(key, _MM_SHUFFLE(3, 3, 1, 1));
+        const auto product = _mm256_mul_epu32(key, keyHigh);
+        // lanes i and i ^ 1 are always in the same 128-bit half
+        const auto swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+        acc[i] = _mm256_add_epi64(acc[i], _mm256_add_epi64(product, swapped));
+      }
+    }
+
+    // scramble
+    for (std::size_t i = 0; i < 2; i++) {
+      auto value = _mm256_xor_si256(acc[i], _mm256_srli_epi64(acc[i], 47));
+      value = _mm256_xor_si256(value, _mm256_load_si256(reinterpret_cast<const __m256i*>(Secret) + i));
+      const auto productLow = _mm256_mul_epu32(value, prime32_1);
+      const auto productHigh = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime32_1);
+      acc[i] = _mm256_add_epi64(productLow, _mm256_slli_epi64(productHigh, 32));
+    }
+
+    data += BlockSize;
+  }
+
+  alignas(32) std::uint64_t scalarAcc[8];
+  for (std::size_t i = 0; i < 2; i++) {
+    _mm256_store_si256(reinterpret_cast<__m256i*>(scalarAcc) + i, acc[i]);
+  }
+
+  _mm256_zeroupper();
+
+  return Finalize(scalarAcc, data, size - numBlocks * BlockSize, size);
+}
+
+
+ML_KERNEL_TARGET("avx512f")
+std::uint64_t Kernel::HashAVX512(const std::uint8_t* data, std::size_t size) {
+  auto acc = _mm512_loadu_si512(InitialAcc);
+
+  const auto secret = _mm512_load_si512(Secret);
+  const auto prime32_1 = _mm512_set1_epi32(static_cast<int>(Prime32_1));
+
+  const std::size_t numBlocks = size / BlockSize;
+  for (std::size_t block = 0; block < numBlocks; block++) {
+    for (std::size_t stripe = 0; stripe < StripesPerBlock; stripe++) {
+      const auto value = _mm512_loadu_si512(data + stripe * StripeSize);
+      const auto key = _mm512_xor_si512(value, secret);
+      const auto keyHigh = _mm512_shuffle_epi32(key, static_cast<_MM_PERM_ENUM>(_MM_SHUFFLE(3, 3, 1, 1)));
+      const auto product = _mm512_mul_epu32(key, keyHigh);
+      const auto swapped = _mm512_shuffle_epi32(value, static_cast<_MM_PERM_ENUM>(_MM_SHUFFLE(1, 0, 3, 2)));
+      acc = _mm512_add_epi64(acc, _mm512_add_epi64(product, swapped));
+    }
+
+    // scramble
+    auto value = _mm512_xor_si512(acc, _mm512_srli_epi64(acc, 47));
+    value = _mm512_xor_si512(value, secret);
+    const auto productLow = _mm512_mul_epu32(value, prime32_1);
+    const auto productHigh = _mm512_mul_epu32(_mm512_srli_epi64(value, 32), prime32_1);
+    acc = _mm512_add_epi64(productLow, _mm512_slli_epi64(productHigh, 32));
+
+    data += BlockSize;
+  }
+
+  alignas(64) std::uint64_t scalarAcc[8];
+  _mm512_store_si512(scalarAcc, acc);
+
+  _mm256_zeroupper();
+
+  return Finalize(scalarAcc, data, size - numBlocks * BlockSize, size);
+}
+
+#else
+
+std::uint64_t Kernel::HashSSE2(const std::uint8_t* data, std::size_t size) {
+  return HashScalar(data, size);
+}
+
+
+std::uint64_t Kernel::HashAVX2(const std::uint8_t* data, std::size_t size) {
+  return HashScalar(data, size);
+}
+
+
+std::uint64_t Kernel::HashAVX512(const std::uint8_t* data, std::size_t size) {
+  return HashScalar(data, size);
+}
+
+#endif
+
+
+std::uint64_t Kernel::Hash(const std::uint8_t* data, std::size_t size) {
+  return GetKernelSet().hash(data, size);
+}
@@ -0,0 +1,19 @@
+#ifndef ML_KERNEL_HASH_HPP
+#define ML_KERNEL_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Kernel {
+  // 64-bit non-cryptographic hash for whole frames
+  // every implementation must return exactly the same value as HashScalar
+  std::uint64_t HashScalar(const std::uint8_t* data, std::size_t size);
+  std::uint64_t HashSSE2(const std::uint8_t* data, std::size_t size);
+  std::uint64_t HashAVX2(const std::uint8_t* data, std::size_t size);
+  std::uint64_t HashAVX512(const std::uint8_t* data, std::size_t size);
+
+  std::uint64_t Hash(const std::uint8_t* data, std::size_t size);
+}
+
+#endif
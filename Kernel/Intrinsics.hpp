@@ -0,0 +1,20 @@
+#ifndef ML_KERNEL_INTRINSICS_HPP
+#define ML_KERNEL_INTRINSICS_HPP
+
+// included only by kernel implementations
+// on x86 / x64 every SIMD variant is compiled regardless of the compiler options,
+// and the one used is chosen at runtime (see Dispatch.hpp)
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+# define ML_KERNEL_X86 1
+# include <immintrin.h>
+#endif
+
+// MSVC accepts any intrinsic in any function, while GCC and Clang need the target for each function
+#if defined(ML_KERNEL_X86) && !defined(_MSC_VER)
+# define ML_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+# define ML_KERNEL_TARGET(isa)
+#endif
+
+#endif
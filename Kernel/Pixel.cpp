@@ -0,0 +1,318 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Pixel.hpp"
+#include "Dispatch.hpp"
+#include "Intrinsics.hpp"
+
+
+namespace {
+  inline bool IsSimilarPixel(const std::uint8_t* pixel, std::uint32_t color, std::uint8_t tolerance) {
+    for (std::size_t i = 0; i < 3; i++) {
+      const int difference = static_cast<int>(pixel[i]) - static_cast<int>((color >> (i * 8)) & 0xFF);
+      if (difference > tolerance || difference < -tolerance) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+
+  inline std::uint8_t RGBToY(int r, int g, int b) {
+    return static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+  }
+
+
+  inline std::uint8_t RGBToU(int r, int g, int b) {
+    return static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+  }
+
+
+  inline std::uint8_t RGBToV(int r, int g, int b) {
+    return static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+  }
+
+
+#ifdef ML_KERNEL_X86
+  // returns a 4-bit mask of pixels that are similar to color
+  ML_KERNEL_TARGET("sse2")
+  inline int SimilarPixelMaskSSE2(__m128i pixels, __m128i color, __m128i tolerance) {
+    const auto difference = _mm_or_si128(_mm_subs_epu8(pixels, color), _mm_subs_epu8(color, pixels));
+    const auto exceeded = _mm_subs_epu8(difference, tolerance);
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(exceeded, _mm_setzero_si128())));
+  }
+
+
+  // returns an 8-bit mask of pixels that are similar to color
+  ML_KERNEL_TARGET("avx2")
+  inline int SimilarPixelMaskAVX2(__m256i pixels, __m256i color, __m256i tolerance) {
+    const auto difference = _mm256_or_si256(_mm256_subs_epu8(pixels, color), _mm256_subs_epu8(color, pixels));
+    const auto exceeded = _mm256_subs_epu8(difference, tolerance);
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(exceeded, _mm256_setzero_si256())));
+  }
+
+
+  // sums the two 32-bit products of each 64-bit element, the results are in elements 0 and 2
+  // a, b: pmaddwd results of two pixels each -> [a0 + a1, a2 + a3, b0 + b1, b2 + b3]
+  ML_KERNEL_TARGET("sse2")
+  inline __m128i HorizontalAddPairsSSE2(__m128i a, __m128i b) {
+    const auto even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)));
+    const auto odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+  }
+
+
+  // 4 BGRA pixels -> 4 Y values in the low 32 bits
+  ML_KERNEL_TARGET("sse2")
+  inline int ConvertToYSSE2(__m128i pixels, __m128i coefficients) {
+    const auto zero = _mm_setzero_si128();
+    const auto low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+    const auto high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+    auto y = HorizontalAddPairsSSE2(low, high);
+    y = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(y, _mm_set1_epi32(128)), 8), _mm_set1_epi32(16));
+    y = _mm_packs_epi32(y, y);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(y, y));
+  }
+#endif
+}
+
+
+void Kernel::ConvertBGRAToBGRScalar(const std::uint8_t* src, std::uint8_t* dst, std::size_t width) {
+  for (std::size_t x = 0; x < width; x++) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    src += 4;
+    dst += 3;
+  }
+}
+
+
+void Kernel::ConvertBGRAToI420Scalar(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width) {
+  for (std::size_t x = 0; x < width; x += 2) {
+    const std::uint8_t* p[4] = {
+      src0 + x * 4,
+      src0 + x * 4 + 4,
+      src1 + x * 4,
+      src1 + x * 4 + 4,
+    };
+
+    dstY0[x]     = RGBToY(p[0][2], p[0][1], p[0][0]);
+    dstY0[x + 1] = RGBToY(p[1][2], p[1][1], p[1][0]);
+    dstY1[x]     = RGBToY(p[2][2], p[2][1], p[2][0]);
+    dstY1[x + 1] = RGBToY(p[3][2], p[3][1], p[3][0]);
+
+    const int r = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+    const int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+    const int b = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+    dstU[x / 2] = RGBToU(r, g, b);
+    dstV[x / 2] = RGBToV(r, g, b);
+  }
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromStartScalar(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  for (std::size_t i = 0; i < count; i++) {
+    if (!IsSimilarPixel(pixels + i * 4, color, tolerance)) {
+      return i;
+    }
+  }
+  return count;
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromEndScalar(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  for (std::size_t i = 0; i < count; i++) {
+    if (!IsSimilarPixel(pixels + (count - 1 - i) * 4, color, tolerance)) {
+      return i;
+    }
+  }
+  return count;
+}
+
+
+#ifdef ML_KERNEL_X86
+
+ML_KERNEL_TARGET("ssse3")
+void Kernel::ConvertBGRAToBGRSSSE3(const std::uint8_t* src, std::uint8_t* dst, std::size_t width) {
+  // drops every 4th byte, leaving 12 bytes at the bottom
+  const auto shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+  std::size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const auto ptr = reinterpret_cast<const __m128i*>(src + x * 4);
+    const auto v0 = _mm_shuffle_epi8(_mm_loadu_si128(ptr), shuffle);
+    const auto v1 = _mm_shuffle_epi8(_mm_loadu_si128(ptr + 1), shuffle);
+    const auto v2 = _mm_shuffle_epi8(_mm_loadu_si128(ptr + 2), shuffle);
+    const auto v3 = _mm_shuffle_epi8(_mm_loadu_si128(ptr + 3), shuffle);
+
+    const auto out = reinterpret_cast<__m128i*>(dst + x * 3);
+    _mm_storeu_si128(out, _mm_or_si128(v0, _mm_slli_si128(v1, 12)));
+    _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(v1, 4), _mm_slli_si128(v2, 8)));
+    _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(v2, 8), _mm_slli_si128(v3, 4)));
+  }
+
+  ConvertBGRAToBGRScalar(src + x * 4, dst + x * 3, width - x);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+void Kernel::ConvertBGRAToI420SSE2(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width) {
+  // coefficients for B, G, R, A in 16-bit lanes
+  const auto coefficientsY = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+  const auto coefficientsU = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+  const auto coefficientsV = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+  const auto zero = _mm_setzero_si128();
+
+  std::size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const auto pixels0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src0 + x * 4));
+    const auto pixels1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src1 + x * 4));
+
+    const int y0 = ConvertToYSSE2(pixels0, coefficientsY);
+    const int y1 = ConvertToYSSE2(pixels1, coefficientsY);
+    std::memcpy(dstY0 + x, &y0, 4);
+    std::memcpy(dstY1 + x, &y1, 4);
+
+    // average of each 2x2 block
+    const auto verticalLow = _mm_add_epi16(_mm_unpacklo_epi8(pixels0, zero), _mm_unpacklo_epi8(pixels1, zero));
+    const auto verticalHigh = _mm_add_epi16(_mm_unpackhi_epi8(pixels0, zero), _mm_unpackhi_epi8(pixels1, zero));
+    const auto sumLow = _mm_add_epi16(verticalLow, _mm_srli_si128(verticalLow, 8));
+    const auto sumHigh = _mm_add_epi16(verticalHigh, _mm_srli_si128(verticalHigh, 8));
+    const auto average = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(sumLow, sumHigh), _mm_set1_epi16(2)), 2);
+
+    const auto productU = _mm_madd_epi16(average, coefficientsU);
+    const auto productV = _mm_madd_epi16(average, coefficientsV);
+    auto uv = HorizontalAddPairsSSE2(productU, productV);
+    uv = _mm_add_epi32(_mm_srai_epi32(_mm_add_epi32(uv, _mm_set1_epi32(128)), 8), _mm_set1_epi32(128));
+
+    alignas(16) std::int32_t values[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(values), uv);
+    dstU[x / 2]     = static_cast<std::uint8_t>(values[0]);
+    dstU[x / 2 + 1] = static_cast<std::uint8_t>(values[1]);
+    dstV[x / 2]     = static_cast<std::uint8_t>(values[2]);
+    dstV[x / 2 + 1] = static_cast<std::uint8_t>(values[3]);
+  }
+
+  ConvertBGRAToI420Scalar(src0 + x * 4, src1 + x * 4, dstY0 + x, dstY1 + x, dstU + x / 2, dstV + x / 2, width - x);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+std::size_t Kernel::CountUniformPixelsFromStartSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  const auto colorVector = _mm_set1_epi32(static_cast<int>(color));
+  const auto toleranceVector = _mm_set1_epi32(static_cast<int>(0xFF000000u | tolerance * 0x010101u));
+
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const auto mask = SimilarPixelMaskSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i * 4)), colorVector, toleranceVector);
+    if (mask != 0xF) {
+      break;
+    }
+  }
+  return i + CountUniformPixelsFromStartScalar(pixels + i * 4, count - i, color, tolerance);
+}
+
+
+ML_KERNEL_TARGET("sse2")
+std::size_t Kernel::CountUniformPixelsFromEndSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  const auto colorVector = _mm_set1_epi32(static_cast<int>(color));
+  const auto toleranceVector = _mm_set1_epi32(static_cast<int>(0xFF000000u | tolerance * 0x010101u));
+
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const auto mask = SimilarPixelMaskSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + (count - i - 4) * 4)), colorVector, toleranceVector);
+    if (mask != 0xF) {
+      break;
+    }
+  }
+  return i + CountUniformPixelsFromEndScalar(pixels, count - i, color, tolerance);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+std::size_t Kernel::CountUniformPixelsFromStartAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  const auto colorVector = _mm256_set1_epi32(static_cast<int>(color));
+  const auto toleranceVector = _mm256_set1_epi32(static_cast<int>(0xFF000000u | tolerance * 0x010101u));
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const auto mask = SimilarPixelMaskAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i * 4)), colorVector, toleranceVector);
+    if (mask != 0xFF) {
+      break;
+    }
+  }
+  _mm256_zeroupper();
+  return i + CountUniformPixelsFromStartScalar(pixels + i * 4, count - i, color, tolerance);
+}
+
+
+ML_KERNEL_TARGET("avx2")
+std::size_t Kernel::CountUniformPixelsFromEndAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  const auto colorVector = _mm256_set1_epi32(static_cast<int>(color));
+  const auto toleranceVector = _mm256_set1_epi32(static_cast<int>(0xFF000000u | tolerance * 0x010101u));
+
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const auto mask = SimilarPixelMaskAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + (count - i - 8) * 4)), colorVector, toleranceVector);
+    if (mask != 0xFF) {
+      break;
+    }
+  }
+  _mm256_zeroupper();
+  return i + CountUniformPixelsFromEndScalar(pixels, count - i, color, tolerance);
+}
+
+#else
+
+void Kernel::ConvertBGRAToBGRSSSE3(const std::uint8_t* src, std::uint8_t* dst, std::size_t width) {
+  ConvertBGRAToBGRScalar(src, dst, width);
+}
+
+
+void Kernel::ConvertBGRAToI420SSE2(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width) {
+  ConvertBGRAToI420Scalar(src0, src1, dstY0, dstY1, dstU, dstV, width);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromStartSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return CountUniformPixelsFromStartScalar(pixels, count, color, tolerance);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromEndSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return CountUniformPixelsFromEndScalar(pixels, count, color, tolerance);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromStartAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return CountUniformPixelsFromStartScalar(pixels, count, color, tolerance);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromEndAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return CountUniformPixelsFromEndScalar(pixels, count, color, tolerance);
+}
+
+#endif
+
+
+void Kernel::ConvertBGRAToBGR(const std::uint8_t* src, std::uint8_t* dst, std::size_t width) {
+  GetKernelSet().convertBGRAToBGR(src, dst, width);
+}
+
+
+void Kernel::ConvertBGRAToI420(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width) {
+  GetKernelSet().convertBGRAToI420(src0, src1, dstY0, dstY1, dstU, dstV, width);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromStart(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return GetKernelSet().countUniformPixelsFromStart(pixels, count, color, tolerance);
+}
+
+
+std::size_t Kernel::CountUniformPixelsFromEnd(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance) {
+  return GetKernelSet().countUniformPixelsFromEnd(pixels, count, color, tolerance);
+}
@@ -0,0 +1,38 @@
+#ifndef ML_KERNEL_PIXEL_HPP
+#define ML_KERNEL_PIXEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Kernel {
+  // all functions take 32bpp BGRA pixels
+  // every implementation must return exactly the same result as the scalar one
+
+  // BGRA -> BGR (24bpp)
+  void ConvertBGRAToBGRScalar(const std::uint8_t* src, std::uint8_t* dst, std::size_t width);
+  void ConvertBGRAToBGRSSSE3(const std::uint8_t* src, std::uint8_t* dst, std::size_t width);
+
+  void ConvertBGRAToBGR(const std::uint8_t* src, std::uint8_t* dst, std::size_t width);
+
+  // two lines of BGRA -> two lines of Y and one line of U and V (BT.601 limited range, 4:2:0)
+  // width must be even
+  void ConvertBGRAToI420Scalar(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width);
+  void ConvertBGRAToI420SSE2(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width);
+
+  void ConvertBGRAToI420(const std::uint8_t* src0, const std::uint8_t* src1, std::uint8_t* dstY0, std::uint8_t* dstY1, std::uint8_t* dstU, std::uint8_t* dstV, std::size_t width);
+
+  // returns the number of leading (or trailing) pixels whose B, G and R differ from color by at most tolerance
+  // alpha is ignored
+  std::size_t CountUniformPixelsFromStartScalar(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromStartSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromStartAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromEndScalar(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromEndSSE2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromEndAVX2(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+
+  std::size_t CountUniformPixelsFromStart(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+  std::size_t CountUniformPixelsFromEnd(const std::uint8_t* pixels, std::size_t count, std::uint32_t color, std::uint8_t tolerance);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "SHA256.hpp"
+
+
+namespace {
+  constexpr std::uint32_t InitialState[8] = {
+    0x6A09E667u, 0xBB67AE85u, 0x3C6EF372u, 0xA54FF53Au, 0x510E527Fu, 0x9B05688Cu, 0x1F83D9ABu, 0x5BE0CD19u,
+  };
+
+  constexpr std::uint32_t RoundConstants[64] = {
+    0x428A2F98u, 0x71374491u, 0xB5C0FBCFu, 0xE9B5DBA5u, 0x3956C25Bu, 0x59F111F1u, 0x923F82A4u, 0xAB1C5ED5u,
+    0xD807AA98u, 0x12835B01u, 0x243185BEu, 0x550C7DC3u, 0x72BE5D74u, 0x80DEB1FEu, 0x9BDC06A7u, 0xC19BF174u,
+    0xE49B69C1u, 0xEFBE4786u, 0x0FC19DC6u, 0x240CA1CCu, 0x2DE92C6Fu, 0x4A7484AAu, 0x5CB0A9DCu, 0x76F988DAu,
+    0x983E5152u, 0xA831C66Du, 0xB00327C8u, 0xBF597FC7u, 0xC6E00BF3u, 0xD5A79147u, 0x06CA6351u, 0x14292967u,
+    0x27B70A85u, 0x2E1B2138u, 0x4D2C6DFCu, 0x53380D13u, 0x650A7354u, 0x766A0ABBu, 0x81C2C92Eu, 0x92722C85u,
+    0xA2BFE8A1u, 0xA81A664Bu, 0xC24B8B70u, 0xC76C51A3u, 0xD192E819u, 0xD6990624u, 0xF40E3585u, 0x106AA070u,
+    0x19A4C116u, 0x1E376C08u, 0x2748774Cu, 0x34B0BCB5u, 0x391C0CB3u, 0x4ED8AA4Au, 0x5B9CCA4Fu, 0x682E6FF3u,
+    0x748F82EEu, 0x78A5636Fu, 0x84C87814u, 0x8CC70208u, 0x90BEFFFAu, 0xA4506CEBu, 0xBEF9A3F7u, 0xC67178F2u,
+  };
+
+
+  inline std::uint32_t RotR32(std::uint32_t value, unsigned int shift) {
+    return (value >> shift) | (value << (32 - shift));
+  }
+
+
+  inline std::uint32_t LoadBE32(const std::uint8_t* ptr) {
+    return (static_cast<std::uint32_t>(ptr[0]) << 24) | (static_cast<std::uint32_t>(ptr[1]) << 16) | (static_cast<std::uint32_t>(ptr[2]) << 8) | ptr[3];
+  }
+}
+
+
+Kernel::SHA256::SHA256() :
+  mState{},
+  mBuffer{},
+  mBufferedSize(0),
+  mTotalSize(0)
+{
+  std::memcpy(mState, InitialState, sizeof(mState));
+}
+
+
+void Kernel::SHA256::ProcessBlock(const std::uint8_t* block) {
+  std::uint32_t w[64];
+  for (std::size_t i = 0; i < 16; i++) {
+    w[i] = LoadBE32(block + i * 4);
+  }
+  for (std::size_t i = 16; i < 64; i++) {
+    const auto s0 = RotR32(w[i - 15], 7) ^ RotR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    const auto s1 = RotR32(w[i - 2], 17) ^ RotR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  auto a = mState[0];
+  auto b = mState[1];
+  auto c = mState[2];
+  auto d = mState[3];
+  auto e = mState[4];
+  auto f = mState[5];
+  auto g = mState[6];
+  auto h = mState[7];
+
+  for (std::size_t i = 0; i < 64; i++) {
+    const auto s1 = RotR32(e, 6) ^ RotR32(e, 11) ^ RotR32(e, 25);
+    const auto ch = (e & f) ^ (~e & g);
+    const auto temp1 = h + s1 + ch + RoundConstants[i] + w[i];
+    const auto s0 = RotR32(a, 2) ^ RotR32(a, 13) ^ RotR32(a, 22);
+    const auto maj = (a & b) ^ (a & c) ^ (b & c);
+    const auto temp2 = s0 + maj;
+
+    h = g;
+    g = f;
+    f = e;
+    e = d + temp1;
+    d = c;
+    c = b;
+    b = a;
+    a = temp1 + temp2;
+  }
+
+  mState[0] += a;
+  mState[1] += b;
+  mState[2] += c;
+  mState[3] += d;
+  mState[4] += e;
+  mState[5] += f;
+  mState[6] += g;
+  mState[7] += h;
+}
+
+
+void Kernel::SHA256::Update(const std::uint8_t* data, std::size_t size) {
+  mTotalSize += size;
+
+  if (mBufferedSize) {
+    const auto copySize = std::min(size, BlockSize - mBufferedSize);
+    std::memcpy(mBuffer + mBufferedSize, data, copySize);
+    mBufferedSize += copySize;
+    data += copySize;
+    size -= copySize;
+    if (mBufferedSize < BlockSize) {
+      return;
+    }
+    ProcessBlock(mBuffer);
+    mBufferedSize = 0;
+  }
+
+  while (size >= BlockSize) {
+    ProcessBlock(data);
+    data += BlockSize;
+    size -= BlockSize;
+  }
+
+  if (size) {
+    std::memcpy(mBuffer, data, size);
+  }
+  mBufferedSize = size;
+}
+
+
+Kernel::SHA256::Digest Kernel::SHA256::Finish() {
+  const std::uint64_t totalBits = mTotalSize * 8;
+
+  // 0x80, zeros up to 56 bytes in the last block, then the length in bits as big endian
+  std::uint8_t padding[BlockSize * 2]{};
+  padding[0] = 0x80;
+  const std::size_t paddingSize = (mBufferedSize < BlockSize - 8 ? BlockSize : BlockSize * 2) - mBufferedSize;
+  for (std::size_t i = 0; i < 8; i++) {
+    padding[paddingSize - 8 + i] = static_cast<std::uint8_t>(totalBits >> (56 - i * 8));
+  }
+  Update(padding, paddingSize);
+
+  Digest digest;
+  for (std::size_t i = 0; i < 8; i++) {
+    digest[i * 4 + 0] = static_cast<std::uint8_t>(mState[i] >> 24);
+    digest[i * 4 + 1] = static_cast<std::uint8_t>(mState[i] >> 16);
+    digest[i * 4 + 2] = static_cast<std::uint8_t>(mState[i] >> 8);
+    digest[i * 4 + 3] = static_cast<std::uint8_t>(mState[i]);
+  }
+  return digest;
+}
+
+
+Kernel::SHA256::Digest Kernel::SHA256::Compute(const std::uint8_t* data, std::size_t size) {
+  SHA256 sha256;
+  sha256.Update(data, size);
+  return sha256.Finish();
+}
@@ -0,0 +1,38 @@
+#ifndef ML_KERNEL_SHA256_HPP
+#define ML_KERNEL_SHA256_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace Kernel {
+  // SHA-256 (FIPS 180-4), for digests that other tools can check
+  // scalar only, and not part of KernelSet: it is far slower than Kernel::Hash and only used on request
+  class SHA256 {
+  public:
+    static constexpr std::size_t DigestSize = 32;
+    using Digest = std::array<std::uint8_t, DigestSize>;
+
+  private:
+    static constexpr std::size_t BlockSize = 64;
+
+    std::uint32_t mState[8];
+    std::uint8_t mBuffer[BlockSize];
+    std::size_t mBufferedSize;
+    std::uint64_t mTotalSize;
+
+    void ProcessBlock(const std::uint8_t* block);
+
+  public:
+    SHA256();
+
+    void Update(const std::uint8_t* data, std::size_t size);
+    // the object must not be used afterwards
+    Digest Finish();
+
+    static Digest Compute(const std::uint8_t* data, std::size_t size);
+  };
+}
+
+#endif
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "SelfCheck.hpp"
+#include "Audio.hpp"
+#include "CPUFeature.hpp"
+#include "Dispatch.hpp"
+
+using namespace std::literals;
+
+
+namespace {
+  // 1920x1080 BGRA
+  constexpr std::size_t BenchmarkWidth = 1920;
+  constexpr std::size_t BenchmarkHeight = 1080;
+  constexpr std::size_t BenchmarkFrameSize = BenchmarkWidth * BenchmarkHeight * 4;
+  constexpr auto BenchmarkDuration = 200ms;
+
+  // a 4K BGRA frame
+  constexpr std::size_t CachePollutionFrameSize = 3840 * 2160 * 4;
+  // small enough to fit in the last level cache of any CPU in question
+  constexpr std::size_t CachePollutionWorkingSetSize = 1024 * 1024;
+  constexpr std::size_t CachePollutionRounds = 16;
+  constexpr std::size_t CacheLineSize = 64;
+
+  constexpr std::size_t NumCheckRounds = 200;
+  constexpr std::size_t MaxCheckPixels = 1000;
+
+  // taps per output sample in the FIR benchmark, as in AudioTransform
+  constexpr std::size_t BenchmarkFilterTaps = 32;
+
+
+  std::vector<std::uint8_t> MakeRandomData(std::mt19937& random, std::size_t size) {
+    std::vector<std::uint8_t> data(size);
+    for (auto& value : data) {
+      value = static_cast<std::uint8_t>(random());
+    }
+    return data;
+  }
+
+
+  // samples in [-range, range)
+  std::vector<float> MakeRandomSamples(std::mt19937& random, std::size_t count, float range) {
+    std::uniform_real_distribution<float> distribution(-range, range);
+    std::vector<float> samples(count);
+    for (auto& sample : samples) {
+      sample = distribution(random);
+    }
+    return samples;
+  }
+
+
+  bool IsSameFloats(const std::vector<float>& a, const std::vector<float>& b) {
+    return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+  }
+
+
+  // runs function repeatedly for BenchmarkDuration and returns the throughput in MiB/s
+  template<typename Function>
+  double Measure(std::size_t bytesPerCall, Function function) {
+    const auto startTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration elapsed{};
+    std::size_t numCalls = 0;
+    do {
+      function();
+      numCalls++;
+      elapsed = std::chrono::steady_clock::now() - startTime;
+    } while (elapsed < BenchmarkDuration);
+    return static_cast<double>(bytesPerCall) * numCalls / (1024. * 1024.) / std::chrono::duration<double>(elapsed).count();
+  }
+
+
+  bool Check(const Kernel::KernelSet& reference, const Kernel::KernelSet& target) {
+    std::mt19937 random(0x6D656932);
+    bool ok = true;
+
+    auto report = [&ok, &target] (std::wstring_view name, bool passed) {
+      if (!passed) {
+        std::wcerr << L"[check] "sv << Kernel::GetISAName(target.isa) << L" "sv << name << L": MISMATCH"sv << std::endl;
+        ok = false;
+      }
+    };
+
+    for (std::size_t round = 0; round < NumCheckRounds; round++) {
+      // odd sizes and offsets to exercise the unaligned heads and the tails
+      const std::size_t numPixels = random() % MaxCheckPixels + 1;
+      const std::size_t offset = random() % 64;
+      const auto source = MakeRandomData(random, (numPixels * 2 + 16) * 4 + offset);
+      const auto src0 = source.data() + offset;
+      const auto src1 = src0 + numPixels * 4;
+
+      {
+        const std::size_t size = numPixels * 4 + random() % 4;
+        report(L"hash"sv, reference.hash(src0, size) == target.hash(src0, size));
+      }
+
+      {
+        const std::size_t size = numPixels * 4 + random() % 4;
+        const std::size_t destOffset = random() % 64;
+        std::vector<std::uint8_t> referenceOutput(size + destOffset);
+        std::vector<std::uint8_t> targetOutput(size + destOffset);
+        reference.copy(referenceOutput.data() + destOffset, src0, size);
+        target.copy(targetOutput.data() + destOffset, src0, size);
+        report(L"copy"sv, referenceOutput == targetOutput);
+
+        std::fill(targetOutput.begin(), targetOutput.end(), 0);
+        target.copyStream(targetOutput.data() + destOffset, src0, size);
+        report(L"stream copy"sv, referenceOutput == targetOutput);
+      }
+
+      {
+        std::vector<std::uint8_t> referenceOutput(numPixels * 3);
+        std::vector<std::uint8_t> targetOutput(numPixels * 3);
+        reference.convertBGRAToBGR(src0, referenceOutput.data(), numPixels);
+        target.convertBGRAToBGR(src0, targetOutput.data(), numPixels);
+        report(L"bgra->bgr"sv, referenceOutput == targetOutput);
+      }
+
+      {
+        const std::size_t width = numPixels & ~static_cast<std::size_t>(1);
+        const std::size_t chromaWidth = width / 2;
+        std::vector<std::uint8_t> referenceOutput(width * 2 + chromaWidth * 2);
+        std::vector<std::uint8_t> targetOutput(width * 2 + chromaWidth * 2);
+        auto convert = [&] (const Kernel::KernelSet& kernelSet, std::vector<std::uint8_t>& output) {
+          const auto ptr = output.data();
+          kernelSet.convertBGRAToI420(src0, src1, ptr, ptr + width, ptr + width * 2, ptr + width * 2 + chromaWidth, width);
+        };
+        convert(reference, referenceOutput);
+        convert(target, targetOutput);
+        report(L"bgra->i420"sv, referenceOutput == targetOutput);
+      }
+
+      {
+        // a uniform run of random length followed by random pixels
+        std::uint32_t color;
+        std::memcpy(&color, src0, 4);
+        const std::uint8_t tolerance = static_cast<std::uint8_t>(random() % 32);
+        std::vector<std::uint8_t> pixels(source.begin() + offset, source.begin() + offset + numPixels * 4);
+        const std::size_t runLength = random() % (numPixels + 1);
+        for (std::size_t i = 0; i < runLength; i++) {
+          std::memcpy(pixels.data() + i * 4, &color, 4);
+          std::memcpy(pixels.data() + (numPixels - 1 - i) * 4, &color, 4);
+        }
+        report(L"uniform scan"sv,
+               reference.countUniformPixelsFromStart(pixels.data(), numPixels, color, tolerance) == target.countUniformPixelsFromStart(pixels.data(), numPixels, color, tolerance) &&
+               reference.countUniformPixelsFromEnd(pixels.data(), numPixels, color, tolerance) == target.countUniformPixelsFromEnd(pixels.data(), numPixels, color, tolerance));
+      }
+
+      {
+        // numPixels samples of each depth fit in the source
+        std::vector<float> referenceOutput(numPixels);
+        std::vector<float> targetOutput(numPixels);
+        reference.convertU8ToFloat(src0, referenceOutput.data(), numPixels);
+        target.convertU8ToFloat(src0, targetOutput.data(), numPixels);
+        report(L"u8->float"sv, IsSameFloats(referenceOutput, targetOutput));
+
+        reference.convertS16ToFloat(src0, referenceOutput.data(), numPixels);
+        target.convertS16ToFloat(src0, targetOutput.data(), numPixels);
+        report(L"s16->float"sv, IsSameFloats(referenceOutput, targetOutput));
+
+        reference.convertS24ToFloat(src0, referenceOutput.data(), numPixels);
+        target.convertS24ToFloat(src0, targetOutput.data(), numPixels);
+        report(L"s24->float"sv, IsSameFloats(referenceOutput, targetOutput));
+      }
+
+      {
+        // beyond full scale, with ties of the rounding and values that cannot be converted
+        auto samples = MakeRandomSamples(random, numPixels, 1.25f);
+        const float specials[] = {
+          0.5f / 32768.f,
+          1.5f / 32768.f,
+          -2.5f / 32768.f,
+          1.f,
+          -1.f,
+          std::numeric_limits<float>::infinity(),
+          -std::numeric_limits<float>::infinity(),
+          std::numeric_limits<float>::quiet_NaN(),
+        };
+        for (std::size_t i = 0; i < std::size(specials) && i < numPixels; i++) {
+          samples[random() % numPixels] = specials[i];
+        }
+        std::vector<std::uint8_t> referenceOutput(numPixels * 2);
+        std::vector<std::uint8_t> targetOutput(numPixels * 2);
+        reference.convertFloatToS16(samples.data(), referenceOutput.data(), numPixels);
+        target.convertFloatToS16(samples.data(), targetOutput.data(), numPixels);
+        report(L"float->s16"sv, referenceOutput == targetOutput);
+      }
+
+      {
+        const std::size_t count = (numPixels % 64 + 1) * Kernel::DotProductBlock;
+        const auto a = MakeRandomSamples(random, count, 1.f);
+        const auto b = MakeRandomSamples(random, count, 1.f);
+        const float referenceResult = reference.dotProduct(a.data(), b.data(), count);
+        const float targetResult = target.dotProduct(a.data(), b.data(), count);
+        report(L"dot product"sv, std::memcmp(&referenceResult, &targetResult, sizeof(float)) == 0);
+      }
+    }
+
+    return ok;
+  }
+
+
+  void Benchmark(const Kernel::KernelSet& kernelSet) {
+    std::mt19937 random(0x6D656932);
+    const auto source = MakeRandomData(random, BenchmarkFrameSize);
+    std::vector<std::uint8_t> output(BenchmarkFrameSize);
+
+    volatile std::uint64_t sink = 0;
+
+    const double hashSpeed = Measure(BenchmarkFrameSize, [&] () {
+      sink = sink + kernelSet.hash(source.data(), BenchmarkFrameSize);
+    });
+
+    const double copySpeed = Measure(BenchmarkFrameSize, [&] () {
+      kernelSet.copy(output.data(), source.data(), BenchmarkFrameSize);
+    });
+
+    const double copyStreamSpeed = Measure(BenchmarkFrameSize, [&] () {
+      kernelSet.copyStream(output.data(), source.data(), BenchmarkFrameSize);
+    });
+
+    const double bgrSpeed = Measure(BenchmarkFrameSize, [&] () {
+      for (std::size_t y = 0; y < BenchmarkHeight; y++) {
+        kernelSet.convertBGRAToBGR(source.data() + y * BenchmarkWidth * 4, output.data() + y * BenchmarkWidth * 3, BenchmarkWidth);
+      }
+    });
+
+    const double i420Speed = Measure(BenchmarkFrameSize, [&] () {
+      const auto planeU = output.data() + BenchmarkWidth * BenchmarkHeight;
+      const auto planeV = planeU + BenchmarkWidth * BenchmarkHeight / 4;
+      for (std::size_t y = 0; y < BenchmarkHeight; y += 2) {
+        const auto line = source.data() + y * BenchmarkWidth * 4;
+        kernelSet.convertBGRAToI420(line, line + BenchmarkWidth * 4, output.data() + y * BenchmarkWidth, output.data() + (y + 1) * BenchmarkWidth, planeU + y / 2 * (BenchmarkWidth / 2), planeV + y / 2 * (BenchmarkWidth / 2), BenchmarkWidth);
+      }
+    });
+
+    // worst case for the scan: every pixel matches
+    std::vector<std::uint8_t> uniform(BenchmarkFrameSize, 0x10);
+    const double scanSpeed = Measure(BenchmarkFrameSize, [&] () {
+      sink = sink + kernelSet.countUniformPixelsFromStart(uniform.data(), BenchmarkWidth * BenchmarkHeight, 0x10101010u, 0);
+    });
+
+    // the same bytes as 16-bit samples, and back from the floats
+    std::vector<float> samples(BenchmarkFrameSize / 2);
+    const double s16ToFloatSpeed = Measure(BenchmarkFrameSize, [&] () {
+      kernelSet.convertS16ToFloat(source.data(), samples.data(), samples.size());
+    });
+
+    const double floatToS16Speed = Measure(BenchmarkFrameSize, [&] () {
+      kernelSet.convertFloatToS16(samples.data(), output.data(), samples.size());
+    });
+
+    // a filter sliding over the samples, one output per input; the throughput is of the input
+    const std::size_t numFilterOutputs = BenchmarkFrameSize / 2 / 16;
+    const auto taps = MakeRandomSamples(random, BenchmarkFilterTaps, 1.f);
+    const double firSpeed = Measure(numFilterOutputs * sizeof(float), [&] () {
+      float sum = 0.f;
+      for (std::size_t i = 0; i < numFilterOutputs; i++) {
+        sum += kernelSet.dotProduct(taps.data(), samples.data() + i, BenchmarkFilterTaps);
+      }
+      sink = sink + static_cast<std::uint64_t>(sum != 0.f);
+    });
+
+    std::wcerr << L"[bench] "sv << Kernel::GetISAName(kernelSet.isa) << L": MiB/s"sv
+               << L" hash "sv << hashSpeed
+               << L", copy "sv << copySpeed
+               << L", stream copy "sv << copyStreamSpeed
+               << L", bgra->bgr "sv << bgrSpeed
+               << L", bgra->i420 "sv << i420Speed
+               << L", uniform scan "sv << scanSpeed
+               << L", s16->float "sv << s16ToFloatSpeed
+               << L", float->s16 "sv << floatToS16Speed
+               << L", fir "sv << firSpeed << L" ("sv << BenchmarkFilterTaps << L" taps)"sv << std::endl;
+  }
+
+
+  // how much a frame copy slows down the accesses to a small working set that should stay cached
+  // (the index and header reads between frames in the real workload)
+  // returns the average time per cache line of the working set in nanoseconds
+  double MeasureCachePollution(void (*copy)(void* dest, const void* src, std::size_t size), const std::vector<std::uint8_t>& source, std::vector<std::uint8_t>& output, std::vector<std::uint8_t>& workingSet, const std::vector<std::size_t>& accessOrder) {
+    volatile std::uint8_t sink = 0;
+    std::chrono::steady_clock::duration elapsed{};
+
+    for (std::size_t round = 0; round < CachePollutionRounds; round++) {
+      // warm up
+      for (const auto index : accessOrder) {
+        sink = sink + workingSet[index];
+      }
+
+      copy(output.data(), source.data(), source.size());
+
+      const auto startTime = std::chrono::steady_clock::now();
+      for (const auto index : accessOrder) {
+        sink = sink + workingSet[index];
+      }
+      elapsed += std::chrono::steady_clock::now() - startTime;
+    }
+
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(accessOrder.size()) * CachePollutionRounds);
+  }
+
+
+  void BenchmarkCachePollution(const Kernel::KernelSet& kernelSet) {
+    const std::size_t workingSetSize = CachePollutionWorkingSetSize;
+
+    std::mt19937 random(0x6D656932);
+    const auto source = MakeRandomData(random, CachePollutionFrameSize);
+    std::vector<std::uint8_t> output(CachePollutionFrameSize);
+    auto workingSet = MakeRandomData(random, workingSetSize);
+
+    // random order defeats the hardware prefetcher, so that each access shows whether the line was still cached
+    std::vector<std::size_t> accessOrder(workingSetSize / CacheLineSize);
+    for (std::size_t i = 0; i < accessOrder.size(); i++) {
+      accessOrder[i] = i * CacheLineSize;
+    }
+    std::shuffle(accessOrder.begin(), accessOrder.end(), random);
+
+    const double normalTime = MeasureCachePollution(kernelSet.copy, source, output, workingSet, accessOrder);
+    const double streamTime = MeasureCachePollution(kernelSet.copyStream, source, output, workingSet, accessOrder);
+
+    std::wcerr << L"[bench] "sv << Kernel::GetISAName(kernelSet.isa) << L": cache pollution after copying "sv << (CachePollutionFrameSize / (1024 * 1024)) << L" MiB, "sv
+               << L"ns per line of a "sv << (workingSetSize / 1024) << L" KiB working set: copy "sv << normalTime << L", stream copy "sv << streamTime << std::endl;
+  }
+}
+
+
+bool Kernel::RunSelfCheck(bool benchmark) {
+  const auto detectedISA = DetectISA();
+  const auto reference = GetKernelSet(ISA::Scalar);
+
+  std::wcerr << L"[check] detected instruction set: "sv << GetISAName(detectedISA) << std::endl;
+  std::wcerr << L"[check] last level cache: "sv << DetectLastLevelCacheSize() << L" bytes, streaming copy threshold: "sv << GetStreamingCopyThreshold() << L" bytes"sv << std::endl;
+
+  bool ok = true;
+  for (auto isa = ISA::SSE2; isa <= detectedISA; isa = static_cast<ISA>(static_cast<int>(isa) + 1)) {
+    const bool passed = Check(reference, GetKernelSet(isa));
+    std::wcerr << L"[check] "sv << GetISAName(isa) << L": "sv << (passed ? L"ok"sv : L"FAILED"sv) << std::endl;
+    ok = ok && passed;
+  }
+
+  if (benchmark) {
+    for (auto isa = ISA::Scalar; isa <= detectedISA; isa = static_cast<ISA>(static_cast<int>(isa) + 1)) {
+      Benchmark(GetKernelSet(isa));
+    }
+    BenchmarkCachePollution(GetKernelSet(detectedISA));
+  }
+
+  return ok;
+}
@@ -0,0 +1,12 @@
+#ifndef ML_KERNEL_SELFCHECK_HPP
+#define ML_KERNEL_SELFCHECK_HPP
+
+
+namespace Kernel {
+  // compares every variant the CPU supports with the scalar one on pseudo-random inputs
+  // and optionally measures their throughput on frame-sized buffers
+  // results are written to std::wcerr; returns false if any variant disagrees with the scalar one
+  bool RunSelfCheck(bool benchmark);
+}
+
+#endif
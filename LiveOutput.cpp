@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "LiveOutput.hpp"
+#include "AudioDecoder.hpp"
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
+#include "Source/SourceBase.hpp"
+
+using namespace std::literals;
+
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  // upper bounds of the latency classes of the report, in frame times; one more class takes the rest
+  constexpr std::array<std::uint_fast32_t, 5> LatencyClassBounds = {1, 2, 4, 8, 16};
+
+
+  // decodes the video chunks on its own thread, ahead of the writer by at most capacity chunks
+  // the chunks the writer has given up are skipped, so a slow decoder catches up with the clock instead of falling further behind
+  class LookAheadDecoder {
+    const MEIToAVI& mMeiToAvi;
+    const std::vector<AVIBuilder::BlockLayout>& mChunks;
+    std::size_t mCapacity;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::map<std::size_t, std::unique_ptr<std::uint8_t[]>> mDecodedChunks;    // index in mChunks -> data
+    std::size_t mWriterIndex;   // the chunk the writer waits for; the earlier ones are written or given up
+    bool mStopped;
+    std::exception_ptr mException;
+    std::thread mThread;
+
+    void Run() {
+      try {
+        std::size_t index = 0;
+        while (true) {
+          {
+            std::unique_lock lock(mMutex);
+            mCondition.wait(lock, [this] () {
+              return mStopped || mDecodedChunks.size() < mCapacity;
+            });
+            index = std::max(index, mWriterIndex);
+            if (mStopped || index >= mChunks.size()) {
+              return;
+            }
+          }
+
+          const auto& chunk = mChunks[index];
+          auto data = std::make_unique<std::uint8_t[]>(chunk.size);
+          mMeiToAvi.CreateVideoBlockSource(chunk.blockIndex)->Read(data.get(), chunk.size, 0);
+
+          {
+            std::lock_guard lock(mMutex);
+            // the writer may have given the chunk up while it was decoded
+            if (index >= mWriterIndex) {
+              mDecodedChunks.emplace(index, std::move(data));
+            }
+          }
+          mCondition.notify_all();
+          index++;
+        }
+      } catch (...) {
+        {
+          std::lock_guard lock(mMutex);
+          mException = std::current_exception();
+        }
+        mCondition.notify_all();
+      }
+    }
+
+  public:
+    // chunks: the video chunks with data in the order of the file, which must outlive the decoder
+    LookAheadDecoder(const MEIToAVI& meiToAvi, const std::vector<AVIBuilder::BlockLayout>& chunks, std::size_t capacity) :
+      mMeiToAvi(meiToAvi),
+      mChunks(chunks),
+      mCapacity(std::max<std::size_t>(capacity, 1)),
+      mMutex(),
+      mCondition(),
+      mDecodedChunks(),
+      mWriterIndex(0),
+      mStopped(false),
+      mException(),
+      mThread()
+    {
+      mThread = std::thread([this] () {
+        Run();
+      });
+    }
+
+    ~LookAheadDecoder() {
+      {
+        std::lock_guard lock(mMutex);
+        mStopped = true;
+      }
+      mCondition.notify_all();
+      mThread.join();
+    }
+
+    LookAheadDecoder(const LookAheadDecoder&) = delete;
+    LookAheadDecoder& operator=(const LookAheadDecoder&) = delete;
+
+    // takes the data of the chunk, waiting for it until deadline (if any); returns null if it is not decoded by then,
+    // in which case the chunk is given up
+    // the chunks must be taken in order; rethrows the exception of the decoding thread
+    std::unique_ptr<std::uint8_t[]> Take(std::size_t index, std::optional<Clock::time_point> deadline) {
+      std::unique_lock lock(mMutex);
+
+      mWriterIndex = index;
+      mDecodedChunks.erase(mDecodedChunks.begin(), mDecodedChunks.lower_bound(index));
+      mCondition.notify_all();
+
+      const auto isDecoded = [this, index] () {
+        return mException || mDecodedChunks.count(index) != 0;
+      };
+      if (deadline) {
+        mCondition.wait_until(lock, deadline.value(), isDecoded);
+      } else {
+        mCondition.wait(lock, isDecoded);
+      }
+
+      if (mException) {
+        std::rethrow_exception(mException);
+      }
+
+      std::unique_ptr<std::uint8_t[]> data;
+      if (const auto itr = mDecodedChunks.find(index); itr != mDecodedChunks.end()) {
+        data = std::move(itr->second);
+        mDecodedChunks.erase(itr);
+      }
+      mWriterIndex = index + 1;
+      lock.unlock();
+      mCondition.notify_all();
+      return data;
+    }
+  };
+}
+
+
+void WriteLive(MEIToAVI& meiToAvi, StreamOutput& output, std::uint_fast32_t lookAheadFrames, std::size_t bufferSize, bool showMessage) {
+  auto& source = meiToAvi.GetSource();
+  const auto totalSize = static_cast<std::uint64_t>(source.GetSize());
+
+  const auto strh = meiToAvi.GetVideoStreamHeader();
+  const auto frameTime = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(static_cast<double>(strh.dwScale) / strh.dwRate));
+
+  const auto audioDecoder = meiToAvi.GetAudioDecoder();
+  // 8-bit samples are unsigned
+  const std::uint8_t silence = audioDecoder && audioDecoder->GetFormat().bitsPerSample == 8 ? 0x80 : 0x00;
+
+  // the chunks with data in the order of the file; references share the chunk of an earlier block and repeats have no data
+  // the stream 0 is the video
+  std::vector<AVIBuilder::BlockLayout> chunks;
+  for (const auto& block : meiToAvi.GetBlockLayout()) {
+    if (!block.reference && block.size) {
+      chunks.push_back(block);
+    }
+  }
+  std::sort(chunks.begin(), chunks.end(), [] (const AVIBuilder::BlockLayout& a, const AVIBuilder::BlockLayout& b) {
+    return a.chunkOffset < b.chunkOffset;
+  });
+
+  std::vector<AVIBuilder::BlockLayout> videoChunks;
+  std::copy_if(chunks.cbegin(), chunks.cend(), std::back_inserter(videoChunks), [] (const AVIBuilder::BlockLayout& block) {
+    return block.streamIndex == 0;
+  });
+
+  // the index entries of each video chunk, including those of the blocks referring to it
+  std::multimap<std::uint64_t, const AVIBuilder::BlockLayout*> indexedBlocks;
+  for (const auto& block : meiToAvi.GetBlockLayout()) {
+    if (block.streamIndex == 0) {
+      indexedBlocks.emplace(block.chunkOffset, &block);
+    }
+  }
+
+  // the 32-bit fields of idx1 and ix## rewritten for the frames given up, by absolute offset
+  // the indexes of every RIFF follow the chunks they describe, so the fields are known before they are written
+  std::map<std::uint64_t, std::uint32_t> patchedIndexFields;
+
+  auto buffer = std::make_unique<std::uint8_t[]>(bufferSize);
+  std::uint64_t offset = 0;
+
+  // everything up to end which is not replaced is written as GetSource() has it
+  const auto writeSource = [&] (std::uint64_t end) {
+    while (offset < end) {
+      const auto size = static_cast<std::size_t>(std::min<std::uint64_t>(bufferSize, end - offset));
+      source.Read(buffer.get(), size, static_cast<std::streamsize>(offset));
+      // a field may straddle the buffers
+      for (auto itr = patchedIndexFields.lower_bound(offset >= 3 ? offset - 3 : 0); itr != patchedIndexFields.end() && itr->first < offset + size; itr++) {
+        std::uint8_t value[4];
+        std::memcpy(value, &itr->second, 4);
+        for (std::uint64_t fieldOffset = std::max(itr->first, offset); fieldOffset < std::min(itr->first + 4, offset + size); fieldOffset++) {
+          buffer[static_cast<std::size_t>(fieldOffset - offset)] = value[fieldOffset - itr->first];
+        }
+      }
+      output.Write(buffer.get(), size);
+      offset += size;
+    }
+  };
+
+  const auto writeFill = [&] (std::uint64_t size, std::uint8_t value) {
+    std::memset(buffer.get(), value, static_cast<std::size_t>(std::min<std::uint64_t>(bufferSize, size)));
+    offset += size;
+    while (size) {
+      const auto writeSize = static_cast<std::size_t>(std::min<std::uint64_t>(bufferSize, size));
+      output.Write(buffer.get(), writeSize);
+      size -= writeSize;
+    }
+  };
+
+  LookAheadDecoder decoder(meiToAvi, videoChunks, lookAheadFrames);
+
+  const auto startTime = Clock::now();
+  std::optional<Clock::time_point> clockStartTime;    // frame n is due at clockStartTime + n * frameTime
+  std::optional<Clock::time_point> firstFrameTime;
+  bool audioDecoded = !audioDecoder;
+
+  std::size_t videoChunkIndex = 0;
+  std::size_t numWrittenFrames = 0;
+  std::size_t numDroppedFrames = 0;
+  std::size_t numSilencedBlocks = 0;
+  std::array<std::size_t, LatencyClassBounds.size() + 1> latencyHistogram{};
+
+  for (const auto& chunk : chunks) {
+    if (chunk.streamIndex != 0) {
+      // given until the frame after the chunk is due, or a frame time for those before the first frame
+      if (!audioDecoded) {
+        const auto deadline = clockStartTime && videoChunkIndex < videoChunks.size()
+          ? clockStartTime.value() + frameTime * static_cast<Clock::rep>(videoChunks[videoChunkIndex].blockIndex)
+          : startTime + frameTime;
+        audioDecoded = audioDecoder->WaitUntil(deadline);
+      }
+
+      writeSource(chunk.dataOffset);
+      if (audioDecoded) {
+        writeSource(chunk.dataOffset + chunk.size);
+      } else {
+        writeFill(chunk.size, silence);
+        numSilencedBlocks++;
+      }
+      continue;
+    }
+
+    // the chunk is written at the time of the frame, and given up at the end of it
+    // the first frame (which has nothing to repeat) is waited for, and starts the clock
+    // a chunk needs room for the headers of the empty chunk and JUNK to be given up
+    const auto paddedSize = (static_cast<std::uint64_t>(chunk.size) + 1) / 2 * 2;
+    std::optional<Clock::time_point> frameStartTime;
+    std::optional<Clock::time_point> deadline;
+    if (clockStartTime) {
+      frameStartTime = clockStartTime.value() + frameTime * static_cast<Clock::rep>(chunk.blockIndex);
+      if (paddedSize >= 8) {
+        deadline = frameStartTime.value() + frameTime;
+      }
+    }
+
+    const auto data = decoder.Take(videoChunkIndex++, deadline);
+
+    if (!data) {
+      std::uint8_t header[16];
+      source.Read(header, 8, static_cast<std::streamsize>(chunk.chunkOffset));
+      const std::uint32_t junkSize = static_cast<std::uint32_t>(paddedSize - 8);
+      const std::uint32_t junkId = AVI::GetFourCC("JUNK");
+      std::memset(header + 4, 0, 4);
+      std::memcpy(header + 8, &junkId, 4);
+      std::memcpy(header + 12, &junkSize, 4);
+
+      writeSource(chunk.chunkOffset);
+      output.Write(header, sizeof(header));
+      offset += sizeof(header);
+      writeFill(junkSize, 0);
+      numDroppedFrames++;
+
+      // the entries tell the size 0 of the empty chunk and that it is not a keyframe, as for a repeated frame:
+      // no AVIIF_KEYFRAME in idx1 and AVISTDINDEX_DELTAFRAME in ix##
+      const auto [begin, end] = indexedBlocks.equal_range(chunk.chunkOffset);
+      for (auto itr = begin; itr != end; itr++) {
+        const auto& block = *itr->second;
+        if (block.idx1EntryOffset) {
+          patchedIndexFields.emplace(block.idx1EntryOffset + offsetof(AVI::AVIINDEXENTRY, dwFlags), 0);
+          patchedIndexFields.emplace(block.idx1EntryOffset + offsetof(AVI::AVIINDEXENTRY, dwChunkLength), 0);
+        }
+        patchedIndexFields.emplace(block.ixxxEntryOffset + offsetof(AVI::AVISTDINDEXENTRY, dwSize), AVI::AVISTDINDEX_DELTAFRAME);
+      }
+      continue;
+    }
+
+    if (frameStartTime) {
+      std::this_thread::sleep_until(frameStartTime.value());
+    } else {
+      frameStartTime = Clock::now();
+      clockStartTime = frameStartTime.value() - frameTime * static_cast<Clock::rep>(chunk.blockIndex);
+      firstFrameTime = frameStartTime;
+    }
+
+    writeSource(chunk.dataOffset);
+    output.Write(data.get(), chunk.size);
+    offset += chunk.size;
+    numWrittenFrames++;
+
+    // from the time of the frame until it has been written
+    const auto latencyFrames = static_cast<std::uint_fast32_t>((Clock::now() - frameStartTime.value()) / frameTime);
+    const auto latencyClass = std::upper_bound(LatencyClassBounds.cbegin(), LatencyClassBounds.cend(), latencyFrames) - LatencyClassBounds.cbegin();
+    latencyHistogram[latencyClass]++;
+  }
+
+  writeSource(totalSize);
+
+  if (!showMessage) {
+    return;
+  }
+
+  const auto toMilliseconds = [] (Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  };
+
+  std::wcerr << L"[live] "sv << numWrittenFrames << L" frames written, "sv << numDroppedFrames << L" dropped (the previous frame repeated), "sv
+             << numSilencedBlocks << L" audio blocks silenced; first frame after "sv
+             << (firstFrameTime ? toMilliseconds(firstFrameTime.value() - startTime) : 0.) << L" ms"sv << std::endl;
+
+  std::wcerr << L"[live] latency in frame times:"sv;
+  std::uint_fast32_t lowerBound = 0;
+  for (std::size_t i = 0; i < LatencyClassBounds.size(); i++) {
+    std::wcerr << L" "sv << lowerBound << L"-"sv << LatencyClassBounds[i] << L": "sv << latencyHistogram[i] << L","sv;
+    lowerBound = LatencyClassBounds[i];
+  }
+  std::wcerr << L" "sv << lowerBound << L"+: "sv << latencyHistogram.back() << L", dropped: "sv << numDroppedFrames << std::endl;
+}
@@ -0,0 +1,22 @@
+#ifndef ML_LIVEOUTPUT_HPP
+#define ML_LIVEOUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MEIToAVI.hpp"
+#include "StreamOutput.hpp"
+
+
+// writes the AVI in real time for a player which plays it as it arrives (e.g. "ffplay -" reading a pipe)
+// the output is paced by the clock of the video stream (dwRate / dwScale), which starts when the first frame is written,
+// while another thread decodes the frames at most lookAheadFrames ahead of the output
+// a frame not decoded by the end of its frame time is replaced by a zero-length chunk (the previous frame is repeated)
+// followed by JUNK over the rest of the chunk, so the layout stays the same, and its entries in idx1 and ix## are
+// written with size 0 and as not a keyframe; likewise, audio which is not decoded by the time of the frame it precedes
+// is written as silence
+// the latency of the frames and the drops are reported to std::wcerr if showMessage is set
+// DedupFrames and UtVideo analyze every frame before GetSource() is available, so they defeat the purpose
+void WriteLive(MEIToAVI& meiToAvi, StreamOutput& output, std::uint_fast32_t lookAheadFrames, std::size_t bufferSize, bool showMessage);
+
+#endif
@@ -1,6 +1,7 @@
 #define NOMINMAX
 
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
@@ -9,19 +10,36 @@
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "MEIToAVI.hpp"
 #include "ApproxFraction.hpp"
+#include "AudioDecoder.hpp"
 #include "AVI.hpp"
 #include "AVIBuilder.hpp"
 #include "Fraction.hpp"
+#include "FrameTransform.hpp"
+#include "Interleave.hpp"
+#include "Kernel/Copy.hpp"
+#include "Kernel/Hash.hpp"
+#include "Manifest.hpp"
+#include "MKVBuilder.hpp"
+#include "Movie.hpp"
+#include "RIFF/RIFFChunk.hpp"
+#include "RIFF/RIFFList.hpp"
+#include "RIFF/RIFFRoot.hpp"
+#include "ThreadPool.hpp"
 #include "Source/CachedSource.hpp"
 #include "Source/MemorySource.hpp"
+#include "Source/NullSource.hpp"
 #include "Source/PartialSource.hpp"
+#include "Codec/UtVideoEncoder.hpp"
 
 #include <Windows.h>
 
@@ -63,79 +81,424 @@ namespace {
 #pragma pack(pop)
 
 
-  void CheckError(SSystem::SError error, const std::string& message) {
-    if (error != SSystem::SError::errSuccess) {
-      throw std::runtime_error(message);
+  // number of frames examined by -autocrop
+  constexpr std::uint_fast32_t AutoCropSamples = 16;
+
+  // written to ISFT of the AVI and to MuxingApp / WritingApp of the Matroska file
+  constexpr char ApplicationName[] = "mei2avi v0.2.0";
+
+
+  // decodes a frame for the output and reports it to the observer
+  // observer may be null, or point to an empty function
+  const std::uint8_t* DecodeOutputFrame(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t frameIndex, const MEIToAVI::FrameObserver* observer) {
+    const auto ptrImage = Movie::GetFrameImageBuffer(movieFilePlayer, frameIndex);
+    if (observer && *observer) {
+      (*observer)(frameIndex, ptrImage);
     }
+    return ptrImage;
   }
 
 
   class FrameImageSource : public SourceBase {
     ERISA::SGLMovieFilePlayer* mPtrMovieFilePlayer;
+    std::shared_ptr<FrameTransform> mTransform;   // null if the decoded image is stored as is
+    std::shared_ptr<MEIToAVI::FrameObserver> mFrameObserver;
     std::size_t mFrameIndex;
     std::size_t mSize;
 
   public:
-    FrameImageSource(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t frameIndex) :
+    FrameImageSource(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::shared_ptr<FrameTransform> transform, std::shared_ptr<MEIToAVI::FrameObserver> frameObserver, std::uint_fast32_t frameIndex) :
       mPtrMovieFilePlayer(&movieFilePlayer),
+      mTransform(transform),
+      mFrameObserver(frameObserver),
       mFrameIndex(frameIndex),
       mSize(0)
     {
-      const auto size = mPtrMovieFilePlayer->CurrentFrame()->GetImageSize();
-      mSize = size.w * size.h * 4;
+      if (mTransform) {
+        mSize = mTransform->GetOutputSize();
+      } else {
+        const auto size = mPtrMovieFilePlayer->CurrentFrame()->GetImageSize();
+        mSize = size.w * size.h * 4;
+      }
+    }
+
+    std::streamsize GetSize() const override {
+      return mSize;
+    }
+
+    void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override {
+      const auto ptrImage = DecodeOutputFrame(*mPtrMovieFilePlayer, static_cast<std::uint_fast32_t>(mFrameIndex), mFrameObserver.get());
+      if (!mTransform) {
+        Kernel::Copy(data, ptrImage + offset, size);
+        return;
+      }
+      // CachedSource always reads the whole frame, so the transform writes directly into its buffer
+      if (offset == 0 && size == mSize) {
+        mTransform->Apply(ptrImage, data);
+        return;
+      }
+      auto buffer = std::make_unique<std::uint8_t[]>(mSize);
+      mTransform->Apply(ptrImage, buffer.get());
+      std::memcpy(data, buffer.get() + offset, size);
+    }
+  };
+
+
+  // shared by MeiVideoStream and EncodedFrameSource
+  struct FrameEncoder {
+    UtVideoEncoder encoder;
+    std::unique_ptr<std::uint8_t[]> buffer;
+    std::shared_ptr<FrameTransform> transform;      // null if the decoded image is encoded as is
+    std::unique_ptr<std::uint8_t[]> transformBuffer;
+
+    FrameEncoder(std::uint_fast32_t width, std::uint_fast32_t height, bool hasAlpha, std::uint_fast32_t numSlices, std::uint_fast32_t numThreads, std::shared_ptr<FrameTransform> transform) :
+      encoder(width, height, hasAlpha, numSlices, numThreads),
+      buffer(std::make_unique<std::uint8_t[]>(encoder.GetMaxEncodedSize())),
+      transform(transform),
+      transformBuffer(transform ? std::make_unique<std::uint8_t[]>(transform->GetOutputSize()) : nullptr)
+    {}
+
+    // image is a decoded frame
+    std::size_t Encode(const std::uint8_t* image) {
+      if (transform) {
+        transform->Apply(image, transformBuffer.get());
+        image = transformBuffer.get();
+      }
+      return encoder.Encode(image, buffer.get());
     }
+  };
+
+
+  class EncodedFrameSource : public SourceBase {
+    ERISA::SGLMovieFilePlayer* mPtrMovieFilePlayer;
+    std::shared_ptr<FrameEncoder> mEncoder;
+    std::shared_ptr<MEIToAVI::FrameObserver> mFrameObserver;
+    std::uint_fast32_t mFrameIndex;
+    std::size_t mSize;
+
+  public:
+    EncodedFrameSource(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::shared_ptr<FrameEncoder> encoder, std::shared_ptr<MEIToAVI::FrameObserver> frameObserver, std::uint_fast32_t frameIndex, std::size_t size) :
+      mPtrMovieFilePlayer(&movieFilePlayer),
+      mEncoder(encoder),
+      mFrameObserver(frameObserver),
+      mFrameIndex(frameIndex),
+      mSize(size)
+    {}
 
     std::streamsize GetSize() const override {
       return mSize;
     }
 
     void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override {
-      mPtrMovieFilePlayer->SeekToFrame(mFrameIndex);
-      const auto ptrCurrentFrame = mPtrMovieFilePlayer->CurrentFrame();
-      // hack
-      const auto ptrSmartImage = static_cast<SakuraGL::SGLSmartImage*>(ptrCurrentFrame);
-      const auto ptrImageBuffer = ptrSmartImage->GetImage();
-      std::memcpy(data, ptrImageBuffer->ptrBuffer + offset, size);
+      // the encoder is deterministic, so the size must be the same as the one measured when the layout was built
+      if (mEncoder->Encode(DecodeOutputFrame(*mPtrMovieFilePlayer, mFrameIndex, mFrameObserver.get())) != mSize) {
+        throw std::runtime_error("EncodedFrameSource: encoded size mismatch");
+      }
+      std::memcpy(data, mEncoder->buffer.get() + offset, size);
     }
   };
 
 
   class MeiVideoStream : public AVIBuilder::AVIStream {
+    // how each frame is stored
+    // Unique:    the frame has its own chunk
+    // Repeat:    same as the previous frame, stored as a zero-length chunk
+    // Reference: same as an earlier frame, the index entries point to the chunk of that frame
+    enum class FrameType {
+      Unique,
+      Repeat,
+      Reference,
+    };
+
+    struct FrameInfo {
+      FrameType type;
+      std::uint_fast32_t referencedFrameIndex;
+      std::uint_fast32_t dataSize;
+    };
+
     ERISA::SGLMovieFilePlayer& mMovieFilePlayer;
     CacheStorage& mCacheStorage;
+    std::shared_ptr<FrameTransform> mTransform;   // null if the decoded image is stored as is
     std::uint_fast32_t mNumFrames;
-    std::uint_fast32_t mFrameDataSize;
+    std::uint_fast32_t mImageSize;                // size of a decoded frame
+    std::uint_fast32_t mFrameDataSize;            // size of an uncompressed output frame
+    std::uint_fast32_t mWidth;                    // of the output frame
+    std::uint_fast32_t mHeight;
+    bool mHasAlpha;
+    std::uint_fast32_t mCodecSlices;
     AVI::AVIStreamHeader mStrh;
     BITMAPINFOHEADER mStrf;
     std::shared_ptr<MemorySource> mStrfMemorySource;
+    std::shared_ptr<FrameEncoder> mEncoder;     // null if uncompressed
+    std::vector<FrameInfo> mFrameInfoArray;     // empty if neither deduplication nor compression is enabled
+    std::shared_ptr<MEIToAVI::FrameObserver> mFrameObserver;    // shared with the frame sources, null for readers
+
+    // decodes all frames once to find duplicates and to measure the size of each encoded frame
+    void AnalyzeFrames(bool dedup, std::size_t historySize, bool showMessage) {
+      struct HistoryEntry {
+        std::uint_fast32_t frameIndex;
+        std::uint64_t hash;
+        std::unique_ptr<std::uint8_t[]> data;
+      };
+
+      // unique frames whose data are kept to verify hash matches with memcmp
+      // the oldest one is discarded first, so that the memory usage is bounded
+      std::vector<HistoryEntry> history;
+      std::unordered_multimap<std::uint64_t, std::size_t> historyMap;   // hash -> position in history
+      std::size_t historyNext = 0;
+
+      auto previousFrame = dedup ? std::make_unique<std::uint8_t[]>(mImageSize) : nullptr;
+      std::uint64_t previousHash = 0;
+
+      std::chrono::steady_clock::duration hashTime{};
+      std::uint_fast32_t numRepeats = 0;
+      std::uint_fast32_t numReferences = 0;
+
+      std::chrono::steady_clock::duration encodeTime{};
+      std::uint_fast32_t numEncodedFrames = 0;
+      std::uint_fast64_t totalEncodedSize = 0;
+
+      mFrameInfoArray.clear();
+      mFrameInfoArray.reserve(mNumFrames);
+
+      for (std::uint_fast32_t frameIndex = 0; frameIndex < mNumFrames; frameIndex++) {
+        const auto ptrImage = Movie::GetFrameImageBuffer(mMovieFilePlayer, frameIndex);
+
+        FrameInfo frameInfo{
+          FrameType::Unique,
+          frameIndex,
+          mFrameDataSize,
+        };
+
+        if (dedup) {
+          const auto hashStartTime = std::chrono::steady_clock::now();
+          const auto hash = Kernel::Hash(ptrImage, mImageSize);
+          hashTime += std::chrono::steady_clock::now() - hashStartTime;
+
+          if (frameIndex != 0 && hash == previousHash && std::memcmp(ptrImage, previousFrame.get(), mImageSize) == 0) {
+            frameInfo.type = FrameType::Repeat;
+            frameInfo.referencedFrameIndex = mFrameInfoArray[frameIndex - 1].referencedFrameIndex;
+            numRepeats++;
+          } else {
+            const auto range = historyMap.equal_range(hash);
+            for (auto itr = range.first; itr != range.second; itr++) {
+              const auto& entry = history[itr->second];
+              if (std::memcmp(ptrImage, entry.data.get(), mImageSize) == 0) {
+                frameInfo.type = FrameType::Reference;
+                frameInfo.referencedFrameIndex = entry.frameIndex;
+                numReferences++;
+                break;
+              }
+            }
+
+            std::memcpy(previousFrame.get(), ptrImage, mImageSize);
+            previousHash = hash;
+          }
+
+          if (frameInfo.type == FrameType::Unique && historySize) {
+            if (history.size() < historySize) {
+              history.push_back(HistoryEntry{
+                0,
+                0,
+                std::make_unique<std::uint8_t[]>(mImageSize),
+              });
+              historyNext = history.size() - 1;
+            } else {
+              // evict the oldest one
+              historyNext = (historyNext + 1) % historySize;
+              const auto range = historyMap.equal_range(history[historyNext].hash);
+              for (auto itr = range.first; itr != range.second; itr++) {
+                if (itr->second == historyNext) {
+                  historyMap.erase(itr);
+                  break;
+                }
+              }
+            }
+
+            auto& entry = history[historyNext];
+            entry.frameIndex = frameIndex;
+            entry.hash = hash;
+            std::memcpy(entry.data.get(), ptrImage, mImageSize);
+            historyMap.emplace(hash, historyNext);
+          }
+        }
+
+        if (frameInfo.type == FrameType::Unique) {
+          if (mEncoder) {
+            const auto encodeStartTime = std::chrono::steady_clock::now();
+            frameInfo.dataSize = static_cast<std::uint_fast32_t>(mEncoder->Encode(ptrImage));
+            encodeTime += std::chrono::steady_clock::now() - encodeStartTime;
+            numEncodedFrames++;
+            totalEncodedSize += frameInfo.dataSize;
+          }
+        } else {
+          frameInfo.dataSize = mFrameInfoArray[frameInfo.referencedFrameIndex].dataSize;
+        }
+
+        mFrameInfoArray.push_back(frameInfo);
+      }
+
+      if (!showMessage) {
+        return;
+      }
+
+      if (dedup) {
+        const double hashSeconds = std::chrono::duration<double>(hashTime).count();
+        const double totalMiB = static_cast<double>(mImageSize) * mNumFrames / (1024. * 1024.);
+        const auto numDuplicates = numRepeats + numReferences;
+
+        std::wcerr << L"[info] dedup: "sv << numDuplicates << L" / "sv << mNumFrames << L" frames are duplicates ("sv
+                   << (mNumFrames ? 100. * numDuplicates / mNumFrames : 0.) << L"%, "sv
+                   << numRepeats << L" repeats, "sv << numReferences << L" references)"sv << std::endl;
+        std::wcerr << L"[info] dedup: hashed "sv << totalMiB << L" MiB in "sv << hashSeconds << L" s ("sv
+                   << (hashSeconds > 0. ? totalMiB / hashSeconds : 0.) << L" MiB/s)"sv << std::endl;
+      }
+
+      if (mEncoder) {
+        const double encodeSeconds = std::chrono::duration<double>(encodeTime).count();
+        const double rawMiB = static_cast<double>(mFrameDataSize) * numEncodedFrames / (1024. * 1024.);
+        const double encodedMiB = static_cast<double>(totalEncodedSize) / (1024. * 1024.);
+
+        std::wcerr << L"[info] utvideo: encoded "sv << numEncodedFrames << L" frames, "sv
+                   << rawMiB << L" MiB -> "sv << encodedMiB << L" MiB ("sv
+                   << (rawMiB > 0. ? 100. * encodedMiB / rawMiB : 0.) << L"%) in "sv << encodeSeconds << L" s ("sv
+                   << (encodeSeconds > 0. ? rawMiB / encodeSeconds : 0.) << L" MiB/s, "sv
+                   << (encodeSeconds > 0. ? numEncodedFrames / encodeSeconds : 0.) << L" fps)"sv << std::endl;
+      }
+    }
 
   public:
-    MeiVideoStream(ERISA::SGLMovieFilePlayer& movieFilePlayer, CacheStorage& cacheStorage, const AVI::AVIStreamHeader& strh) :
+    MeiVideoStream(ERISA::SGLMovieFilePlayer& movieFilePlayer, CacheStorage& cacheStorage, std::shared_ptr<FrameTransform> transform, const AVI::AVIStreamHeader& strh, const MEIToAVI::Options& options, bool hasAlpha) :
       mMovieFilePlayer(movieFilePlayer),
       mCacheStorage(cacheStorage),
+      mTransform(transform),
       mNumFrames(static_cast<std::uint_fast32_t>(mMovieFilePlayer.GetAllFrameCount())),
+      mImageSize(0),
       mFrameDataSize(0),
+      mWidth(0),
+      mHeight(0),
+      mHasAlpha(hasAlpha),
+      mCodecSlices(options.codecSlices),
       mStrh(strh),
       mStrf{},
-      mStrfMemorySource()
+      mStrfMemorySource(),
+      mEncoder(),
+      mFrameInfoArray(),
+      mFrameObserver(std::make_shared<MEIToAVI::FrameObserver>())
     {
-      const auto size = mMovieFilePlayer.CurrentFrame()->GetImageSize();
-      mFrameDataSize = size.w * size.h * 4;
+      const auto imageSize = mMovieFilePlayer.CurrentFrame()->GetImageSize();
+      mImageSize = imageSize.w * imageSize.h * 4;
+
+      const auto format = mTransform ? mTransform->GetFormat() : FrameTransform::PixelFormat::BGRA;
+      const std::uint_fast32_t width = mTransform ? mTransform->GetWidth() : imageSize.w;
+      const std::uint_fast32_t height = mTransform ? mTransform->GetHeight() : imageSize.h;
+      mFrameDataSize = mTransform ? static_cast<std::uint_fast32_t>(mTransform->GetOutputSize()) : mImageSize;
+      mWidth = width;
+      mHeight = height;
+
+      if (options.flags & MEIToAVI::UtVideo) {
+        if (format != FrameTransform::PixelFormat::BGRA) {
+          throw std::runtime_error("MeiVideoStream: Ut Video requires BGRA input");
+        }
+        mEncoder = std::make_shared<FrameEncoder>(width, height, hasAlpha, mCodecSlices, std::max(std::thread::hardware_concurrency(), 1u), mTransform);
+      }
 
-      mStrf = BITMAPINFOHEADER{
-        sizeof(BITMAPINFOHEADER),
-        static_cast<std::uint32_t>(size.w),
-        static_cast<std::uint32_t>(-size.h),
-        1u,
-        32u,
-        0u,   // BI_RGB
-        mFrameDataSize,
-        0u,
-        0u,
-        0u,
-        0u,
-      };
-      mStrfMemorySource = std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(&mStrf), sizeof(mStrf));
+      if (mEncoder) {
+        const auto& encoder = mEncoder->encoder;
+        const auto extraData = encoder.GetExtraData();
+
+        mStrh.fccHandler = encoder.GetFourCC();
+
+        // the codec draws the image top-down by itself
+        mStrf = BITMAPINFOHEADER{
+          static_cast<std::uint32_t>(sizeof(BITMAPINFOHEADER) + extraData.size()),
+          static_cast<std::uint32_t>(width),
+          static_cast<std::uint32_t>(height),
+          1u,
+          encoder.GetBitCount(),
+          encoder.GetFourCC(),
+          static_cast<std::uint32_t>(width * height * (encoder.GetBitCount() / 8)),
+          0u,
+          0u,
+          0u,
+          0u,
+        };
+
+        mStrfMemorySource = std::make_shared<MemorySource>(sizeof(mStrf) + extraData.size());
+        std::memcpy(mStrfMemorySource->GetData().get(), &mStrf, sizeof(mStrf));
+        std::memcpy(mStrfMemorySource->GetData().get() + sizeof(mStrf), extraData.data(), extraData.size());
+      } else if (format == FrameTransform::PixelFormat::I420) {
+        // YUV formats are always top-down
+        mStrh.fccHandler = AVI::GetFourCC("I420");
+
+        mStrf = BITMAPINFOHEADER{
+          sizeof(BITMAPINFOHEADER),
+          static_cast<std::uint32_t>(width),
+          static_cast<std::uint32_t>(height),
+          1u,
+          12u,
+          AVI::GetFourCC("I420"),
+          mFrameDataSize,
+          0u,
+          0u,
+          0u,
+          0u,
+        };
+        mStrfMemorySource = std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(&mStrf), sizeof(mStrf));
+      } else {
+        mStrf = BITMAPINFOHEADER{
+          sizeof(BITMAPINFOHEADER),
+          static_cast<std::uint32_t>(width),
+          static_cast<std::uint32_t>(-static_cast<std::int32_t>(height)),
+          1u,
+          format == FrameTransform::PixelFormat::BGR24 ? 24u : 32u,
+          0u,   // BI_RGB
+          mFrameDataSize,
+          0u,
+          0u,
+          0u,
+          0u,
+        };
+        mStrfMemorySource = std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(&mStrf), sizeof(mStrf));
+      }
+
+      const bool dedup = options.flags & MEIToAVI::DedupFrames;
+      if (dedup || mEncoder) {
+        AnalyzeFrames(dedup, options.dedupHistorySize, !(options.flags & MEIToAVI::NoMessage));
+      }
+    }
+
+    // shares the analysis results and the headers with other, but decodes with another player
+    // the transform and the encoder have their own work buffers, so they are not shared
+    MeiVideoStream(const MeiVideoStream& other, ERISA::SGLMovieFilePlayer& movieFilePlayer, CacheStorage& cacheStorage, std::uint_fast32_t numEncoderThreads) :
+      mMovieFilePlayer(movieFilePlayer),
+      mCacheStorage(cacheStorage),
+      mTransform(other.mTransform ? std::make_shared<FrameTransform>(*other.mTransform) : nullptr),
+      mNumFrames(other.mNumFrames),
+      mImageSize(other.mImageSize),
+      mFrameDataSize(other.mFrameDataSize),
+      mWidth(other.mWidth),
+      mHeight(other.mHeight),
+      mHasAlpha(other.mHasAlpha),
+      mCodecSlices(other.mCodecSlices),
+      mStrh(other.mStrh),
+      mStrf(other.mStrf),
+      mStrfMemorySource(other.mStrfMemorySource),
+      mEncoder(other.mEncoder ? std::make_shared<FrameEncoder>(mWidth, mHeight, mHasAlpha, mCodecSlices, numEncoderThreads, mTransform) : nullptr),
+      mFrameInfoArray(other.mFrameInfoArray),
+      mFrameObserver()
+    {}
+
+    // the frame sources are already built, so the observer is set through the shared holder
+    void SetFrameObserver(MEIToAVI::FrameObserver observer) {
+      if (!mFrameObserver) {
+        throw std::runtime_error("MeiVideoStream: frame observer is not available");
+      }
+      *mFrameObserver = std::move(observer);
+    }
+
+    std::uint_fast32_t GetUniqueFrameIndex(std::uint_fast32_t index) const {
+      return mFrameInfoArray.empty() ? index : mFrameInfoArray[index].referencedFrameIndex;
     }
 
     std::uint32_t GetFourCC() const override {
@@ -148,8 +511,27 @@ namespace {
     }
 
     BlockInfo GetBlockInfo(std::uint_fast32_t index) const override {
+      if (mFrameInfoArray.empty()) {
+        return BlockInfo{
+          mFrameDataSize,
+          index,
+          1,
+          AVI::AVIIF_KEYFRAME,
+        };
+      }
+
+      const auto& frameInfo = mFrameInfoArray[index];
+      if (frameInfo.type == FrameType::Repeat) {
+        // a zero-length chunk means "repeat the previous frame"
+        return BlockInfo{
+          0,
+          index,
+          1,
+          0,
+        };
+      }
       return BlockInfo{
-        mFrameDataSize,
+        frameInfo.dataSize,
         index,
         1,
         AVI::AVIIF_KEYFRAME,
@@ -157,7 +539,99 @@ namespace {
     }
 
     std::shared_ptr<SourceBase> GetBlockData(std::uint_fast32_t index) const override {
-      return std::make_shared<CachedSource>(mCacheStorage, std::make_shared<FrameImageSource>(mMovieFilePlayer, index));
+      std::size_t dataSize = mFrameDataSize;
+      if (!mFrameInfoArray.empty()) {
+        const auto& frameInfo = mFrameInfoArray[index];
+        if (frameInfo.type == FrameType::Repeat) {
+          return std::make_shared<NullSource>(0);
+        }
+        // the referenced frame is used when AVIBuilder cannot reuse its chunk
+        index = frameInfo.referencedFrameIndex;
+        dataSize = frameInfo.dataSize;
+      }
+      if (mEncoder) {
+        return std::make_shared<CachedSource>(mCacheStorage, std::make_shared<EncodedFrameSource>(mMovieFilePlayer, mEncoder, mFrameObserver, index, dataSize));
+      }
+      return std::make_shared<CachedSource>(mCacheStorage, std::make_shared<FrameImageSource>(mMovieFilePlayer, mTransform, mFrameObserver, index));
+    }
+
+    std::optional<std::uint_fast32_t> GetReferencedBlock(std::uint_fast32_t index) const override {
+      if (mFrameInfoArray.empty() || mFrameInfoArray[index].type != FrameType::Reference) {
+        return std::nullopt;
+      }
+      return mFrameInfoArray[index].referencedFrameIndex;
+    }
+
+    AVI::AVIStreamHeader GetStrh() override {
+      return mStrh;
+    }
+
+    std::shared_ptr<SourceBase> GetStrf() override {
+      return mStrfMemorySource;
+    }
+  };
+
+
+  // the layout of MeiVideoStream with frames of another size (uncompressed BGR24), whose data are left zero-filled
+  // used for the proxy output, where the frames are written in place afterwards
+  class PlaceholderVideoStream : public AVIBuilder::AVIStream {
+    std::shared_ptr<AVIBuilder::AVIStream> mBaseStream;
+    std::uint_fast32_t mFrameDataSize;
+    AVI::AVIStreamHeader mStrh;
+    BITMAPINFOHEADER mStrf;
+    std::shared_ptr<MemorySource> mStrfMemorySource;
+
+  public:
+    PlaceholderVideoStream(std::shared_ptr<AVIBuilder::AVIStream> baseStream, std::uint_fast32_t width, std::uint_fast32_t height, std::uint_fast32_t frameDataSize) :
+      mBaseStream(baseStream),
+      mFrameDataSize(frameDataSize),
+      mStrh(baseStream->GetStrh()),
+      mStrf{
+        sizeof(BITMAPINFOHEADER),
+        static_cast<std::uint32_t>(width),
+        static_cast<std::uint32_t>(-static_cast<std::int32_t>(height)),
+        1u,
+        24u,
+        0u,   // BI_RGB
+        frameDataSize,
+        0u,
+        0u,
+        0u,
+        0u,
+      },
+      mStrfMemorySource(std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(&mStrf), sizeof(mStrf)))
+    {
+      mStrh.fccHandler = AVI::GetFourCC("\0\0\0\0");
+      mStrh.dwSuggestedBufferSize = 0;
+      mStrh.rcFrame.left = 0;
+      mStrh.rcFrame.top = 0;
+      mStrh.rcFrame.right = static_cast<std::uint16_t>(width);
+      mStrh.rcFrame.bottom = static_cast<std::uint16_t>(height);
+    }
+
+    std::uint32_t GetFourCC() const override {
+      return mBaseStream->GetFourCC();
+    }
+
+    std::uint_fast32_t CountStreams() const override {
+      return mBaseStream->CountStreams();
+    }
+
+    BlockInfo GetBlockInfo(std::uint_fast32_t index) const override {
+      auto blockInfo = mBaseStream->GetBlockInfo(index);
+      // zero-length chunks (repeats) stay as they are
+      if (blockInfo.size) {
+        blockInfo.size = mFrameDataSize;
+      }
+      return blockInfo;
+    }
+
+    std::shared_ptr<SourceBase> GetBlockData(std::uint_fast32_t index) const override {
+      return std::make_shared<NullSource>(GetBlockInfo(index).size);
+    }
+
+    std::optional<std::uint_fast32_t> GetReferencedBlock(std::uint_fast32_t index) const override {
+      return mBaseStream->GetReferencedBlock(index);
     }
 
     AVI::AVIStreamHeader GetStrh() override {
@@ -170,33 +644,61 @@ namespace {
   };
 
 
+  // the audio of an AudioDecoder, which is waited for on the first read
+  // the decoding is cancelled when the source is no longer used, e.g. when the conversion fails or only the layout is wanted
+  class DecodedAudioSource : public SourceBase {
+    std::shared_ptr<AudioDecoder> mDecoder;
+
+  public:
+    DecodedAudioSource(std::shared_ptr<AudioDecoder> decoder) :
+      mDecoder(decoder)
+    {}
+
+    ~DecodedAudioSource() {
+      mDecoder->Cancel();
+    }
+
+    std::streamsize GetSize() const override {
+      return static_cast<std::streamsize>(mDecoder->GetDataSize());
+    }
+
+    void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override {
+      mDecoder->Wait();
+      std::memcpy(data, mDecoder->GetData().get() + offset, size);
+    }
+  };
+
+
   class MeiAudioStream : public AVIBuilder::AVIStream {
     std::uint_fast32_t mAudioBlockSample;
     std::uint_fast32_t mBitsPerSample;
     std::uint_fast32_t mNumChannels;
     std::uint_fast32_t mSamplingRate;
+    bool mFloatingPoint;
     std::uint_fast32_t mBlockSize;
     std::uint_fast32_t mNumSamples;
     std::uint_fast32_t mNumBlocks;
     AVI::AVIStreamHeader mStrh;
     WAVEFORMATEX mStrf;
     std::shared_ptr<MemorySource> mStrfMemorySource;
-    std::shared_ptr<MemorySource> mFullAudioMemorySource;
+    std::shared_ptr<SourceBase> mFullAudioSource;
     std::vector<std::shared_ptr<SourceBase>> mBlockSources;
 
   public:
-    MeiAudioStream(std::shared_ptr<std::uint8_t[]> audioData, std::size_t audioDataSize, std::uint_fast32_t audioBlockSample, std::uint_fast32_t bitsPerSample, std::uint_fast32_t numChannels, std::uint_fast32_t samplingRate) :
+    // initialFrames: audio preload in video frames, by which AVIBuilder places the chunks ahead
+    MeiAudioStream(std::shared_ptr<SourceBase> audioSource, std::uint_fast32_t audioBlockSample, std::uint_fast32_t initialFrames, std::uint_fast32_t bitsPerSample, std::uint_fast32_t numChannels, std::uint_fast32_t samplingRate, bool floatingPoint) :
       mAudioBlockSample(audioBlockSample),
       mBitsPerSample(bitsPerSample),
       mNumChannels(numChannels),
       mSamplingRate(samplingRate),
+      mFloatingPoint(floatingPoint),
       mBlockSize(mBitsPerSample / 8 * mNumChannels),
-      mNumSamples(audioDataSize / mBlockSize),
+      mNumSamples(static_cast<std::uint_fast32_t>(audioSource->GetSize() / mBlockSize)),
       mNumBlocks((mNumSamples + audioBlockSample - 1) / audioBlockSample),
       mStrh(),
       mStrf{},
       mStrfMemorySource(),
-      mFullAudioMemorySource(std::make_shared<MemorySource>(audioData, audioDataSize)),
+      mFullAudioSource(audioSource),
       mBlockSources()
     {
       assert(mNumBlocks != 0);
@@ -207,7 +709,7 @@ namespace {
         0u,
         0u,
         0u,
-        0u,
+        static_cast<std::uint32_t>(initialFrames),
         1u,
         mSamplingRate,
         0u,
@@ -219,7 +721,7 @@ namespace {
       };
 
       mStrf = WAVEFORMATEX{
-        0x0001u,    // WAVE_FORMAT_PCM
+        static_cast<std::uint16_t>(mFloatingPoint ? 0x0003u : 0x0001u),    // WAVE_FORMAT_IEEE_FLOAT, WAVE_FORMAT_PCM
         static_cast<std::uint16_t>(mNumChannels),
         static_cast<std::uint32_t>(mSamplingRate),
         static_cast<std::uint32_t>(mSamplingRate * mBlockSize),
@@ -230,14 +732,15 @@ namespace {
 
       mBlockSources.reserve(mNumBlocks);
 
+      const std::size_t audioDataSize = static_cast<std::size_t>(mFullAudioSource->GetSize());
       const std::size_t audioBlockSize = mAudioBlockSample * mBlockSize;
 
       std::size_t offset = 0;
       for (std::size_t i = 0; i < mNumBlocks - 1; i++) {
-        mBlockSources.push_back(std::make_shared<PartialSource>(mFullAudioMemorySource, offset, audioBlockSize));
+        mBlockSources.push_back(std::make_shared<PartialSource>(mFullAudioSource, offset, audioBlockSize));
         offset += audioBlockSize;
       }
-      mBlockSources.push_back(std::make_shared<PartialSource>(mFullAudioMemorySource, offset, audioDataSize - offset));
+      mBlockSources.push_back(std::make_shared<PartialSource>(mFullAudioSource, offset, audioDataSize - offset));
     }
 
     std::uint32_t GetFourCC() const override {
@@ -262,6 +765,10 @@ namespace {
       return mBlockSources[index];
     }
 
+    std::shared_ptr<SourceBase> GetAudioData() const {
+      return mFullAudioSource;
+    }
+
     AVI::AVIStreamHeader GetStrh() override {
       return mStrh;
     }
@@ -270,27 +777,154 @@ namespace {
       return mStrfMemorySource;
     }
   };
+
+
+  std::shared_ptr<SourceBase> BuildAVI(std::shared_ptr<AVIBuilder::AVIStream> videoStream, std::shared_ptr<AVIBuilder::AVIStream> audioStream, const MEIToAVI::Options& options, std::vector<AVIBuilder::BlockLayout>& blockLayout, bool showMessage) {
+    // the aligned JUNK can be left as a hole in sparse output files; streams keep the size given by -junksize
+    AVIBuilder aviBuilder((options.flags & MEIToAVI::SparseOutput ? AVIBuilder::AlignJunk : 0) | (options.flags & MEIToAVI::GroupRecords ? AVIBuilder::GroupRecords : 0));
+
+    aviBuilder.SetJunkSize(options.junkChunkSize);
+    aviBuilder.SetChunkAlignment(options.chunkAlignment);
+
+    auto listInfo = std::make_shared<RIFFList>(AVI::GetFourCC("LIST"), AVI::GetFourCC("INFO"));
+
+    auto isftMemorySource = std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(ApplicationName), sizeof(ApplicationName));
+    auto isft = std::make_shared<RIFFChunk>(AVI::GetFourCC("ISFT"), isftMemorySource);
+    listInfo->AppendChild(isft);
+
+    aviBuilder.SetListInfo(listInfo);
+
+    aviBuilder.SetAvihFlags(AVI::AVIF_HASINDEX | AVI::AVIF_ISINTERLEAVED | AVI::AVIF_TRUSTCKTYPE);
+
+    aviBuilder.AddStream(videoStream, true);
+    if (audioStream) {
+      aviBuilder.AddStream(audioStream, false);
+    }
+
+    auto avi = aviBuilder.BuildAVI();
+    blockLayout = aviBuilder.GetBlockLayout();
+
+    if (showMessage) {
+      // reference blocks have no chunk of their own
+      const auto numChunks = std::count_if(blockLayout.cbegin(), blockLayout.cend(), [] (const AVIBuilder::BlockLayout& block) {
+        return !block.reference;
+      });
+      std::wcerr << L"[info] "sv << numChunks << L" chunks, "sv << aviBuilder.GetIndexSize() << L" bytes of index"sv << std::endl;
+    }
+
+    if (showMessage && options.chunkAlignment) {
+      const auto paddingSize = aviBuilder.GetAlignmentPaddingSize();
+      std::wcerr << L"[info] chunk alignment: "sv << paddingSize << L" bytes of padding ("sv
+                 << (100.0 * paddingSize / avi->GetSize()) << L"% of the output)"sv << std::endl;
+    }
+    return avi;
+  }
+
+
+  std::shared_ptr<SourceBase> BuildMKV(std::shared_ptr<AVIBuilder::AVIStream> videoStream, std::shared_ptr<AVIBuilder::AVIStream> audioStream, std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+    MKVBuilder mkvBuilder;
+
+    mkvBuilder.SetApplicationName(ApplicationName);
+
+    mkvBuilder.AddStream(videoStream, true);
+    if (audioStream) {
+      mkvBuilder.AddStream(audioStream, false);
+    }
+
+    auto mkv = mkvBuilder.BuildMKV();
+    blockLayout = mkvBuilder.GetBlockLayout();
+    return mkv;
+  }
+
+
+  struct DemuxerReads {
+    std::uint_fast64_t numReads;
+    std::uint_fast64_t maxReadSize;
+  };
+
+
+  // stands in for a demuxer reading the AVI sequentially, which reads each element of LIST-movi (a chunk, or a whole LIST-rec)
+  // at once along with the header of the next one; only the headers are actually read
+  DemuxerReads CountDemuxerReads(SourceBase& source) {
+    const auto readU32 = [&source] (std::streamsize offset) {
+      std::uint32_t value = 0;
+      source.Read(reinterpret_cast<std::uint8_t*>(&value), sizeof(value), offset);
+      return value;
+    };
+
+    DemuxerReads demuxerReads{0, 0};
+
+    // RIFF-AVI and RIFF-AVIX
+    const auto fileSize = source.GetSize();
+    std::streamsize riffOffset = 0;
+    while (riffOffset + 12 <= fileSize) {
+      const auto riffEnd = riffOffset + 8 + readU32(riffOffset + 4);
+      std::streamsize offset = riffOffset + 12;
+      while (offset + 8 <= riffEnd) {
+        const auto size = readU32(offset + 4);
+        if (readU32(offset) == AVI::GetFourCC("LIST") && readU32(offset + 8) == AVI::GetFourCC("movi")) {
+          const auto moviEnd = offset + 8 + size;
+          std::streamsize elementOffset = offset + 12;
+          while (elementOffset + 8 <= moviEnd) {
+            const auto elementSize = 8 + (static_cast<std::uint_fast64_t>(readU32(elementOffset + 4)) + 1) / 2 * 2;
+            demuxerReads.numReads++;
+            demuxerReads.maxReadSize = std::max(demuxerReads.maxReadSize, elementSize);
+            elementOffset += static_cast<std::streamsize>(elementSize);
+          }
+        }
+        offset += 8 + (static_cast<std::streamsize>(size) + 1) / 2 * 2;
+      }
+      riffOffset = riffEnd;
+    }
+
+    return demuxerReads;
+  }
+
+
+  // the AVI, or the Matroska file with MEIToAVI::Matroska
+  std::shared_ptr<SourceBase> BuildOutput(std::shared_ptr<AVIBuilder::AVIStream> videoStream, std::shared_ptr<AVIBuilder::AVIStream> audioStream, const MEIToAVI::Options& options, std::vector<AVIBuilder::BlockLayout>& blockLayout, bool showMessage) {
+    if (options.flags & MEIToAVI::Matroska) {
+      return BuildMKV(videoStream, audioStream, blockLayout);
+    }
+    return BuildAVI(videoStream, audioStream, options, blockLayout, showMessage);
+  }
 }
 
 
 
-MEIToAVI::MEIToAVI(const std::wstring& filePath, const Options& options) :
+MEIToAVI::Reader::Reader(const std::wstring& filePath, const Options& options) :
   mCacheStorage(options.cacheStorageSize, options.cacheStorageLimit),
   mFile(),
   mMovieFilePlayer(),
   mAvi()
 {
-  // open file
-  {
-    auto file = SSystem::SFileOpener::DefaultNewOpenFile(filePath.c_str(), SSystem::SFileOpener::OpenFlag::modeRead | SSystem::SFileOpener::OpenFlag::shareRead);
-    if (!file) {
-      throw std::runtime_error("cannot open file"s);
-    }
-    mFile.reset(file);
-  }
+  Movie::Open(filePath, mFile, mMovieFilePlayer);
+}
+
+
+SourceBase& MEIToAVI::Reader::GetSource() {
+  return *mAvi;
+}
 
-  // open as video
-  CheckError(mMovieFilePlayer.OpenMovieFile(mFile.get(), false), "cannot open file as video"s);
+
+
+MEIToAVI::MEIToAVI(const std::wstring& filePath, const Options& options) :
+  mFilePath(filePath),
+  mOptions(options),
+  mCacheStorage(options.cacheStorageSize, options.cacheStorageLimit),
+  mFile(),
+  mMovieFilePlayer(),
+  mVideoStream(),
+  mAudioStream(),
+  mAudioDecoder(),
+  mBlockLayout(),
+  mVideoChunkOffsets(),
+  mTransformParameters(options.transform),
+  mImageWidth(0),
+  mImageHeight(0),
+  mAvi()
+{
+  Movie::Open(filePath, mFile, mMovieFilePlayer);
 
   // get media
   const auto& mediaFile = mMovieFilePlayer.GetMediaFile();
@@ -304,56 +938,43 @@ MEIToAVI::MEIToAVI(const std::wstring& filePath, const Options& options) :
 
 
   // load audio
-  std::shared_ptr<std::uint8_t[]> audioData;
-  std::size_t audioDataSize;
+  // the audio is decoded in the background while the video is set up, and the audio chunks wait for it when first read
+  std::shared_ptr<DecodedAudioSource> audioSource;
   std::uint_fast32_t audioBitsPerSample = 0;
   std::uint_fast32_t audioNumChannels = 0;
   std::uint_fast32_t audioSamplingRate = 0;
+  std::uint_fast32_t audioNumSamples = 0;
+  bool audioFloatingPoint = false;
 
   if (hasAudio) {
-    SSystem::SFile fileForSound;
-    CheckError(fileForSound.Open(filePath.c_str(), SSystem::SFileOpener::OpenFlag::modeRead | SSystem::SFileOpener::OpenFlag::shareRead), "cannot open file for audio"s);
-
-    ERISA::SGLSoundFilePlayer soundFilePlayer;
-    CheckError(soundFilePlayer.OpenSoundFile(&fileForSound, false), "cannot open file as audio"s);
-
-    audioBitsPerSample = soundFilePlayer.GetBitsPerSample();
-    audioNumChannels = soundFilePlayer.GetChannelCount();
-    audioSamplingRate = soundFilePlayer.GetFrequency();
-
-    const std::uint_fast32_t audioNumSamples = soundFilePlayer.GetTotalSampleCount();
-    const std::uint_fast32_t audioBlockSize = audioBitsPerSample / 8 * audioNumChannels;
-
     // f[^Sēǂݏo
     // \ߓǂł͎̂OɃ`N̔zu肵ĂKv邽
     // meit@Cł̔zû܂AVIɂ̂l͂Ŗʓ|
 
-    audioDataSize = audioNumSamples * audioBlockSize;
-    audioData = std::shared_ptr<std::uint8_t[]>(std::make_unique<std::uint8_t[]>(audioDataSize));
+    const auto audioDecoder = std::make_shared<AudioDecoder>(filePath, ThreadPool::GetShared().GetNumWorkers() + 1);
 
-    SSystem::SArray<std::uint8_t> audioBuffer;
-    std::uint_fast32_t offset = 0;
-    while (offset < audioDataSize) {
-      soundFilePlayer.GetNextWaveBuffer(audioBuffer);
-      std::memcpy(audioData.get() + offset, audioBuffer.GetArray(), audioBuffer.GetLength());
-      offset += audioBuffer.GetLength();
-
-#ifdef _DEBUG
-      OutputDebugStringW((L"Read audio: "s + std::to_wstring(offset) + L" / "s + std::to_wstring(audioDataSize) + L"\n"s).c_str());
-#endif
-    }
+    if (audioDecoder->GetDataSize()) {
+      // converted in the same background job
+      audioDecoder->SetTransform(options.audioTransform);
 
-    soundFilePlayer.Close();
-    fileForSound.Close();
+      const auto& audioFormat = audioDecoder->GetFormat();
+      audioBitsPerSample = audioFormat.bitsPerSample;
+      audioNumChannels = audioFormat.numChannels;
+      audioSamplingRate = audioFormat.samplingRate;
+      audioFloatingPoint = audioFormat.floatingPoint;
+      audioNumSamples = static_cast<std::uint_fast32_t>(audioDecoder->GetDataSize() / audioFormat.GetBlockSize());
 
-    if (!audioDataSize) {
+      audioDecoder->Start();
+      audioSource = std::make_shared<DecodedAudioSource>(audioDecoder);
+      mAudioDecoder = audioDecoder;
+    } else {
       hasAudio = false;
     }
   }
 
 
   // load video
-  const bool videoHasAlpha = !(options.flags & NoAlpha) && mediaFile.m_eriInfoHeader.fdwFormatType == 0x04000001 /*ERI_RGBA_IMAGE*/;
+  bool videoHasAlpha = !(options.flags & NoAlpha) && mediaFile.m_eriInfoHeader.fdwFormatType == 0x04000001 /*ERI_RGBA_IMAGE*/;
   const auto videoSize = mMovieFilePlayer.CurrentFrame()->GetImageSize();
   const auto videoNumFrames = static_cast<std::uint_fast32_t>(mMovieFilePlayer.GetAllFrameCount());
   const auto videoDurationMillis = static_cast<std::uint_fast32_t>(mMovieFilePlayer.GetTotalTime());
@@ -384,33 +1005,77 @@ MEIToAVI::MEIToAVI(const std::wstring& filePath, const Options& options) :
   }
 
 
-  // 1t[̃Tv
-  // SẴI[fBIubN͂̒Pʂɂ
-  // ꂽꍇ̓ubÑTv͕ςɃubN̈ʒu𒲐č킹
-  std::uint_fast32_t audioSamplesPerFrame = 0;
+  // crop, scale and convert
+  auto transformParameters = options.transform;
 
-  if (hasAudio) {
-    audioSamplesPerFrame = options.audioBlockSamples ? options.audioBlockSamples : audioSamplingRate * videoFPS.denominator / videoFPS.numerator;
+  if (options.flags & AutoCrop) {
+    const auto detectedBorders = Movie::DetectBorders(mMovieFilePlayer, AutoCropSamples);
+    if (detectedBorders) {
+      // manual margins are applied to the inside of the detected borders
+      transformParameters.crop.left += detectedBorders->left;
+      transformParameters.crop.top += detectedBorders->top;
+      transformParameters.crop.right += detectedBorders->right;
+      transformParameters.crop.bottom += detectedBorders->bottom;
+    }
+
+    if (!(options.flags & NoMessage)) {
+      if (detectedBorders) {
+        std::wcerr << L"[info] autocrop: detected borders (left, top, right, bottom) = ("sv
+                   << detectedBorders->left << L", "sv << detectedBorders->top << L", "sv << detectedBorders->right << L", "sv << detectedBorders->bottom << L")"sv << std::endl;
+      } else {
+        std::wcerr << L"[info] autocrop: no borders detected"sv << std::endl;
+      }
+    }
   }
 
+  mTransformParameters = transformParameters;
+  mImageWidth = videoSize.w;
+  mImageHeight = videoSize.h;
+
+  auto transform = std::make_shared<FrameTransform>(videoSize.w, videoSize.h, transformParameters);
+  if (transform->IsIdentity()) {
+    transform.reset();
+  } else {
+    // only BGRA keeps the alpha channel
+    if (transform->GetFormat() != FrameTransform::PixelFormat::BGRA) {
+      videoHasAlpha = false;
+    }
+
+    if (!(options.flags & NoMessage)) {
+      const auto& crop = transform->GetCrop();
+      std::wcerr << L"[info] output frame is "sv << transform->GetWidth() << L"x"sv << transform->GetHeight()
+                 << L" (crop (left, top, right, bottom) = ("sv << crop.left << L", "sv << crop.top << L", "sv << crop.right << L", "sv << crop.bottom << L"))"sv << std::endl;
+    }
+  }
 
-  AVIBuilder aviBuilder;
+  const auto outputWidth = transform ? transform->GetWidth() : static_cast<std::uint_fast32_t>(videoSize.w);
+  const auto outputHeight = transform ? transform->GetHeight() : static_cast<std::uint_fast32_t>(videoSize.h);
 
-  aviBuilder.SetJunkSize(options.junkChunkSize);
 
-  auto listInfo = std::make_shared<RIFFList>(AVI::GetFourCC("LIST"), AVI::GetFourCC("INFO"));
+  // 1ubÑTv
+  // SẴI[fBIubN͂̒Pʂɂ
+  // ꂽꍇ̓ubÑTv͕ςɃubN̈ʒu𒲐č킹
+  // the planner makes the blocks whole video frames long and preloads the audio within -interleave
+  Interleave::Plan interleavePlan{};
 
-  const char isftStr[] = "mei2avi v0.2.0";
-  auto isftMemorySource = std::make_shared<MemorySource>(reinterpret_cast<const std::uint8_t*>(isftStr), sizeof(isftStr));
-  auto isft = std::make_shared<RIFFChunk>(AVI::GetFourCC("ISFT"), isftMemorySource);
-  listInfo->AppendChild(isft);
+  if (hasAudio) {
+    interleavePlan = Interleave::PlanAudio(Interleave::Parameters{
+      videoFPS,
+      audioSamplingRate,
+      audioNumSamples,
+      options.audioBlockSamples,
+      options.interleaveMillis,
+    });
 
-  aviBuilder.SetListInfo(listInfo);
+    if (!(options.flags & NoMessage)) {
+      std::wcerr << L"[info] interleave: "sv << interleavePlan.numAudioBlocks << L" audio blocks of "sv << interleavePlan.audioBlockSamples << L" samples, preload "sv
+                 << interleavePlan.initialFrames << L" frames, up to "sv << interleavePlan.bufferMillis << L" ms of audio buffered by the player"sv << std::endl;
+    }
+  }
 
-  aviBuilder.SetAvihFlags(AVI::AVIF_HASINDEX | AVI::AVIF_ISINTERLEAVED | AVI::AVIF_TRUSTCKTYPE);
 
   // video stream
-  auto videoStream = std::make_shared<MeiVideoStream>(mMovieFilePlayer, mCacheStorage, AVI::AVIStreamHeader{
+  mVideoStream = std::make_shared<MeiVideoStream>(mMovieFilePlayer, mCacheStorage, transform, AVI::AVIStreamHeader{
     AVI::GetFourCC("vids"),
     videoHasAlpha ? AVI::GetFourCC("RGBA") : AVI::GetFourCC("\0\0\0\0"),
     0u,
@@ -427,23 +1092,217 @@ MEIToAVI::MEIToAVI(const std::wstring& filePath, const Options& options) :
     {
       0u,
       0u,
-      static_cast<std::uint16_t>(videoSize.w),
-      static_cast<std::uint16_t>(videoSize.h),
+      static_cast<std::uint16_t>(outputWidth),
+      static_cast<std::uint16_t>(outputHeight),
     },
-  });
-  aviBuilder.AddStream(videoStream, true);
+  }, options, videoHasAlpha);
 
   // audio stream
   if (hasAudio) {
-    auto audioStream = std::make_shared<MeiAudioStream>(audioData, audioDataSize, audioSamplesPerFrame, audioBitsPerSample, audioNumChannels, audioSamplingRate);
-    aviBuilder.AddStream(audioStream, false);
+    mAudioStream = std::make_shared<MeiAudioStream>(audioSource, interleavePlan.audioBlockSamples, interleavePlan.initialFrames, audioBitsPerSample, audioNumChannels, audioSamplingRate, audioFloatingPoint);
   }
 
 
-  mAvi = aviBuilder.BuildAVI();
+  mAvi = BuildOutput(mVideoStream, mAudioStream, options, mBlockLayout, !(options.flags & NoMessage));
+
+  // reference blocks have no chunk of their own
+  for (const auto& block : mBlockLayout) {
+    if (block.streamIndex == 0 && !block.reference) {
+      mVideoChunkOffsets.emplace_back(block.chunkOffset, block.blockIndex);
+    }
+  }
+  std::sort(mVideoChunkOffsets.begin(), mVideoChunkOffsets.end());
 }
 
 
 SourceBase& MEIToAVI::GetSource() {
   return *mAvi;
 }
+
+
+const std::vector<AVIBuilder::BlockLayout>& MEIToAVI::GetBlockLayout() const {
+  return mBlockLayout;
+}
+
+
+void MEIToAVI::WriteManifest(const std::wstring& binaryFilePath, const std::wstring& jsonFilePath) const {
+  // in the same order as added to AVIBuilder
+  std::vector<Manifest::StreamInfo> streams;
+  for (const auto& stream : {mVideoStream, mAudioStream}) {
+    if (!stream) {
+      continue;
+    }
+    const auto strh = stream->GetStrh();
+    streams.push_back(Manifest::StreamInfo{
+      AVIBuilder::GetChunkId(streams.size(), stream->GetFourCC()),
+      strh.fccType,
+      strh.dwScale,
+      strh.dwRate,
+    });
+  }
+
+  const auto fileSize = static_cast<std::uint64_t>(mAvi->GetSize());
+  Manifest::Write(binaryFilePath, fileSize, streams, mBlockLayout);
+  Manifest::WriteJSON(jsonFilePath, fileSize, streams, mBlockLayout);
+}
+
+
+void MEIToAVI::SetFrameObserver(FrameObserver observer) {
+  static_cast<MeiVideoStream&>(*mVideoStream).SetFrameObserver(std::move(observer));
+}
+
+
+std::uint_fast32_t MEIToAVI::GetUniqueFrameIndex(std::uint_fast32_t frameIndex) const {
+  return static_cast<const MeiVideoStream&>(*mVideoStream).GetUniqueFrameIndex(frameIndex);
+}
+
+
+std::uint_fast32_t MEIToAVI::CountFrames() const {
+  return mVideoStream->CountStreams();
+}
+
+
+const FrameTransform::Parameters& MEIToAVI::GetTransformParameters() const {
+  return mTransformParameters;
+}
+
+
+std::shared_ptr<FrameTransform> MEIToAVI::CreateFrameTransform(const FrameTransform::Parameters& parameters) const {
+  return std::make_shared<FrameTransform>(mImageWidth, mImageHeight, parameters);
+}
+
+
+std::size_t MEIToAVI::GetImageSize() const {
+  return static_cast<std::size_t>(mImageWidth) * mImageHeight * 4;
+}
+
+
+AVI::AVIStreamHeader MEIToAVI::GetVideoStreamHeader() const {
+  return mVideoStream->GetStrh();
+}
+
+
+std::shared_ptr<SourceBase> MEIToAVI::CreateVideoBlockSource(std::uint_fast32_t blockIndex) const {
+  return mVideoStream->GetBlockData(blockIndex);
+}
+
+
+std::shared_ptr<AudioDecoder> MEIToAVI::GetAudioDecoder() const {
+  return mAudioDecoder;
+}
+
+
+std::shared_ptr<SourceBase> MEIToAVI::BuildWAV() const {
+  if (!mAudioStream) {
+    return nullptr;
+  }
+
+  const auto audioData = static_cast<const MeiAudioStream&>(*mAudioStream).GetAudioData();
+
+  // sizes of RIFF chunks are 32-bit
+  constexpr std::streamsize MaxDataSize = 0xFFFFFFFF - 4 - 8 - sizeof(WAVEFORMATEX) - 8;
+  if (audioData->GetSize() > MaxDataSize) {
+    throw std::runtime_error("MEIToAVI: audio is too large for WAV");
+  }
+
+  RIFFRoot riffRoot;
+
+  auto riffWave = std::make_shared<RIFFList>(AVI::GetFourCC("RIFF"), AVI::GetFourCC("WAVE"));
+  riffRoot.AppendChild(riffWave);
+
+  riffWave->AppendChild(std::make_shared<RIFFChunk>(AVI::GetFourCC("fmt "), mAudioStream->GetStrf()));
+  riffWave->AppendChild(std::make_shared<RIFFChunk>(AVI::GetFourCC("data"), audioData));
+
+  riffRoot.CreateSource();
+  return riffRoot.GetSource();
+}
+
+
+std::shared_ptr<SourceBase> MEIToAVI::BuildPlaceholderAVI(const FrameTransform& transform, std::vector<AVIBuilder::BlockLayout>& blockLayout) const {
+  if (transform.GetFormat() != FrameTransform::PixelFormat::BGR24) {
+    throw std::runtime_error("MEIToAVI: placeholder frames must be BGR24");
+  }
+
+  auto videoStream = std::make_shared<PlaceholderVideoStream>(mVideoStream, transform.GetWidth(), transform.GetHeight(), static_cast<std::uint_fast32_t>(transform.GetOutputSize()));
+  return BuildAVI(videoStream, mAudioStream, mOptions, blockLayout, false);
+}
+
+
+void MEIToAVI::BenchContainers() const {
+  struct Container {
+    std::wstring_view name;
+    bool matroska;
+    bool groupRecords;
+  };
+
+  for (const auto& container : {Container{L"avi"sv, false, false}, Container{L"avi (rec)"sv, false, true}, Container{L"mkv"sv, true, false}}) {
+    auto options = mOptions;
+    options.flags = container.groupRecords ? options.flags | GroupRecords : options.flags & ~GroupRecords;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    std::vector<AVIBuilder::BlockLayout> blockLayout;
+    const auto source = container.matroska ? BuildMKV(mVideoStream, mAudioStream, blockLayout) : BuildAVI(mVideoStream, mAudioStream, options, blockLayout, false);
+
+    const auto buildTime = std::chrono::steady_clock::now() - startTime;
+
+    // everything but the data of the blocks stored in the file is the overhead of the container, including the padding
+    std::uint64_t payloadSize = 0;
+    std::uint_fast64_t numStoredBlocks = 0;
+    for (const auto& block : blockLayout) {
+      if (!block.reference && block.size) {
+        payloadSize += block.size;
+        numStoredBlocks++;
+      }
+    }
+    const auto totalSize = static_cast<std::uint64_t>(source->GetSize());
+    const auto overheadSize = totalSize - payloadSize;
+
+    std::wcerr << L"[bench] "sv << container.name << L": built in "sv << std::chrono::duration<double, std::milli>(buildTime).count() << L" ms, "sv
+               << totalSize << L" bytes, overhead "sv << overheadSize << L" bytes ("sv
+               << (totalSize ? 100. * overheadSize / totalSize : 0.) << L"%, "sv
+               << (numStoredBlocks ? static_cast<double>(overheadSize) / numStoredBlocks : 0.) << L" bytes per stored block)"sv;
+    if (!container.matroska) {
+      const auto demuxerReads = CountDemuxerReads(*source);
+      std::wcerr << L", "sv << demuxerReads.numReads << L" demuxer reads of up to "sv << demuxerReads.maxReadSize << L" bytes"sv;
+    }
+    std::wcerr << std::endl;
+  }
+}
+
+
+std::uint64_t MEIToAVI::EstimateSeekCost(std::uint64_t fromOffset, std::uint64_t toOffset) const {
+  // index of the video frame whose chunk contains (or last precedes) the offset
+  const auto getFrameIndex = [this] (std::uint64_t offset) -> std::uint64_t {
+    const auto itr = std::upper_bound(mVideoChunkOffsets.begin(), mVideoChunkOffsets.end(), std::make_pair(offset, std::numeric_limits<std::uint_fast32_t>::max()));
+    return itr == mVideoChunkOffsets.begin() ? 0 : std::prev(itr)->second;
+  };
+
+  const auto fromFrame = getFrameIndex(fromOffset);
+  const auto toFrame = getFrameIndex(toOffset);
+
+  // the current frame is still cached and the following ones are decoded in order,
+  // anything else makes the player seek to a key frame
+  if (toFrame >= fromFrame && toFrame - fromFrame < RandomSeekCost) {
+    return toFrame - fromFrame;
+  }
+  return RandomSeekCost;
+}
+
+
+std::unique_ptr<MEIToAVI::Reader> MEIToAVI::CreateReader(std::uint_fast32_t numEncoderThreads) const {
+  std::unique_ptr<Reader> reader(new Reader(mFilePath, mOptions));
+
+  // the audio stream only consists of stateless sources and can be shared as is
+  const auto& videoStream = static_cast<const MeiVideoStream&>(*mVideoStream);
+  auto readerVideoStream = std::make_shared<MeiVideoStream>(videoStream, reader->mMovieFilePlayer, reader->mCacheStorage, numEncoderThreads);
+
+  std::vector<AVIBuilder::BlockLayout> blockLayout;
+  reader->mAvi = BuildOutput(readerVideoStream, mAudioStream, mOptions, blockLayout, false);
+
+  if (reader->mAvi->GetSize() != mAvi->GetSize()) {
+    throw std::runtime_error("MEIToAVI: reader produced a different layout");
+  }
+
+  return reader;
+}
@@ -1,12 +1,20 @@
 #ifndef ML_MEITOAVi_HPP
 #define ML_MEITOAVi_HPP
 
+#include "AudioDecoder.hpp"
+#include "AudioTransform.hpp"
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
 #include "CacheStorage.hpp"
+#include "FrameTransform.hpp"
 #include "RIFF/RIFFRoot.hpp"
 #include "Source/SourceBase.hpp"
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <sakuraglx/sakuraglx.h>
 #include <sakuragl/sgl_erisa_lib.h>
@@ -18,6 +26,12 @@ public:
   static constexpr unsigned int NoAudio     = 0x0002;
   static constexpr unsigned int NoAlpha     = 0x0004;
   static constexpr unsigned int NoApproxFPS = 0x0008;
+  static constexpr unsigned int DedupFrames = 0x0010;
+  static constexpr unsigned int UtVideo     = 0x0020;
+  static constexpr unsigned int AutoCrop    = 0x0040;
+  static constexpr unsigned int Matroska    = 0x0080;   // build a Matroska file instead of an AVI
+  static constexpr unsigned int GroupRecords = 0x0100;  // wrap each interleave period of the AVI in LIST-rec
+  static constexpr unsigned int SparseOutput = 0x0200;  // the AVI is written into a file which may be sparse; JUNK is aligned to become a hole
 
   struct Options {
     unsigned int flags;
@@ -25,18 +39,98 @@ public:
     std::size_t cacheStorageLimit;
     std::uint_fast32_t audioBlockSamples;
     std::uint_fast32_t junkChunkSize;
+    std::size_t dedupHistorySize;
+    std::uint_fast32_t codecSlices;
+    FrameTransform::Parameters transform;
+    std::uint_fast32_t chunkAlignment;
+    AudioTransform::Parameters audioTransform;
+    std::uint_fast32_t interleaveMillis;    // bound of the audio buffered by a player, see Interleave
+  };
+
+  // receives a decoded frame (top-down BGRA) with its index
+  using FrameObserver = std::function<void(std::uint_fast32_t frameIndex, const std::uint8_t* image)>;
+
+  // estimated number of frames decoded when the player has to seek (to a key frame)
+  static constexpr std::uint64_t RandomSeekCost = 30;
+
+  // another decoder instance producing exactly the same AVI
+  // used to read different ranges of the output concurrently
+  class Reader {
+    CacheStorage mCacheStorage;
+    std::unique_ptr<SSystem::SFileInterface> mFile;
+    ERISA::SGLMovieFilePlayer mMovieFilePlayer;
+    std::shared_ptr<SourceBase> mAvi;
+
+    friend class MEIToAVI;
+
+    Reader(const std::wstring& filePath, const Options& options);
+
+  public:
+    SourceBase& GetSource();
   };
 
 private:
+  std::wstring mFilePath;
+  Options mOptions;
   CacheStorage mCacheStorage;
   std::unique_ptr<SSystem::SFileInterface> mFile;
   ERISA::SGLMovieFilePlayer mMovieFilePlayer;
+  std::shared_ptr<AVIBuilder::AVIStream> mVideoStream;
+  std::shared_ptr<AVIBuilder::AVIStream> mAudioStream;
+  std::shared_ptr<AudioDecoder> mAudioDecoder;        // null without audio; decodes in the background for mAudioStream
+  std::vector<AVIBuilder::BlockLayout> mBlockLayout;
+  std::vector<std::pair<std::uint64_t, std::uint_fast32_t>> mVideoChunkOffsets;   // chunk offset, frame index
+  FrameTransform::Parameters mTransformParameters;    // including the borders detected by AutoCrop
+  std::uint_fast32_t mImageWidth;                     // of a decoded frame
+  std::uint_fast32_t mImageHeight;
   std::shared_ptr<SourceBase> mAvi;
 
 public:
   MEIToAVI(const std::wstring& filePath, const Options& options);
 
   SourceBase& GetSource();
+  const std::vector<AVIBuilder::BlockLayout>& GetBlockLayout() const;
+  // writes the binary and the JSON manifests of the block layout (see Manifest.hpp)
+  void WriteManifest(const std::wstring& binaryFilePath, const std::wstring& jsonFilePath) const;
+
+  // the analysis results (deduplication, encoded sizes) and the audio data are shared with the reader
+  // numEncoderThreads: threads used by the reader's encoder
+  std::unique_ptr<Reader> CreateReader(std::uint_fast32_t numEncoderThreads) const;
+
+  // called whenever GetSource() decodes a frame for its own chunk; frames read from the cache are not reported again,
+  // and repeated or referenced frames (see GetUniqueFrameIndex) are not decoded at all
+  // the observer runs on the reading thread and the image is only valid during the call
+  void SetFrameObserver(FrameObserver observer);
+  // the frame whose image is the same as frameIndex and which is decoded for its own chunk (frameIndex unless deduplicated)
+  std::uint_fast32_t GetUniqueFrameIndex(std::uint_fast32_t frameIndex) const;
+  std::uint_fast32_t CountFrames() const;
+  // the transform of the output video, with the borders detected by AutoCrop added to the crop
+  const FrameTransform::Parameters& GetTransformParameters() const;
+  // a transform for the images passed to the frame observer
+  std::shared_ptr<FrameTransform> CreateFrameTransform(const FrameTransform::Parameters& parameters) const;
+  // size of the images passed to the frame observer, in bytes
+  std::size_t GetImageSize() const;
+  // frame rate of the output video as dwRate / dwScale
+  AVI::AVIStreamHeader GetVideoStreamHeader() const;
+  // a new source of the data of a video block, apart from the chunks of GetSource() but decoding with the same player,
+  // so GetSource() must not read video chunks while it is read
+  std::shared_ptr<SourceBase> CreateVideoBlockSource(std::uint_fast32_t blockIndex) const;
+  // the decoder of the audio stream of GetSource(), or null if there is no audio
+  std::shared_ptr<AudioDecoder> GetAudioDecoder() const;
+
+  // a standalone WAV file of the decoded audio, or null if there is no audio
+  std::shared_ptr<SourceBase> BuildWAV() const;
+  // an AVI with the same frames and audio as GetSource(), but with the frames converted by transform (which must output BGR24)
+  // the frame data are left zero-filled, to be written in place at the chunk offsets in blockLayout
+  std::shared_ptr<SourceBase> BuildPlaceholderAVI(const FrameTransform& transform, std::vector<AVIBuilder::BlockLayout>& blockLayout) const;
+
+  // builds the layout of the AVI with and without GroupRecords and of the Matroska file again and reports their build time and container overhead,
+  // and for the AVIs the reads of a demuxer which reads one element of LIST-movi at a time
+  void BenchContainers() const;
+
+  // estimated number of frames to decode for a decoder which last read up to fromOffset to read at toOffset
+  // at most RandomSeekCost; used as the cost function of DecoderPool
+  std::uint64_t EstimateSeekCost(std::uint64_t fromOffset, std::uint64_t toOffset) const;
 };
 
 #endif
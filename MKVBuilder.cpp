@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "MKVBuilder.hpp"
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
+#include "Matroska.hpp"
+#include "EBML/EBMLBase.hpp"
+#include "EBML/EBMLElement.hpp"
+#include "EBML/EBMLMaster.hpp"
+#include "EBML/EBMLRoot.hpp"
+#include "Source/ConcatenatedSource.hpp"
+#include "Source/MemorySource.hpp"
+
+
+/*
+EBML
+Segment
+  SeekHead
+  Info
+  Tracks
+    TrackEntry
+    TrackEntry
+  Cluster
+    Timestamp
+    SimpleBlock
+    SimpleBlock
+    ...
+  Cluster
+  ...
+  Cues
+    CuePoint
+    CuePoint
+    ...
+//*/
+
+
+namespace {
+  // the Segment size is written with 8 bytes as usual, so that the offset of its content is fixed
+  constexpr std::size_t SegmentSizeLength = 8;
+
+  // the SeekPositions have a fixed width, so that the size of SeekHead does not depend on the positions
+  constexpr std::size_t SeekPositionWidth = 8;
+
+  // track number (1 byte), relative timestamp (2 bytes) and flags (1 byte)
+  constexpr std::size_t SimpleBlockHeaderSize = 4;
+
+  // track numbers are written as 1-byte variable size integers
+  constexpr std::size_t MaxTracks = 126;
+
+
+#pragma pack(push, 1)
+  // the beginning of BITMAPINFOHEADER
+  struct BitmapInfoHeader {
+    std::uint32_t biSize;
+    std::int32_t biWidth;
+    std::int32_t biHeight;      // negative for top-down images
+  };
+
+  // the beginning of WAVEFORMATEX
+  struct WaveFormat {
+    std::uint16_t wFormatTag;
+    std::uint16_t nChannels;
+    std::uint32_t nSamplesPerSec;
+    std::uint32_t nAvgBytesPerSec;
+    std::uint16_t nBlockAlign;
+    std::uint16_t wBitsPerSample;
+  };
+#pragma pack(pop)
+
+
+  template<typename T>
+  T ReadStrf(MemorySource& strf) {
+    if (strf.GetSize() < static_cast<std::streamsize>(sizeof(T))) {
+      throw std::runtime_error("MKVBuilder: strf too small");
+    }
+    T header;
+    std::memcpy(&header, strf.GetData().get(), sizeof(T));
+    return header;
+  }
+
+
+  // entries: id and position of the elements
+  std::shared_ptr<EBMLMaster> CreateSeekHead(const std::vector<std::pair<std::uint32_t, std::uint64_t>>& entries) {
+    auto seekHead = std::make_shared<EBMLMaster>(Matroska::SeekHead);
+    for (const auto& [id, position] : entries) {
+      auto seek = std::make_shared<EBMLMaster>(Matroska::Seek);
+      // the id is stored as binary, which is its big endian representation
+      seek->AppendChild(EBMLElement::CreateUInt(Matroska::SeekID, id));
+      seek->AppendChild(EBMLElement::CreateUInt(Matroska::SeekPosition, position, SeekPositionWidth));
+      seekHead->AppendChild(seek);
+    }
+    return seekHead;
+  }
+
+
+  std::shared_ptr<EBMLMaster> CreateTrackEntry(AVIBuilder::AVIStream& stream, std::uint64_t trackNumber) {
+    const auto strh = stream.GetStrh();
+    const auto strf = std::make_shared<MemorySource>(*stream.GetStrf());
+
+    auto trackEntry = std::make_shared<EBMLMaster>(Matroska::TrackEntry);
+    trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::TrackNumber, trackNumber));
+    trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::TrackUID, trackNumber));
+
+    if (strh.fccType == AVIBuilder::AVIStream::FourCCvids) {
+      // any format that fits in AVI, including Ut Video, is stored as in AVI with the BITMAPINFOHEADER as is
+      const auto bitmapInfoHeader = ReadStrf<BitmapInfoHeader>(*strf);
+
+      trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::TrackType, Matroska::TrackTypeVideo));
+      trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::FlagLacing, 0));
+      trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::DefaultDuration, static_cast<std::uint64_t>(std::llround(1.e9 * strh.dwScale / strh.dwRate))));
+      trackEntry->AppendChild(EBMLElement::CreateString(Matroska::CodecID, "V_MS/VFW/FOURCC"));
+      trackEntry->AppendChild(std::make_shared<EBMLElement>(Matroska::CodecPrivate, strf));
+
+      auto video = std::make_shared<EBMLMaster>(Matroska::Video);
+      video->AppendChild(EBMLElement::CreateUInt(Matroska::PixelWidth, static_cast<std::uint64_t>(std::abs(bitmapInfoHeader.biWidth))));
+      video->AppendChild(EBMLElement::CreateUInt(Matroska::PixelHeight, static_cast<std::uint64_t>(std::abs(bitmapInfoHeader.biHeight))));
+      trackEntry->AppendChild(video);
+    } else if (strh.fccType == AVIBuilder::AVIStream::FourCCauds) {
+      const auto waveFormat = ReadStrf<WaveFormat>(*strf);
+      const bool pcm = waveFormat.wFormatTag == 0x0001;   // WAVE_FORMAT_PCM
+      const bool floatPCM = waveFormat.wFormatTag == 0x0003;   // WAVE_FORMAT_IEEE_FLOAT
+
+      trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::TrackType, Matroska::TrackTypeAudio));
+      trackEntry->AppendChild(EBMLElement::CreateUInt(Matroska::FlagLacing, 0));
+      if (pcm) {
+        trackEntry->AppendChild(EBMLElement::CreateString(Matroska::CodecID, "A_PCM/INT/LIT"));
+      } else if (floatPCM) {
+        trackEntry->AppendChild(EBMLElement::CreateString(Matroska::CodecID, "A_PCM/FLOAT/IEEE"));
+      } else {
+        trackEntry->AppendChild(EBMLElement::CreateString(Matroska::CodecID, "A_MS/ACM"));
+        trackEntry->AppendChild(std::make_shared<EBMLElement>(Matroska::CodecPrivate, strf));
+      }
+
+      auto audio = std::make_shared<EBMLMaster>(Matroska::Audio);
+      audio->AppendChild(EBMLElement::CreateFloat(Matroska::SamplingFrequency, waveFormat.nSamplesPerSec));
+      audio->AppendChild(EBMLElement::CreateUInt(Matroska::Channels, waveFormat.nChannels));
+      if (waveFormat.wBitsPerSample) {
+        audio->AppendChild(EBMLElement::CreateUInt(Matroska::BitDepth, waveFormat.wBitsPerSample));
+      }
+      trackEntry->AppendChild(audio);
+    } else {
+      throw std::runtime_error("MKVBuilder: unsupported stream type");
+    }
+
+    return trackEntry;
+  }
+}
+
+
+//
+
+
+MKVBuilder::MKVBuilder() :
+  mStreams(),
+  mPrimaryVideoStreamIndex(),
+  mApplicationName(),
+  mBlockLayout(),
+  mPayloadSize(0),
+  mNumClusters(0)
+{}
+
+
+void MKVBuilder::SetApplicationName(const std::string& applicationName) {
+  mApplicationName = applicationName;
+}
+
+
+void MKVBuilder::AddStream(std::shared_ptr<AVIBuilder::AVIStream> stream, bool primaryVideoStream) {
+  if (primaryVideoStream) {
+    assert(!mPrimaryVideoStreamIndex);
+    mPrimaryVideoStreamIndex.emplace(mStreams.size());
+  }
+
+  mStreams.push_back(stream);
+}
+
+
+std::shared_ptr<SourceBase> MKVBuilder::BuildMKV() {
+  struct OrderedBlock {
+    double time;                          // in ticks, before rounding
+    std::size_t streamIndex;
+    std::uint_fast32_t blockIndex;
+    AVIBuilder::AVIStream::BlockInfo info;
+  };
+
+  // where a block ended up, relative to the content of its Cluster
+  struct PlacedBlock {
+    std::size_t clusterIndex;
+    std::uint64_t elementOffset;
+    std::uint64_t headerSize;             // of the element and the SimpleBlock header
+    bool reference;
+  };
+
+  struct CueInfo {
+    std::int64_t timestamp;
+    std::uint64_t elementOffset;
+  };
+
+  struct ClusterInfo {
+    std::shared_ptr<EBMLMaster> cluster;
+    std::int64_t timestamp;
+    std::uint64_t contentSize;            // counted here, as EBMLMaster::GetSize walks all the children
+    std::optional<CueInfo> cue;           // the first keyframe of the primary video stream in the Cluster
+  };
+
+  if (mStreams.empty()) {
+    throw std::runtime_error("MKVBuilder: no streams");
+  }
+  if (mStreams.size() > MaxTracks) {
+    throw std::runtime_error("MKVBuilder: too many streams");
+  }
+
+  // without video, the blocks of the first stream serve as keyframes
+  const std::size_t primaryStreamIndex = mPrimaryVideoStreamIndex.value_or(0);
+
+  // EBML header
+  auto ebml = std::make_shared<EBMLMaster>(Matroska::EBML);
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::EBMLVersion, 1));
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::EBMLReadVersion, 1));
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::EBMLMaxIDLength, 4));
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::EBMLMaxSizeLength, 8));
+  ebml->AppendChild(EBMLElement::CreateString(Matroska::DocType, "matroska"));
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::DocTypeVersion, 4));      // CueRelativePosition
+  ebml->AppendChild(EBMLElement::CreateUInt(Matroska::DocTypeReadVersion, 2));  // SimpleBlock
+
+  // ticks per unit of BlockInfo::startTime of each stream
+  std::vector<double> timeCoefs;
+  double duration = 0.;
+  std::size_t numBlocks = 0;
+  for (const auto& stream : mStreams) {
+    const auto strh = stream->GetStrh();
+    const double timeCoef = static_cast<double>(strh.dwScale) * (1.e9 / TimestampScale) / strh.dwRate;
+    timeCoefs.push_back(timeCoef);
+    duration = std::max(duration, timeCoef * strh.dwLength);
+    numBlocks += stream->CountStreams();
+  }
+
+  // Info
+  auto info = std::make_shared<EBMLMaster>(Matroska::Info);
+  info->AppendChild(EBMLElement::CreateUInt(Matroska::TimestampScale, TimestampScale));
+  info->AppendChild(EBMLElement::CreateString(Matroska::MuxingApp, mApplicationName));
+  info->AppendChild(EBMLElement::CreateString(Matroska::WritingApp, mApplicationName));
+  info->AppendChild(EBMLElement::CreateFloat(Matroska::Duration, duration));
+
+  // Tracks
+  auto tracks = std::make_shared<EBMLMaster>(Matroska::Tracks);
+  for (std::size_t i = 0; i < mStreams.size(); i++) {
+    tracks->AppendChild(CreateTrackEntry(*mStreams[i], i + 1));
+  }
+
+  // interleave the blocks of all streams by time, the earlier stream first on ties as in AVIBuilder
+  std::vector<OrderedBlock> orderedBlocks;
+  orderedBlocks.reserve(numBlocks);
+  for (std::size_t i = 0; i < mStreams.size(); i++) {
+    const auto numStreamBlocks = mStreams[i]->CountStreams();
+    for (std::uint_fast32_t j = 0; j < numStreamBlocks; j++) {
+      const auto blockInfo = mStreams[i]->GetBlockInfo(j);
+      orderedBlocks.push_back(OrderedBlock{
+        timeCoefs[i] * blockInfo.startTime,
+        i,
+        j,
+        blockInfo,
+      });
+    }
+  }
+  std::sort(orderedBlocks.begin(), orderedBlocks.end(), [] (const OrderedBlock& a, const OrderedBlock& b) {
+    if (a.time != b.time) {
+      return a.time < b.time;
+    }
+    return a.streamIndex == b.streamIndex ? a.blockIndex < b.blockIndex : a.streamIndex < b.streamIndex;
+  });
+
+  // Clusters
+  std::vector<ClusterInfo> clusters;
+  std::vector<PlacedBlock> placedBlocks;
+  placedBlocks.reserve(orderedBlocks.size());
+  std::vector<std::optional<PlacedBlock>> lastPlacedBlocks(mStreams.size());
+
+  mPayloadSize = 0;
+
+  for (const auto& block : orderedBlocks) {
+    auto& lastPlacedBlock = lastPlacedBlocks[block.streamIndex];
+
+    // a block without data repeats the previous one, which then simply lasts until the next block
+    if (!block.info.size && lastPlacedBlock) {
+      auto placedBlock = lastPlacedBlock.value();
+      placedBlock.reference = true;
+      placedBlocks.push_back(placedBlock);
+      continue;
+    }
+
+    const auto timestamp = static_cast<std::int64_t>(std::llround(block.time));
+    const bool keyframe = block.info.indexFlags & AVI::AVIIF_KEYFRAME;
+    const bool primaryKeyframe = keyframe && block.streamIndex == primaryStreamIndex;
+
+    // the timestamps of the blocks are 16-bit signed integers relative to the Cluster
+    bool startCluster = clusters.empty() || timestamp - clusters.back().timestamp > std::numeric_limits<std::int16_t>::max();
+    if (!startCluster && primaryKeyframe) {
+      const auto& clusterInfo = clusters.back();
+      startCluster = timestamp - clusterInfo.timestamp >= ClusterDuration || clusterInfo.contentSize >= ClusterSize;
+    }
+
+    if (startCluster) {
+      auto cluster = std::make_shared<EBMLMaster>(Matroska::Cluster);
+      auto clusterTimestamp = EBMLElement::CreateUInt(Matroska::Timestamp, static_cast<std::uint64_t>(timestamp));
+      cluster->AppendChild(clusterTimestamp);
+      clusters.push_back(ClusterInfo{
+        cluster,
+        timestamp,
+        static_cast<std::uint64_t>(clusterTimestamp->GetSize()),
+        std::nullopt,
+      });
+    }
+
+    auto& clusterInfo = clusters.back();
+
+    const auto relativeTimestamp = static_cast<std::uint16_t>(static_cast<std::int16_t>(timestamp - clusterInfo.timestamp));
+    const std::array<std::uint8_t, SimpleBlockHeaderSize> blockHeader{
+      static_cast<std::uint8_t>(0x80 | (block.streamIndex + 1)),
+      static_cast<std::uint8_t>(relativeTimestamp >> 8),
+      static_cast<std::uint8_t>(relativeTimestamp),
+      keyframe ? Matroska::SimpleBlockKeyframe : static_cast<std::uint8_t>(0),
+    };
+
+    // referenced blocks get their data again, as Matroska has no way to share it
+    auto simpleBlock = std::make_shared<EBMLElement>(Matroska::SimpleBlock, std::make_shared<ConcatenatedSource>(std::array<std::shared_ptr<SourceBase>, 2>{
+      std::make_shared<MemorySource>(blockHeader.data(), blockHeader.size()),
+      mStreams[block.streamIndex]->GetBlockData(block.blockIndex),
+    }));
+    const auto elementSize = static_cast<std::uint64_t>(simpleBlock->GetSize());
+
+    const PlacedBlock placedBlock{
+      clusters.size() - 1,
+      clusterInfo.contentSize,
+      elementSize - block.info.size,
+      false,
+    };
+    placedBlocks.push_back(placedBlock);
+    lastPlacedBlock = placedBlock;
+
+    if (primaryKeyframe && !clusterInfo.cue) {
+      clusterInfo.cue = CueInfo{
+        timestamp,
+        clusterInfo.contentSize,
+      };
+    }
+
+    clusterInfo.cluster->AppendChild(simpleBlock);
+    clusterInfo.contentSize += elementSize;
+    mPayloadSize += block.info.size;
+  }
+
+  mNumClusters = clusters.size();
+
+  // positions are relative to the content of the Segment
+  // SeekHead comes first, and its size does not depend on the positions
+  const bool hasCues = std::any_of(clusters.cbegin(), clusters.cend(), [] (const ClusterInfo& clusterInfo) {
+    return clusterInfo.cue.has_value();
+  });
+
+  std::vector<std::pair<std::uint32_t, std::uint64_t>> seekEntries{
+    {Matroska::Info, 0},
+    {Matroska::Tracks, 0},
+  };
+  if (hasCues) {
+    seekEntries.emplace_back(Matroska::Cues, 0);
+  }
+
+  std::uint64_t position = CreateSeekHead(seekEntries)->GetSize();
+
+  seekEntries[0].second = position;
+  position += info->GetSize();
+
+  seekEntries[1].second = position;
+  position += tracks->GetSize();
+
+  std::vector<std::uint64_t> clusterPositions;
+  std::vector<std::uint64_t> clusterContentPositions;
+  clusterPositions.reserve(clusters.size());
+  clusterContentPositions.reserve(clusters.size());
+  for (const auto& clusterInfo : clusters) {
+    const auto headerSize = EBMLBase::GetIdLength(Matroska::Cluster) + EBMLBase::GetSizeLength(clusterInfo.contentSize);
+    clusterPositions.push_back(position);
+    clusterContentPositions.push_back(position + headerSize);
+    position += headerSize + clusterInfo.contentSize;
+  }
+
+  // Cues
+  std::shared_ptr<EBMLMaster> cues;
+  if (hasCues) {
+    seekEntries[2].second = position;
+
+    cues = std::make_shared<EBMLMaster>(Matroska::Cues);
+    for (std::size_t i = 0; i < clusters.size(); i++) {
+      const auto& cue = clusters[i].cue;
+      if (!cue) {
+        continue;
+      }
+
+      auto cueTrackPositions = std::make_shared<EBMLMaster>(Matroska::CueTrackPositions);
+      cueTrackPositions->AppendChild(EBMLElement::CreateUInt(Matroska::CueTrack, primaryStreamIndex + 1));
+      cueTrackPositions->AppendChild(EBMLElement::CreateUInt(Matroska::CueClusterPosition, clusterPositions[i]));
+      cueTrackPositions->AppendChild(EBMLElement::CreateUInt(Matroska::CueRelativePosition, cue->elementOffset));
+
+      auto cuePoint = std::make_shared<EBMLMaster>(Matroska::CuePoint);
+      cuePoint->AppendChild(EBMLElement::CreateUInt(Matroska::CueTime, static_cast<std::uint64_t>(cue->timestamp)));
+      cuePoint->AppendChild(cueTrackPositions);
+      cues->AppendChild(cuePoint);
+    }
+  }
+
+  // Segment
+  auto segment = std::make_shared<EBMLMaster>(Matroska::Segment, SegmentSizeLength);
+  segment->AppendChild(CreateSeekHead(seekEntries));
+  segment->AppendChild(info);
+  segment->AppendChild(tracks);
+  for (const auto& clusterInfo : clusters) {
+    segment->AppendChild(clusterInfo.cluster);
+  }
+  if (cues) {
+    segment->AppendChild(cues);
+  }
+
+  EBMLRoot root;
+  root.AppendChild(ebml);
+  root.AppendChild(segment);
+
+  const auto segmentContentOffset = static_cast<std::uint64_t>(ebml->GetSize()) + EBMLBase::GetIdLength(Matroska::Segment) + SegmentSizeLength;
+  assert(clusters.empty() || static_cast<std::uint64_t>(clusters.front().cluster->GetOffset()) == segmentContentOffset + clusterPositions.front());
+
+  // block layout
+  mBlockLayout.clear();
+  mBlockLayout.reserve(orderedBlocks.size());
+  for (std::size_t i = 0; i < orderedBlocks.size(); i++) {
+    const auto& block = orderedBlocks[i];
+    const auto& placedBlock = placedBlocks[i];
+    const auto elementOffset = segmentContentOffset + clusterContentPositions[placedBlock.clusterIndex] + placedBlock.elementOffset;
+    mBlockLayout.push_back(AVIBuilder::BlockLayout{
+      static_cast<std::uint_fast32_t>(block.streamIndex),
+      block.blockIndex,
+      elementOffset,
+      elementOffset + placedBlock.headerSize,
+      block.info.size,
+      block.info.startTime,
+      block.info.indexFlags,
+      placedBlock.reference,
+      0,
+      0,
+    });
+  }
+
+  root.CreateSource();
+  return root.GetSource();
+}
+
+
+const std::vector<AVIBuilder::BlockLayout>& MKVBuilder::GetBlockLayout() const {
+  return mBlockLayout;
+}
+
+
+std::uint_fast64_t MKVBuilder::GetPayloadSize() const {
+  return mPayloadSize;
+}
+
+
+std::size_t MKVBuilder::CountClusters() const {
+  return mNumClusters;
+}
@@ -0,0 +1,59 @@
+#ifndef ML_MKVBUILDER_HPP
+#define ML_MKVBUILDER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "AVIBuilder.hpp"
+#include "Source/SourceBase.hpp"
+
+
+// builds a Matroska file from the same streams as AVIBuilder
+// every element size is known before the data is read, so the result is a lazily evaluated source like the AVI:
+// the headers come first with the exact Segment size, the blocks refer to the data sources of the streams,
+// and the Cues follow the Clusters, so that it can be written sequentially or read at any offset
+class MKVBuilder {
+public:
+  // nanoseconds per tick of the timestamps
+  static constexpr std::uint64_t TimestampScale = 1000000;
+
+  // a Cluster is started at the next keyframe of the primary video stream once the current one is this long or large,
+  // and each Cluster which starts with a keyframe gets a CuePoint
+  static constexpr std::int64_t ClusterDuration = 1000;
+  static constexpr std::uint64_t ClusterSize = 8 * 1024 * 1024;
+
+protected:
+  std::vector<std::shared_ptr<AVIBuilder::AVIStream>> mStreams;
+  std::optional<std::size_t> mPrimaryVideoStreamIndex;
+  std::string mApplicationName;
+  std::vector<AVIBuilder::BlockLayout> mBlockLayout;
+  std::uint_fast64_t mPayloadSize;
+  std::size_t mNumClusters;
+
+public:
+  MKVBuilder();
+
+  // written to MuxingApp and WritingApp
+  void SetApplicationName(const std::string& applicationName);
+
+  void AddStream(std::shared_ptr<AVIBuilder::AVIStream> stream, bool primaryVideoStream);
+
+  std::shared_ptr<SourceBase> BuildMKV();
+
+  // blocks of all streams in the order of the SimpleBlocks
+  // blocks without data (repeated frames) have no SimpleBlock, the time of the previous block is simply extended;
+  // they are listed with size 0 at the SimpleBlock of the previous block of the stream, marked as references
+  // available after BuildMKV
+  const std::vector<AVIBuilder::BlockLayout>& GetBlockLayout() const;
+  // total size of the block data; the rest of the file is the container overhead
+  // available after BuildMKV
+  std::uint_fast64_t GetPayloadSize() const;
+  // available after BuildMKV
+  std::size_t CountClusters() const;
+};
+
+#endif
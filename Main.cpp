@@ -1,16 +1,39 @@
 #define NOMINMAX
 
 #include <algorithm>
-#include <fstream>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <ios>
 #include <iostream>
 #include <io.h>
 #include <fcntl.h>
 
+#include "AudioDecoder.hpp"
+#include "Batch.hpp"
+#include "DecoderPool.hpp"
+#include "HashTree.hpp"
+#include "LiveOutput.hpp"
 #include "MEIToAVI.hpp"
+#include "Movie.hpp"
+#include "MultiOutput.hpp"
+#include "OutputFile.hpp"
+#include "ParallelOutput.hpp"
+#include "RawStreams.hpp"
+#include "RangeServer.hpp"
+#include "ResumeJournal.hpp"
+#include "SpooledInput.hpp"
+#include "StreamOutput.hpp"
+#include "ThreadPool.hpp"
+#include "Kernel/CPUFeature.hpp"
+#include "Kernel/Dispatch.hpp"
+#include "Kernel/Hash.hpp"
+#include "Kernel/SelfCheck.hpp"
 
 using namespace std::literals;
 
@@ -19,24 +42,429 @@ namespace {
   constexpr std::size_t CacheStorageSize = std::numeric_limits<std::size_t>::max();
   constexpr std::size_t CacheStorageLimit = 2;
   constexpr std::size_t DefaultAudioBlockSamples = 0;
+  constexpr std::uint_fast32_t DefaultInterleaveMillis = 500;
   constexpr std::size_t DefaultJunkSize = 4096;
   constexpr std::size_t DefaultBufferSize = 64 * 1024;
+  constexpr std::size_t DedupHistorySize = 16;
+  constexpr std::uint_fast32_t DefaultCodecSlices = 8;
+  constexpr std::size_t ServeBenchRequestSize = 1024 * 1024;
+  constexpr std::uint_fast32_t ServeBenchClients = 4;
+  constexpr std::uint_fast32_t DefaultServeDecoders = 4;
+  constexpr std::size_t DefaultServePrefetchChunks = 8;
+  constexpr auto ServeDecoderIdleTimeout = std::chrono::seconds(60);
+
+
+  std::wstring ToHex(std::uint64_t value) {
+    static const wchar_t hex[] = L"0123456789abcdef";
+    std::wstring str(16, L'0');
+    for (std::size_t i = 0; i < 16; i++) {
+      str[15 - i] = hex[(value >> (i * 4)) & 0x0F];
+    }
+    return str;
+  }
+
+
+  // whether a leaf of source has the hash recorded in leaves
+  bool MatchesLeaf(SourceBase& source, const HashTree::Leaves& leaves, std::uint64_t leafIndex) {
+    const std::uint64_t begin = leafIndex * leaves.leafSize;
+    const auto size = static_cast<std::size_t>(std::min<std::uint64_t>(leaves.leafSize, leaves.fileSize - begin));
+    auto buffer = std::make_unique<std::uint8_t[]>(size);
+    source.Read(buffer.get(), size, begin);
+    return Kernel::Hash(buffer.get(), size) == leaves.hashes[static_cast<std::size_t>(leafIndex)];
+  }
+
+
+  // the value of the option before argIndex, which is moved past it; throws if the command line ends before it
+  wchar_t* NextArg(int argc, wchar_t* argv[], int& argIndex) {
+    if (argIndex >= argc) {
+      throw std::runtime_error("missing value for an option"s);
+    }
+    return argv[argIndex++];
+  }
+
+
+  enum class ParseResult {
+    Unknown,      // not an option of MEIToAVI::Options
+    Parsed,
+    Invalid,      // the reason has been written to std::wcerr
+  };
+
+
+  // parses an option of MEIToAVI::Options; arg is argv[argIndex - 1], and argIndex is moved past its values
+  // shared by the command line and the job lines of -batch
+  ParseResult ParseConversionOption(const std::wstring& arg, int argc, wchar_t* argv[], int& argIndex, MEIToAVI::Options& options) {
+    const auto nextArg = [argc, argv, &argIndex] () {
+      return NextArg(argc, argv, argIndex);
+    };
+
+    if (arg == L"-quiet"sv) {
+      options.flags |= MEIToAVI::NoMessage;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-noaudio"sv) {
+      options.flags |= MEIToAVI::NoAudio;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-noalpha"sv) {
+      options.flags |= MEIToAVI::NoAlpha;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-orgfps"sv) {
+      options.flags |= MEIToAVI::NoApproxFPS;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-dedup"sv) {
+      options.flags |= MEIToAVI::DedupFrames;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-utvideo"sv) {
+      options.flags |= MEIToAVI::UtVideo;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-slices"sv) {
+      const auto argSlices = std::stoll(nextArg());
+      if (argSlices < 1 || argSlices > 256) {
+        std::wcerr << L"count must be between 1 and 256" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.codecSlices = static_cast<std::uint_fast32_t>(argSlices);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-crop"sv) {
+      std::uint_fast32_t* const margins[] = {
+        &options.transform.crop.left,
+        &options.transform.crop.top,
+        &options.transform.crop.right,
+        &options.transform.crop.bottom,
+      };
+      for (const auto ptrMargin : margins) {
+        const auto argMargin = std::stoll(nextArg());
+        if (argMargin < 0) {
+          std::wcerr << L"margins must be greater than or equal to 0" << std::endl;
+          return ParseResult::Invalid;
+        }
+        *ptrMargin = static_cast<std::uint_fast32_t>(argMargin);
+      }
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-autocrop"sv) {
+      options.flags |= MEIToAVI::AutoCrop;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-scale"sv) {
+      const auto argWidth = std::stoll(nextArg());
+      const auto argHeight = std::stoll(nextArg());
+      if (argWidth < 0 || argHeight < 0 || argWidth > 65535 || argHeight > 65535) {
+        std::wcerr << L"width and height must be between 0 and 65535" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.transform.width = static_cast<std::uint_fast32_t>(argWidth);
+      options.transform.height = static_cast<std::uint_fast32_t>(argHeight);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-filter"sv) {
+      const std::wstring argFilter(nextArg());
+      if (argFilter == L"box"sv) {
+        options.transform.filter = FrameTransform::Filter::Box;
+      } else if (argFilter == L"bilinear"sv) {
+        options.transform.filter = FrameTransform::Filter::Bilinear;
+      } else {
+        std::wcerr << L"filter must be box or bilinear" << std::endl;
+        return ParseResult::Invalid;
+      }
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-pixfmt"sv) {
+      const std::wstring argFormat(nextArg());
+      if (argFormat == L"bgra"sv) {
+        options.transform.format = FrameTransform::PixelFormat::BGRA;
+      } else if (argFormat == L"bgr24"sv) {
+        options.transform.format = FrameTransform::PixelFormat::BGR24;
+      } else if (argFormat == L"i420"sv) {
+        options.transform.format = FrameTransform::PixelFormat::I420;
+      } else {
+        std::wcerr << L"pixel format must be bgra, bgr24 or i420" << std::endl;
+        return ParseResult::Invalid;
+      }
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-ablock"sv) {
+      const auto argSamples = std::stoll(nextArg());
+      if (argSamples < 0) {
+        std::wcerr << L"sample must be greater than or equal to 0" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.audioBlockSamples = static_cast<std::uint_fast32_t>(argSamples);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-interleave"sv) {
+      const auto argMillis = std::stoll(nextArg());
+      if (argMillis < 0 || argMillis > 10000) {
+        std::wcerr << L"ms must be between 0 and 10000" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.interleaveMillis = static_cast<std::uint_fast32_t>(argMillis);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-arate"sv) {
+      const auto argRate = std::stoll(nextArg());
+      if (argRate < 0 || argRate > 768000) {
+        std::wcerr << L"rate must be between 0 and 768000" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.audioTransform.samplingRate = static_cast<std::uint_fast32_t>(argRate);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-achannels"sv) {
+      const auto argChannels = std::stoll(nextArg());
+      if (argChannels < 0 || argChannels > 8) {
+        std::wcerr << L"count must be between 0 and 8" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.audioTransform.numChannels = static_cast<std::uint_fast32_t>(argChannels);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-afmt"sv) {
+      const std::wstring argFormat(nextArg());
+      if (argFormat == L"s16"sv) {
+        options.audioTransform.format = AudioTransform::SampleFormat::Int16;
+      } else if (argFormat == L"float"sv) {
+        options.audioTransform.format = AudioTransform::SampleFormat::Float;
+      } else {
+        std::wcerr << L"sample format must be s16 or float" << std::endl;
+        return ParseResult::Invalid;
+      }
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-junksize"sv) {
+      const auto argJunkChunkSize = std::stoll(nextArg());
+      if (argJunkChunkSize < 0) {
+        std::wcerr << L"size must be greater than or equal to 0" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.junkChunkSize = static_cast<std::uint_fast32_t>(argJunkChunkSize);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-align"sv) {
+      const auto argAlignment = std::stoll(nextArg());
+      if (argAlignment < 0 || argAlignment > 0x10000000 || (argAlignment & (argAlignment - 1))) {
+        std::wcerr << L"size must be 0 or a power of two up to 256 MiB" << std::endl;
+        return ParseResult::Invalid;
+      }
+      options.chunkAlignment = static_cast<std::uint_fast32_t>(argAlignment);
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-mkv"sv) {
+      options.flags |= MEIToAVI::Matroska;
+      return ParseResult::Parsed;
+    }
+
+    if (arg == L"-rec"sv) {
+      options.flags |= MEIToAVI::GroupRecords;
+      return ParseResult::Parsed;
+    }
+
+    return ParseResult::Unknown;
+  }
+
+
+  // combinations of MEIToAVI::Options that cannot be used; returns false after writing the reason
+  bool CheckConversionOptions(const MEIToAVI::Options& options) {
+    if ((options.flags & MEIToAVI::UtVideo) && options.transform.format != FrameTransform::PixelFormat::BGRA) {
+      std::wcerr << L"-utvideo cannot be used with -pixfmt other than bgra" << std::endl;
+      return false;
+    }
+
+    if ((options.flags & MEIToAVI::Matroska) && options.chunkAlignment) {
+      std::wcerr << L"-align cannot be used with -mkv" << std::endl;
+      return false;
+    }
+
+    if ((options.flags & MEIToAVI::Matroska) && (options.flags & MEIToAVI::GroupRecords)) {
+      std::wcerr << L"-rec cannot be used with -mkv" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+
+  // a job line of -batch: conversion options, -bufsize, -manifest, -hashtree and -sha256, then infile and outfile
+  // the options start from those given on the command line (defaults); returns std::nullopt after writing the reason
+  std::optional<Batch::Job> ParseBatchJob(const Batch::JobLine& jobLine, const Batch::Job& defaults) {
+    auto args = jobLine.args;
+    std::vector<wchar_t*> argv;
+    for (auto& arg : args) {
+      argv.push_back(arg.data());
+    }
+    const int argc = static_cast<int>(argv.size());
+
+    auto job = defaults;
+    job.lineNumber = jobLine.lineNumber;
+
+    const auto reportInvalid = [&jobLine] () {
+      std::wcerr << L"line "sv << jobLine.lineNumber << L" of the job file is invalid" << std::endl;
+      return std::nullopt;
+    };
+
+    int argIndex = 0;
+    while (argIndex < argc) {
+      const std::wstring arg(argv[argIndex]);
+      argIndex++;
+
+      switch (ParseConversionOption(arg, argc, argv.data(), argIndex, job.options)) {
+        case ParseResult::Parsed:
+          continue;
+
+        case ParseResult::Invalid:
+          return reportInvalid();
+
+        case ParseResult::Unknown:
+          break;
+      }
+
+      if (arg == L"-bufsize"sv && argIndex < argc) {
+        const auto argBufferSize = std::stoll(argv[argIndex++]);
+        if (argBufferSize < 1) {
+          std::wcerr << L"size must be greater than 0" << std::endl;
+          return reportInvalid();
+        }
+        job.bufferSize = static_cast<std::size_t>(argBufferSize);
+        continue;
+      }
+
+      if (arg == L"-manifest"sv) {
+        job.writeManifest = true;
+        continue;
+      }
+
+      if (arg == L"-hashtree"sv) {
+        job.writeHashTree = true;
+        continue;
+      }
+
+      if (arg == L"-sha256"sv) {
+        job.writeHashTree = true;
+        job.hashSHA256 = true;
+        continue;
+      }
+
+      argIndex--;
+
+      break;
+    }
+
+    if (argIndex + 2 != argc) {
+      std::wcerr << L"a job line must be options followed by infile and outfile" << std::endl;
+      return reportInvalid();
+    }
+
+    if (!CheckConversionOptions(job.options)) {
+      return reportInvalid();
+    }
+
+    job.inFile = argv[argIndex];
+    job.outFile = argv[argIndex + 1];
+
+    return job;
+  }
 
 
   int ShowUsage(const wchar_t* program) {
     std::wcerr << L"mei2avi v0.3.0"sv << std::endl;
     std::wcerr << L"Copyright (c) 2019 SegaraRai"sv << std::endl;
     std::wcerr << std::endl;
-    std::wcerr << L"usage: "sv << program << L" [-quiet] [-noaudio] [-noalpha] [-orgfps] [-ablock sample] [-junksize size] [-bufsize size] infile outfile"sv << std::endl;
+    std::wcerr << L"usage: "sv << program << L" [-isa name] -selfcheck"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [-threads count] [-pin] -poolbench"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] -y4m [-rawpcm] infile videoout [audioout]"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] -serve port [-decoders count] [-prefetch count] [-servebench count] infile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] -containerbench infile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" -inputbench infile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] -live count infile outfile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [-threads count] [-mmap] -audiocheck infile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [-quiet] [-threads count] -verify file"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] -repair infile outfile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [options] [-memory size] -batch jobfile"sv << std::endl;
+    std::wcerr << L"       "sv << program << L" [-quiet] [-isa name] [-ntthreshold size] [-mmap] [-stdinbuf size] [-noaudio] [-noalpha] [-orgfps] [-dedup] [-utvideo] [-slices count] [-crop left top right bottom] [-autocrop] [-scale width height] [-filter name] [-pixfmt name] [-ablock sample] [-interleave ms] [-arate rate] [-achannels count] [-afmt name] [-junksize size] [-align size] [-rec] [-mkv] [-bufsize size] [-threads count] [-pin] [-resume] [-manifest] [-hashtree] [-sha256] [-wav file] [-proxy width height file] [-thumbs seconds prefix] infile outfile"sv << std::endl;
     std::wcerr << std::endl;
     std::wcerr << L"-quiet      suppress messages"sv << std::endl;
+    std::wcerr << L"-mmap       read the input through one read-only mapping shared by all decoders instead of a file for each"sv << std::endl;
+    std::wcerr << L"-stdinbuf   keep this many bytes of the input from stdin in memory and the rest in a temporary file (default: "sv << SpooledInput::DefaultMemoryLimit << L")"sv << std::endl;
     std::wcerr << L"-noaudio    skip decoding audio"sv << std::endl;
     std::wcerr << L"-noalpha    assume that the source has no alpha channel"sv << std::endl;
     std::wcerr << L"-orgfps     use original frame rate"sv << std::endl;
-    std::wcerr << L"-ablock     set the number of samples for each audio block (default: "sv << DefaultAudioBlockSamples << L", set 0 to calculate automatically)"sv << std::endl;
+    std::wcerr << L"-dedup      store duplicate frames as zero-length chunks or references to earlier chunks"sv << std::endl;
+    std::wcerr << L"-utvideo    compress video with Ut Video (lossless)"sv << std::endl;
+    std::wcerr << L"-slices     set the number of slices for -utvideo (default: "sv << DefaultCodecSlices << L", 1-256)"sv << std::endl;
+    std::wcerr << L"-crop       remove the specified number of pixels from each edge"sv << std::endl;
+    std::wcerr << L"-autocrop   detect and remove constant-colored letterbox / pillarbox borders (applied before -crop)"sv << std::endl;
+    std::wcerr << L"-scale      resize the cropped frame (set either to 0 to keep the aspect ratio)"sv << std::endl;
+    std::wcerr << L"-filter     set the filter for -scale: box or bilinear (default: box)"sv << std::endl;
+    std::wcerr << L"-pixfmt     set the output pixel format: bgra, bgr24 or i420 (default: bgra, -utvideo requires bgra)"sv << std::endl;
+    std::wcerr << L"-ablock     set the number of samples for each audio block (default: "sv << DefaultAudioBlockSamples << L", set 0 to choose whole video frames within -interleave)"sv << std::endl;
+    std::wcerr << L"-interleave  bound the audio a player buffers ahead of the video to ms milliseconds; the audio blocks (unless -ablock) and the preload are chosen within it"sv << std::endl;
+    std::wcerr << L"            (default: "sv << DefaultInterleaveMillis << L", set 0 for blocks of one video frame without preload)"sv << std::endl;
+    std::wcerr << L"-arate      resample the audio to rate Hz (default: 0 = keep)"sv << std::endl;
+    std::wcerr << L"-achannels  mix the audio down to 1 or 2 channels, or spread mono to count channels (default: 0 = keep)"sv << std::endl;
+    std::wcerr << L"-afmt       set the audio sample format: s16 or float (default: as decoded, or s16 / float for deeper sources when -arate or -achannels converts)"sv << std::endl;
     std::wcerr << L"-junksize   set the size of JUNK chunk (default: "sv << DefaultJunkSize << L", set 0 to disable JUNK chunk)"sv << std::endl;
+    std::wcerr << L"-align      start the data of every video chunk at a multiple of size bytes (power of two, default: 0 = disabled)"sv << std::endl;
+    std::wcerr << L"-rec        group the chunks of each audio block and the video frames after it in a LIST-rec, for players to read them at once"sv << std::endl;
+    std::wcerr << L"-mkv        write a Matroska file instead of an AVI (-junksize does not apply, -align and -rec cannot be used)"sv << std::endl;
     std::wcerr << L"-bufsize    set buffer size for output (default: "sv << DefaultBufferSize << L")"sv << std::endl;
+    std::wcerr << L"-threads    decode and write different parts of the output with this many decoders at once (default: 1, requires a file output)"sv << std::endl;
+    std::wcerr << L"-pin        bind the threads of the thread pool (one per CPU, or -threads if more) to one processor each"sv << std::endl;
+    std::wcerr << L"-resume     record the progress in outfile.resume, and continue from it if outfile was left incomplete with the same input and options"sv << std::endl;
+    std::wcerr << L"-manifest   write the offset, size and time of every block to outfile.manifest (binary) and outfile.manifest.json"sv << std::endl;
+    std::wcerr << L"-hashtree   write a Merkle tree of the hashes of every "sv << HashTree::DefaultLeafSize / (1024 * 1024) << L" MiB of outfile to outfile.hashtree, hashed while writing"sv << std::endl;
+    std::wcerr << L"-sha256     also hash the leaves of -hashtree with SHA-256 (implies -hashtree)"sv << std::endl;
+    std::wcerr << L"-wav        also write the audio to file as WAV"sv << std::endl;
+    std::wcerr << L"-proxy      also write an uncompressed BGR24 AVI of width x height (set either to 0 to keep the aspect ratio) to file"sv << std::endl;
+    std::wcerr << L"-thumbs     also write the output frame every seconds seconds to prefix000000.ppm, prefix000001.ppm, ..."sv << std::endl;
+    std::wcerr << L"            the additional outputs share the decoded frames with outfile; they require a file output and no -threads"sv << std::endl;
+    std::wcerr << L"-y4m        write the video as YUV4MPEG2 (I420) to videoout and the audio as WAV to audioout while decoding, without building an AVI"sv << std::endl;
+    std::wcerr << L"            videoout and audioout may be \"-\" (stdout), fd:N (file descriptor), \\\\.\\pipe\\name (named pipe created for the reader) or a file"sv << std::endl;
+    std::wcerr << L"-rawpcm     write the audio of -y4m as raw PCM instead of WAV"sv << std::endl;
+    std::wcerr << L"-serve      serve the AVI at http://127.0.0.1:port/ with Range support instead of writing it (0 picks a free port)"sv << std::endl;
+    std::wcerr << L"-decoders   set the maximum number of decoder instances for -serve; requests go to the one nearest to the range (default: "sv << DefaultServeDecoders << L")"sv << std::endl;
+    std::wcerr << L"-prefetch   set the number of chunks read ahead by -serve after each range (default: "sv << DefaultServePrefetchChunks << L", 0 disables it)"sv << std::endl;
+    std::wcerr << L"-servebench measure the latency of count random 1 MiB range requests against -serve and exit"sv << std::endl;
+    std::wcerr << L"-live       write outfile at the pace of the video for a player reading it as it comes, decoding at most count frames ahead"sv << std::endl;
+    std::wcerr << L"            frames decoded late are replaced by repeating the previous one and late audio by silence (1-64; -threads, -resume,"sv << std::endl;
+    std::wcerr << L"            -manifest, -hashtree, -sha256, -repair, -wav, -proxy, -thumbs, -mkv, -dedup and -utvideo cannot be used)"sv << std::endl;
+    std::wcerr << L"-containerbench  build the layout of the AVI with and without -rec and of the Matroska file, report their build time, overhead and demuxer reads and exit"sv << std::endl;
+    std::wcerr << L"-inputbench  decode every frame reading infile through a file and through a mapping, cold and warm, report the time and reads and exit"sv << std::endl;
+    std::wcerr << L"-audiocheck  decode the audio of infile with one decoder and split across the thread pool, compare them, report the time and exit"sv << std::endl;
+    std::wcerr << L"-verify     hash file again and compare it with file.hashtree, listing the ranges that differ (threads: -threads, default: one per CPU)"sv << std::endl;
+    std::wcerr << L"-repair     convert only the ranges of outfile that differ from outfile.hashtree again; the options must be those of the original conversion"sv << std::endl;
+    std::wcerr << L"-batch      run the jobs of jobfile in one process, one per line as \"[options] infile outfile\" (# starts a comment)"sv << std::endl;
+    std::wcerr << L"            the options on the command line apply to every job; -threads sets the number of jobs run at once (default: one per CPU)"sv << std::endl;
+    std::wcerr << L"-memory     limit the memory estimated for the jobs of -batch running at once to size bytes (default: half of the physical memory)"sv << std::endl;
+    std::wcerr << L"-isa        limit SIMD kernels to scalar, sse2, ssse3, avx2 or avx512 (default: best supported)"sv << std::endl;
+    std::wcerr << L"-ntthreshold  copy buffers of at least this size with non-temporal stores (default: half of the last level cache, set 0 to disable)"sv << std::endl;
+    std::wcerr << L"-selfcheck  verify SIMD kernels against the scalar ones, measure their throughput and exit"sv << std::endl;
+    std::wcerr << L"-poolbench  measure how the thread pool scales from 1 to -threads (default: one per CPU) threads and exit"sv << std::endl;
     std::wcerr << std::endl;
+    std::wcerr << L"set infile to \"-\" to read from stdin"sv << std::endl;
     std::wcerr << L"set outfile to \"-\" to output to stdout"sv << std::endl;
     std::wcerr << std::endl;
     std::wcerr << L"This program makes use of EntisGLS version 4s.05." << std::endl;
@@ -55,62 +483,297 @@ int xwmain(int argc, wchar_t* argv[]) {
     CacheStorageLimit,
     DefaultAudioBlockSamples,
     DefaultJunkSize,
+    DedupHistorySize,
+    DefaultCodecSlices,
+    {
+      {0, 0, 0, 0},
+      0,
+      0,
+      FrameTransform::Filter::Box,
+      FrameTransform::PixelFormat::BGRA,
+    },
+    0,
+    {
+      0,
+      0,
+      AudioTransform::SampleFormat::Source,
+    },
+    DefaultInterleaveMillis,
   };
 
   std::size_t bufferSize = DefaultBufferSize;
+  std::uint_fast32_t numThreads = 1;
+  bool threadsSpecified = false;
+  bool pinThreads = false;
+  bool resume = false;
+  bool writeManifest = false;
+  bool writeHashTree = false;
+  bool hashSHA256 = false;
+  bool verify = false;
+  bool repair = false;
+  bool batch = false;
+  std::optional<std::uint64_t> memoryBudget;
+  MultiOutputTargets multiOutputTargets{
+    L""s,
+    L""s,
+    0,
+    0,
+    L""s,
+    0,
+  };
+  std::optional<std::uint16_t> servePort;
+  std::uint_fast32_t numServeDecoders = DefaultServeDecoders;
+  std::size_t servePrefetchChunks = DefaultServePrefetchChunks;
+  std::size_t serveBenchRequests = 0;
+  std::optional<std::uint_fast32_t> liveLookAhead;
+  std::optional<Kernel::ISA> forcedISA;
+  std::optional<std::size_t> streamingCopyThreshold;
+  bool selfCheck = false;
+  bool poolBench = false;
+  bool rawStreams = false;
+  bool rawPCM = false;
+  bool containerBench = false;
+  bool inputBench = false;
+  bool audioCheck = false;
+  bool mapInput = false;
+  std::size_t stdinMemoryLimit = SpooledInput::DefaultMemoryLimit;
 
   int argIndex = 1;
+  const auto nextArg = [argc, argv, &argIndex] () {
+    return NextArg(argc, argv, argIndex);
+  };
   while (argIndex < argc) {
     const std::wstring arg(argv[argIndex]);
     argIndex++;
 
-    if (arg == L"-quiet"sv) {
-      options.flags |= MEIToAVI::NoMessage;
+    switch (ParseConversionOption(arg, argc, argv, argIndex, options)) {
+      case ParseResult::Parsed:
+        continue;
+
+      case ParseResult::Invalid:
+        return 2;
+
+      case ParseResult::Unknown:
+        break;
+    }
+
+    if (arg == L"-bufsize"sv) {
+      const auto argBufferSize = std::stoll(nextArg());
+      if (argBufferSize < 1) {
+        std::wcerr << L"size must be greater than 0" << std::endl;
+        return 2;
+      }
+      bufferSize = static_cast<std::size_t>(argBufferSize);
       continue;
     }
 
-    if (arg == L"-noaudio"sv) {
-      options.flags |= MEIToAVI::NoAudio;
+    if (arg == L"-threads"sv) {
+      const auto argThreads = std::stoll(nextArg());
+      if (argThreads < 1 || argThreads > 256) {
+        std::wcerr << L"count must be between 1 and 256" << std::endl;
+        return 2;
+      }
+      numThreads = static_cast<std::uint_fast32_t>(argThreads);
+      threadsSpecified = true;
       continue;
     }
 
-    if (arg == L"-noalpha"sv) {
-      options.flags |= MEIToAVI::NoAlpha;
+    if (arg == L"-pin"sv) {
+      pinThreads = true;
       continue;
     }
 
-    if (arg == L"-orgfps"sv) {
-      options.flags |= MEIToAVI::NoApproxFPS;
+    if (arg == L"-resume"sv) {
+      resume = true;
       continue;
     }
 
-    if (arg == L"-ablock"sv) {
-      const auto argSamples = std::stoll(argv[argIndex++]);
-      if (argSamples < 0) {
-        std::wcerr << L"sample must be greater than or equal to 0" << std::endl;
+    if (arg == L"-manifest"sv) {
+      writeManifest = true;
+      continue;
+    }
+
+    if (arg == L"-hashtree"sv) {
+      writeHashTree = true;
+      continue;
+    }
+
+    if (arg == L"-sha256"sv) {
+      writeHashTree = true;
+      hashSHA256 = true;
+      continue;
+    }
+
+    if (arg == L"-verify"sv) {
+      verify = true;
+      continue;
+    }
+
+    if (arg == L"-repair"sv) {
+      repair = true;
+      continue;
+    }
+
+    if (arg == L"-batch"sv) {
+      batch = true;
+      continue;
+    }
+
+    if (arg == L"-memory"sv) {
+      const auto argMemory = std::stoll(nextArg());
+      if (argMemory < 1) {
+        std::wcerr << L"size must be greater than 0" << std::endl;
         return 2;
       }
-      options.audioBlockSamples = static_cast<std::uint_fast32_t>(argSamples);
+      memoryBudget = static_cast<std::uint64_t>(argMemory);
       continue;
     }
 
-    if (arg == L"-junksize"sv) {
-      const auto argJunkChunkSize = std::stoll(argv[argIndex++]);
-      if (argJunkChunkSize < 0) {
+    if (arg == L"-wav"sv) {
+      multiOutputTargets.wavFilePath = nextArg();
+      continue;
+    }
+
+    if (arg == L"-proxy"sv) {
+      const auto argWidth = std::stoll(nextArg());
+      const auto argHeight = std::stoll(nextArg());
+      if (argWidth < 0 || argHeight < 0 || argWidth > 65535 || argHeight > 65535) {
+        std::wcerr << L"width and height must be between 0 and 65535" << std::endl;
+        return 2;
+      }
+      multiOutputTargets.proxyWidth = static_cast<std::uint_fast32_t>(argWidth);
+      multiOutputTargets.proxyHeight = static_cast<std::uint_fast32_t>(argHeight);
+      multiOutputTargets.proxyFilePath = nextArg();
+      continue;
+    }
+
+    if (arg == L"-thumbs"sv) {
+      const auto argInterval = std::stoll(nextArg());
+      if (argInterval < 1) {
+        std::wcerr << L"seconds must be greater than 0" << std::endl;
+        return 2;
+      }
+      multiOutputTargets.thumbnailInterval = static_cast<std::uint_fast32_t>(argInterval);
+      multiOutputTargets.thumbnailPrefix = nextArg();
+      continue;
+    }
+
+    if (arg == L"-y4m"sv) {
+      rawStreams = true;
+      continue;
+    }
+
+    if (arg == L"-rawpcm"sv) {
+      rawPCM = true;
+      continue;
+    }
+
+    if (arg == L"-serve"sv) {
+      const auto argPort = std::stoll(nextArg());
+      if (argPort < 0 || argPort > 65535) {
+        std::wcerr << L"port must be between 0 and 65535" << std::endl;
+        return 2;
+      }
+      servePort = static_cast<std::uint16_t>(argPort);
+      continue;
+    }
+
+    if (arg == L"-decoders"sv) {
+      const auto argCount = std::stoll(nextArg());
+      if (argCount < 1 || argCount > 256) {
+        std::wcerr << L"count must be between 1 and 256" << std::endl;
+        return 2;
+      }
+      numServeDecoders = static_cast<std::uint_fast32_t>(argCount);
+      continue;
+    }
+
+    if (arg == L"-prefetch"sv) {
+      const auto argCount = std::stoll(nextArg());
+      if (argCount < 0 || argCount > 1024) {
+        std::wcerr << L"count must be between 0 and 1024" << std::endl;
+        return 2;
+      }
+      servePrefetchChunks = static_cast<std::size_t>(argCount);
+      continue;
+    }
+
+    if (arg == L"-servebench"sv) {
+      const auto argCount = std::stoll(nextArg());
+      if (argCount < 1) {
+        std::wcerr << L"count must be greater than 0" << std::endl;
+        return 2;
+      }
+      serveBenchRequests = static_cast<std::size_t>(argCount);
+      continue;
+    }
+
+    if (arg == L"-live"sv) {
+      const auto argCount = std::stoll(nextArg());
+      if (argCount < 1 || argCount > 64) {
+        std::wcerr << L"count must be between 1 and 64" << std::endl;
+        return 2;
+      }
+      liveLookAhead = static_cast<std::uint_fast32_t>(argCount);
+      continue;
+    }
+
+    if (arg == L"-containerbench"sv) {
+      containerBench = true;
+      continue;
+    }
+
+    if (arg == L"-inputbench"sv) {
+      inputBench = true;
+      continue;
+    }
+
+    if (arg == L"-audiocheck"sv) {
+      audioCheck = true;
+      continue;
+    }
+
+    if (arg == L"-mmap"sv) {
+      mapInput = true;
+      continue;
+    }
+
+    if (arg == L"-stdinbuf"sv) {
+      const auto argSize = std::stoll(nextArg());
+      if (argSize < 0) {
         std::wcerr << L"size must be greater than or equal to 0" << std::endl;
         return 2;
       }
-      options.junkChunkSize = static_cast<std::uint_fast32_t>(argJunkChunkSize);
+      stdinMemoryLimit = static_cast<std::size_t>(argSize);
       continue;
     }
 
-    if (arg == L"-bufsize"sv) {
-      const auto argBufferSize = std::stoll(argv[argIndex++]);
-      if (argBufferSize < 1) {
-        std::wcerr << L"size must be greater than 0" << std::endl;
+    if (arg == L"-isa"sv) {
+      forcedISA = Kernel::ParseISAName(nextArg());
+      if (!forcedISA) {
+        std::wcerr << L"name must be scalar, sse2, ssse3, avx2 or avx512" << std::endl;
         return 2;
       }
-      bufferSize = static_cast<std::size_t>(argBufferSize);
+      continue;
+    }
+
+    if (arg == L"-ntthreshold"sv) {
+      const auto argThreshold = std::stoll(nextArg());
+      if (argThreshold < 0) {
+        std::wcerr << L"size must be greater than or equal to 0" << std::endl;
+        return 2;
+      }
+      streamingCopyThreshold = argThreshold ? static_cast<std::size_t>(argThreshold) : std::numeric_limits<std::size_t>::max();
+      continue;
+    }
+
+    if (arg == L"-selfcheck"sv) {
+      selfCheck = true;
+      continue;
+    }
+
+    if (arg == L"-poolbench"sv) {
+      poolBench = true;
       continue;
     }
 
@@ -119,23 +782,412 @@ int xwmain(int argc, wchar_t* argv[]) {
     break;
   };
 
-  if (argIndex + 2 != argc) {
+  const auto isa = Kernel::Initialize(forcedISA, streamingCopyThreshold);
+
+  if (selfCheck) {
+    std::wcerr << L"[check] kernels in use: "sv << Kernel::GetISAName(isa) << std::endl;
+    return Kernel::RunSelfCheck(true) ? 0 : 1;
+  }
+
+  // large enough for every worker of -threads and -batch to run at once
+  const auto numPoolThreads = std::max<std::uint_fast32_t>(std::max(std::thread::hardware_concurrency(), 1u), numThreads);
+  ThreadPool::Configure(numPoolThreads, pinThreads);
+
+  if (poolBench) {
+    BenchThreadPool(numPoolThreads, pinThreads);
+    return 0;
+  }
+
+  if (inputBench) {
+    if (argIndex + 1 != argc || argv[argIndex] == L"-"sv) {
+      return ShowUsage(argv[0]);
+    }
+    Movie::BenchInput(argv[argIndex]);
+    return 0;
+  }
+
+  if (mapInput) {
+    Movie::SetInputMode(Movie::InputMode::Mapped);
+  }
+  SpooledInput::Configure(stdinMemoryLimit);
+
+  if (audioCheck) {
+    if (argIndex + 1 != argc) {
+      return ShowUsage(argv[0]);
+    }
+    return AudioDecoder::Check(argv[argIndex], ThreadPool::GetShared().GetNumWorkers() + 1) ? 0 : 1;
+  }
+
+  if (verify) {
+    if (argIndex + 1 != argc || rawStreams || servePort || containerBench || repair || batch || liveLookAhead) {
+      return ShowUsage(argv[0]);
+    }
+  } else if (batch) {
+    if (argIndex + 1 != argc || rawStreams || rawPCM || servePort || containerBench || repair || liveLookAhead) {
+      return ShowUsage(argv[0]);
+    }
+  } else if (rawStreams) {
+    if ((argIndex + 2 != argc && argIndex + 3 != argc) || servePort || containerBench || repair || liveLookAhead) {
+      return ShowUsage(argv[0]);
+    }
+  } else if (containerBench) {
+    if (argIndex + 1 != argc || servePort || rawPCM || liveLookAhead) {
+      return ShowUsage(argv[0]);
+    }
+  } else if (argIndex + (servePort ? 1 : 2) != argc || (serveBenchRequests && !servePort) || rawPCM || (servePort && (repair || liveLookAhead))) {
     return ShowUsage(argv[0]);
   }
 
+  if (!(options.flags & MEIToAVI::NoMessage)) {
+    if (forcedISA && isa != forcedISA) {
+      std::wcerr << L"[warn] "sv << Kernel::GetISAName(forcedISA.value()) << L" is not supported by this CPU, using "sv << Kernel::GetISAName(isa) << std::endl;
+    }
+    std::wcerr << L"[info] kernels: "sv << Kernel::GetISAName(isa) << L", streaming copy from "sv << Kernel::GetStreamingCopyThreshold() << L" bytes"sv << std::endl;
+  }
+
+  if (!CheckConversionOptions(options)) {
+    return 2;
+  }
+
+  // the audio of -y4m is written while it is decoded, as it comes
+  if (rawStreams && (options.audioTransform.samplingRate || options.audioTransform.numChannels || options.audioTransform.format != AudioTransform::SampleFormat::Source)) {
+    std::wcerr << L"-arate, -achannels and -afmt cannot be used with -y4m" << std::endl;
+    return 2;
+  }
+
+  if (verify) {
+    const std::wstring filePath(argv[argIndex++]);
+    const auto expected = HashTree::Read(filePath + L".hashtree"s);
+
+    OutputFile file(filePath, OutputFile::Mode::Read);
+
+    const auto startTime = std::chrono::steady_clock::now();
+    const auto actual = HashTree::HashFile(file, expected.leafSize, expected.sha256, threadsSpecified ? numThreads : std::max(std::thread::hardware_concurrency(), 1u));
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    if (!(options.flags & MEIToAVI::NoMessage)) {
+      std::wcerr << L"[info] verify: "sv << actual.fileSize << L" bytes in "sv << seconds << L" s ("sv
+                 << (seconds > 0 ? actual.fileSize / seconds / (1024 * 1024) : 0.0) << L" MiB/s)"sv << std::endl;
+    }
+
+    if (actual.fileSize != expected.fileSize) {
+      std::wcerr << L"[verify] size differs: "sv << actual.fileSize << L" bytes, expected "sv << expected.fileSize << L" bytes"sv << std::endl;
+    }
+
+    const auto ranges = HashTree::Compare(expected, actual);
+    std::uint64_t differentSize = 0;
+    for (const auto& range : ranges) {
+      std::wcerr << L"[verify] differs: "sv << range.begin << L"-"sv << range.end << L" ("sv << (range.end - range.begin) << L" bytes)"sv << std::endl;
+      differentSize += range.end - range.begin;
+    }
+
+    if (ranges.empty()) {
+      std::wcerr << L"[verify] ok, root "sv << ToHex(HashTree::GetRootHash(actual)) << (expected.sha256 ? L" (with SHA-256)"sv : L""sv) << std::endl;
+      return 0;
+    }
+    std::wcerr << L"[verify] "sv << ranges.size() << L" ranges ("sv << differentSize << L" bytes) differ"sv << std::endl;
+    return 1;
+  }
+
+  if (batch) {
+    const bool multiOutput = !multiOutputTargets.wavFilePath.empty() || !multiOutputTargets.proxyFilePath.empty() || !multiOutputTargets.thumbnailPrefix.empty();
+    if (resume || multiOutput) {
+      std::wcerr << L"-batch cannot be used with -resume, -wav, -proxy or -thumbs" << std::endl;
+      return 2;
+    }
+
+    const Batch::Job defaults{
+      0,
+      L""s,
+      L""s,
+      options,
+      bufferSize,
+      writeManifest,
+      writeHashTree,
+      hashSHA256,
+    };
+
+    std::vector<Batch::Job> jobs;
+    for (const auto& jobLine : Batch::ReadJobFile(argv[argIndex++])) {
+      const auto job = ParseBatchJob(jobLine, defaults);
+      if (!job) {
+        return 2;
+      }
+      jobs.push_back(job.value());
+    }
+
+    const auto numWorkers = threadsSpecified ? numThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    const auto numFailed = Batch::Run(jobs, numWorkers, memoryBudget ? memoryBudget.value() : Batch::GetDefaultMemoryBudget(), !(options.flags & MEIToAVI::NoMessage));
+    return numFailed ? 1 : 0;
+  }
+
   const std::wstring inFile(argv[argIndex++]);
+
+  if (containerBench) {
+    MEIToAVI meiToAvi(inFile, options);
+    meiToAvi.BenchContainers();
+    return 0;
+  }
+
+  if (rawStreams) {
+    const std::wstring videoTarget(argv[argIndex++]);
+    const std::wstring audioTarget(argIndex < argc ? argv[argIndex++] : L"");
+
+    if (videoTarget == L"-"sv && audioTarget == L"-"sv) {
+      std::wcerr << L"videoout and audioout cannot both be stdout" << std::endl;
+      return 2;
+    }
+
+    // both are opened first so that an unwritable path fails before decoding
+    StreamOutput videoOutput(videoTarget);
+    std::optional<StreamOutput> audioOutput;
+    if (!audioTarget.empty()) {
+      audioOutput.emplace(audioTarget);
+    }
+
+    WriteRawStreams(inFile, options, &videoOutput, audioOutput ? &audioOutput.value() : nullptr, rawPCM);
+    return 0;
+  }
+
+  if (servePort) {
+    MEIToAVI meiToAvi(inFile, options);
+    const auto totalSize = static_cast<std::uint64_t>(meiToAvi.GetSource().GetSize());
+
+    const bool showMessage = !(options.flags & MEIToAVI::NoMessage);
+
+    // the primary instance is left untouched, as the readers are cloned from it
+    // readers are created on demand by the connection threads, one at a time as EntisGLS is not meant to open files concurrently
+    const auto numEncoderThreads = std::max<std::uint_fast32_t>(std::max(std::thread::hardware_concurrency(), 1u) / numServeDecoders, 1);
+    std::mutex readerCreationMutex;
+    DecoderPool<SourceBase> sourcePool([&meiToAvi, &readerCreationMutex, numEncoderThreads] () {
+      std::lock_guard lock(readerCreationMutex);
+      std::shared_ptr<MEIToAVI::Reader> reader = meiToAvi.CreateReader(numEncoderThreads);
+      auto& source = reader->GetSource();
+      return std::shared_ptr<SourceBase>(std::move(reader), &source);
+    }, [&meiToAvi] (std::uint64_t fromOffset, std::uint64_t toOffset) {
+      return meiToAvi.EstimateSeekCost(fromOffset, toOffset);
+    }, MEIToAVI::RandomSeekCost, 1, numServeDecoders, ServeDecoderIdleTimeout);
+
+    RangeServer server(sourcePool, totalSize, meiToAvi.GetBlockLayout(), servePrefetchChunks, servePort.value(), bufferSize, showMessage && !serveBenchRequests);
+
+    if (showMessage) {
+      std::wcerr << L"[info] avi size = "sv << totalSize << L" bytes"sv << std::endl;
+      std::wcerr << L"[info] serving at http://127.0.0.1:"sv << server.GetPort() << L"/"sv << std::endl;
+    }
+
+    if (serveBenchRequests) {
+      std::thread serverThread([&server] () {
+        server.Run();
+      });
+      try {
+        RunRangeLoadTest(server.GetPort(), totalSize, serveBenchRequests, ServeBenchRequestSize, ServeBenchClients);
+      } catch (...) {
+        server.Close();
+        serverThread.join();
+        throw;
+      }
+      server.Close();
+      serverThread.join();
+
+      const auto stats = sourcePool.GetStats();
+      const auto toMilliseconds = [] (auto duration) {
+        return std::chrono::duration<double, std::milli>(duration).count();
+      };
+      std::wcerr << L"[bench] decoders: "sv << stats.maxDecoders << L" at most, "sv << stats.numCreated << L" created, "sv << stats.numDestroyed << L" destroyed"sv << std::endl;
+      std::wcerr << L"[bench] reads: "sv << stats.numAcquisitions << L", seek cost "sv << (stats.numAcquisitions ? static_cast<double>(stats.totalSeekCost) / stats.numAcquisitions : 0.0) << L" frames avg, "sv << stats.maxSeekCost << L" max"sv << std::endl;
+      std::wcerr << L"[bench] decoder wait: "sv << (stats.numAcquisitions ? toMilliseconds(stats.totalWaitTime) / stats.numAcquisitions : 0.0) << L" ms avg, "sv << toMilliseconds(stats.maxWaitTime) << L" ms max"sv << std::endl;
+      const auto prefetchStats = server.GetPrefetchStats();
+      std::wcerr << L"[bench] prefetch: "sv << prefetchStats.numPrefetches << L" read-aheads of "sv << prefetchStats.prefetchedSize << L" bytes, "sv << prefetchStats.usedSize << L" bytes of them sent"sv << std::endl;
+      return 0;
+    }
+
+    server.Run();
+    return 0;
+  }
+
   const std::wstring outFile(argv[argIndex++]);
 
   const bool useStdOut = outFile == L"-"sv;
 
-  std::ofstream ofs;
-  if (useStdOut) {
-    if (_setmode(_fileno(stdout), _O_BINARY) == -1) {
-      throw std::runtime_error("_setmode failed"s);
+  if (useStdOut && numThreads > 1) {
+    std::wcerr << L"-threads cannot be used with stdout" << std::endl;
+    return 2;
+  }
+
+  if (useStdOut && writeManifest) {
+    std::wcerr << L"-manifest cannot be used with stdout" << std::endl;
+    return 2;
+  }
+
+  const bool multiOutput = !multiOutputTargets.wavFilePath.empty() || !multiOutputTargets.proxyFilePath.empty() || !multiOutputTargets.thumbnailPrefix.empty();
+
+  if (multiOutput && (useStdOut || numThreads > 1)) {
+    std::wcerr << L"-wav, -proxy and -thumbs cannot be used with stdout or -threads" << std::endl;
+    return 2;
+  }
+
+  if (resume && (useStdOut || multiOutput)) {
+    std::wcerr << L"-resume cannot be used with stdout, -wav, -proxy or -thumbs" << std::endl;
+    return 2;
+  }
+
+  if (writeHashTree && (useStdOut || multiOutput)) {
+    std::wcerr << L"-hashtree and -sha256 cannot be used with stdout, -wav, -proxy or -thumbs" << std::endl;
+    return 2;
+  }
+
+  if (repair && (useStdOut || multiOutput || resume || writeHashTree || writeManifest)) {
+    std::wcerr << L"-repair cannot be used with stdout, -resume, -manifest, -hashtree, -sha256, -wav, -proxy or -thumbs" << std::endl;
+    return 2;
+  }
+
+  if (liveLookAhead) {
+    if (numThreads > 1 || resume || writeManifest || writeHashTree || repair || multiOutput || (options.flags & (MEIToAVI::Matroska | MEIToAVI::DedupFrames | MEIToAVI::UtVideo))) {
+      std::wcerr << L"-live cannot be used with -threads, -resume, -manifest, -hashtree, -sha256, -repair, -wav, -proxy, -thumbs, -mkv, -dedup or -utvideo" << std::endl;
+      return 2;
+    }
+
+    const bool showMessage = !(options.flags & MEIToAVI::NoMessage);
+
+    // opened first so that an unwritable path fails before the input is analyzed
+    StreamOutput output(outFile);
+
+    MEIToAVI meiToAvi(inFile, options);
+
+    if (showMessage) {
+      std::wcerr << L"[info] avi size = "sv << meiToAvi.GetSource().GetSize() << L" bytes"sv << std::endl;
+    }
+
+    WriteLive(meiToAvi, output, liveLookAhead.value(), bufferSize, showMessage);
+    output.Close();
+    return 0;
+  }
+
+  // from here on the output is a file, where JUNK can be left as a hole (repair must lay it out as the original did)
+  if (!useStdOut) {
+    options.flags |= MEIToAVI::SparseOutput;
+  }
+
+  if (repair) {
+    const bool showMessage = !(options.flags & MEIToAVI::NoMessage);
+
+    const auto expected = HashTree::Read(outFile + L".hashtree"s);
+
+    OutputFile outputFile(outFile, OutputFile::Mode::Modify);
+
+    auto ranges = HashTree::Compare(expected, HashTree::HashFile(outputFile, expected.leafSize, expected.sha256, threadsSpecified ? numThreads : std::max(std::thread::hardware_concurrency(), 1u)));
+    if (ranges.empty() && outputFile.GetSize() == expected.fileSize) {
+      if (showMessage) {
+        std::wcerr << L"[info] repair: outfile matches outfile.hashtree, nothing to do"sv << std::endl;
+      }
+      return 0;
+    }
+
+    MEIToAVI meiToAvi(inFile, options);
+    auto& source = meiToAvi.GetSource();
+
+    // the first leaf holds the headers and the last one the indexes, which change with nearly any option
+    const auto numLeaves = HashTree::CountLeaves(expected.fileSize, expected.leafSize);
+    if (static_cast<std::uint64_t>(source.GetSize()) != expected.fileSize || !MatchesLeaf(source, expected, 0) || !MatchesLeaf(source, expected, numLeaves - 1)) {
+      std::wcerr << L"infile or the options differ from those of the original conversion" << std::endl;
+      return 1;
+    }
+
+    // a longer file is cut, and a shorter one is extended and filled
+    if (outputFile.GetSize() != expected.fileSize) {
+      outputFile.Preallocate(expected.fileSize);
+    }
+    for (auto& range : ranges) {
+      range.end = std::min(range.end, expected.fileSize);
+    }
+    ranges.erase(std::remove_if(ranges.begin(), ranges.end(), [] (const HashTree::Range& range) {
+      return range.begin >= range.end;
+    }), ranges.end());
+
+    std::uint64_t repairSize = 0;
+    for (const auto& range : ranges) {
+      repairSize += range.end - range.begin;
+    }
+    if (showMessage) {
+      std::wcerr << L"[info] repair: "sv << ranges.size() << L" ranges, "sv << repairSize << L" bytes"sv << std::endl;
+    }
+
+    HashTree::Builder hashBuilder(expected.fileSize, expected.leafSize, expected.sha256);
+    RewriteRanges(meiToAvi, outputFile, ranges, numThreads, bufferSize, showMessage, &hashBuilder);
+
+    // the rewritten ranges consist of whole leaves, so all of them have been hashed
+    const auto& repaired = hashBuilder.GetLeaves();
+    for (const auto& range : ranges) {
+      for (auto leafIndex = static_cast<std::size_t>(range.begin / expected.leafSize); leafIndex * expected.leafSize < range.end; leafIndex++) {
+        if (repaired.hashes[leafIndex] != expected.hashes[leafIndex] || (expected.sha256 && repaired.digests[leafIndex] != expected.digests[leafIndex])) {
+          throw std::runtime_error("repaired data does not match the hash tree"s);
+        }
+      }
+    }
+
+    outputFile.Close();
+
+    if (showMessage) {
+      std::wcerr << L"[info] repair: "sv << repairSize << L" bytes rewritten and verified"sv << std::endl;
+    }
+    return 0;
+  }
+
+  if (!useStdOut) {
+    // opened first so that an unwritable path fails before the input is analyzed
+    OutputFile outputFile(outFile, resume ? OutputFile::Mode::Keep : OutputFile::Mode::Create);
+
+    MEIToAVI meiToAvi(inFile, options);
+
+    if (!(options.flags & MEIToAVI::NoMessage)) {
+      std::wcerr << L"[info] avi size = "sv << meiToAvi.GetSource().GetSize() << L" bytes"sv << std::endl;
+    }
+
+    std::optional<ResumeJournal> journal;
+    if (resume) {
+      journal.emplace(outFile + L".resume"s, meiToAvi.GetSource(), meiToAvi.GetBlockLayout());
+    }
+
+    std::optional<HashTree::Builder> hashBuilder;
+    if (writeHashTree) {
+      hashBuilder.emplace(meiToAvi.GetSource().GetSize(), HashTree::DefaultLeafSize, hashSHA256);
+    }
+
+    if (multiOutput) {
+      WriteMultiOutput(meiToAvi, outputFile, multiOutputTargets, bufferSize, !(options.flags & MEIToAVI::NoMessage));
+    } else {
+      WriteParallel(meiToAvi, outputFile, numThreads, bufferSize, !(options.flags & MEIToAVI::NoMessage), journal ? &journal.value() : nullptr, hashBuilder ? &hashBuilder.value() : nullptr);
+    }
+
+    if (hashBuilder) {
+      // only the leaves skipped by -resume are read back
+      const auto readBackSize = hashBuilder->Complete(outputFile, numThreads);
+      HashTree::Write(outFile + L".hashtree"s, hashBuilder->GetLeaves());
+
+      if (!(options.flags & MEIToAVI::NoMessage)) {
+        std::wcerr << L"[info] hash tree: "sv << hashBuilder->GetLeaves().hashes.size() << L" leaves, root "sv << ToHex(HashTree::GetRootHash(hashBuilder->GetLeaves()));
+        if (readBackSize) {
+          std::wcerr << L", "sv << readBackSize << L" bytes read back"sv;
+        }
+        std::wcerr << std::endl;
+      }
     }
-  } else {
-    ofs.exceptions(std::ios::failbit | std::ios::badbit);
-    ofs.open(outFile, std::ios::binary);
+
+    outputFile.Close();
+
+    if (journal) {
+      journal->Remove();
+    }
+
+    if (writeManifest) {
+      meiToAvi.WriteManifest(outFile + L".manifest"s, outFile + L".manifest.json"s);
+    }
+
+    return 0;
+  }
+
+  if (_setmode(_fileno(stdout), _O_BINARY) == -1) {
+    throw std::runtime_error("_setmode failed"s);
   }
 
   {
@@ -150,20 +1202,14 @@ int xwmain(int argc, wchar_t* argv[]) {
     auto buffer = std::make_unique<std::uint8_t[]>(bufferSize);
     std::streamsize offset = 0;
 
-    std::ostream* ptrOs = useStdOut ? &std::cout : &ofs;
-
     while (offset != totalSize) {
       const auto readSize = static_cast<std::size_t>(std::min<std::streamsize>(bufferSize, totalSize - offset));
       source.Read(buffer.get(), readSize, offset);
-      ptrOs->write(reinterpret_cast<const char*>(buffer.get()), readSize);
+      std::cout.write(reinterpret_cast<const char*>(buffer.get()), readSize);
       offset += readSize;
     }
 
-    ptrOs->flush();
-  }
-
-  if (!useStdOut) {
-    ofs.close();
+    std::cout.flush();
   }
 
   return 0;
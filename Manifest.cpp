@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Manifest.hpp"
+
+
+namespace {
+  // blocks sorted by stream and block index, which is also the order of the output
+  std::vector<const AVIBuilder::BlockLayout*> SortBlocks(std::size_t numStreams, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+    std::vector<const AVIBuilder::BlockLayout*> sortedBlocks;
+    sortedBlocks.reserve(blockLayout.size());
+    for (const auto& block : blockLayout) {
+      if (block.streamIndex >= numStreams) {
+        throw std::runtime_error("Manifest: stream index out of range");
+      }
+      sortedBlocks.push_back(&block);
+    }
+
+    std::stable_sort(sortedBlocks.begin(), sortedBlocks.end(), [] (const AVIBuilder::BlockLayout* a, const AVIBuilder::BlockLayout* b) {
+      return a->streamIndex != b->streamIndex ? a->streamIndex < b->streamIndex : a->blockIndex < b->blockIndex;
+    });
+
+    return sortedBlocks;
+  }
+
+
+  std::vector<std::uint32_t> CountBlocks(std::size_t numStreams, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+    std::vector<std::uint32_t> counts(numStreams, 0);
+    for (const auto& block : blockLayout) {
+      counts[block.streamIndex]++;
+    }
+    return counts;
+  }
+
+
+  std::uint16_t GetFlags(const AVIBuilder::BlockLayout& block) {
+    std::uint16_t flags = 0;
+    if (block.indexFlags & AVI::AVIIF_KEYFRAME) {
+      flags |= Manifest::FlagKeyframe;
+    }
+    if (block.reference) {
+      flags |= Manifest::FlagReference;
+    }
+    return flags;
+  }
+
+
+  std::string FourCCToString(std::uint32_t fourCC) {
+    std::string str;
+    for (int i = 0; i < 4; i++) {
+      const auto c = static_cast<char>((fourCC >> (i * 8)) & 0xFF);
+      // stream ids are printable ASCII; anything else is escaped so that the JSON stays valid
+      if (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') {
+        str += c;
+      } else {
+        static const char hex[] = "0123456789abcdef";
+        str += "\\u00";
+        str += hex[(c >> 4) & 0x0F];
+        str += hex[c & 0x0F];
+      }
+    }
+    return str;
+  }
+}
+
+
+void Manifest::Write(const std::wstring& filePath, std::uint64_t fileSize, const std::vector<StreamInfo>& streams, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+  const auto sortedBlocks = SortBlocks(streams.size(), blockLayout);
+  const auto blockCounts = CountBlocks(streams.size(), blockLayout);
+
+  std::ofstream ofs;
+  ofs.exceptions(std::ios::failbit | std::ios::badbit);
+  ofs.open(filePath, std::ios::binary);
+
+  const FileHeader fileHeader{
+    Magic,
+    Version,
+    static_cast<std::uint32_t>(streams.size()),
+    0u,
+    fileSize,
+    static_cast<std::uint64_t>(sortedBlocks.size()),
+  };
+  ofs.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+  std::uint32_t firstBlock = 0;
+  for (std::size_t i = 0; i < streams.size(); i++) {
+    const auto& stream = streams[i];
+    const StreamEntry streamEntry{
+      stream.chunkId,
+      stream.fccType,
+      stream.scale,
+      stream.rate,
+      firstBlock,
+      blockCounts[i],
+    };
+    ofs.write(reinterpret_cast<const char*>(&streamEntry), sizeof(streamEntry));
+    firstBlock += blockCounts[i];
+  }
+
+  std::vector<BlockEntry> blockEntries;
+  blockEntries.reserve(sortedBlocks.size());
+  for (const auto ptrBlock : sortedBlocks) {
+    blockEntries.push_back(BlockEntry{
+      ptrBlock->dataOffset,
+      static_cast<std::uint32_t>(ptrBlock->size),
+      static_cast<std::uint32_t>(ptrBlock->startTime),
+      static_cast<std::uint16_t>(ptrBlock->streamIndex),
+      GetFlags(*ptrBlock),
+      0u,
+    });
+  }
+  ofs.write(reinterpret_cast<const char*>(blockEntries.data()), sizeof(BlockEntry) * blockEntries.size());
+
+  ofs.close();
+}
+
+
+void Manifest::WriteJSON(const std::wstring& filePath, std::uint64_t fileSize, const std::vector<StreamInfo>& streams, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+  const auto sortedBlocks = SortBlocks(streams.size(), blockLayout);
+
+  std::ofstream ofs;
+  ofs.exceptions(std::ios::failbit | std::ios::badbit);
+  ofs.open(filePath, std::ios::binary);
+
+  ofs << "{\n";
+  ofs << "  \"version\": " << Version << ",\n";
+  ofs << "  \"fileSize\": " << fileSize << ",\n";
+  ofs << "  \"streams\": [";
+
+  auto itrBlock = sortedBlocks.cbegin();
+  for (std::size_t i = 0; i < streams.size(); i++) {
+    const auto& stream = streams[i];
+    ofs << (i ? ",\n" : "\n");
+    ofs << "    {\n";
+    ofs << "      \"chunkId\": \"" << FourCCToString(stream.chunkId) << "\",\n";
+    ofs << "      \"type\": \"" << FourCCToString(stream.fccType) << "\",\n";
+    ofs << "      \"scale\": " << stream.scale << ",\n";
+    ofs << "      \"rate\": " << stream.rate << ",\n";
+    ofs << "      \"blocks\": [";
+
+    // offset and size of the data, start time in stream units, flags (1: keyframe, 2: reference)
+    bool first = true;
+    for (; itrBlock != sortedBlocks.cend() && (*itrBlock)->streamIndex == i; itrBlock++) {
+      const auto& block = **itrBlock;
+      ofs << (first ? "\n" : ",\n");
+      ofs << "        [" << block.dataOffset << ", " << block.size << ", " << block.startTime << ", " << GetFlags(block) << "]";
+      first = false;
+    }
+
+    ofs << (first ? "]\n" : "\n      ]\n");
+    ofs << "    }";
+  }
+
+  ofs << (streams.empty() ? "]\n" : "\n  ]\n");
+  ofs << "}\n";
+
+  ofs.close();
+}
@@ -0,0 +1,81 @@
+#ifndef ML_MANIFEST_HPP
+#define ML_MANIFEST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
+
+
+// sidecar listing where the data of every block is in the AVI, so that a consumer can read frame N of a stream
+// with a single positional read, without parsing idx1 or ix##
+//
+// binary layout (little endian):
+//   FileHeader
+//   StreamEntry * numStreams
+//   BlockEntry * numBlocks     sorted by stream, then by block index
+// block N of stream S is BlockEntry[streams[S].firstBlock + N]
+namespace Manifest {
+  constexpr std::uint32_t Magic = AVI::GetFourCC("M2AM");
+  constexpr std::uint32_t Version = 1;
+
+  constexpr std::uint16_t FlagKeyframe = 0x0001;
+  constexpr std::uint16_t FlagReference = 0x0002;   // shares the chunk of an earlier block
+
+
+#pragma pack(push, 1)
+
+  struct FileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t numStreams;
+    std::uint32_t reserved;
+    std::uint64_t fileSize;       // of the AVI
+    std::uint64_t numBlocks;
+  };
+
+  static_assert(sizeof(FileHeader) == 4 * 8);
+
+
+  struct StreamEntry {
+    std::uint32_t chunkId;        // 00db, 01wb, ...
+    std::uint32_t fccType;        // vids, auds, ...
+    std::uint32_t scale;          // startTime * scale / rate = seconds
+    std::uint32_t rate;
+    std::uint32_t firstBlock;
+    std::uint32_t numBlocks;
+  };
+
+  static_assert(sizeof(StreamEntry) == 4 * 6);
+
+
+  struct BlockEntry {
+    std::uint64_t offset;         // of the data, not the chunk header
+    std::uint32_t size;
+    std::uint32_t startTime;      // in stream units
+    std::uint16_t streamIndex;
+    std::uint16_t flags;
+    std::uint32_t reserved;
+  };
+
+  static_assert(sizeof(BlockEntry) == 4 * 6);
+
+#pragma pack(pop)
+
+
+  struct StreamInfo {
+    std::uint32_t chunkId;
+    std::uint32_t fccType;
+    std::uint32_t scale;
+    std::uint32_t rate;
+  };
+
+  void Write(const std::wstring& filePath, std::uint64_t fileSize, const std::vector<StreamInfo>& streams, const std::vector<AVIBuilder::BlockLayout>& blockLayout);
+  // the same content for humans and scripts
+  void WriteJSON(const std::wstring& filePath, std::uint64_t fileSize, const std::vector<StreamInfo>& streams, const std::vector<AVIBuilder::BlockLayout>& blockLayout);
+}
+
+#endif
@@ -0,0 +1,256 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "MappedFile.hpp"
+
+#include <Windows.h>
+
+#include <sakuraglx/sakuraglx.h>
+
+
+namespace {
+  using PrefetchVirtualMemoryFunction = BOOL (WINAPI*)(HANDLE, ULONG_PTR, PWIN32_MEMORY_RANGE_ENTRY, ULONG);
+
+  // mappings of the inputs still in use, by path
+  std::mutex gMappingsMutex;
+  std::unordered_map<std::wstring, std::weak_ptr<MappedFile>> gMappings;
+
+
+  // PrefetchVirtualMemory is new in Windows 8, so it is looked up rather than imported; null on older systems
+  PrefetchVirtualMemoryFunction GetPrefetchVirtualMemory() {
+    static const auto function = reinterpret_cast<PrefetchVirtualMemoryFunction>(GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory"));
+    return function;
+  }
+
+
+  // an I/O error while a page is brought in raises EXCEPTION_IN_PAGE_ERROR rather than failing a read
+  // (kept apart from the callers, as __try cannot be used in a function with objects to unwind)
+  bool CopyFromView(void* data, const std::uint8_t* view, std::size_t size) {
+    __try {
+      std::memcpy(data, view, size);
+    } __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+      return false;
+    }
+    return true;
+  }
+}
+
+
+MappedFile::MappedFile(const std::wstring& filePath) :
+  mFileHandle(INVALID_HANDLE_VALUE),
+  mMappingHandle(nullptr),
+  mData(nullptr),
+  mSize(0),
+  mNumReads(0),
+  mReadSize(0),
+  mNumPrefetches(0),
+  mPrefetchSize(0)
+{
+  mFileHandle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (mFileHandle == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("MappedFile: cannot open file");
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mFileHandle, &size)) {
+    CloseHandle(mFileHandle);
+    throw std::runtime_error("MappedFile: cannot get file size");
+  }
+  mSize = static_cast<std::uint64_t>(size.QuadPart);
+
+  // an empty file cannot be mapped, and has nothing to read anyway
+  if (!mSize) {
+    return;
+  }
+
+  if (mSize > std::numeric_limits<std::size_t>::max()) {
+    CloseHandle(mFileHandle);
+    throw std::runtime_error("MappedFile: file too large to map");
+  }
+
+  mMappingHandle = CreateFileMappingW(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mMappingHandle) {
+    CloseHandle(mFileHandle);
+    throw std::runtime_error("MappedFile: cannot map file");
+  }
+
+  mData = static_cast<const std::uint8_t*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+  if (!mData) {
+    CloseHandle(mMappingHandle);
+    CloseHandle(mFileHandle);
+    throw std::runtime_error("MappedFile: cannot map file");
+  }
+}
+
+
+MappedFile::~MappedFile() {
+  if (mData) {
+    UnmapViewOfFile(mData);
+  }
+  if (mMappingHandle) {
+    CloseHandle(mMappingHandle);
+  }
+  CloseHandle(mFileHandle);
+}
+
+
+std::shared_ptr<MappedFile> MappedFile::Open(const std::wstring& filePath) {
+  std::lock_guard lock(gMappingsMutex);
+
+  for (auto itr = gMappings.begin(); itr != gMappings.end(); ) {
+    if (itr->second.expired()) {
+      itr = gMappings.erase(itr);
+    } else {
+      itr++;
+    }
+  }
+
+  if (const auto itr = gMappings.find(filePath); itr != gMappings.end()) {
+    if (auto file = itr->second.lock()) {
+      return file;
+    }
+  }
+
+  auto file = std::make_shared<MappedFile>(filePath);
+  gMappings[filePath] = file;
+  return file;
+}
+
+
+std::uint64_t MappedFile::GetSize() const {
+  return mSize;
+}
+
+
+std::size_t MappedFile::Read(void* data, std::size_t size, std::uint64_t offset) {
+  auto readSize = static_cast<std::size_t>(std::min<std::uint64_t>(size, mSize - std::min(offset, mSize)));
+  // nothing is read on an I/O error, as ReadFile would fail
+  if (readSize && !CopyFromView(data, mData + offset, readSize)) {
+    readSize = 0;
+  }
+
+  mNumReads++;
+  mReadSize += readSize;
+
+  return readSize;
+}
+
+
+void MappedFile::Prefetch(std::uint64_t offset, std::uint64_t size) {
+  // only a hint; on systems older than Windows 8 the pages are simply read on access
+  const auto prefetchVirtualMemory = GetPrefetchVirtualMemory();
+  if (!prefetchVirtualMemory || offset >= mSize) {
+    return;
+  }
+  size = std::min(size, mSize - offset);
+
+  WIN32_MEMORY_RANGE_ENTRY range{
+    const_cast<std::uint8_t*>(mData + offset),
+    static_cast<SIZE_T>(size),
+  };
+  prefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+  mNumPrefetches++;
+  mPrefetchSize += size;
+}
+
+
+MappedFile::Stats MappedFile::GetStats() const {
+  return Stats{
+    mNumReads,
+    mReadSize,
+    mNumPrefetches,
+    mPrefetchSize,
+  };
+}
+
+
+
+MappedFileInterface::MappedFileInterface(std::shared_ptr<MappedFile> file) :
+  mFile(file),
+  mPosition(0),
+  mPrefetchBegin(0),
+  mPrefetchEnd(0)
+{}
+
+
+SSystem::SFileInterface* MappedFileInterface::Duplicate() {
+  auto duplicate = new MappedFileInterface(mFile);
+  duplicate->mPosition = mPosition;
+  return duplicate;
+}
+
+
+unsigned long int MappedFileInterface::Read(void* ptrBuffer, unsigned long int nBytes) {
+  if (mPosition < mPrefetchBegin || mPosition > mPrefetchEnd) {
+    // seeked away
+    mPrefetchBegin = mPosition;
+    mPrefetchEnd = mPosition;
+  }
+  if (mPosition + nBytes + PrefetchSize / 2 > mPrefetchEnd) {
+    const auto prefetchEnd = std::min(mPosition + nBytes + PrefetchSize, mFile->GetSize());
+    if (prefetchEnd > mPrefetchEnd) {
+      mFile->Prefetch(mPrefetchEnd, prefetchEnd - mPrefetchEnd);
+      mPrefetchEnd = prefetchEnd;
+    }
+  }
+
+  const auto readSize = mFile->Read(ptrBuffer, nBytes, mPosition);
+  mPosition += readSize;
+  return static_cast<unsigned long int>(readSize);
+}
+
+
+unsigned long int MappedFileInterface::Write(const void* ptrBuffer, unsigned long int nBytes) {
+  return 0;
+}
+
+
+SSystem::UInt64 MappedFileInterface::GetLength() {
+  return mFile->GetSize();
+}
+
+
+SSystem::UInt64 MappedFileInterface::GetPosition() const {
+  return mPosition;
+}
+
+
+SSystem::SError MappedFileInterface::Seek(SSystem::Int64 nOffsetPos, SeekOrigin fSeekFrom) {
+  std::int64_t base = 0;
+  switch (fSeekFrom) {
+    case FromBegin:
+      base = 0;
+      break;
+
+    case FromCurrent:
+      base = static_cast<std::int64_t>(mPosition);
+      break;
+
+    case FromEnd:
+      base = static_cast<std::int64_t>(mFile->GetSize());
+      break;
+  }
+
+  const auto position = base + nOffsetPos;
+  if (position < 0) {
+    return SSystem::SError::errGeneralError;
+  }
+  mPosition = static_cast<std::uint64_t>(position);
+  return SSystem::SError::errSuccess;
+}
+
+
+SSystem::SError MappedFileInterface::SetEndOfFile() {
+  return SSystem::SError::errGeneralError;
+}
@@ -0,0 +1,86 @@
+#ifndef ML_MAPPEDFILE_HPP
+#define ML_MAPPEDFILE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <sakuraglx/sakuraglx.h>
+
+
+// read-only view of a whole input file, shared by every decoder which opens the same path
+// reads are copies from the view, so a decoder read costs no system call unless it touches a page which is not resident;
+// the pages ahead of each reader are requested in the background as it goes (see MappedFileInterface)
+class MappedFile {
+public:
+  struct Stats {
+    std::uint64_t numReads;
+    std::uint64_t readSize;
+    std::uint64_t numPrefetches;    // system calls
+    std::uint64_t prefetchSize;
+  };
+
+private:
+  void* mFileHandle;      // HANDLE
+  void* mMappingHandle;   // HANDLE
+  const std::uint8_t* mData;
+  std::uint64_t mSize;
+  std::atomic<std::uint64_t> mNumReads;
+  std::atomic<std::uint64_t> mReadSize;
+  std::atomic<std::uint64_t> mNumPrefetches;
+  std::atomic<std::uint64_t> mPrefetchSize;
+
+public:
+  // throws if the file cannot be mapped, e.g. when it does not fit in the address space of a 32-bit process
+  explicit MappedFile(const std::wstring& filePath);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // the mapping of filePath which is still in use, or a new one
+  static std::shared_ptr<MappedFile> Open(const std::wstring& filePath);
+
+  std::uint64_t GetSize() const;
+
+  // thread-safe; returns the number of bytes copied, which is less than size only at the end of the file or,
+  // as 0, on an I/O error while the pages are brought in (e.g. a network share gone or the file truncated by another process)
+  std::size_t Read(void* data, std::size_t size, std::uint64_t offset);
+  // thread-safe; asks the system to read [offset, offset + size) into memory without waiting for it
+  // does nothing on systems older than Windows 8
+  void Prefetch(std::uint64_t offset, std::uint64_t size);
+
+  Stats GetStats() const;
+};
+
+
+// file interface of EntisGLS over a MappedFile, with its own position
+// the pages from the position up to PrefetchSize ahead are prefetched whenever less than half of that remains
+// prefetched, and a seek outside of the prefetched range starts over from the new position
+class MappedFileInterface : public SSystem::SFileInterface {
+public:
+  static constexpr std::uint64_t PrefetchSize = 4 * 1024 * 1024;
+
+private:
+  std::shared_ptr<MappedFile> mFile;
+  std::uint64_t mPosition;
+  std::uint64_t mPrefetchBegin;
+  std::uint64_t mPrefetchEnd;
+
+public:
+  explicit MappedFileInterface(std::shared_ptr<MappedFile> file);
+
+  SSystem::SFileInterface* Duplicate() override;
+  unsigned long int Read(void* ptrBuffer, unsigned long int nBytes) override;
+  // the file is read-only; always writes nothing
+  unsigned long int Write(const void* ptrBuffer, unsigned long int nBytes) override;
+  SSystem::UInt64 GetLength() override;
+  SSystem::UInt64 GetPosition() const override;
+  SSystem::SError Seek(SSystem::Int64 nOffsetPos, SeekOrigin fSeekFrom = FromBegin) override;
+  // the file is read-only; always fails
+  SSystem::SError SetEndOfFile() override;
+};
+
+#endif
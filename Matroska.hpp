@@ -0,0 +1,74 @@
+#ifndef ML_MATROSKA_HPP
+#define ML_MATROSKA_HPP
+
+#include <cstdint>
+
+// obtained from https://www.matroska.org/technical/elements.html
+
+
+namespace Matroska {
+  // EBML header
+  constexpr std::uint32_t EBML = 0x1A45DFA3;
+  constexpr std::uint32_t EBMLVersion = 0x4286;
+  constexpr std::uint32_t EBMLReadVersion = 0x42F7;
+  constexpr std::uint32_t EBMLMaxIDLength = 0x42F2;
+  constexpr std::uint32_t EBMLMaxSizeLength = 0x42F3;
+  constexpr std::uint32_t DocType = 0x4282;
+  constexpr std::uint32_t DocTypeVersion = 0x4287;
+  constexpr std::uint32_t DocTypeReadVersion = 0x4285;
+
+  constexpr std::uint32_t Segment = 0x18538067;
+
+  // meta seek information
+  constexpr std::uint32_t SeekHead = 0x114D9B74;
+  constexpr std::uint32_t Seek = 0x4DBB;
+  constexpr std::uint32_t SeekID = 0x53AB;
+  constexpr std::uint32_t SeekPosition = 0x53AC;
+
+  // segment information
+  constexpr std::uint32_t Info = 0x1549A966;
+  constexpr std::uint32_t TimestampScale = 0x2AD7B1;
+  constexpr std::uint32_t Duration = 0x4489;
+  constexpr std::uint32_t MuxingApp = 0x4D80;
+  constexpr std::uint32_t WritingApp = 0x5741;
+
+  // cluster
+  constexpr std::uint32_t Cluster = 0x1F43B675;
+  constexpr std::uint32_t Timestamp = 0xE7;
+  constexpr std::uint32_t SimpleBlock = 0xA3;
+
+  // track
+  constexpr std::uint32_t Tracks = 0x1654AE6B;
+  constexpr std::uint32_t TrackEntry = 0xAE;
+  constexpr std::uint32_t TrackNumber = 0xD7;
+  constexpr std::uint32_t TrackUID = 0x73C5;
+  constexpr std::uint32_t TrackType = 0x83;
+  constexpr std::uint32_t FlagLacing = 0x9C;
+  constexpr std::uint32_t DefaultDuration = 0x23E383;
+  constexpr std::uint32_t CodecID = 0x86;
+  constexpr std::uint32_t CodecPrivate = 0x63A2;
+  constexpr std::uint32_t Video = 0xE0;
+  constexpr std::uint32_t PixelWidth = 0xB0;
+  constexpr std::uint32_t PixelHeight = 0xBA;
+  constexpr std::uint32_t Audio = 0xE1;
+  constexpr std::uint32_t SamplingFrequency = 0xB5;
+  constexpr std::uint32_t Channels = 0x9F;
+  constexpr std::uint32_t BitDepth = 0x6264;
+
+  // cueing data
+  constexpr std::uint32_t Cues = 0x1C53BB6B;
+  constexpr std::uint32_t CuePoint = 0xBB;
+  constexpr std::uint32_t CueTime = 0xB3;
+  constexpr std::uint32_t CueTrackPositions = 0xB7;
+  constexpr std::uint32_t CueTrack = 0xF7;
+  constexpr std::uint32_t CueClusterPosition = 0xF1;
+  constexpr std::uint32_t CueRelativePosition = 0xF0;
+
+
+  constexpr std::uint64_t TrackTypeVideo = 1;
+  constexpr std::uint64_t TrackTypeAudio = 2;
+
+  constexpr std::uint8_t SimpleBlockKeyframe = 0x80;
+}
+
+#endif
@@ -0,0 +1,232 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "Movie.hpp"
+#include "FrameTransform.hpp"
+#include "MappedFile.hpp"
+#include "SpooledInput.hpp"
+
+#include <Windows.h>
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+using namespace std::literals;
+
+
+namespace {
+  std::mutex gOpenMutex;
+  Movie::InputMode gInputMode = Movie::InputMode::File;
+
+
+  std::unique_ptr<SSystem::SFileInterface> OpenInput(const std::wstring& filePath, Movie::InputMode inputMode) {
+    if (filePath == L"-"sv) {
+      return std::make_unique<SpooledInputInterface>(SpooledInput::GetStdin());
+    }
+
+    if (inputMode == Movie::InputMode::Mapped) {
+      return std::make_unique<MappedFileInterface>(MappedFile::Open(filePath));
+    }
+
+    auto rawFile = SSystem::SFileOpener::DefaultNewOpenFile(filePath.c_str(), SSystem::SFileOpener::OpenFlag::modeRead | SSystem::SFileOpener::OpenFlag::shareRead);
+    if (!rawFile) {
+      throw std::runtime_error("cannot open file"s);
+    }
+    return std::unique_ptr<SSystem::SFileInterface>(rawFile);
+  }
+
+
+  // counts the reads of a file of EntisGLS, each of which is a system call unless the file buffers them
+  class CountingFileInterface : public SSystem::SFileInterface {
+  public:
+    struct Counters {
+      std::uint64_t numReads;
+      std::uint64_t readSize;
+    };
+
+  private:
+    std::unique_ptr<SSystem::SFileInterface> mFile;
+    std::shared_ptr<Counters> mCounters;    // shared with the duplicates
+
+  public:
+    CountingFileInterface(std::unique_ptr<SSystem::SFileInterface>&& file, std::shared_ptr<Counters> counters) :
+      mFile(std::move(file)),
+      mCounters(counters)
+    {}
+
+    SSystem::SFileInterface* Duplicate() override {
+      return new CountingFileInterface(std::unique_ptr<SSystem::SFileInterface>(mFile->Duplicate()), mCounters);
+    }
+
+    unsigned long int Read(void* ptrBuffer, unsigned long int nBytes) override {
+      const auto readSize = mFile->Read(ptrBuffer, nBytes);
+      mCounters->numReads++;
+      mCounters->readSize += readSize;
+      return readSize;
+    }
+
+    unsigned long int Write(const void* ptrBuffer, unsigned long int nBytes) override {
+      return mFile->Write(ptrBuffer, nBytes);
+    }
+
+    SSystem::UInt64 GetLength() override {
+      return mFile->GetLength();
+    }
+
+    SSystem::UInt64 GetPosition() const override {
+      return mFile->GetPosition();
+    }
+
+    SSystem::SError Seek(SSystem::Int64 nOffsetPos, SeekOrigin fSeekFrom) override {
+      return mFile->Seek(nOffsetPos, fSeekFrom);
+    }
+
+    SSystem::SError SetEndOfFile() override {
+      return mFile->SetEndOfFile();
+    }
+  };
+
+
+  // opening a file without buffering makes the system drop its cached pages when no other handle uses them
+  // best effort; returns false if the file could not be opened so
+  bool DropFromCache(const std::wstring& filePath) {
+    const auto handle = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+      return false;
+    }
+    CloseHandle(handle);
+    return true;
+  }
+}
+
+
+void Movie::CheckError(SSystem::SError error, const std::string& message) {
+  if (error != SSystem::SError::errSuccess) {
+    throw std::runtime_error(message);
+  }
+}
+
+
+void Movie::SetInputMode(InputMode inputMode) {
+  std::lock_guard lock(gOpenMutex);
+  gInputMode = inputMode;
+}
+
+
+void Movie::Open(const std::wstring& filePath, std::unique_ptr<SSystem::SFileInterface>& file, ERISA::SGLMovieFilePlayer& movieFilePlayer) {
+  std::lock_guard lock(gOpenMutex);
+
+  file = OpenInput(filePath, gInputMode);
+
+  // open as video
+  CheckError(movieFilePlayer.OpenMovieFile(file.get(), false), "cannot open file as video"s);
+}
+
+
+void Movie::OpenSound(const std::wstring& filePath, std::unique_ptr<SSystem::SFileInterface>& file, ERISA::SGLSoundFilePlayer& soundFilePlayer) {
+  std::lock_guard lock(gOpenMutex);
+
+  file = OpenInput(filePath, gInputMode);
+
+  CheckError(soundFilePlayer.OpenSoundFile(file.get(), false), "cannot open file as audio"s);
+}
+
+
+const std::uint8_t* Movie::GetFrameImageBuffer(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t frameIndex) {
+  movieFilePlayer.SeekToFrame(frameIndex);
+  const auto ptrCurrentFrame = movieFilePlayer.CurrentFrame();
+  // hack
+  const auto ptrSmartImage = static_cast<SakuraGL::SGLSmartImage*>(ptrCurrentFrame);
+  const auto ptrImageBuffer = ptrSmartImage->GetImage();
+  return ptrImageBuffer->ptrBuffer;
+}
+
+
+std::optional<FrameTransform::Margins> Movie::DetectBorders(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t numSamples) {
+  const auto size = movieFilePlayer.CurrentFrame()->GetImageSize();
+  const auto numFrames = static_cast<std::uint_fast32_t>(movieFilePlayer.GetAllFrameCount());
+
+  numSamples = std::min(numSamples, numFrames);
+
+  std::optional<FrameTransform::Margins> result;
+  for (std::uint_fast32_t i = 0; i < numSamples; i++) {
+    const auto frameIndex = static_cast<std::uint_fast32_t>((static_cast<std::uint_fast64_t>(i) * 2 + 1) * numFrames / (numSamples * 2));
+    const auto margins = FrameTransform::DetectBorders(GetFrameImageBuffer(movieFilePlayer, frameIndex), size.w, size.h);
+    if (!margins) {
+      continue;
+    }
+    if (!result) {
+      result = margins;
+      continue;
+    }
+    result->left = std::min(result->left, margins->left);
+    result->top = std::min(result->top, margins->top);
+    result->right = std::min(result->right, margins->right);
+    result->bottom = std::min(result->bottom, margins->bottom);
+  }
+  return result;
+}
+
+
+void Movie::BenchInput(const std::wstring& filePath) {
+  const auto toMiBPerSecond = [] (std::uint64_t size, double seconds) {
+    return seconds > 0 ? size / seconds / (1024 * 1024) : 0.0;
+  };
+
+  for (const auto inputMode : {InputMode::File, InputMode::Mapped}) {
+    const auto modeName = inputMode == InputMode::File ? L"file"sv : L"mapped"sv;
+
+    const bool dropped = DropFromCache(filePath);
+
+    for (const bool cold : {true, false}) {
+      // held for the pass, so that its counters cover every decoder which maps the file
+      std::shared_ptr<MappedFile> mappedFile;
+      if (inputMode == InputMode::Mapped) {
+        mappedFile = MappedFile::Open(filePath);
+      }
+
+      auto counters = std::make_shared<CountingFileInterface::Counters>(CountingFileInterface::Counters{0, 0});
+      std::unique_ptr<SSystem::SFileInterface> file;
+      ERISA::SGLMovieFilePlayer movieFilePlayer;
+      {
+        std::lock_guard lock(gOpenMutex);
+        file = std::make_unique<CountingFileInterface>(OpenInput(filePath, inputMode), counters);
+      }
+
+      const auto startTime = std::chrono::steady_clock::now();
+
+      {
+        std::lock_guard lock(gOpenMutex);
+        CheckError(movieFilePlayer.OpenMovieFile(file.get(), false), "cannot open file as video"s);
+      }
+      const auto numFrames = static_cast<std::uint_fast32_t>(movieFilePlayer.GetAllFrameCount());
+      for (std::uint_fast32_t i = 0; i < numFrames; i++) {
+        GetFrameImageBuffer(movieFilePlayer, i);
+      }
+
+      const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      movieFilePlayer.Close();
+
+      std::wcerr << L"[bench] "sv << modeName << (cold ? dropped ? L" cold: "sv : L" cold (not dropped from the cache): "sv : L" warm: "sv)
+                 << seconds << L" s, "sv << (seconds > 0 ? numFrames / seconds : 0.0) << L" frames/s, "sv
+                 << counters->numReads << L" reads of "sv << counters->readSize << L" bytes ("sv << toMiBPerSecond(counters->readSize, seconds) << L" MiB/s)"sv;
+      if (mappedFile) {
+        const auto stats = mappedFile->GetStats();
+        std::wcerr << L", "sv << stats.numPrefetches << L" prefetch calls of "sv << stats.prefetchSize << L" bytes"sv;
+      } else {
+        std::wcerr << L", each a system call unless EntisGLS buffers it"sv;
+      }
+      std::wcerr << std::endl;
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef ML_MOVIE_HPP
+#define ML_MOVIE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "FrameTransform.hpp"
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+
+// access to MEI files through EntisGLS, shared by the converters
+namespace Movie {
+  enum class InputMode {
+    File,       // a file of EntisGLS for every decoder, each read going to the system
+    Mapped,     // one read-only mapping of every input shared by all its decoders (see MappedFile)
+  };
+
+  // throws std::runtime_error with message unless error is errSuccess
+  void CheckError(SSystem::SError error, const std::string& message);
+
+  // how Open and OpenSound read the input from then on; InputMode::File by default
+  void SetInputMode(InputMode inputMode);
+
+  // filePath "-" is stdin, which is read once into a SpooledInput shared by every decoder regardless of the input mode
+  // file must be kept open as long as movieFilePlayer is used
+  // EntisGLS is not meant to open files from several threads at once, so Open and OpenSound are serialized
+  // process-wide; this lets independent conversions (-batch) open their inputs on their own threads
+  void Open(const std::wstring& filePath, std::unique_ptr<SSystem::SFileInterface>& file, ERISA::SGLMovieFilePlayer& movieFilePlayer);
+  // file must be kept open as long as soundFilePlayer is used
+  void OpenSound(const std::wstring& filePath, std::unique_ptr<SSystem::SFileInterface>& file, ERISA::SGLSoundFilePlayer& soundFilePlayer);
+
+  // decodes the frame (top-down 32bpp BGRA); the buffer is owned by the player and valid until the next call
+  const std::uint8_t* GetFrameImageBuffer(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t frameIndex);
+
+  // detects borders common to frames sampled evenly across the movie
+  // single-colored frames (e.g. fades) are ignored
+  std::optional<FrameTransform::Margins> DetectBorders(ERISA::SGLMovieFilePlayer& movieFilePlayer, std::uint_fast32_t numSamples);
+
+  // decodes every frame with each input mode, first right after dropping the file from the cache of the system
+  // (cold) and then again (warm), and writes the time and the number of reads and system calls to std::wcerr
+  void BenchInput(const std::wstring& filePath);
+}
+
+#endif
@@ -0,0 +1,448 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <ios>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MultiOutput.hpp"
+#include "AVIBuilder.hpp"
+#include "FrameTransform.hpp"
+#include "ParallelOutput.hpp"
+#include "Kernel/Copy.hpp"
+#include "Source/SourceBase.hpp"
+
+using namespace std::literals;
+
+
+namespace {
+  // decoded frames waiting for each output; a decoded frame takes width * height * 4 bytes
+  constexpr std::size_t FrameQueueCapacity = 8;
+
+
+  struct DecodedFrame {
+    std::uint_fast32_t index;
+    std::shared_ptr<const std::uint8_t[]> image;    // shared by all outputs
+  };
+
+
+  template<typename T>
+  class BoundedQueue {
+    std::mutex mMutex;
+    std::condition_variable mNotFullCondition;
+    std::condition_variable mNotEmptyCondition;
+    std::deque<T> mItems;
+    std::size_t mCapacity;
+    bool mClosed;
+
+  public:
+    BoundedQueue(std::size_t capacity) :
+      mMutex(),
+      mNotFullCondition(),
+      mNotEmptyCondition(),
+      mItems(),
+      mCapacity(capacity),
+      mClosed(false)
+    {}
+
+    // waits while the queue is full; returns false if the queue has been closed
+    bool Push(T item) {
+      std::unique_lock lock(mMutex);
+      mNotFullCondition.wait(lock, [this] () {
+        return mClosed || mItems.size() < mCapacity;
+      });
+      if (mClosed) {
+        return false;
+      }
+      mItems.push_back(std::move(item));
+      lock.unlock();
+      mNotEmptyCondition.notify_one();
+      return true;
+    }
+
+    // waits while the queue is empty; returns std::nullopt once the queue is closed and drained
+    std::optional<T> Pop() {
+      std::unique_lock lock(mMutex);
+      mNotEmptyCondition.wait(lock, [this] () {
+        return mClosed || !mItems.empty();
+      });
+      if (mItems.empty()) {
+        return std::nullopt;
+      }
+      auto item = std::move(mItems.front());
+      mItems.pop_front();
+      lock.unlock();
+      mNotFullCondition.notify_one();
+      return item;
+    }
+
+    void Close() {
+      {
+        std::lock_guard lock(mMutex);
+        mClosed = true;
+      }
+      mNotFullCondition.notify_all();
+      mNotEmptyCondition.notify_all();
+    }
+  };
+
+
+  // an output other than the AVI
+  // everything but IsWanted runs on the output's own thread; IsWanted is called by the decoding thread
+  class Sink {
+  public:
+    virtual ~Sink() = default;
+
+    virtual std::wstring_view GetName() const = 0;
+
+    // whether the decoded frame should be queued for Consume
+    virtual bool IsWanted(std::uint_fast32_t frameIndex) const {
+      return false;
+    }
+
+    virtual void Start() {}
+
+    virtual void Consume(std::uint_fast32_t frameIndex, const std::uint8_t* image) {}
+
+    virtual void Finish() {}
+  };
+
+
+  // the audio is already decoded, so the WAV is written at once
+  class WAVSink : public Sink {
+    std::shared_ptr<SourceBase> mSource;
+    OutputFile mOutputFile;
+    std::size_t mBufferSize;
+
+  public:
+    WAVSink(std::shared_ptr<SourceBase> source, const std::wstring& filePath, std::size_t bufferSize) :
+      mSource(source),
+      mOutputFile(filePath),
+      mBufferSize(bufferSize)
+    {}
+
+    std::wstring_view GetName() const override {
+      return L"wav"sv;
+    }
+
+    void Start() override {
+      WriteSource(*mSource, mOutputFile, mBufferSize);
+    }
+
+    void Finish() override {
+      mOutputFile.Close();
+    }
+  };
+
+
+  FrameTransform::Parameters ToBGR24(FrameTransform::Parameters parameters) {
+    parameters.format = FrameTransform::PixelFormat::BGR24;
+    return parameters;
+  }
+
+
+  FrameTransform::Parameters ToBGR24(FrameTransform::Parameters parameters, std::uint_fast32_t width, std::uint_fast32_t height) {
+    parameters.width = width;
+    parameters.height = height;
+    return ToBGR24(parameters);
+  }
+
+
+  // the proxy is written with zero-filled frames first, and then each frame is written in place as it arrives
+  class ProxySink : public Sink {
+    std::shared_ptr<FrameTransform> mTransform;
+    std::vector<AVIBuilder::BlockLayout> mBlockLayout;
+    std::shared_ptr<SourceBase> mSource;
+    std::unordered_map<std::uint_fast32_t, std::vector<std::uint64_t>> mFrameDataOffsets;   // unique frame index -> offsets of the frame data
+    std::size_t mNumWrittenFrames;
+    std::unique_ptr<std::uint8_t[]> mBuffer;
+    OutputFile mOutputFile;
+    std::size_t mBufferSize;
+
+  public:
+    ProxySink(const MEIToAVI& meiToAvi, const std::wstring& filePath, std::uint_fast32_t width, std::uint_fast32_t height, std::size_t bufferSize) :
+      mTransform(meiToAvi.CreateFrameTransform(ToBGR24(meiToAvi.GetTransformParameters(), width, height))),
+      mBlockLayout(),
+      mSource(meiToAvi.BuildPlaceholderAVI(*mTransform, mBlockLayout)),
+      mFrameDataOffsets(),
+      mNumWrittenFrames(0),
+      mBuffer(std::make_unique<std::uint8_t[]>(mTransform->GetOutputSize())),
+      mOutputFile(filePath),
+      mBufferSize(bufferSize)
+    {
+      // repeated frames are zero-length chunks and referenced ones have no chunk of their own
+      for (const auto& block : mBlockLayout) {
+        if (block.streamIndex == 0 && !block.reference && block.size) {
+          mFrameDataOffsets[meiToAvi.GetUniqueFrameIndex(block.blockIndex)].push_back(block.dataOffset);
+        }
+      }
+    }
+
+    std::wstring_view GetName() const override {
+      return L"proxy"sv;
+    }
+
+    bool IsWanted(std::uint_fast32_t frameIndex) const override {
+      return mFrameDataOffsets.count(frameIndex) != 0;
+    }
+
+    void Start() override {
+      WriteSource(*mSource, mOutputFile, mBufferSize);
+    }
+
+    void Consume(std::uint_fast32_t frameIndex, const std::uint8_t* image) override {
+      mTransform->Apply(image, mBuffer.get());
+      for (const auto offset : mFrameDataOffsets.at(frameIndex)) {
+        mOutputFile.Write(mBuffer.get(), mTransform->GetOutputSize(), offset);
+      }
+      mNumWrittenFrames++;
+    }
+
+    void Finish() override {
+      if (mNumWrittenFrames != mFrameDataOffsets.size()) {
+        throw std::runtime_error("ProxySink: some frames were not decoded");
+      }
+      mOutputFile.Close();
+    }
+  };
+
+
+  // binary PPM (P6) of the output frame every interval seconds
+  class ThumbnailSink : public Sink {
+    std::wstring mPrefix;
+    std::shared_ptr<FrameTransform> mTransform;
+    std::unordered_map<std::uint_fast32_t, std::vector<std::uint_fast32_t>> mFrameThumbnails;   // unique frame index -> thumbnail numbers
+    std::size_t mNumThumbnails;
+    std::size_t mNumWrittenThumbnails;
+    std::unique_ptr<std::uint8_t[]> mBuffer;
+    std::vector<char> mLine;
+
+    void WritePPM(std::uint_fast32_t number) {
+      std::wostringstream filePath;
+      filePath << mPrefix << std::setw(6) << std::setfill(L'0') << number << L".ppm"sv;
+
+      const auto width = mTransform->GetWidth();
+      const auto height = mTransform->GetHeight();
+      const auto stride = mTransform->GetOutputSize() / height;   // BGR24 lines are padded to 4 bytes
+
+      std::ofstream ofs;
+      ofs.exceptions(std::ios::failbit | std::ios::badbit);
+      ofs.open(filePath.str(), std::ios::binary);
+
+      ofs << "P6\n"sv << width << ' ' << height << "\n255\n"sv;
+
+      for (std::uint_fast32_t y = 0; y < height; y++) {
+        const auto ptrLine = mBuffer.get() + y * stride;
+        for (std::uint_fast32_t x = 0; x < width; x++) {
+          mLine[x * 3 + 0] = static_cast<char>(ptrLine[x * 3 + 2]);
+          mLine[x * 3 + 1] = static_cast<char>(ptrLine[x * 3 + 1]);
+          mLine[x * 3 + 2] = static_cast<char>(ptrLine[x * 3 + 0]);
+        }
+        ofs.write(mLine.data(), mLine.size());
+      }
+
+      ofs.close();
+    }
+
+  public:
+    ThumbnailSink(const MEIToAVI& meiToAvi, const std::wstring& prefix, std::uint_fast32_t interval) :
+      mPrefix(prefix),
+      mTransform(meiToAvi.CreateFrameTransform(ToBGR24(meiToAvi.GetTransformParameters()))),
+      mFrameThumbnails(),
+      mNumThumbnails(0),
+      mNumWrittenThumbnails(0),
+      mBuffer(std::make_unique<std::uint8_t[]>(mTransform->GetOutputSize())),
+      mLine(static_cast<std::size_t>(mTransform->GetWidth()) * 3)
+    {
+      const auto strh = meiToAvi.GetVideoStreamHeader();
+      const auto numFrames = meiToAvi.CountFrames();
+
+      // dwRate / dwScale frames per second
+      for (std::uint_fast32_t number = 0; ; number++) {
+        const auto frameIndex = static_cast<std::uint64_t>(number) * interval * strh.dwRate / strh.dwScale;
+        if (frameIndex >= numFrames) {
+          break;
+        }
+        mFrameThumbnails[meiToAvi.GetUniqueFrameIndex(static_cast<std::uint_fast32_t>(frameIndex))].push_back(number);
+        mNumThumbnails++;
+      }
+    }
+
+    std::wstring_view GetName() const override {
+      return L"thumbnails"sv;
+    }
+
+    bool IsWanted(std::uint_fast32_t frameIndex) const override {
+      return mFrameThumbnails.count(frameIndex) != 0;
+    }
+
+    void Consume(std::uint_fast32_t frameIndex, const std::uint8_t* image) override {
+      mTransform->Apply(image, mBuffer.get());
+      for (const auto number : mFrameThumbnails.at(frameIndex)) {
+        WritePPM(number);
+        mNumWrittenThumbnails++;
+      }
+    }
+
+    void Finish() override {
+      if (mNumWrittenThumbnails != mNumThumbnails) {
+        throw std::runtime_error("ThumbnailSink: some frames were not decoded");
+      }
+    }
+  };
+
+
+  struct SinkWorker {
+    std::unique_ptr<Sink> sink;
+    BoundedQueue<DecodedFrame> queue;
+    std::exception_ptr exception;
+    std::uint_fast32_t numFrames;
+    std::chrono::steady_clock::duration busyTime;
+    std::chrono::steady_clock::duration totalTime;
+    std::chrono::steady_clock::duration stallTime;    // time the decoding waited for the queue
+
+    SinkWorker(std::unique_ptr<Sink> sink) :
+      sink(std::move(sink)),
+      queue(FrameQueueCapacity),
+      exception(),
+      numFrames(0),
+      busyTime(),
+      totalTime(),
+      stallTime()
+    {}
+
+    void Run() {
+      const auto startTime = std::chrono::steady_clock::now();
+      try {
+        auto busyStartTime = std::chrono::steady_clock::now();
+        sink->Start();
+        busyTime += std::chrono::steady_clock::now() - busyStartTime;
+
+        while (const auto frame = queue.Pop()) {
+          busyStartTime = std::chrono::steady_clock::now();
+          sink->Consume(frame->index, frame->image.get());
+          busyTime += std::chrono::steady_clock::now() - busyStartTime;
+          numFrames++;
+        }
+
+        busyStartTime = std::chrono::steady_clock::now();
+        sink->Finish();
+        busyTime += std::chrono::steady_clock::now() - busyStartTime;
+      } catch (...) {
+        exception = std::current_exception();
+        // the decoding goes on without this output
+        queue.Close();
+      }
+      totalTime = std::chrono::steady_clock::now() - startTime;
+    }
+  };
+}
+
+
+void WriteMultiOutput(MEIToAVI& meiToAvi, OutputFile& outputFile, const MultiOutputTargets& targets, std::size_t bufferSize, bool showMessage) {
+  // the outputs are opened here so that an unwritable path fails before decoding
+  std::vector<std::unique_ptr<SinkWorker>> workers;
+
+  if (!targets.wavFilePath.empty()) {
+    if (const auto wavSource = meiToAvi.BuildWAV()) {
+      workers.push_back(std::make_unique<SinkWorker>(std::make_unique<WAVSink>(wavSource, targets.wavFilePath, bufferSize)));
+    } else if (showMessage) {
+      std::wcerr << L"[warn] the input has no audio, WAV is not written"sv << std::endl;
+    }
+  }
+
+  if (!targets.proxyFilePath.empty()) {
+    workers.push_back(std::make_unique<SinkWorker>(std::make_unique<ProxySink>(meiToAvi, targets.proxyFilePath, targets.proxyWidth, targets.proxyHeight, bufferSize)));
+  }
+
+  if (!targets.thumbnailPrefix.empty()) {
+    workers.push_back(std::make_unique<SinkWorker>(std::make_unique<ThumbnailSink>(meiToAvi, targets.thumbnailPrefix, targets.thumbnailInterval)));
+  }
+
+  // each decoded frame is copied once and shared by the outputs which need it
+  const auto imageSize = meiToAvi.GetImageSize();
+  std::optional<std::uint_fast32_t> lastFrameIndex;
+  meiToAvi.SetFrameObserver([&workers, &lastFrameIndex, imageSize] (std::uint_fast32_t frameIndex, const std::uint8_t* image) {
+    // an earlier frame may be decoded again for a chunk that cannot refer to the original one
+    if (lastFrameIndex && frameIndex <= lastFrameIndex.value()) {
+      return;
+    }
+    lastFrameIndex = frameIndex;
+
+    std::shared_ptr<std::uint8_t[]> frameImage;
+    for (auto& worker : workers) {
+      if (!worker->sink->IsWanted(frameIndex)) {
+        continue;
+      }
+      if (!frameImage) {
+        frameImage = std::shared_ptr<std::uint8_t[]>(std::make_unique<std::uint8_t[]>(imageSize));
+        Kernel::Copy(frameImage.get(), image, imageSize);
+      }
+      const auto pushStartTime = std::chrono::steady_clock::now();
+      worker->queue.Push(DecodedFrame{frameIndex, frameImage});
+      worker->stallTime += std::chrono::steady_clock::now() - pushStartTime;
+    }
+  });
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  threads.reserve(workers.size());
+  for (auto& worker : workers) {
+    threads.emplace_back(&SinkWorker::Run, worker.get());
+  }
+
+  const auto finish = [&] () {
+    meiToAvi.SetFrameObserver(nullptr);
+    for (auto& worker : workers) {
+      worker->queue.Close();
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  };
+
+  try {
+    // decoded sequentially, so every frame is decoded once in order
+    WriteParallel(meiToAvi, outputFile, 1, bufferSize, showMessage);
+  } catch (...) {
+    finish();
+    throw;
+  }
+  const auto aviTime = std::chrono::steady_clock::now() - startTime;
+  finish();
+
+  const auto totalTime = std::chrono::steady_clock::now() - startTime;
+
+  for (const auto& worker : workers) {
+    if (worker->exception) {
+      std::rethrow_exception(worker->exception);
+    }
+  }
+
+  if (showMessage) {
+    const auto toSeconds = [] (std::chrono::steady_clock::duration duration) {
+      return std::chrono::duration<double>(duration).count();
+    };
+
+    for (const auto& worker : workers) {
+      std::wcerr << L"[info] "sv << worker->sink->GetName() << L": "sv << worker->numFrames << L" frames, busy "sv << toSeconds(worker->busyTime) << L" s of "sv
+                 << toSeconds(worker->totalTime) << L" s, decoding waited "sv << toSeconds(worker->stallTime) << L" s for it"sv << std::endl;
+    }
+    std::wcerr << L"[info] all outputs in "sv << toSeconds(totalTime) << L" s (avi "sv << toSeconds(aviTime) << L" s)"sv << std::endl;
+  }
+}
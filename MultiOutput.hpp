@@ -0,0 +1,28 @@
+#ifndef ML_MULTIOUTPUT_HPP
+#define ML_MULTIOUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "MEIToAVI.hpp"
+#include "OutputFile.hpp"
+
+
+// outputs written along with the AVI; empty paths are skipped
+struct MultiOutputTargets {
+  std::wstring wavFilePath;
+  std::wstring proxyFilePath;           // uncompressed BGR24 AVI with the same frames and audio
+  std::uint_fast32_t proxyWidth;        // 0 to keep the aspect ratio
+  std::uint_fast32_t proxyHeight;
+  std::wstring thumbnailPrefix;         // thumbnails are written to prefix000000.ppm, prefix000001.ppm, ...
+  std::uint_fast32_t thumbnailInterval; // in seconds
+};
+
+
+// writes the AVI and the other targets in a single pass, decoding each frame only once
+// the AVI is written on the calling thread, and the decoded frames are handed to the other targets, each of which
+// runs on its own thread behind a bounded queue; a slow target holds the decoding back only when its queue is full
+void WriteMultiOutput(MEIToAVI& meiToAvi, OutputFile& outputFile, const MultiOutputTargets& targets, std::size_t bufferSize, bool showMessage);
+
+#endif
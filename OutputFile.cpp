@@ -0,0 +1,206 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "OutputFile.hpp"
+
+#include <Windows.h>
+#include <winioctl.h>
+
+
+namespace {
+  // SetFileValidData needs SE_MANAGE_VOLUME_NAME enabled in the token of the process; it is tried only once
+  bool EnableManageVolumePrivilege() {
+    static const bool enabled = [] () {
+      HANDLE token;
+      if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES, &token)) {
+        return false;
+      }
+
+      TOKEN_PRIVILEGES privileges{};
+      privileges.PrivilegeCount = 1;
+      privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+      // AdjustTokenPrivileges succeeds with ERROR_NOT_ALL_ASSIGNED if the token does not hold the privilege
+      const bool result = LookupPrivilegeValueW(nullptr, SE_MANAGE_VOLUME_NAME, &privileges.Privileges[0].Luid)
+        && AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+        && GetLastError() == ERROR_SUCCESS;
+
+      CloseHandle(token);
+      return result;
+    }();
+    return enabled;
+  }
+}
+
+
+OutputFile::OutputFile(const std::wstring& filePath, Mode mode) :
+  mHandle(INVALID_HANDLE_VALUE),
+  mSparse(false)
+{
+  const DWORD access = mode == Mode::Read ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+  const DWORD shareMode = mode == Mode::Read ? FILE_SHARE_READ : 0;
+  const DWORD disposition = mode == Mode::Create || mode == Mode::Temporary ? CREATE_ALWAYS : mode == Mode::Keep ? OPEN_ALWAYS : OPEN_EXISTING;
+  // a temporary file is kept in the cache as long as there is memory for it, and deleted when closed
+  const DWORD attributes = mode == Mode::Temporary ? FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE : FILE_ATTRIBUTE_NORMAL;
+  mHandle = CreateFileW(filePath.c_str(), access, shareMode, nullptr, disposition, attributes, nullptr);
+  if (mHandle == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("OutputFile: cannot open file");
+  }
+}
+
+
+OutputFile::~OutputFile() {
+  if (mHandle != INVALID_HANDLE_VALUE) {
+    CloseHandle(mHandle);
+  }
+}
+
+
+bool OutputFile::SetSparse() {
+  DWORD returnedSize = 0;
+  if (!DeviceIoControl(mHandle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &returnedSize, nullptr)) {
+    return false;
+  }
+  mSparse = true;
+  return true;
+}
+
+
+void OutputFile::Preallocate(std::uint64_t size) {
+  if (!mSparse) {
+    // only a hint; the file is still written correctly if the file system ignores it
+    FILE_ALLOCATION_INFO allocationInfo{};
+    allocationInfo.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(mHandle, FileAllocationInfo, &allocationInfo, sizeof(allocationInfo));
+  }
+
+  LARGE_INTEGER distance;
+  distance.QuadPart = static_cast<LONGLONG>(size);
+  if (!SetFilePointerEx(mHandle, distance, nullptr, FILE_BEGIN) || !SetEndOfFile(mHandle)) {
+    throw std::runtime_error("OutputFile: cannot allocate file");
+  }
+}
+
+
+bool OutputFile::SetValidData(std::uint64_t size) {
+  if (mSparse || !EnableManageVolumePrivilege()) {
+    return false;
+  }
+  return SetFileValidData(mHandle, static_cast<LONGLONG>(size));
+}
+
+
+void OutputFile::Write(const std::uint8_t* data, std::size_t size, std::uint64_t offset) {
+  while (size) {
+    // WriteFile takes the size as DWORD
+    const auto writeSize = static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max()));
+
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD writtenSize = 0;
+    if (!WriteFile(mHandle, data, writeSize, &writtenSize, &overlapped) || writtenSize != writeSize) {
+      throw std::runtime_error("OutputFile: cannot write file");
+    }
+
+    data += writeSize;
+    size -= writeSize;
+    offset += writeSize;
+  }
+}
+
+
+void OutputFile::Read(std::uint8_t* data, std::size_t size, std::uint64_t offset) {
+  while (size) {
+    const auto readSize = static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max()));
+
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD returnedSize = 0;
+    if (!ReadFile(mHandle, data, readSize, &returnedSize, &overlapped) || returnedSize != readSize) {
+      throw std::runtime_error("OutputFile: cannot read file");
+    }
+
+    data += readSize;
+    size -= readSize;
+    offset += readSize;
+  }
+}
+
+
+std::uint64_t OutputFile::GetSize() const {
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(mHandle, &size)) {
+    throw std::runtime_error("OutputFile: cannot get file size");
+  }
+  return static_cast<std::uint64_t>(size.QuadPart);
+}
+
+
+void OutputFile::Flush() {
+  if (!FlushFileBuffers(mHandle)) {
+    throw std::runtime_error("OutputFile: cannot flush file");
+  }
+}
+
+
+std::optional<std::size_t> OutputFile::CountExtents() const {
+  STARTING_VCN_INPUT_BUFFER input{};
+  input.StartingVcn.QuadPart = 0;
+
+  // the extents are returned in several calls if they do not fit in the buffer
+  union {
+    RETRIEVAL_POINTERS_BUFFER header;
+    std::uint8_t data[64 * 1024];
+  } output;
+
+  std::size_t numExtents = 0;
+  while (true) {
+    DWORD returnedSize = 0;
+    const bool succeeded = DeviceIoControl(mHandle, FSCTL_GET_RETRIEVAL_POINTERS, &input, sizeof(input), &output, sizeof(output), &returnedSize, nullptr);
+    const auto error = succeeded ? ERROR_SUCCESS : GetLastError();
+    if (error == ERROR_HANDLE_EOF) {
+      // no clusters are allocated (entirely sparse, or stored in the MFT record)
+      return numExtents;
+    }
+    if (error != ERROR_SUCCESS && error != ERROR_MORE_DATA) {
+      return std::nullopt;
+    }
+
+    const auto& header = output.header;
+    for (DWORD i = 0; i < header.ExtentCount; i++) {
+      // holes of sparse files have no LCN
+      if (header.Extents[i].Lcn.QuadPart != -1) {
+        numExtents++;
+      }
+    }
+
+    if (error == ERROR_SUCCESS || !header.ExtentCount) {
+      return numExtents;
+    }
+
+    input.StartingVcn = header.Extents[header.ExtentCount - 1].NextVcn;
+  }
+}
+
+
+void OutputFile::Close() {
+  if (mHandle == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  const auto handle = mHandle;
+  mHandle = INVALID_HANDLE_VALUE;
+  if (!CloseHandle(handle)) {
+    throw std::runtime_error("OutputFile: cannot close file");
+  }
+}
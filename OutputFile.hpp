@@ -0,0 +1,54 @@
+#ifndef ML_OUTPUTFILE_HPP
+#define ML_OUTPUTFILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+
+// output file which can be written at arbitrary offsets from multiple threads at once
+class OutputFile {
+  void* mHandle;    // HANDLE
+  bool mSparse;
+
+public:
+  enum class Mode {
+    Create,     // creates the file or truncates the existing one
+    Keep,       // opens the file as is, creating it if missing (for -resume)
+    Modify,     // opens an existing file as is (for -repair)
+    Read,       // opens an existing file for reading only (for -verify)
+    Temporary,  // creates a file which is deleted when closed (for spilling stdin)
+  };
+
+  OutputFile(const std::wstring& filePath, Mode mode = Mode::Create);
+  ~OutputFile();
+
+  OutputFile(const OutputFile&) = delete;
+  OutputFile& operator=(const OutputFile&) = delete;
+
+  // ranges that are never written take no disk space in a sparse file
+  // returns false if the file system does not support sparse files
+  bool SetSparse();
+  // sets the file size in advance, so that concurrent writes do not have to extend the file
+  // the clusters are also reserved at once unless the file is sparse, which keeps the file from being fragmented
+  // the valid data length stays where it was, so unless the file is sparse, a write beyond it makes the file system
+  // zero-fill the range before it first, synchronously, which serializes writes out of order (see SetValidData)
+  void Preallocate(std::uint64_t size);
+  // marks the file as written up to size, so that writes out of order do not zero-fill the ranges before them
+  // returns false if the process cannot enable SE_MANAGE_VOLUME_NAME (usually held by administrators only) or the file is sparse
+  // the ranges never written afterwards keep whatever the disk held, so every byte up to size must be written
+  bool SetValidData(std::uint64_t size);
+  // positional; thread-safe
+  void Write(const std::uint8_t* data, std::size_t size, std::uint64_t offset);
+  // positional; thread-safe; fails beyond the end of the file
+  void Read(std::uint8_t* data, std::size_t size, std::uint64_t offset);
+  std::uint64_t GetSize() const;
+  // waits until everything written so far is on the disk
+  void Flush();
+  // number of fragments allocated on disk (holes are not counted), or std::nullopt if unknown
+  std::optional<std::size_t> CountExtents() const;
+  void Close();
+};
+
+#endif
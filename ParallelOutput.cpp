@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ParallelOutput.hpp"
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
+#include "ThreadPool.hpp"
+#include "Source/SourceBase.hpp"
+
+using namespace std::literals;
+
+
+namespace {
+  // a worker takes a new range whenever it finishes one; several ranges per worker even out the load
+  constexpr std::size_t RangesPerThread = 4;
+
+  // zero-filled ranges at least this large are not written; NTFS deallocates sparse files in 64 KiB units,
+  // to which the JUNK of MEIToAVI::SparseOutput is aligned
+  constexpr std::streamsize MinHoleSize = AVIBuilder::JunkAlignment;
+
+  // a range is the unit of resumption, so with a journal the output is split into ranges of about this size at most
+  constexpr std::uint64_t ResumeRangeSize = 1024 * 1024 * 1024;
+
+  // on resume, the tail of this many most recently completed ranges is read back and compared
+  constexpr std::size_t ResumeVerifyRanges = 8;
+  constexpr std::uint64_t ResumeVerifySize = 4 * 1024 * 1024;
+
+
+  struct Range {
+    std::uint64_t begin;
+    std::uint64_t end;
+  };
+
+
+  struct WorkerStat {
+    std::uint64_t writtenSize;
+    std::uint_fast32_t numRanges;
+    std::chrono::steady_clock::duration time;
+  };
+
+
+  // zero-filled ranges of the source which are worth leaving unwritten, merged and sorted
+  std::vector<SourceBase::ZeroRange> FindHoles(const SourceBase& source) {
+    std::vector<SourceBase::ZeroRange> zeroRanges;
+    source.GetZeroRanges(zeroRanges, 0);
+
+    std::vector<SourceBase::ZeroRange> holes;
+    for (const auto& zeroRange : zeroRanges) {
+      if (!holes.empty() && holes.back().offset + holes.back().size == zeroRange.offset) {
+        holes.back().size += zeroRange.size;
+        continue;
+      }
+      if (!holes.empty() && holes.back().size < MinHoleSize) {
+        holes.pop_back();
+      }
+      holes.push_back(zeroRange);
+    }
+    if (!holes.empty() && holes.back().size < MinHoleSize) {
+      holes.pop_back();
+    }
+
+    return holes;
+  }
+
+
+  // writes [begin, end) of the source except for the holes
+  // with hashBuilder, the range is read in pieces which do not cross a leaf boundary, and the holes are hashed as zeros
+  void WriteRange(SourceBase& source, OutputFile& outputFile, std::uint8_t* buffer, std::size_t bufferSize, std::uint64_t begin, std::uint64_t end, const std::vector<SourceBase::ZeroRange>& holes, HashTree::Builder* hashBuilder) {
+    auto itrHole = std::upper_bound(holes.cbegin(), holes.cend(), begin, [] (std::uint64_t offset, const SourceBase::ZeroRange& hole) {
+      return offset < static_cast<std::uint64_t>(hole.offset + hole.size);
+    });
+
+    auto offset = begin;
+    while (offset != end) {
+      auto pieceEnd = std::min<std::uint64_t>(end, offset + bufferSize);
+      if (hashBuilder) {
+        pieceEnd = std::min(pieceEnd, hashBuilder->GetLeafEnd(offset));
+      }
+
+      auto dataOffset = offset;
+      while (dataOffset != pieceEnd) {
+        const auto buffered = buffer + static_cast<std::size_t>(dataOffset - offset);
+
+        if (itrHole != holes.cend() && static_cast<std::uint64_t>(itrHole->offset) <= dataOffset) {
+          const auto holeEnd = static_cast<std::uint64_t>(itrHole->offset + itrHole->size);
+          const auto skipEnd = std::min(holeEnd, pieceEnd);
+          if (hashBuilder) {
+            std::memset(buffered, 0, static_cast<std::size_t>(skipEnd - dataOffset));
+          }
+          if (skipEnd == holeEnd) {
+            itrHole++;
+          }
+          dataOffset = skipEnd;
+          continue;
+        }
+
+        const auto dataEnd = itrHole == holes.cend() ? pieceEnd : std::min<std::uint64_t>(itrHole->offset, pieceEnd);
+        const auto size = static_cast<std::size_t>(dataEnd - dataOffset);
+        source.Read(buffered, size, dataOffset);
+        outputFile.Write(buffered, size, dataOffset);
+        dataOffset = dataEnd;
+      }
+
+      if (hashBuilder) {
+        hashBuilder->Update(offset, buffer, static_cast<std::size_t>(pieceEnd - offset));
+      }
+      offset = pieceEnd;
+    }
+  }
+
+
+  std::vector<Range> SplitRanges(const std::vector<AVIBuilder::BlockLayout>& blockLayout, std::uint64_t totalSize, std::size_t numRanges) {
+    // candidates: chunks of video keyframes, in the order of the file
+    std::vector<std::uint64_t> candidates;
+    for (const auto& block : blockLayout) {
+      if (block.streamIndex == 0 && !block.reference && (block.indexFlags & AVI::AVIIF_KEYFRAME)) {
+        candidates.push_back(block.chunkOffset);
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    // the first range includes the headers, the last one includes the indexes
+    std::vector<Range> ranges;
+    std::uint64_t begin = 0;
+    auto itrCandidate = candidates.begin();
+    for (std::size_t i = 1; i < numRanges; i++) {
+      const std::uint64_t target = totalSize * i / numRanges;
+      itrCandidate = std::lower_bound(itrCandidate, candidates.end(), std::max(target, begin + 1));
+      if (itrCandidate == candidates.end()) {
+        break;
+      }
+      ranges.push_back(Range{begin, *itrCandidate});
+      begin = *itrCandidate;
+    }
+    ranges.push_back(Range{begin, totalSize});
+
+    return ranges;
+  }
+
+
+  // the parts of ranges not covered by completedRanges
+  // the completed ranges were split at video keyframe chunks too, so the remaining ranges still start at such chunks
+  std::vector<Range> SubtractRanges(const std::vector<Range>& ranges, std::vector<ResumeJournal::Range> completedRanges) {
+    std::sort(completedRanges.begin(), completedRanges.end(), [] (const ResumeJournal::Range& a, const ResumeJournal::Range& b) {
+      return a.begin < b.begin;
+    });
+
+    std::vector<Range> remainingRanges;
+    auto itrCompleted = completedRanges.cbegin();
+    for (const auto& range : ranges) {
+      auto begin = range.begin;
+      while (itrCompleted != completedRanges.cend() && itrCompleted->end <= begin) {
+        itrCompleted++;
+      }
+      for (auto itr = itrCompleted; itr != completedRanges.cend() && itr->begin < range.end; itr++) {
+        if (itr->begin > begin) {
+          remainingRanges.push_back(Range{begin, itr->begin});
+        }
+        begin = std::max(begin, itr->end);
+      }
+      if (begin < range.end) {
+        remainingRanges.push_back(Range{begin, range.end});
+      }
+    }
+    return remainingRanges;
+  }
+
+
+  // writes the ranges with numThreads decoders on the shared thread pool; a worker takes the next range whenever it finishes one
+  void WriteRanges(MEIToAVI& meiToAvi, OutputFile& outputFile, const std::vector<Range>& ranges, std::uint_fast32_t numThreads, std::size_t bufferSize, const std::vector<SourceBase::ZeroRange>& holes, bool showMessage, HashTree::Builder* hashBuilder, ResumeJournal* journal) {
+    if (showMessage && numThreads > 1) {
+      std::wcerr << L"[info] parallel output: "sv << ranges.size() << L" ranges, "sv << numThreads << L" threads"sv << std::endl;
+    }
+
+    // the readers are opened here, as EntisGLS is not meant to open files from several threads at once
+    // the encoder threads are divided among the workers
+    const auto numEncoderThreads = std::max<std::uint_fast32_t>(std::max(std::thread::hardware_concurrency(), 1u) / numThreads, 1);
+    std::vector<std::unique_ptr<MEIToAVI::Reader>> readers;
+    readers.reserve(numThreads - 1);
+    for (std::uint_fast32_t i = 1; i < numThreads; i++) {
+      readers.push_back(meiToAvi.CreateReader(numEncoderThreads));
+    }
+
+    // a whole leaf fits in a piece, so that most leaves are hashed straight from the buffer
+    const auto workerBufferSize = hashBuilder ? std::max<std::size_t>(bufferSize, hashBuilder->GetLeaves().leafSize) : bufferSize;
+
+    std::atomic<std::size_t> nextRange(0);
+    std::vector<WorkerStat> stats(numThreads, WorkerStat{0, 0, {}});
+
+    auto worker = [&] (std::size_t workerIndex) {
+      try {
+        auto& source = workerIndex == 0 ? meiToAvi.GetSource() : readers[workerIndex - 1]->GetSource();
+        auto& stat = stats[workerIndex];
+        auto buffer = std::make_unique<std::uint8_t[]>(workerBufferSize);
+
+        const auto startTime = std::chrono::steady_clock::now();
+
+        std::size_t rangeIndex;
+        while ((rangeIndex = nextRange++) < ranges.size()) {
+          const auto& range = ranges[rangeIndex];
+          WriteRange(source, outputFile, buffer.get(), workerBufferSize, range.begin, range.end, holes, hashBuilder);
+          stat.writtenSize += range.end - range.begin;
+          stat.numRanges++;
+
+          if (journal) {
+            outputFile.Flush();
+            journal->Append(range.begin, range.end);
+          }
+        }
+
+        stat.time = std::chrono::steady_clock::now() - startTime;
+      } catch (...) {
+        // let the other workers stop early
+        nextRange = ranges.size();
+        throw;
+      }
+    };
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    ThreadPool::GetShared().ParallelFor(numThreads, numThreads, ThreadPool::Priority::Normal, worker);
+
+    const auto totalTime = std::chrono::steady_clock::now() - startTime;
+
+    if (showMessage) {
+      const auto toMiBPerSecond = [] (std::uint64_t size, std::chrono::steady_clock::duration time) {
+        const auto seconds = std::chrono::duration<double>(time).count();
+        return seconds > 0 ? size / seconds / (1024 * 1024) : 0.0;
+      };
+
+      for (std::uint_fast32_t i = 0; numThreads > 1 && i < numThreads; i++) {
+        const auto& stat = stats[i];
+        std::wcerr << L"[info] worker "sv << i << L": "sv << stat.numRanges << L" ranges, "sv << stat.writtenSize << L" bytes in "sv
+                   << std::chrono::duration<double>(stat.time).count() << L" s ("sv << toMiBPerSecond(stat.writtenSize, stat.time) << L" MiB/s)"sv << std::endl;
+      }
+      std::uint64_t writtenSize = 0;
+      for (const auto& stat : stats) {
+        writtenSize += stat.writtenSize;
+      }
+      std::wcerr << L"[info] total: "sv << writtenSize << L" bytes in "sv << std::chrono::duration<double>(totalTime).count() << L" s ("sv
+                 << toMiBPerSecond(writtenSize, totalTime) << L" MiB/s)"sv << std::endl;
+    }
+  }
+}
+
+
+void WriteParallel(MEIToAVI& meiToAvi, OutputFile& outputFile, std::uint_fast32_t numThreads, std::size_t bufferSize, bool showMessage, ResumeJournal* journal, HashTree::Builder* hashBuilder) {
+  auto& primarySource = meiToAvi.GetSource();
+  const std::uint64_t totalSize = primarySource.GetSize();
+  const auto& blockLayout = meiToAvi.GetBlockLayout();
+
+  std::size_t numRanges = static_cast<std::size_t>(numThreads) * RangesPerThread;
+  if (journal) {
+    numRanges = std::max<std::size_t>(numRanges, static_cast<std::size_t>((totalSize + ResumeRangeSize - 1) / ResumeRangeSize));
+  }
+  auto ranges = SplitRanges(blockLayout, totalSize, numRanges);
+
+  if (journal) {
+    const auto verifyStartTime = std::chrono::steady_clock::now();
+    const auto result = journal->Verify(primarySource, outputFile, ResumeVerifyRanges, ResumeVerifySize, bufferSize);
+    const auto verifyTime = std::chrono::steady_clock::now() - verifyStartTime;
+    journal->Start();
+
+    if (journal->GetCompletedRanges().empty()) {
+      // nothing is reused, and whatever the file contained would otherwise remain in the holes
+      outputFile.Preallocate(0);
+    }
+
+    ranges = SubtractRanges(ranges, journal->GetCompletedRanges());
+
+    if (showMessage) {
+      if (!result.headerMatched) {
+        std::wcerr << L"[warn] resume: the existing output does not match, writing it from the beginning"sv << std::endl;
+      } else if (result.numDiscardedRanges) {
+        std::wcerr << L"[warn] resume: "sv << result.numDiscardedRanges << L" recorded ranges do not match and are written again"sv << std::endl;
+      }
+
+      std::uint64_t remainingSize = 0;
+      for (const auto& range : ranges) {
+        remainingSize += range.end - range.begin;
+      }
+
+      if (!journal->GetCompletedRanges().empty()) {
+        std::wcerr << L"[info] resume: "sv << (totalSize - remainingSize) << L" of "sv << totalSize << L" bytes already written, verified "sv
+                   << result.verifiedSize << L" bytes in "sv << std::chrono::duration<double>(verifyTime).count() << L" s"sv << std::endl;
+        if (!ranges.empty()) {
+          // the first missing range starts at a video keyframe chunk unless it is the very beginning
+          const auto begin = ranges.front().begin;
+          const auto itrBlock = std::find_if(blockLayout.cbegin(), blockLayout.cend(), [begin] (const AVIBuilder::BlockLayout& block) {
+            return block.streamIndex == 0 && !block.reference && block.chunkOffset == begin;
+          });
+          std::wcerr << L"[info] resume: continuing from offset "sv << begin;
+          if (itrBlock != blockLayout.cend()) {
+            std::wcerr << L" (frame "sv << itrBlock->blockIndex << L")"sv;
+          }
+          std::wcerr << std::endl;
+        }
+      }
+    }
+
+    if (ranges.empty()) {
+      return;
+    }
+  }
+
+  numThreads = static_cast<std::uint_fast32_t>(std::min<std::size_t>(numThreads, ranges.size()));
+
+  const auto holes = FindHoles(primarySource);
+  std::uint64_t totalHoleSize = 0;
+  for (const auto& hole : holes) {
+    totalHoleSize += hole.size;
+  }
+
+  bool sparse = !holes.empty() && outputFile.SetSparse();
+  outputFile.Preallocate(totalSize);
+
+  // in a file which is not sparse, a write beyond the valid data length waits for the file system to zero-fill the range
+  // before it, which serializes the workers; the valid data length is set in advance if the privilege allows, else
+  // the file is made sparse, else the ranges are written in order by a single worker
+  bool validData = false;
+  if (numThreads > 1 && !sparse) {
+    validData = outputFile.SetValidData(totalSize);
+    sparse = !validData && outputFile.SetSparse();
+    if (!validData && !sparse) {
+      numThreads = 1;
+    }
+  }
+
+  if (showMessage) {
+    if (validData) {
+      std::wcerr << L"[info] output file: valid data length set in advance"sv << std::endl;
+    } else if (sparse) {
+      std::wcerr << L"[info] output file: sparse"sv << std::endl;
+    } else {
+      std::wcerr << L"[info] output file: not sparse, written in order"sv << std::endl;
+    }
+  }
+
+  // the holes would keep the old content of the disk once the valid data length is set, so they are written too
+  const auto unwrittenHoles = validData ? std::vector<SourceBase::ZeroRange>() : holes;
+  if (showMessage && !unwrittenHoles.empty()) {
+    std::wcerr << L"[info] "sv << totalHoleSize << L" zero bytes in "sv << holes.size() << L" ranges are not written"sv << std::endl;
+  }
+
+  WriteRanges(meiToAvi, outputFile, ranges, numThreads, bufferSize, unwrittenHoles, showMessage, hashBuilder, journal);
+
+  if (showMessage) {
+    if (const auto numExtents = outputFile.CountExtents()) {
+      std::wcerr << L"[info] output file has "sv << numExtents.value() << L" extents"sv << std::endl;
+    }
+  }
+}
+
+
+void RewriteRanges(MEIToAVI& meiToAvi, OutputFile& outputFile, const std::vector<HashTree::Range>& ranges, std::uint_fast32_t numThreads, std::size_t bufferSize, bool showMessage, HashTree::Builder* hashBuilder) {
+  std::vector<Range> rewriteRanges;
+  rewriteRanges.reserve(ranges.size());
+  for (const auto& range : ranges) {
+    rewriteRanges.push_back(Range{range.begin, range.end});
+  }
+
+  if (rewriteRanges.empty()) {
+    return;
+  }
+
+  numThreads = static_cast<std::uint_fast32_t>(std::min<std::size_t>(numThreads, rewriteRanges.size()));
+
+  // no holes: the damage may well be in a range which was left unwritten
+  WriteRanges(meiToAvi, outputFile, rewriteRanges, numThreads, bufferSize, {}, showMessage, hashBuilder, nullptr);
+  outputFile.Flush();
+}
+
+
+void WriteSource(SourceBase& source, OutputFile& outputFile, std::size_t bufferSize) {
+  const std::uint64_t totalSize = source.GetSize();
+  const auto holes = FindHoles(source);
+
+  outputFile.Preallocate(totalSize);
+
+  auto buffer = std::make_unique<std::uint8_t[]>(bufferSize);
+  WriteRange(source, outputFile, buffer.get(), bufferSize, 0, totalSize, holes, nullptr);
+}
@@ -0,0 +1,35 @@
+#ifndef ML_PARALLELOUTPUT_HPP
+#define ML_PARALLELOUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "HashTree.hpp"
+#include "MEIToAVI.hpp"
+#include "OutputFile.hpp"
+#include "ResumeJournal.hpp"
+#include "Source/SourceBase.hpp"
+
+
+// writes the AVI into a preallocated file, with several decoder instances at once if numThreads > 1
+// the output is split into ranges at video keyframe chunks, so that each range can be decoded without
+// replaying the frames of the preceding range, and the ranges are written in place
+// large zero-filled ranges (JUNK) are skipped and left as holes if the file system supports sparse files
+// with numThreads > 1, a file which is not sparse gets its valid data length set in advance (which needs SE_MANAGE_VOLUME_NAME,
+// and then the holes are written too), or is made sparse, or else is written in order by one decoder, since the file system
+// zero-fills up to every write beyond the data written so far; the time and the extent count are reported for each case
+// with journal, every completed range is recorded, and the ranges recorded by an earlier run are verified and skipped,
+// so that the decoding restarts at the video keyframe where the first missing range begins
+// with hashBuilder, the leaves are hashed by the workers as they are written; the leaves of the ranges skipped by
+// journal are left to HashTree::Builder::Complete
+void WriteParallel(MEIToAVI& meiToAvi, OutputFile& outputFile, std::uint_fast32_t numThreads, std::size_t bufferSize, bool showMessage, ResumeJournal* journal = nullptr, HashTree::Builder* hashBuilder = nullptr);
+
+// writes the given ranges of an existing output again in place (for -repair), zero-filled ranges included
+// the ranges need not start at keyframes, as the decoders seek on their own
+void RewriteRanges(MEIToAVI& meiToAvi, OutputFile& outputFile, const std::vector<HashTree::Range>& ranges, std::uint_fast32_t numThreads, std::size_t bufferSize, bool showMessage, HashTree::Builder* hashBuilder = nullptr);
+
+// writes a whole source into a preallocated file on the calling thread, leaving large zero-filled ranges unwritten
+void WriteSource(SourceBase& source, OutputFile& outputFile, std::size_t bufferSize);
+
+#endif
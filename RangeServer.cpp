@@ -0,0 +1,700 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "RangeServer.hpp"
+#include "ThreadPool.hpp"
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+using namespace std::literals;
+
+
+namespace {
+  constexpr std::size_t MaxHeaderSize = 16 * 1024;
+  constexpr std::size_t ReceiveBufferSize = 4096;
+
+  // the read-ahead of a connection holds at most this much, whatever the size of the chunks
+  constexpr std::uint64_t MaxPrefetchSize = 64 * 1024 * 1024;
+
+  constexpr std::string_view ContentType = "video/x-msvideo"sv;
+
+  // for the messages of the connections
+  std::mutex gLogMutex;
+
+
+  void InitializeWinsock() {
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+      throw std::runtime_error("RangeServer: WSAStartup failed");
+    }
+  }
+
+
+  // the header and the data are sent separately; without this, Nagle's algorithm holds back the data until
+  // the delayed ACK for the header arrives, which adds tens of milliseconds to every request
+  void DisableNagle(SOCKET socket) {
+    const int value = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+
+  bool SendAll(SOCKET socket, const char* data, std::size_t size) {
+    while (size) {
+      const int sentSize = send(socket, data, static_cast<int>(std::min<std::size_t>(size, 1 << 30)), 0);
+      if (sentSize == SOCKET_ERROR || sentSize == 0) {
+        return false;
+      }
+      data += sentSize;
+      size -= sentSize;
+    }
+    return true;
+  }
+
+
+  // receives until pendingData contains the end of a header ("\r\n\r\n")
+  // returns the size of the header including the terminator, or std::nullopt if the connection was closed or the header is too large
+  std::optional<std::size_t> ReceiveHeader(SOCKET socket, std::string& pendingData) {
+    char buffer[ReceiveBufferSize];
+    std::size_t searchFrom = 0;
+    while (true) {
+      const auto headerEnd = pendingData.find("\r\n\r\n"sv, searchFrom);
+      if (headerEnd != std::string::npos) {
+        return headerEnd + 4;
+      }
+      if (pendingData.size() > MaxHeaderSize) {
+        return std::nullopt;
+      }
+      searchFrom = pendingData.size() >= 3 ? pendingData.size() - 3 : 0;
+
+      const int receivedSize = recv(socket, buffer, sizeof(buffer), 0);
+      if (receivedSize == SOCKET_ERROR || receivedSize == 0) {
+        return std::nullopt;
+      }
+      pendingData.append(buffer, receivedSize);
+    }
+  }
+
+
+  bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && std::equal(a.cbegin(), a.cend(), b.cbegin(), [] (char x, char y) {
+      return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+    });
+  }
+
+
+  std::string_view Trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+      str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+      str.remove_suffix(1);
+    }
+    return str;
+  }
+
+
+  std::optional<std::uint64_t> ParseUInt(std::string_view str) {
+    if (str.empty() || str.size() > 19) {
+      return std::nullopt;
+    }
+    std::uint64_t value = 0;
+    for (const char c : str) {
+      if (c < '0' || c > '9') {
+        return std::nullopt;
+      }
+      value = value * 10 + (c - '0');
+    }
+    return value;
+  }
+
+
+  struct Request {
+    std::string_view method;
+    std::string_view version;
+    std::optional<std::string_view> range;
+    bool close;
+  };
+
+
+  // header: the request line and the header fields, without the terminating empty line
+  std::optional<Request> ParseRequest(std::string_view header) {
+    Request request{};
+
+    auto lineEnd = header.find("\r\n"sv);
+    const auto requestLine = header.substr(0, lineEnd);
+    header.remove_prefix(lineEnd == std::string_view::npos ? header.size() : lineEnd + 2);
+
+    // method SP request-target SP HTTP-version
+    const auto firstSpace = requestLine.find(' ');
+    const auto lastSpace = requestLine.rfind(' ');
+    if (firstSpace == std::string_view::npos || firstSpace == lastSpace) {
+      return std::nullopt;
+    }
+    request.method = requestLine.substr(0, firstSpace);
+    request.version = requestLine.substr(lastSpace + 1);
+    if (request.version.substr(0, 5) != "HTTP/"sv) {
+      return std::nullopt;
+    }
+    // HTTP/1.0 closes by default
+    request.close = request.version == "HTTP/1.0"sv;
+
+    while (!header.empty()) {
+      lineEnd = header.find("\r\n"sv);
+      const auto line = header.substr(0, lineEnd);
+      header.remove_prefix(lineEnd == std::string_view::npos ? header.size() : lineEnd + 2);
+
+      const auto colon = line.find(':');
+      if (colon == std::string_view::npos) {
+        return std::nullopt;
+      }
+      const auto name = Trim(line.substr(0, colon));
+      const auto value = Trim(line.substr(colon + 1));
+      if (EqualsIgnoreCase(name, "Range"sv)) {
+        request.range = value;
+      } else if (EqualsIgnoreCase(name, "Connection"sv)) {
+        if (EqualsIgnoreCase(value, "close"sv)) {
+          request.close = true;
+        } else if (EqualsIgnoreCase(value, "keep-alive"sv)) {
+          request.close = false;
+        }
+      }
+    }
+
+    return request;
+  }
+
+
+  enum class RangeResult {
+    Full,           // no (usable) range; the whole content is sent
+    Partial,
+    Unsatisfiable,
+  };
+
+
+  // only a single byte range is supported; other forms are ignored as permitted by RFC 7233
+  RangeResult ParseRange(std::string_view range, std::uint64_t totalSize, std::uint64_t& first, std::uint64_t& last) {
+    const auto equal = range.find('=');
+    if (equal == std::string_view::npos || !EqualsIgnoreCase(Trim(range.substr(0, equal)), "bytes"sv)) {
+      return RangeResult::Full;
+    }
+    const auto spec = Trim(range.substr(equal + 1));
+    if (spec.find(',') != std::string_view::npos) {
+      return RangeResult::Full;
+    }
+
+    const auto hyphen = spec.find('-');
+    if (hyphen == std::string_view::npos) {
+      return RangeResult::Full;
+    }
+    const auto firstStr = Trim(spec.substr(0, hyphen));
+    const auto lastStr = Trim(spec.substr(hyphen + 1));
+
+    if (firstStr.empty()) {
+      // suffix: the last n bytes
+      const auto suffixSize = ParseUInt(lastStr);
+      if (!suffixSize) {
+        return RangeResult::Full;
+      }
+      if (suffixSize.value() == 0 || totalSize == 0) {
+        return RangeResult::Unsatisfiable;
+      }
+      first = totalSize - std::min(suffixSize.value(), totalSize);
+      last = totalSize - 1;
+      return RangeResult::Partial;
+    }
+
+    const auto parsedFirst = ParseUInt(firstStr);
+    const auto parsedLast = lastStr.empty() ? std::optional<std::uint64_t>(std::numeric_limits<std::uint64_t>::max()) : ParseUInt(lastStr);
+    if (!parsedFirst || !parsedLast || parsedFirst.value() > parsedLast.value()) {
+      return RangeResult::Full;
+    }
+    if (parsedFirst.value() >= totalSize) {
+      return RangeResult::Unsatisfiable;
+    }
+    first = parsedFirst.value();
+    last = std::min(parsedLast.value(), totalSize - 1);
+    return RangeResult::Partial;
+  }
+}
+
+
+// the frame caches of the readers keep only a couple of frames, too few to hold the chunks read ahead,
+// so the data are kept here instead
+struct RangeServer::Prefetch {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool running;
+  std::atomic<bool> cancelled;
+  std::uint64_t offset;               // where data begins
+  std::vector<std::uint8_t> data;
+};
+
+
+RangeServer::RangeServer(DecoderPool<SourceBase>& sourcePool, std::uint64_t totalSize, const std::vector<AVIBuilder::BlockLayout>& blockLayout, std::size_t prefetchChunks, std::uint16_t port, std::size_t bufferSize, bool logRequests) :
+  mSourcePool(sourcePool),
+  mTotalSize(totalSize),
+  mBufferSize(bufferSize),
+  mLogRequests(logRequests),
+  mListenSocket(INVALID_SOCKET),
+  mPort(0),
+  mConnectionMutex(),
+  mConnectionCondition(),
+  mClientSockets(),
+  mClosing(false),
+  mPrefetchChunks(prefetchChunks),
+  mChunkEnds(),
+  mNumPrefetches(0),
+  mPrefetchedSize(0),
+  mPrefetchUsedSize(0)
+{
+  for (const auto& block : blockLayout) {
+    if (!block.reference) {
+      mChunkEnds.push_back(block.dataOffset + block.size);
+    }
+  }
+  std::sort(mChunkEnds.begin(), mChunkEnds.end());
+
+  InitializeWinsock();
+
+  const auto listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (listenSocket == INVALID_SOCKET) {
+    WSACleanup();
+    throw std::runtime_error("RangeServer: cannot create socket");
+  }
+  mListenSocket = listenSocket;
+
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  int addressSize = sizeof(address);
+  if (bind(listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+      listen(listenSocket, SOMAXCONN) == SOCKET_ERROR ||
+      getsockname(listenSocket, reinterpret_cast<sockaddr*>(&address), &addressSize) == SOCKET_ERROR) {
+    closesocket(listenSocket);
+    WSACleanup();
+    throw std::runtime_error("RangeServer: cannot listen on the port");
+  }
+
+  mPort = ntohs(address.sin_port);
+}
+
+
+RangeServer::~RangeServer() {
+  Close();
+  WSACleanup();
+}
+
+
+std::uint16_t RangeServer::GetPort() const {
+  return mPort;
+}
+
+
+void RangeServer::Run() {
+  const auto listenSocket = static_cast<SOCKET>(mListenSocket);
+  while (true) {
+    const auto clientSocket = accept(listenSocket, nullptr, nullptr);
+    if (clientSocket == INVALID_SOCKET) {
+      // closed by Close
+      return;
+    }
+
+    DisableNagle(clientSocket);
+
+    {
+      std::lock_guard lock(mConnectionMutex);
+      // accepted just before Close, which would not shut it down
+      if (mClosing) {
+        closesocket(clientSocket);
+        return;
+      }
+      mClientSockets.insert(clientSocket);
+    }
+
+    std::thread([this, clientSocket] () {
+      HandleConnection(clientSocket);
+
+      // closed under the lock, so that Close never shuts down a socket whose handle has been reused
+      std::lock_guard lock(mConnectionMutex);
+      closesocket(static_cast<SOCKET>(clientSocket));
+      mClientSockets.erase(clientSocket);
+      mConnectionCondition.notify_all();
+    }).detach();
+  }
+}
+
+
+void RangeServer::Close() {
+  if (mListenSocket != INVALID_SOCKET) {
+    closesocket(static_cast<SOCKET>(mListenSocket));
+    mListenSocket = INVALID_SOCKET;
+  }
+
+  std::unique_lock lock(mConnectionMutex);
+  mClosing = true;
+
+  // a client may keep an idle connection open for good, blocking its thread in recv
+  // shutting the sockets down makes recv and send of the threads fail, so they finish
+  for (const auto clientSocket : mClientSockets) {
+    shutdown(static_cast<SOCKET>(clientSocket), SD_BOTH);
+  }
+
+  mConnectionCondition.wait(lock, [this] () {
+    return mClientSockets.empty();
+  });
+}
+
+
+RangeServer::PrefetchStats RangeServer::GetPrefetchStats() const {
+  return PrefetchStats{
+    mNumPrefetches,
+    mPrefetchedSize,
+    mPrefetchUsedSize,
+  };
+}
+
+
+void RangeServer::HandleConnection(std::uintptr_t clientSocket) {
+  Prefetch prefetch{{}, {}, false, false, 0, {}};
+  try {
+    auto buffer = std::make_unique<std::uint8_t[]>(mBufferSize);
+    std::string pendingData;
+    while (HandleRequest(clientSocket, pendingData, buffer.get(), prefetch)) {}
+  } catch (const std::exception& exception) {
+    std::lock_guard lock(gLogMutex);
+    std::wcerr << L"[error] "sv << exception.what() << std::endl;
+  }
+
+  // the task refers to prefetch
+  TakePrefetch(prefetch, std::nullopt);
+}
+
+
+void RangeServer::StartPrefetch(Prefetch& prefetch, std::uint64_t offset) {
+  const auto itrChunk = std::upper_bound(mChunkEnds.cbegin(), mChunkEnds.cend(), offset);
+  if (!mPrefetchChunks || itrChunk == mChunkEnds.cend()) {
+    return;
+  }
+  const auto lastChunkIndex = std::min<std::size_t>(static_cast<std::size_t>(itrChunk - mChunkEnds.cbegin()) + mPrefetchChunks - 1, mChunkEnds.size() - 1);
+  const auto end = std::min(mChunkEnds[lastChunkIndex], offset + MaxPrefetchSize);
+
+  {
+    std::lock_guard lock(prefetch.mutex);
+    prefetch.running = true;
+    prefetch.cancelled = false;
+    prefetch.offset = offset;
+    prefetch.data.clear();
+  }
+
+  // Normal priority, so that the slices of frames being served go first
+  ThreadPool::GetShared().Submit([this, &prefetch, offset, end] () {
+    std::vector<std::uint8_t> data;
+    try {
+      // only the decoder the range has just been read with is worth it; any other would have to seek
+      if (auto source = mSourcePool.TryAcquire(offset, 1)) {
+        data.resize(static_cast<std::size_t>(end - offset));
+        std::size_t readSize = 0;
+        while (readSize != data.size() && !prefetch.cancelled) {
+          const auto stepSize = std::min(mBufferSize, data.size() - readSize);
+          (*source)->Read(data.data() + readSize, stepSize, static_cast<std::streamsize>(offset + readSize));
+          readSize += stepSize;
+          source->SetPosition(offset + readSize);
+        }
+        data.resize(readSize);
+
+        mNumPrefetches++;
+        mPrefetchedSize += readSize;
+      }
+    } catch (...) {
+      // the next request reads the range on its own and reports the error
+      data.clear();
+    }
+
+    {
+      std::lock_guard lock(prefetch.mutex);
+      prefetch.data = std::move(data);
+      prefetch.running = false;
+    }
+    prefetch.condition.notify_all();
+  }, ThreadPool::Priority::Normal);
+}
+
+
+std::vector<std::uint8_t> RangeServer::TakePrefetch(Prefetch& prefetch, std::optional<std::uint64_t> offset) {
+  std::unique_lock lock(prefetch.mutex);
+  if (offset != prefetch.offset) {
+    prefetch.cancelled = true;
+  }
+  prefetch.condition.wait(lock, [&prefetch] () {
+    return !prefetch.running;
+  });
+
+  auto data = std::move(prefetch.data);
+  prefetch.data.clear();
+  if (offset != prefetch.offset) {
+    data.clear();
+  }
+  return data;
+}
+
+
+bool RangeServer::HandleRequest(std::uintptr_t clientSocket, std::string& pendingData, std::uint8_t* buffer, Prefetch& prefetch) {
+  const auto socket = static_cast<SOCKET>(clientSocket);
+
+  const auto headerSize = ReceiveHeader(socket, pendingData);
+  if (!headerSize) {
+    return false;
+  }
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  // requests with a body are not supported, so the next request starts right after the header
+  const std::string header = pendingData.substr(0, headerSize.value() - 4);
+  pendingData.erase(0, headerSize.value());
+
+  const auto request = ParseRequest(header);
+  if (!request) {
+    const auto response = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"sv;
+    SendAll(socket, response.data(), response.size());
+    return false;
+  }
+
+  const bool isHead = request->method == "HEAD"sv;
+  if (!isHead && request->method != "GET"sv) {
+    const auto response = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\n\r\n"sv;
+    return SendAll(socket, response.data(), response.size()) && !request->close;
+  }
+
+  std::uint64_t first = 0;
+  std::uint64_t last = mTotalSize ? mTotalSize - 1 : 0;
+  const auto rangeResult = request->range ? ParseRange(request->range.value(), mTotalSize, first, last) : RangeResult::Full;
+
+  std::string response;
+  std::uint64_t contentSize = 0;
+  switch (rangeResult) {
+    case RangeResult::Full:
+      contentSize = mTotalSize;
+      response = "HTTP/1.1 200 OK\r\n"s;
+      break;
+
+    case RangeResult::Partial:
+      contentSize = last - first + 1;
+      response = "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes "s + std::to_string(first) + "-"s + std::to_string(last) + "/"s + std::to_string(mTotalSize) + "\r\n"s;
+      break;
+
+    case RangeResult::Unsatisfiable:
+      response = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */"s + std::to_string(mTotalSize) + "\r\n"s;
+      break;
+  }
+
+  response += "Content-Type: "s + std::string(ContentType) + "\r\n"s;
+  response += "Accept-Ranges: bytes\r\n"s;
+  response += "Content-Length: "s + std::to_string(contentSize) + "\r\n"s;
+  response += request->close ? "Connection: close\r\n"s : "Connection: keep-alive\r\n"s;
+  response += "\r\n"s;
+
+  if (!SendAll(socket, response.data(), response.size())) {
+    return false;
+  }
+
+  if (!isHead && contentSize) {
+    auto offset = first;
+    const auto end = first + contentSize;
+
+    const auto prefetched = TakePrefetch(prefetch, first);
+    if (!prefetched.empty()) {
+      const auto prefetchedSize = static_cast<std::size_t>(std::min<std::uint64_t>(prefetched.size(), contentSize));
+      if (!SendAll(socket, reinterpret_cast<const char*>(prefetched.data()), prefetchedSize)) {
+        return false;
+      }
+      mPrefetchUsedSize += prefetchedSize;
+      offset += prefetchedSize;
+    }
+
+    while (offset != end) {
+      const auto readSize = static_cast<std::size_t>(std::min<std::uint64_t>(mBufferSize, end - offset));
+      {
+        auto source = mSourcePool.Acquire(offset);
+        source->Read(buffer, readSize, static_cast<std::streamsize>(offset));
+        source.SetPosition(offset + readSize);
+      }
+      // the client may close the connection at any time, e.g. when the player seeks
+      if (!SendAll(socket, reinterpret_cast<const char*>(buffer), readSize)) {
+        return false;
+      }
+      offset += readSize;
+    }
+
+    if (!request->close) {
+      StartPrefetch(prefetch, end);
+    }
+  }
+
+  if (mLogRequests) {
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    std::wostringstream message;
+    message << L"[serve] "sv << std::wstring(request->method.cbegin(), request->method.cend()) << L" "sv;
+    if (rangeResult == RangeResult::Partial) {
+      message << first << L"-"sv << last;
+    } else if (rangeResult == RangeResult::Full) {
+      message << L"full"sv;
+    } else {
+      message << L"unsatisfiable"sv;
+    }
+    message << L" ("sv << elapsed << L" ms)\n"sv;
+    std::lock_guard lock(gLogMutex);
+    std::wcerr << message.str() << std::flush;
+  }
+
+  return !request->close;
+}
+
+
+
+void RunRangeLoadTest(std::uint16_t port, std::uint64_t totalSize, std::size_t numRequests, std::size_t requestSize, std::uint_fast32_t numClients) {
+  if (!totalSize || !numRequests || !numClients) {
+    return;
+  }
+
+  InitializeWinsock();
+
+  requestSize = static_cast<std::size_t>(std::min<std::uint64_t>(requestSize, totalSize));
+
+  std::vector<std::vector<double>> latencies(numClients);
+  std::vector<std::exception_ptr> exceptions(numClients);
+  std::atomic<std::size_t> nextRequest(0);
+
+  auto client = [&] (std::uint_fast32_t clientIndex) {
+    SOCKET clientSocket = INVALID_SOCKET;
+    try {
+      clientSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+      if (clientSocket == INVALID_SOCKET) {
+        throw std::runtime_error("RunRangeLoadTest: cannot create socket");
+      }
+
+      sockaddr_in address{};
+      address.sin_family = AF_INET;
+      address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      address.sin_port = htons(port);
+      if (connect(clientSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR) {
+        throw std::runtime_error("RunRangeLoadTest: cannot connect");
+      }
+      DisableNagle(clientSocket);
+
+      std::mt19937_64 random(clientIndex);
+      std::uniform_int_distribution<std::uint64_t> offsetDistribution(0, totalSize - requestSize);
+
+      std::string pendingData;
+      char buffer[64 * 1024];
+
+      while (nextRequest++ < numRequests) {
+        const auto first = offsetDistribution(random);
+        const auto last = first + requestSize - 1;
+        const auto request = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nRange: bytes="s + std::to_string(first) + "-"s + std::to_string(last) + "\r\n\r\n"s;
+
+        const auto startTime = std::chrono::steady_clock::now();
+
+        if (!SendAll(clientSocket, request.data(), request.size())) {
+          throw std::runtime_error("RunRangeLoadTest: cannot send request");
+        }
+
+        const auto headerSize = ReceiveHeader(clientSocket, pendingData);
+        if (!headerSize || pendingData.compare(0, 13, "HTTP/1.1 206 ") != 0) {
+          throw std::runtime_error("RunRangeLoadTest: unexpected response");
+        }
+
+        // the server always sends Content-Length
+        const auto contentLengthPos = pendingData.find("Content-Length: "sv);
+        if (contentLengthPos == std::string::npos || contentLengthPos > headerSize.value()) {
+          throw std::runtime_error("RunRangeLoadTest: no Content-Length");
+        }
+        const auto contentLength = std::stoull(pendingData.substr(contentLengthPos + 16));
+        if (contentLength != requestSize) {
+          throw std::runtime_error("RunRangeLoadTest: unexpected Content-Length");
+        }
+
+        std::uint64_t remainingSize = contentLength;
+        const auto bufferedSize = std::min<std::uint64_t>(pendingData.size() - headerSize.value(), remainingSize);
+        remainingSize -= bufferedSize;
+        pendingData.erase(0, static_cast<std::size_t>(headerSize.value() + bufferedSize));
+
+        while (remainingSize) {
+          const int receivedSize = recv(clientSocket, buffer, static_cast<int>(std::min<std::uint64_t>(sizeof(buffer), remainingSize)), 0);
+          if (receivedSize == SOCKET_ERROR || receivedSize == 0) {
+            throw std::runtime_error("RunRangeLoadTest: connection closed");
+          }
+          remainingSize -= receivedSize;
+        }
+
+        latencies[clientIndex].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count());
+      }
+    } catch (...) {
+      exceptions[clientIndex] = std::current_exception();
+      nextRequest = numRequests;
+    }
+
+    if (clientSocket != INVALID_SOCKET) {
+      closesocket(clientSocket);
+    }
+  };
+
+  const auto startTime = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> threads;
+  threads.reserve(numClients);
+  for (std::uint_fast32_t i = 0; i < numClients; i++) {
+    threads.emplace_back(client, i);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const auto totalTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+  WSACleanup();
+
+  for (const auto& exception : exceptions) {
+    if (exception) {
+      std::rethrow_exception(exception);
+    }
+  }
+
+  std::vector<double> allLatencies;
+  for (const auto& clientLatencies : latencies) {
+    allLatencies.insert(allLatencies.end(), clientLatencies.cbegin(), clientLatencies.cend());
+  }
+  std::sort(allLatencies.begin(), allLatencies.end());
+
+  const auto percentile = [&allLatencies] (double p) {
+    const auto index = static_cast<std::size_t>(p * (allLatencies.size() - 1) + .5);
+    return allLatencies[index];
+  };
+
+  std::wcerr << L"[bench] "sv << allLatencies.size() << L" requests of "sv << requestSize << L" bytes from "sv << numClients << L" clients in "sv << totalTime << L" s ("sv
+             << (allLatencies.size() / totalTime) << L" req/s, "sv << (allLatencies.size() * static_cast<double>(requestSize) / totalTime / (1024 * 1024)) << L" MiB/s)"sv << std::endl;
+  std::wcerr << L"[bench] latency (ms): min "sv << allLatencies.front() << L", p50 "sv << percentile(.5) << L", p90 "sv << percentile(.9)
+             << L", p99 "sv << percentile(.99) << L", max "sv << allLatencies.back() << std::endl;
+}
@@ -0,0 +1,85 @@
+#ifndef ML_RANGESERVER_HPP
+#define ML_RANGESERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "AVIBuilder.hpp"
+#include "DecoderPool.hpp"
+#include "Source/SourceBase.hpp"
+
+
+// serves a source over HTTP/1.1 on the loopback interface, with support for Range requests
+// so that players can open the virtual AVI as a seekable URL without writing it out
+// the data are read (decoded) on demand; connections are served by their own threads,
+// and each read borrows a source (a decoder instance, as sources are not thread-safe) from the pool
+// with the read offset as its position
+// after each range, the data up to the end of the next prefetchChunks chunks are read ahead on the thread pool into a buffer
+// of the connection, with the decoder the range was read with; the next request of the connection is served from it if it
+// continues there, and cancels it otherwise
+class RangeServer {
+public:
+  struct PrefetchStats {
+    std::uint64_t numPrefetches;    // read-aheads which found the decoder idle
+    std::uint64_t prefetchedSize;
+    std::uint64_t usedSize;         // of prefetchedSize, sent to the clients
+  };
+
+private:
+  struct Prefetch;
+
+  DecoderPool<SourceBase>& mSourcePool;
+  std::uint64_t mTotalSize;
+  std::size_t mBufferSize;
+  bool mLogRequests;
+  std::uintptr_t mListenSocket;   // SOCKET
+  std::uint16_t mPort;
+  std::mutex mConnectionMutex;
+  std::condition_variable mConnectionCondition;
+  std::set<std::uintptr_t> mClientSockets;    // SOCKET, of the open connections
+  bool mClosing;
+  std::size_t mPrefetchChunks;
+  std::vector<std::uint64_t> mChunkEnds;      // end of the data of every chunk, sorted
+  std::atomic<std::uint64_t> mNumPrefetches;
+  std::atomic<std::uint64_t> mPrefetchedSize;
+  std::atomic<std::uint64_t> mPrefetchUsedSize;
+
+  void HandleConnection(std::uintptr_t clientSocket);
+  // returns false if the connection should be closed
+  bool HandleRequest(std::uintptr_t clientSocket, std::string& pendingData, std::uint8_t* buffer, Prefetch& prefetch);
+  void StartPrefetch(Prefetch& prefetch, std::uint64_t offset);
+  // waits for the read-ahead and returns its data if it starts at offset; cancels it otherwise (always if offset is std::nullopt)
+  std::vector<std::uint8_t> TakePrefetch(Prefetch& prefetch, std::optional<std::uint64_t> offset);
+
+public:
+  // port 0 picks an unused port (see GetPort)
+  // every source in the pool must have the same content of totalSize bytes, laid out as blockLayout
+  // prefetchChunks 0 disables the read-ahead
+  RangeServer(DecoderPool<SourceBase>& sourcePool, std::uint64_t totalSize, const std::vector<AVIBuilder::BlockLayout>& blockLayout, std::size_t prefetchChunks, std::uint16_t port, std::size_t bufferSize, bool logRequests);
+  ~RangeServer();
+
+  RangeServer(const RangeServer&) = delete;
+  RangeServer& operator=(const RangeServer&) = delete;
+
+  std::uint16_t GetPort() const;
+
+  // accepts connections until Close is called
+  void Run();
+  // stops accepting connections, shuts down the open ones (including idle keep-alive ones) and waits for them to finish
+  void Close();
+
+  PrefetchStats GetPrefetchStats() const;
+};
+
+
+// measures the latency of random range requests against a RangeServer on the loopback interface
+void RunRangeLoadTest(std::uint16_t port, std::uint64_t totalSize, std::size_t numRequests, std::size_t requestSize, std::uint_fast32_t numClients);
+
+#endif
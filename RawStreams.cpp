@@ -0,0 +1,238 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "RawStreams.hpp"
+#include "ApproxFraction.hpp"
+#include "AVI.hpp"
+#include "Fraction.hpp"
+#include "FrameTransform.hpp"
+#include "Movie.hpp"
+
+#include <Windows.h>
+
+#include <sakuraglx/sakuraglx.h>
+#include <sakuragl/sgl_erisa_lib.h>
+
+using namespace std::literals;
+
+
+namespace {
+#pragma pack(push, 1)
+  struct WAVHeader {
+    std::uint32_t riffId;
+    std::uint32_t riffSize;
+    std::uint32_t waveId;
+    std::uint32_t fmtId;
+    std::uint32_t fmtSize;
+    std::uint16_t wFormatTag;
+    std::uint16_t nChannels;
+    std::uint32_t nSamplesPerSec;
+    std::uint32_t nAvgBytesPerSec;
+    std::uint16_t nBlockAlign;
+    std::uint16_t wBitsPerSample;
+    std::uint32_t dataId;
+    std::uint32_t dataSize;
+  };
+
+  static_assert(sizeof(WAVHeader) == 44);
+#pragma pack(pop)
+
+
+  // number of frames examined by -autocrop
+  constexpr std::uint_fast32_t AutoCropSamples = 16;
+
+
+  void WriteVideo(ERISA::SGLMovieFilePlayer& movieFilePlayer, const MEIToAVI::Options& options, StreamOutput& output, bool showMessage) {
+    const auto startTime = std::chrono::steady_clock::now();
+
+    const auto size = movieFilePlayer.CurrentFrame()->GetImageSize();
+    const auto numFrames = static_cast<std::uint_fast32_t>(movieFilePlayer.GetAllFrameCount());
+    const auto durationMillis = static_cast<std::uint_fast32_t>(movieFilePlayer.GetTotalTime());
+
+    Fraction<std::uint_fast32_t> fps{
+      numFrames * static_cast<std::uint_fast32_t>(1000),
+      durationMillis,
+    };
+    if (!(options.flags & MEIToAVI::NoApproxFPS)) {
+      fps = ApproxFraction(fps);
+    }
+
+    // YUV4MPEG2 has no BGR formats
+    auto parameters = options.transform;
+    parameters.format = FrameTransform::PixelFormat::I420;
+
+    if (options.flags & MEIToAVI::AutoCrop) {
+      if (const auto detectedBorders = Movie::DetectBorders(movieFilePlayer, AutoCropSamples)) {
+        parameters.crop.left += detectedBorders->left;
+        parameters.crop.top += detectedBorders->top;
+        parameters.crop.right += detectedBorders->right;
+        parameters.crop.bottom += detectedBorders->bottom;
+      }
+    }
+
+    FrameTransform transform(size.w, size.h, parameters);
+
+    // the chroma of FrameTransform is the average of each 2x2 block, i.e. sited at the center
+    const auto header = "YUV4MPEG2 W"s + std::to_string(transform.GetWidth()) + " H"s + std::to_string(transform.GetHeight())
+                      + " F"s + std::to_string(fps.numerator) + ":"s + std::to_string(fps.denominator)
+                      + " Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n"s;
+    constexpr auto frameHeader = "FRAME\n"sv;
+
+    if (showMessage) {
+      std::wcerr << L"[info] y4m: "sv << transform.GetWidth() << L"x"sv << transform.GetHeight() << L" I420, "sv
+                 << fps.numerator << L"/"sv << fps.denominator << L" fps, "sv << numFrames << L" frames"sv << std::endl;
+    }
+
+    output.Write(reinterpret_cast<const std::uint8_t*>(header.data()), header.size());
+
+    const auto frameSize = transform.GetOutputSize();
+    auto buffer = std::make_unique<std::uint8_t[]>(frameSize);
+
+    std::chrono::steady_clock::duration firstFrameTime{};
+    for (std::uint_fast32_t frameIndex = 0; frameIndex < numFrames; frameIndex++) {
+      transform.Apply(Movie::GetFrameImageBuffer(movieFilePlayer, frameIndex), buffer.get());
+      output.Write(reinterpret_cast<const std::uint8_t*>(frameHeader.data()), frameHeader.size());
+      output.Write(buffer.get(), frameSize);
+
+      if (frameIndex == 0) {
+        firstFrameTime = std::chrono::steady_clock::now() - startTime;
+      }
+    }
+
+    output.Close();
+
+    if (showMessage) {
+      const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      std::wcerr << L"[info] y4m: "sv << numFrames << L" frames in "sv << seconds << L" s ("sv << (seconds > 0 ? numFrames / seconds : 0.0)
+                 << L" fps), first frame sent after "sv << std::chrono::duration<double, std::milli>(firstFrameTime).count() << L" ms"sv << std::endl;
+    }
+  }
+
+
+  void WriteAudio(ERISA::SGLSoundFilePlayer& soundFilePlayer, StreamOutput& output, bool rawPCM) {
+    const std::uint_fast32_t bitsPerSample = soundFilePlayer.GetBitsPerSample();
+    const std::uint_fast32_t numChannels = soundFilePlayer.GetChannelCount();
+    const std::uint_fast32_t samplingRate = soundFilePlayer.GetFrequency();
+    const std::uint_fast32_t numSamples = soundFilePlayer.GetTotalSampleCount();
+    const std::uint_fast32_t blockSize = bitsPerSample / 8 * numChannels;
+
+    const std::uint64_t dataSize = static_cast<std::uint64_t>(numSamples) * blockSize;
+
+    if (!rawPCM) {
+      // the length is known from the MEI header, so the WAV header can be sent first
+      // sizes that do not fit are set to 0xFFFFFFFF, which readers of streamed WAV take as unknown
+      const auto toSize = [] (std::uint64_t size) {
+        return static_cast<std::uint32_t>(std::min<std::uint64_t>(size, 0xFFFFFFFFu));
+      };
+
+      const WAVHeader header{
+        AVI::GetFourCC("RIFF"),
+        toSize(sizeof(WAVHeader) - 8 + dataSize + (dataSize & 1)),
+        AVI::GetFourCC("WAVE"),
+        AVI::GetFourCC("fmt "),
+        16u,
+        0x0001u,    // WAVE_FORMAT_PCM
+        static_cast<std::uint16_t>(numChannels),
+        static_cast<std::uint32_t>(samplingRate),
+        static_cast<std::uint32_t>(samplingRate * blockSize),
+        static_cast<std::uint16_t>(blockSize),
+        static_cast<std::uint16_t>(bitsPerSample),
+        AVI::GetFourCC("data"),
+        toSize(dataSize),
+      };
+      output.Write(reinterpret_cast<const std::uint8_t*>(&header), sizeof(header));
+    }
+
+    SSystem::SArray<std::uint8_t> audioBuffer;
+    std::uint64_t offset = 0;
+    while (offset < dataSize) {
+      soundFilePlayer.GetNextWaveBuffer(audioBuffer);
+      if (!audioBuffer.GetLength()) {
+        throw std::runtime_error("WriteRawStreams: audio ended early");
+      }
+      const auto size = static_cast<std::size_t>(std::min<std::uint64_t>(audioBuffer.GetLength(), dataSize - offset));
+      output.Write(audioBuffer.GetArray(), size);
+      offset += size;
+    }
+
+    if (!rawPCM && (dataSize & 1)) {
+      const std::uint8_t padding = 0;
+      output.Write(&padding, 1);
+    }
+
+    output.Close();
+  }
+}
+
+
+void WriteRawStreams(const std::wstring& filePath, const MEIToAVI::Options& options, StreamOutput* videoOutput, StreamOutput* audioOutput, bool rawPCM) {
+  const bool showMessage = !(options.flags & MEIToAVI::NoMessage);
+
+  std::unique_ptr<SSystem::SFileInterface> file;
+  ERISA::SGLMovieFilePlayer movieFilePlayer;
+  Movie::Open(filePath, file, movieFilePlayer);
+
+  // the audio is opened here, as EntisGLS is not meant to open files from several threads at once
+  std::unique_ptr<SSystem::SFileInterface> fileForSound;
+  ERISA::SGLSoundFilePlayer soundFilePlayer;
+  bool hasAudio = false;
+
+  if (audioOutput) {
+    if (!(options.flags & MEIToAVI::NoAudio)) {
+      hasAudio = movieFilePlayer.GetMediaFile().m_flagsRead & ERISA::SGLMediaFile::readSoundInfo;
+    }
+
+    if (hasAudio) {
+      Movie::OpenSound(filePath, fileForSound, soundFilePlayer);
+    } else {
+      if (showMessage) {
+        std::wcerr << L"[warn] the input has no audio, the audio output is left empty"sv << std::endl;
+      }
+      audioOutput->Close();
+    }
+  }
+
+  std::exception_ptr audioException;
+  std::thread audioThread;
+  if (hasAudio) {
+    audioThread = std::thread([&soundFilePlayer, audioOutput, rawPCM, &audioException] () {
+      try {
+        WriteAudio(soundFilePlayer, *audioOutput, rawPCM);
+      } catch (...) {
+        audioException = std::current_exception();
+      }
+    });
+  }
+
+  try {
+    if (videoOutput) {
+      WriteVideo(movieFilePlayer, options, *videoOutput, showMessage);
+    }
+  } catch (...) {
+    if (audioThread.joinable()) {
+      audioThread.join();
+    }
+    throw;
+  }
+
+  if (audioThread.joinable()) {
+    audioThread.join();
+    soundFilePlayer.Close();
+    fileForSound.reset();
+  }
+
+  if (audioException) {
+    std::rethrow_exception(audioException);
+  }
+}
@@ -0,0 +1,16 @@
+#ifndef ML_RAWSTREAMS_HPP
+#define ML_RAWSTREAMS_HPP
+
+#include <string>
+
+#include "MEIToAVI.hpp"
+#include "StreamOutput.hpp"
+
+
+// writes the video as YUV4MPEG2 (I420) and the audio as WAV (or raw PCM if rawPCM is set) without building an AVI
+// nothing is analyzed beforehand, so the first frame is sent as soon as it is decoded
+// the audio is decoded and written by its own thread, so that a reader may consume both outputs at its own pace
+// either output may be null; options.transform.format is ignored, and DedupFrames and UtVideo do not apply
+void WriteRawStreams(const std::wstring& filePath, const MEIToAVI::Options& options, StreamOutput* videoOutput, StreamOutput* audioOutput, bool rawPCM);
+
+#endif
@@ -0,0 +1,210 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ResumeJournal.hpp"
+#include "Kernel/Hash.hpp"
+
+#include <Windows.h>
+
+
+namespace {
+  std::uint64_t GetHeaderSize(std::uint64_t totalSize, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+    std::uint64_t headerSize = totalSize;
+    for (const auto& block : blockLayout) {
+      headerSize = std::min(headerSize, block.chunkOffset);
+    }
+    return headerSize;
+  }
+
+
+  // the header region is made of headers only, so reading it does not decode anything
+  std::uint64_t ComputeFingerprint(SourceBase& source, std::uint64_t headerSize, const std::vector<AVIBuilder::BlockLayout>& blockLayout) {
+    auto header = std::make_unique<std::uint8_t[]>(static_cast<std::size_t>(headerSize));
+    source.Read(header.get(), static_cast<std::size_t>(headerSize), 0);
+
+    std::vector<std::uint64_t> layoutValues;
+    layoutValues.reserve(blockLayout.size() * 6);
+    for (const auto& block : blockLayout) {
+      layoutValues.push_back(static_cast<std::uint64_t>(block.streamIndex) << 32 | block.blockIndex);
+      layoutValues.push_back(block.chunkOffset);
+      layoutValues.push_back(block.dataOffset);
+      layoutValues.push_back(block.size);
+      layoutValues.push_back(block.startTime);
+      layoutValues.push_back(static_cast<std::uint64_t>(block.indexFlags) << 1 | (block.reference ? 1 : 0));
+    }
+
+    const std::array<std::uint64_t, 3> values{
+      static_cast<std::uint64_t>(source.GetSize()),
+      Kernel::Hash(header.get(), static_cast<std::size_t>(headerSize)),
+      Kernel::Hash(reinterpret_cast<const std::uint8_t*>(layoutValues.data()), layoutValues.size() * sizeof(std::uint64_t)),
+    };
+    return Kernel::Hash(reinterpret_cast<const std::uint8_t*>(values.data()), values.size() * sizeof(std::uint64_t));
+  }
+
+
+  bool CompareRange(SourceBase& source, OutputFile& outputFile, std::uint64_t begin, std::uint64_t end, std::size_t bufferSize) {
+    auto sourceBuffer = std::make_unique<std::uint8_t[]>(bufferSize);
+    auto fileBuffer = std::make_unique<std::uint8_t[]>(bufferSize);
+
+    auto offset = begin;
+    while (offset != end) {
+      const auto readSize = static_cast<std::size_t>(std::min<std::uint64_t>(bufferSize, end - offset));
+      source.Read(sourceBuffer.get(), readSize, offset);
+      outputFile.Read(fileBuffer.get(), readSize, offset);
+      if (std::memcmp(sourceBuffer.get(), fileBuffer.get(), readSize) != 0) {
+        return false;
+      }
+      offset += readSize;
+    }
+    return true;
+  }
+}
+
+
+ResumeJournal::ResumeJournal(const std::wstring& filePath, SourceBase& source, const std::vector<AVIBuilder::BlockLayout>& blockLayout) :
+  mFilePath(filePath),
+  mFileSize(static_cast<std::uint64_t>(source.GetSize())),
+  mFingerprint(0),
+  mHeaderSize(GetHeaderSize(mFileSize, blockLayout)),
+  mCompletedRanges(),
+  mMutex(),
+  mStream()
+{
+  mFingerprint = ComputeFingerprint(source, mHeaderSize, blockLayout);
+
+  std::ifstream ifs(mFilePath, std::ios::binary);
+  if (!ifs) {
+    return;
+  }
+
+  FileHeader fileHeader;
+  if (!ifs.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader))) {
+    return;
+  }
+  if (fileHeader.magic != Magic || fileHeader.version != Version || fileHeader.fileSize != mFileSize || fileHeader.fingerprint != mFingerprint) {
+    return;
+  }
+
+  Record record;
+  while (ifs.read(reinterpret_cast<char*>(&record), sizeof(record))) {
+    if (record.begin < record.end && record.end <= mFileSize) {
+      mCompletedRanges.push_back(Range{record.begin, record.end});
+    }
+  }
+}
+
+
+const std::vector<ResumeJournal::Range>& ResumeJournal::GetCompletedRanges() const {
+  return mCompletedRanges;
+}
+
+
+ResumeJournal::VerifyResult ResumeJournal::Verify(SourceBase& source, OutputFile& outputFile, std::size_t numTailRanges, std::uint64_t tailSize, std::size_t bufferSize) {
+  VerifyResult result{
+    0,
+    0,
+    true,
+  };
+
+  if (mCompletedRanges.empty()) {
+    return result;
+  }
+
+  const auto discardAll = [this, &result] () {
+    result.headerMatched = false;
+    result.numDiscardedRanges += mCompletedRanges.size();
+    mCompletedRanges.clear();
+    return result;
+  };
+
+  // the output is preallocated, so any other size means that it is not the file the journal was written for
+  if (outputFile.GetSize() != mFileSize) {
+    return discardAll();
+  }
+
+  // the header region is always in the first range
+  const auto itrFirst = std::find_if(mCompletedRanges.cbegin(), mCompletedRanges.cend(), [] (const Range& range) {
+    return range.begin == 0;
+  });
+  if (itrFirst != mCompletedRanges.cend()) {
+    const auto end = std::min(mHeaderSize, itrFirst->end);
+    if (!CompareRange(source, outputFile, 0, end, bufferSize)) {
+      return discardAll();
+    }
+    result.verifiedSize += end;
+  }
+
+  const auto numTails = std::min(numTailRanges, mCompletedRanges.size());
+  for (std::size_t i = mCompletedRanges.size() - numTails; i < mCompletedRanges.size(); ) {
+    const auto& range = mCompletedRanges[i];
+    const auto begin = range.end - std::min(tailSize, range.end - range.begin);
+    if (!CompareRange(source, outputFile, begin, range.end, bufferSize)) {
+      mCompletedRanges.erase(mCompletedRanges.begin() + i);
+      result.numDiscardedRanges++;
+      continue;
+    }
+    result.verifiedSize += range.end - begin;
+    i++;
+  }
+
+  return result;
+}
+
+
+void ResumeJournal::Start() {
+  std::lock_guard lock(mMutex);
+
+  mStream.exceptions(std::ios::failbit | std::ios::badbit);
+  mStream.open(mFilePath, std::ios::binary | std::ios::trunc);
+
+  const FileHeader fileHeader{
+    Magic,
+    Version,
+    mFileSize,
+    mFingerprint,
+  };
+  mStream.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+  for (const auto& range : mCompletedRanges) {
+    const Record record{
+      range.begin,
+      range.end,
+    };
+    mStream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  }
+  mStream.flush();
+}
+
+
+void ResumeJournal::Append(std::uint64_t begin, std::uint64_t end) {
+  std::lock_guard lock(mMutex);
+
+  const Record record{
+    begin,
+    end,
+  };
+  mStream.write(reinterpret_cast<const char*>(&record), sizeof(record));
+  mStream.flush();
+  mCompletedRanges.push_back(Range{begin, end});
+}
+
+
+void ResumeJournal::Remove() {
+  std::lock_guard lock(mMutex);
+
+  if (mStream.is_open()) {
+    mStream.close();
+  }
+  DeleteFileW(mFilePath.c_str());
+}
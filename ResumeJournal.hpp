@@ -0,0 +1,94 @@
+#ifndef ML_RESUMEJOURNAL_HPP
+#define ML_RESUMEJOURNAL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "AVI.hpp"
+#include "AVIBuilder.hpp"
+#include "OutputFile.hpp"
+#include "Source/SourceBase.hpp"
+
+
+// sidecar of the output recording which ranges are completely written, so that an interrupted conversion can continue
+// the layout of the output only depends on the input and the options, so the ranges stay valid as long as the
+// fingerprint of the layout matches
+//
+// binary layout (little endian):
+//   FileHeader
+//   Record * n     appended as ranges complete; a range is recorded only after its data is flushed to the disk
+// records which are incomplete or out of the file are ignored
+class ResumeJournal {
+public:
+  static constexpr std::uint32_t Magic = AVI::GetFourCC("M2AR");
+  static constexpr std::uint32_t Version = 1;
+
+#pragma pack(push, 1)
+
+  struct FileHeader {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t fileSize;       // of the output
+    std::uint64_t fingerprint;    // of the headers and the block layout
+  };
+
+  static_assert(sizeof(FileHeader) == 4 * 6);
+
+
+  struct Record {
+    std::uint64_t begin;
+    std::uint64_t end;
+  };
+
+  static_assert(sizeof(Record) == 8 * 2);
+
+#pragma pack(pop)
+
+  struct Range {
+    std::uint64_t begin;
+    std::uint64_t end;
+  };
+
+  struct VerifyResult {
+    std::uint64_t verifiedSize;         // bytes read back and compared
+    std::size_t numDiscardedRanges;
+    bool headerMatched;                 // false if the header region differs, in which case every range is discarded
+  };
+
+private:
+  std::wstring mFilePath;
+  std::uint64_t mFileSize;
+  std::uint64_t mFingerprint;
+  std::uint64_t mHeaderSize;            // everything before the first block
+  std::vector<Range> mCompletedRanges;  // in the order of completion
+  std::mutex mMutex;
+  std::ofstream mStream;
+
+public:
+  // loads the ranges recorded by an earlier run for the same layout, if any
+  ResumeJournal(const std::wstring& filePath, SourceBase& source, const std::vector<AVIBuilder::BlockLayout>& blockLayout);
+
+  ResumeJournal(const ResumeJournal&) = delete;
+  ResumeJournal& operator=(const ResumeJournal&) = delete;
+
+  // in the order of completion
+  const std::vector<Range>& GetCompletedRanges() const;
+
+  // reads the loaded ranges back from outputFile and compares them with source: the header region, and the last
+  // tailSize bytes of each of the numTailRanges most recently completed ranges (the data at risk if the earlier run
+  // was cut off); the ranges that differ are discarded, and all of them if the header region or the file size differs
+  VerifyResult Verify(SourceBase& source, OutputFile& outputFile, std::size_t numTailRanges, std::uint64_t tailSize, std::size_t bufferSize);
+
+  // rewrites the journal with the loaded (and verified) ranges and keeps it open for Append
+  void Start();
+  // thread-safe; the data of the range must already be flushed
+  void Append(std::uint64_t begin, std::uint64_t end);
+  // deletes the journal once the output is complete
+  void Remove();
+};
+
+#endif
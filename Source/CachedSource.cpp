@@ -8,6 +8,7 @@
 #include "CachedSource.hpp"
 #include "SourceBase.hpp"
 #include "Util.hpp"
+#include "../Kernel/Copy.hpp"
 
 
 CachedSource::CachedSource(CacheStorage& cacheStorage, std::shared_ptr<SourceBase> source) :
@@ -28,13 +29,13 @@ void CachedSource::Read(std::uint8_t* data, std::size_t size, std::streamsize of
 
   const CacheStorage::CacheData* ptr = mCacheId ? mPtrCacheStorage->Get(mCacheId.value()) : nullptr;
   if (ptr) {
-    std::memcpy(data, ptr->data.get() + offset, size);
+    Kernel::Copy(data, ptr->data.get() + offset, size);
     //std::wcerr << L"cache hit" << std::endl;
     return;
   }
   auto sourceData = std::make_unique<std::uint8_t[]>(mSize);
   mSource->Read(sourceData.get(), mSize, 0);
-  std::memcpy(data, sourceData.get() + offset, size);
+  Kernel::Copy(data, sourceData.get() + offset, size);
   mCacheId = mPtrCacheStorage->Add(std::move(sourceData), mSize);
   //std::wcerr << L"cache miss" << std::endl;
   return;
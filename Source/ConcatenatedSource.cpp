@@ -5,6 +5,7 @@
 #include <ios>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include "ConcatenatedSource.hpp"
 #include "SourceBase.hpp"
@@ -79,3 +80,10 @@ void ConcatenatedSource::Read(std::uint8_t* data, std::size_t size, std::streams
     mLastUsedIndex++;
   }
 }
+
+
+void ConcatenatedSource::GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const {
+  for (const auto& piece : mPieces) {
+    piece.source->GetZeroRanges(zeroRanges, baseOffset + piece.offset);
+  }
+}
@@ -55,6 +55,7 @@ public:
 
   std::streamsize GetSize() const override;
   void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override;
+  void GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const override;
 };
 
 #endif
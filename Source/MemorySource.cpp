@@ -8,6 +8,7 @@
 #include "MemorySource.hpp"
 #include "SourceBase.hpp"
 #include "Util.hpp"
+#include "../Kernel/Copy.hpp"
 
 
 MemorySource::MemorySource(const std::uint8_t* data, std::size_t size) :
@@ -57,7 +58,7 @@ void MemorySource::Read(std::uint8_t* data, std::size_t size, std::streamsize of
     return;
   }
 
-  std::memcpy(data, mData.get() + offset, size);
+  Kernel::Copy(data, mData.get() + offset, size);
 }
 
 
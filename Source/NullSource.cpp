@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <cstring>
 #include <ios>
+#include <vector>
 
 #include "NullSource.hpp"
 #include "Util.hpp"
@@ -26,3 +27,12 @@ void NullSource::Read(std::uint8_t* data, std::size_t size, std::streamsize offs
 
   std::memset(data, 0, size);
 }
+
+
+void NullSource::GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const {
+  if (!mSize) {
+    return;
+  }
+
+  zeroRanges.push_back(ZeroRange{baseOffset, mSize});
+}
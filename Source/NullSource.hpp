@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <ios>
+#include <vector>
 
 #include "SourceBase.hpp"
 
@@ -16,6 +17,7 @@ public:
 
   std::streamsize GetSize() const override;
   void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override;
+  void GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const override;
 };
 
 #endif
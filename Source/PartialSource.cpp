@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <ios>
+#include <vector>
 
 #include "PartialSource.hpp"
 #include "SourceBase.hpp"
@@ -44,3 +46,18 @@ void PartialSource::Read(std::uint8_t* data, std::size_t size, std::streamsize o
   mSource->Read(data, size, offset + mOffset);
   return;
 }
+
+
+void PartialSource::GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const {
+  std::vector<ZeroRange> sourceZeroRanges;
+  mSource->GetZeroRanges(sourceZeroRanges, 0);
+
+  for (const auto& zeroRange : sourceZeroRanges) {
+    const auto begin = std::max(zeroRange.offset, mOffset);
+    const auto end = std::min(zeroRange.offset + zeroRange.size, mOffset + mSize);
+    if (begin >= end) {
+      continue;
+    }
+    zeroRanges.push_back(ZeroRange{baseOffset + begin - mOffset, end - begin});
+  }
+}
@@ -5,6 +5,8 @@
 #include <cstdint>
 #include <ios>
 #include <limits>
+#include <memory>
+#include <vector>
 
 #include "SourceBase.hpp"
 
@@ -21,6 +23,7 @@ public:
 
   std::streamsize GetSize() const override;
   void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) override;
+  void GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const override;
 };
 
 #endif
@@ -4,14 +4,24 @@
 #include <cstddef>
 #include <cstdint>
 #include <ios>
+#include <vector>
 
 
 class SourceBase {
 public:
+  struct ZeroRange {
+    std::streamsize offset;
+    std::streamsize size;
+  };
+
   virtual ~SourceBase() = default;
 
   virtual std::streamsize GetSize() const = 0;
   virtual void Read(std::uint8_t* data, std::size_t size, std::streamsize offset) = 0;
+
+  // appends the ranges which are known to be filled with zeros without reading them, shifted by baseOffset
+  // the ranges are appended in ascending order, but adjacent ones are not merged
+  virtual void GetZeroRanges(std::vector<ZeroRange>& zeroRanges, std::streamsize baseOffset) const {}
 };
 
 #endif
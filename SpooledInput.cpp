@@ -0,0 +1,231 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SpooledInput.hpp"
+#include "OutputFile.hpp"
+
+#include <Windows.h>
+
+#include <sakuraglx/sakuraglx.h>
+
+
+namespace {
+  std::mutex gStdinMutex;
+  std::size_t gStdinMemoryLimit = SpooledInput::DefaultMemoryLimit;
+  std::shared_ptr<SpooledInput> gStdin;
+
+
+  std::wstring CreateTemporaryFilePath() {
+    wchar_t directory[MAX_PATH + 1];
+    const auto length = GetTempPathW(MAX_PATH + 1, directory);
+    if (length == 0 || length > MAX_PATH) {
+      throw std::runtime_error("SpooledInput: cannot get the temporary directory");
+    }
+
+    wchar_t filePath[MAX_PATH];
+    if (!GetTempFileNameW(directory, L"m2a", 0, filePath)) {
+      throw std::runtime_error("SpooledInput: cannot create a temporary file");
+    }
+    return filePath;
+  }
+}
+
+
+SpooledInput::SpooledInput(void* handle, std::size_t memoryLimit) :
+  mHandle(handle),
+  mMemoryLimit((memoryLimit + ChunkSize - 1) / ChunkSize * ChunkSize),
+  mMutex(),
+  mChunks(mMemoryLimit / ChunkSize),
+  mSpillFile(),
+  mSize(0),
+  mComplete(false)
+{}
+
+
+void SpooledInput::Fill(std::uint64_t size) {
+  std::unique_ptr<std::uint8_t[]> spillBuffer;
+
+  while (!mComplete && mSize < size) {
+    std::uint8_t* buffer;
+    std::size_t bufferSize;
+    if (mSize < mMemoryLimit) {
+      const auto chunkIndex = static_cast<std::size_t>(mSize / ChunkSize);
+      if (!mChunks[chunkIndex]) {
+        mChunks[chunkIndex] = std::make_unique<std::uint8_t[]>(ChunkSize);
+      }
+      const auto chunkOffset = static_cast<std::size_t>(mSize % ChunkSize);
+      buffer = mChunks[chunkIndex].get() + chunkOffset;
+      bufferSize = ChunkSize - chunkOffset;
+    } else {
+      if (!mSpillFile) {
+        mSpillFile.emplace(CreateTemporaryFilePath(), OutputFile::Mode::Temporary);
+      }
+      if (!spillBuffer) {
+        spillBuffer = std::make_unique<std::uint8_t[]>(ChunkSize);
+      }
+      buffer = spillBuffer.get();
+      bufferSize = ChunkSize;
+    }
+
+    DWORD readSize = 0;
+    if (!ReadFile(mHandle, buffer, static_cast<DWORD>(bufferSize), &readSize, nullptr)) {
+      // the writer of a pipe closing its end is the end of the stream
+      if (GetLastError() != ERROR_BROKEN_PIPE) {
+        throw std::runtime_error("SpooledInput: cannot read input");
+      }
+      readSize = 0;
+    }
+    if (!readSize) {
+      mComplete = true;
+      break;
+    }
+
+    if (mSize >= mMemoryLimit) {
+      mSpillFile->Write(buffer, readSize, mSize - mMemoryLimit);
+    }
+    mSize += readSize;
+  }
+}
+
+
+std::uint64_t SpooledInput::GetSize() {
+  std::lock_guard lock(mMutex);
+  Fill(std::numeric_limits<std::uint64_t>::max());
+  return mSize;
+}
+
+
+std::size_t SpooledInput::Read(void* data, std::size_t size, std::uint64_t offset) {
+  std::uint64_t availableSize;
+  {
+    std::lock_guard lock(mMutex);
+    Fill(offset + size);
+    availableSize = mSize;
+  }
+
+  // the chunks and the spilled bytes below availableSize are never written again, so they are read without the lock
+  const auto readSize = static_cast<std::size_t>(std::min<std::uint64_t>(size, availableSize - std::min(offset, availableSize)));
+  auto dest = static_cast<std::uint8_t*>(data);
+  auto remainingSize = readSize;
+
+  while (remainingSize && offset < mMemoryLimit) {
+    const auto chunkOffset = static_cast<std::size_t>(offset % ChunkSize);
+    const auto copySize = std::min(remainingSize, ChunkSize - chunkOffset);
+    std::memcpy(dest, mChunks[static_cast<std::size_t>(offset / ChunkSize)].get() + chunkOffset, copySize);
+    dest += copySize;
+    offset += copySize;
+    remainingSize -= copySize;
+  }
+
+  if (remainingSize) {
+    mSpillFile->Read(dest, remainingSize, offset - mMemoryLimit);
+  }
+
+  return readSize;
+}
+
+
+SpooledInput::Stats SpooledInput::GetStats() {
+  std::lock_guard lock(mMutex);
+  return Stats{
+    mSize,
+    mSize > mMemoryLimit ? mSize - mMemoryLimit : 0,
+    mComplete,
+  };
+}
+
+
+void SpooledInput::Configure(std::size_t memoryLimit) {
+  std::lock_guard lock(gStdinMutex);
+  gStdinMemoryLimit = memoryLimit;
+}
+
+
+std::shared_ptr<SpooledInput> SpooledInput::GetStdin() {
+  std::lock_guard lock(gStdinMutex);
+  if (!gStdin) {
+    const auto handle = GetStdHandle(STD_INPUT_HANDLE);
+    if (handle == INVALID_HANDLE_VALUE || handle == nullptr) {
+      throw std::runtime_error("SpooledInput: no stdin");
+    }
+    gStdin = std::make_shared<SpooledInput>(handle, gStdinMemoryLimit);
+  }
+  return gStdin;
+}
+
+
+
+SpooledInputInterface::SpooledInputInterface(std::shared_ptr<SpooledInput> input) :
+  mInput(input),
+  mPosition(0)
+{}
+
+
+SSystem::SFileInterface* SpooledInputInterface::Duplicate() {
+  auto duplicate = new SpooledInputInterface(mInput);
+  duplicate->mPosition = mPosition;
+  return duplicate;
+}
+
+
+unsigned long int SpooledInputInterface::Read(void* ptrBuffer, unsigned long int nBytes) {
+  const auto readSize = mInput->Read(ptrBuffer, nBytes, mPosition);
+  mPosition += readSize;
+  return static_cast<unsigned long int>(readSize);
+}
+
+
+unsigned long int SpooledInputInterface::Write(const void* ptrBuffer, unsigned long int nBytes) {
+  return 0;
+}
+
+
+SSystem::UInt64 SpooledInputInterface::GetLength() {
+  return mInput->GetSize();
+}
+
+
+SSystem::UInt64 SpooledInputInterface::GetPosition() const {
+  return mPosition;
+}
+
+
+SSystem::SError SpooledInputInterface::Seek(SSystem::Int64 nOffsetPos, SeekOrigin fSeekFrom) {
+  std::int64_t base = 0;
+  switch (fSeekFrom) {
+    case FromBegin:
+      base = 0;
+      break;
+
+    case FromCurrent:
+      base = static_cast<std::int64_t>(mPosition);
+      break;
+
+    case FromEnd:
+      base = static_cast<std::int64_t>(mInput->GetSize());
+      break;
+  }
+
+  const auto position = base + nOffsetPos;
+  if (position < 0) {
+    return SSystem::SError::errGeneralError;
+  }
+  mPosition = static_cast<std::uint64_t>(position);
+  return SSystem::SError::errSuccess;
+}
+
+
+SSystem::SError SpooledInputInterface::SetEndOfFile() {
+  return SSystem::SError::errGeneralError;
+}
@@ -0,0 +1,89 @@
+#ifndef ML_SPOOLEDINPUT_HPP
+#define ML_SPOOLEDINPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "OutputFile.hpp"
+
+#include <sakuraglx/sakuraglx.h>
+
+
+// seekable copy of a stream which can only be read once (stdin), shared by every decoder of the input
+// the stream is read only as far as the decoders have asked for; the first memoryLimit bytes are kept in memory and the
+// rest is spilled to a temporary file, which the system keeps cached as long as there is memory for it
+// nothing is released before the end, as the decoders seek back (the audio is decoded from the start on its own, and
+// the readers of -threads and -serve go anywhere)
+class SpooledInput {
+public:
+  static constexpr std::size_t DefaultMemoryLimit = 64 * 1024 * 1024;
+  static constexpr std::size_t ChunkSize = 1024 * 1024;
+
+  struct Stats {
+    std::uint64_t size;           // read from the stream so far
+    std::uint64_t spilledSize;
+    bool complete;                // the end of the stream has been reached
+  };
+
+private:
+  void* mHandle;    // HANDLE
+  std::size_t mMemoryLimit;
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<std::uint8_t[]>> mChunks;   // sized up front, so that filled chunks never move
+  std::optional<OutputFile> mSpillFile;
+  std::uint64_t mSize;
+  bool mComplete;
+
+  // reads the stream until size bytes are available or it ends; mMutex must be held
+  void Fill(std::uint64_t size);
+
+public:
+  // handle must stay open as long as this is used
+  SpooledInput(void* handle, std::size_t memoryLimit);
+
+  SpooledInput(const SpooledInput&) = delete;
+  SpooledInput& operator=(const SpooledInput&) = delete;
+
+  // reads the whole stream, as the size is only known at its end
+  std::uint64_t GetSize();
+
+  // thread-safe; waits for the stream as needed and returns the number of bytes copied, which is less than size only
+  // at the end of the stream
+  std::size_t Read(void* data, std::size_t size, std::uint64_t offset);
+
+  Stats GetStats();
+
+
+  // the spooled stdin of the process, created on first use
+  // Configure takes effect only before the first GetStdin
+  static void Configure(std::size_t memoryLimit);
+  static std::shared_ptr<SpooledInput> GetStdin();
+};
+
+
+// file interface of EntisGLS over a SpooledInput, with its own position
+class SpooledInputInterface : public SSystem::SFileInterface {
+  std::shared_ptr<SpooledInput> mInput;
+  std::uint64_t mPosition;
+
+public:
+  explicit SpooledInputInterface(std::shared_ptr<SpooledInput> input);
+
+  SSystem::SFileInterface* Duplicate() override;
+  unsigned long int Read(void* ptrBuffer, unsigned long int nBytes) override;
+  // the input is read-only; always writes nothing
+  unsigned long int Write(const void* ptrBuffer, unsigned long int nBytes) override;
+  // reads the whole stream
+  SSystem::UInt64 GetLength() override;
+  SSystem::UInt64 GetPosition() const override;
+  // seeking from the end reads the whole stream
+  SSystem::SError Seek(SSystem::Int64 nOffsetPos, SeekOrigin fSeekFrom = FromBegin) override;
+  // the input is read-only; always fails
+  SSystem::SError SetEndOfFile() override;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "StreamOutput.hpp"
+
+#include <Windows.h>
+#include <io.h>
+
+using namespace std::literals;
+
+
+namespace {
+  constexpr DWORD PipeBufferSize = 1024 * 1024;
+}
+
+
+StreamOutput::StreamOutput(const std::wstring& target) :
+  mHandle(INVALID_HANDLE_VALUE),
+  mOwned(true),
+  mPipe(false),
+  mConnected(false)
+{
+  const std::wstring_view targetView(target);
+
+  if (targetView == L"-"sv) {
+    mHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+    mOwned = false;
+  } else if (targetView.substr(0, 3) == L"fd:"sv) {
+    mHandle = reinterpret_cast<HANDLE>(_get_osfhandle(std::stoi(target.substr(3))));
+    mOwned = false;
+  } else if (targetView.substr(0, 9) == L"\\\\.\\pipe\\"sv) {
+    mHandle = CreateNamedPipeW(target.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, PipeBufferSize, 0, 0, nullptr);
+    mPipe = true;
+  } else {
+    mHandle = CreateFileW(target.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  }
+
+  if (mHandle == INVALID_HANDLE_VALUE || mHandle == nullptr) {
+    mHandle = INVALID_HANDLE_VALUE;
+    throw std::runtime_error("StreamOutput: cannot open output");
+  }
+}
+
+
+StreamOutput::~StreamOutput() {
+  if (mOwned && mHandle != INVALID_HANDLE_VALUE) {
+    CloseHandle(mHandle);
+  }
+}
+
+
+void StreamOutput::Write(const std::uint8_t* data, std::size_t size) {
+  if (mPipe && !mConnected) {
+    if (!ConnectNamedPipe(mHandle, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED) {
+      throw std::runtime_error("StreamOutput: cannot connect pipe");
+    }
+    mConnected = true;
+  }
+
+  while (size) {
+    // WriteFile takes the size as DWORD
+    const auto writeSize = static_cast<DWORD>(std::min<std::size_t>(size, std::numeric_limits<DWORD>::max()));
+
+    DWORD writtenSize = 0;
+    if (!WriteFile(mHandle, data, writeSize, &writtenSize, nullptr)) {
+      throw std::runtime_error("StreamOutput: cannot write output");
+    }
+
+    // pipes may accept less than requested
+    data += writtenSize;
+    size -= writtenSize;
+  }
+}
+
+
+void StreamOutput::Close() {
+  if (mHandle == INVALID_HANDLE_VALUE) {
+    return;
+  }
+
+  const auto handle = mHandle;
+  mHandle = INVALID_HANDLE_VALUE;
+
+  // lets the reader receive the rest before the pipe is closed
+  if (mPipe && mConnected) {
+    FlushFileBuffers(handle);
+  }
+
+  if (mOwned && !CloseHandle(handle)) {
+    throw std::runtime_error("StreamOutput: cannot close output");
+  }
+}
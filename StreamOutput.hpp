@@ -0,0 +1,31 @@
+#ifndef ML_STREAMOUTPUT_HPP
+#define ML_STREAMOUTPUT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+// sequential output which does not have to be seekable
+// target: "-" for stdout, "fd:N" for an inherited file descriptor, "\\.\pipe\name" to create a named pipe
+// (the reader connects to it, e.g. "ffmpeg -i \\.\pipe\name"), or a file path
+class StreamOutput {
+  void* mHandle;      // HANDLE
+  bool mOwned;        // false for stdout and file descriptors
+  bool mPipe;
+  bool mConnected;
+
+public:
+  StreamOutput(const std::wstring& target);
+  ~StreamOutput();
+
+  StreamOutput(const StreamOutput&) = delete;
+  StreamOutput& operator=(const StreamOutput&) = delete;
+
+  // waits for the reader to connect to a named pipe on the first call
+  void Write(const std::uint8_t* data, std::size_t size);
+  // waits until a named pipe is drained by the reader
+  void Close();
+};
+
+#endif
@@ -0,0 +1,442 @@
+#define NOMINMAX
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.hpp"
+#include "Kernel/Hash.hpp"
+
+#include <Windows.h>
+
+using namespace std::literals;
+
+
+namespace {
+  constexpr std::size_t BenchBlockSize = 64 * 1024;
+  constexpr std::size_t BenchNumBlocks = 16;          // 1 MiB, so that the workloads measure the pool rather than memory
+  constexpr std::size_t BenchUniformTasks = 8192;
+  constexpr std::size_t BenchSkewedTasks = 1024;
+  constexpr std::size_t BenchNestedTasks = 64;
+  constexpr std::size_t BenchRepeats = 3;
+
+  // the pool and the index of the worker running on this thread, for tasks submitted from inside the pool
+  thread_local ThreadPool* gCurrentPool = nullptr;
+  thread_local std::size_t gCurrentWorker = 0;
+
+  std::mutex gSharedMutex;
+  std::uint_fast32_t gSharedNumThreads = 0;
+  bool gSharedPinThreads = false;
+  std::unique_ptr<ThreadPool> gSharedPool;
+
+
+  // blocks hashed by task index of the skewed benchmark; the first tasks are the largest
+  std::size_t GetSkewedBlocks(std::size_t index) {
+    return (BenchSkewedTasks - index + 63) / 64;
+  }
+
+
+  std::size_t GetTotalSkewedBlocks() {
+    std::size_t numBlocks = 0;
+    for (std::size_t i = 0; i < BenchSkewedTasks; i++) {
+      numBlocks += GetSkewedBlocks(i);
+    }
+    return numBlocks;
+  }
+
+
+  struct Group {
+    const std::function<void(std::size_t)>* func;
+    std::size_t count;
+    std::atomic<std::size_t> nextIndex;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::size_t numActive;        // threads other than the caller which may still be running an index
+    std::exception_ptr exception;
+  };
+
+
+  void RunGroup(Group& group) {
+    std::size_t index;
+    while ((index = group.nextIndex++) < group.count) {
+      try {
+        (*group.func)(index);
+      } catch (...) {
+        std::lock_guard lock(group.mutex);
+        if (!group.exception) {
+          group.exception = std::current_exception();
+        }
+        // let the other threads stop early
+        group.nextIndex = group.count;
+      }
+    }
+  }
+}
+
+
+ThreadPool::ThreadPool(std::uint_fast32_t numThreads, bool pinThreads) :
+  mWorkers(),
+  mPinThreads(pinThreads),
+  mMutex(),
+  mCondition(),
+  mNumQueued(0),
+  mNumRunning(0),
+  mNextWorker(0),
+  mStopping(false)
+{
+  const std::size_t numWorkers = std::max<std::uint_fast32_t>(numThreads, 2) - 1;
+
+  mWorkers.reserve(numWorkers);
+  for (std::size_t i = 0; i < numWorkers; i++) {
+    auto worker = std::make_unique<Worker>();
+    worker->numTasks = 0;
+    worker->numStolen = 0;
+    worker->busyTime = 0;
+    mWorkers.push_back(std::move(worker));
+  }
+
+  // started after every deque exists, as a worker may steal from any of them
+  for (std::size_t i = 0; i < numWorkers; i++) {
+    mWorkers[i]->thread = std::thread(&ThreadPool::RunWorker, this, i);
+  }
+}
+
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(mMutex);
+    mStopping = true;
+  }
+  mCondition.notify_all();
+
+  // the tasks still queued are run before the workers exit
+  for (auto& worker : mWorkers) {
+    worker->thread.join();
+  }
+}
+
+
+void ThreadPool::Push(Task task, Priority priority) {
+  const auto workerIndex = gCurrentPool == this ? gCurrentWorker : mNextWorker++ % mWorkers.size();
+
+  {
+    auto& worker = *mWorkers[workerIndex];
+    std::lock_guard lock(worker.mutex);
+    worker.deques[static_cast<std::size_t>(priority)].push_back(std::move(task));
+    // counted under the lock of the deque, so that it never falls below the number of tasks taken
+    mNumQueued++;
+  }
+
+  // an idle worker checks mNumQueued under mMutex before it waits, so the notification cannot fall between the two
+  {
+    std::lock_guard lock(mMutex);
+  }
+  mCondition.notify_one();
+}
+
+
+bool ThreadPool::Take(std::size_t workerIndex, Task& task, bool& stolen) {
+  if (!mNumQueued) {
+    return false;
+  }
+
+  for (std::size_t priority = 0; priority < NumPriorities; priority++) {
+    for (std::size_t i = 0; i < mWorkers.size(); i++) {
+      auto& worker = *mWorkers[(workerIndex + i) % mWorkers.size()];
+      std::lock_guard lock(worker.mutex);
+
+      auto& deque = worker.deques[priority];
+      if (deque.empty()) {
+        continue;
+      }
+
+      // the newest task of its own (likely still in cache), the oldest of another (likely the largest remaining)
+      if (i == 0) {
+        task = std::move(deque.back());
+        deque.pop_back();
+      } else {
+        task = std::move(deque.front());
+        deque.pop_front();
+      }
+      // running before it stops being queued, so that WaitIdle never sees neither
+      mNumRunning++;
+      mNumQueued--;
+      stolen = i != 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void ThreadPool::RunWorker(std::size_t workerIndex) {
+  gCurrentPool = this;
+  gCurrentWorker = workerIndex;
+
+  if (mPinThreads) {
+    // processor 0 is left to the thread which calls ParallelFor
+    const std::size_t numProcessors = std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, sizeof(DWORD_PTR) * 8);
+    SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << ((workerIndex + 1) % numProcessors));
+  }
+
+  auto& worker = *mWorkers[workerIndex];
+
+  Task task;
+  bool stolen = false;
+  while (true) {
+    if (Take(workerIndex, task, stolen)) {
+      const auto startTime = Clock::now();
+      task();
+      task = nullptr;
+      worker.busyTime += (Clock::now() - startTime).count();
+      worker.numTasks++;
+      if (stolen) {
+        worker.numStolen++;
+      }
+      mNumRunning--;
+      continue;
+    }
+
+    std::unique_lock lock(mMutex);
+    mCondition.wait(lock, [this] () {
+      return mStopping || mNumQueued != 0;
+    });
+    if (mStopping && !mNumQueued) {
+      return;
+    }
+  }
+}
+
+
+std::size_t ThreadPool::GetNumWorkers() const {
+  return mWorkers.size();
+}
+
+
+void ThreadPool::Submit(Task task, Priority priority) {
+  Push(std::move(task), priority);
+}
+
+
+void ThreadPool::ParallelFor(std::size_t count, std::size_t maxConcurrency, Priority priority, const std::function<void(std::size_t)>& func) {
+  const auto numThreads = std::min({count, maxConcurrency, mWorkers.size() + 1});
+  if (numThreads <= 1) {
+    for (std::size_t i = 0; i < count; i++) {
+      func(i);
+    }
+    return;
+  }
+
+  // shared with the tasks, as the ones which start after all indices are taken may outlive this call
+  auto group = std::make_shared<Group>();
+  group->func = &func;
+  group->count = count;
+  group->nextIndex = 0;
+  group->numActive = 0;
+
+  for (std::size_t i = 1; i < numThreads; i++) {
+    Push([group] () {
+      {
+        std::lock_guard lock(group->mutex);
+        group->numActive++;
+      }
+      RunGroup(*group);
+      {
+        std::lock_guard lock(group->mutex);
+        if (--group->numActive == 0) {
+          group->condition.notify_all();
+        }
+      }
+    }, priority);
+  }
+
+  RunGroup(*group);
+
+  // every index has been taken by now, so this only waits for the ones running on other threads
+  std::unique_lock lock(group->mutex);
+  group->condition.wait(lock, [&group] () {
+    return group->numActive == 0;
+  });
+  if (group->exception) {
+    std::rethrow_exception(group->exception);
+  }
+}
+
+
+void ThreadPool::WaitIdle() const {
+  while (mNumQueued || mNumRunning) {
+    std::this_thread::yield();
+  }
+}
+
+
+std::vector<ThreadPool::WorkerStats> ThreadPool::GetStats() const {
+  std::vector<WorkerStats> stats;
+  stats.reserve(mWorkers.size());
+  for (const auto& worker : mWorkers) {
+    stats.push_back(WorkerStats{
+      worker->numTasks,
+      worker->numStolen,
+      Clock::duration(worker->busyTime),
+    });
+  }
+  return stats;
+}
+
+
+void ThreadPool::ResetStats() {
+  for (auto& worker : mWorkers) {
+    worker->numTasks = 0;
+    worker->numStolen = 0;
+    worker->busyTime = 0;
+  }
+}
+
+
+void ThreadPool::Configure(std::uint_fast32_t numThreads, bool pinThreads) {
+  std::lock_guard lock(gSharedMutex);
+  gSharedNumThreads = numThreads;
+  gSharedPinThreads = pinThreads;
+}
+
+
+ThreadPool& ThreadPool::GetShared() {
+  std::lock_guard lock(gSharedMutex);
+  if (!gSharedPool) {
+    const auto numThreads = gSharedNumThreads ? gSharedNumThreads : std::max(std::thread::hardware_concurrency(), 1u);
+    gSharedPool = std::make_unique<ThreadPool>(numThreads, gSharedPinThreads);
+  }
+  return *gSharedPool;
+}
+
+
+void BenchThreadPool(std::uint_fast32_t maxThreads, bool pinThreads) {
+  std::mt19937 random(0x6D656932);
+  std::vector<std::uint8_t> data(BenchBlockSize * BenchNumBlocks);
+  for (auto& value : data) {
+    value = static_cast<std::uint8_t>(random());
+  }
+
+  std::atomic<std::uint64_t> sink(0);
+  const auto hashBlocks = [&data, &sink] (std::size_t index, std::size_t numBlocks) {
+    std::uint64_t hash = 0;
+    for (std::size_t i = 0; i < numBlocks; i++) {
+      hash ^= Kernel::Hash(data.data() + (index + i) % BenchNumBlocks * BenchBlockSize, BenchBlockSize);
+    }
+    sink ^= hash;
+  };
+
+  struct Workload {
+    std::wstring_view name;
+    std::size_t numBlocks;
+    std::function<void(ThreadPool& pool, std::size_t numThreads)> run;
+  };
+
+  const Workload workloads[] = {
+    // many equal tasks: the cost of handing out a task
+    {
+      L"uniform"sv,
+      BenchUniformTasks,
+      [&hashBlocks] (ThreadPool& pool, std::size_t numThreads) {
+        pool.ParallelFor(BenchUniformTasks, numThreads, ThreadPool::Priority::Normal, [&hashBlocks] (std::size_t i) {
+          hashBlocks(i, 1);
+        });
+      },
+    },
+    // tasks of decreasing size: whether the threads which finish early pick up the rest
+    {
+      L"skewed"sv,
+      GetTotalSkewedBlocks(),
+      [&hashBlocks] (ThreadPool& pool, std::size_t numThreads) {
+        pool.ParallelFor(BenchSkewedTasks, numThreads, ThreadPool::Priority::Normal, [&hashBlocks] (std::size_t i) {
+          hashBlocks(i, GetSkewedBlocks(i));
+        });
+      },
+    },
+    // a loop inside every task of a loop, like the slices of a frame inside a range writer: needs stealing
+    {
+      L"nested"sv,
+      BenchNestedTasks * BenchNestedTasks,
+      [&hashBlocks] (ThreadPool& pool, std::size_t numThreads) {
+        pool.ParallelFor(BenchNestedTasks, numThreads, ThreadPool::Priority::Normal, [&pool, &hashBlocks, numThreads] (std::size_t i) {
+          pool.ParallelFor(BenchNestedTasks, numThreads, ThreadPool::Priority::High, [&hashBlocks, i] (std::size_t j) {
+            hashBlocks(i * BenchNestedTasks + j, 1);
+          });
+        });
+      },
+    },
+  };
+
+  std::vector<std::uint_fast32_t> threadCounts;
+  for (std::uint_fast32_t numThreads = 1; numThreads < maxThreads; numThreads *= 2) {
+    threadCounts.push_back(numThreads);
+  }
+  threadCounts.push_back(maxThreads);
+
+  std::wcerr << L"[bench] thread pool: up to "sv << maxThreads << L" threads"sv << (pinThreads ? L", pinned"sv : L""sv) << std::endl;
+
+  for (const auto& workload : workloads) {
+    double baseTime = 0;
+    for (const auto numThreads : threadCounts) {
+      ThreadPool pool(numThreads, pinThreads);
+
+      // warm up
+      workload.run(pool, numThreads);
+
+      auto bestTime = std::chrono::steady_clock::duration::max();
+      std::vector<ThreadPool::WorkerStats> bestStats;
+      for (std::size_t i = 0; i < BenchRepeats; i++) {
+        // the workers record a task only after ParallelFor has returned
+        pool.WaitIdle();
+        pool.ResetStats();
+        const auto startTime = std::chrono::steady_clock::now();
+        workload.run(pool, numThreads);
+        const auto time = std::chrono::steady_clock::now() - startTime;
+        pool.WaitIdle();
+        if (time < bestTime) {
+          bestTime = time;
+          bestStats = pool.GetStats();
+        }
+      }
+
+      const auto seconds = std::chrono::duration<double>(bestTime).count();
+      if (numThreads == threadCounts.front()) {
+        baseTime = seconds;
+      }
+
+      std::uint64_t numTasks = 0;
+      std::uint64_t numStolen = 0;
+      ThreadPool::Clock::duration busyTime{};
+      for (const auto& stats : bestStats) {
+        numTasks += stats.numTasks;
+        numStolen += stats.numStolen;
+        busyTime += stats.busyTime;
+      }
+      const auto busyRatio = numThreads > 1 ? std::chrono::duration<double>(busyTime).count() / (seconds * pool.GetNumWorkers()) : 0.0;
+
+      std::wcerr << L"[bench] "sv << workload.name << L" "sv << numThreads << L" threads: "sv << seconds * 1000 << L" ms, "sv
+                 << (seconds > 0 ? baseTime / seconds : 0.0) << L"x, "sv
+                 << (seconds > 0 ? workload.numBlocks * BenchBlockSize / seconds / (1024 * 1024) : 0.0) << L" MiB/s, "sv
+                 << L"worker tasks "sv << numTasks << L" ("sv << numStolen << L" stolen), workers busy "sv << busyRatio * 100 << L"%"sv << std::endl;
+    }
+  }
+
+  // keeps the hashing from being optimized away
+  if (sink == 0x6D656932) {
+    std::wcerr << std::endl;
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef ML_THREADPOOL_HPP
+#define ML_THREADPOOL_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// work-stealing pool shared by the parallel parts of the program (slice encoding, range writers, hashing, batch jobs)
+// every worker has a deque per priority; a worker runs the newest task of its own deque first and steals the oldest
+// task of another worker when its own is empty, and no task of lower priority is started while one of higher priority
+// is queued anywhere
+// tasks submitted by a worker go to its own deque, and the others are dealt out to the workers in turn
+class ThreadPool {
+public:
+  // High is for work somebody is waiting for right now (e.g. the slices of the frame being encoded),
+  // Normal for work that only has to be done eventually (e.g. ranges written ahead)
+  enum class Priority {
+    High,
+    Normal,
+  };
+
+  static constexpr std::size_t NumPriorities = 2;
+
+  using Clock = std::chrono::steady_clock;
+  using Task = std::function<void()>;
+
+  struct WorkerStats {
+    std::uint64_t numTasks;
+    std::uint64_t numStolen;      // of numTasks, taken from the deque of another worker
+    Clock::duration busyTime;
+  };
+
+private:
+  struct Worker {
+    std::mutex mutex;
+    std::array<std::deque<Task>, NumPriorities> deques;
+    std::atomic<std::uint64_t> numTasks;
+    std::atomic<std::uint64_t> numStolen;
+    std::atomic<Clock::rep> busyTime;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+  bool mPinThreads;
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  std::atomic<std::size_t> mNumQueued;
+  std::atomic<std::size_t> mNumRunning;
+  std::atomic<std::size_t> mNextWorker;
+  bool mStopping;
+
+  void Push(Task task, Priority priority);
+  bool Take(std::size_t workerIndex, Task& task, bool& stolen);
+  void RunWorker(std::size_t workerIndex);
+
+public:
+  // starts numThreads - 1 workers (at least one), as the thread calling ParallelFor takes part too
+  // with pinThreads, worker i is bound to logical processor i + 1 (modulo the first 64)
+  ThreadPool(std::uint_fast32_t numThreads, bool pinThreads);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  std::size_t GetNumWorkers() const;
+
+  // task must not throw
+  void Submit(Task task, Priority priority);
+
+  // calls func(i) for every i in [0, count) on at most maxConcurrency threads, including the calling thread, and
+  // returns when all of them have returned
+  // the calling thread only waits for indices other threads have already started, so ParallelFor may be nested in
+  // func or called from a task
+  // if func throws, no more indices are started and the first exception is rethrown
+  void ParallelFor(std::size_t count, std::size_t maxConcurrency, Priority priority, const std::function<void(std::size_t)>& func);
+
+  // spins until no task is queued or running; for measurements
+  void WaitIdle() const;
+
+  std::vector<WorkerStats> GetStats() const;
+  void ResetStats();
+
+
+  // the pool used throughout the program
+  // Configure takes effect only before the first GetShared; by default there is one thread per logical processor
+  static void Configure(std::uint_fast32_t numThreads, bool pinThreads);
+  static ThreadPool& GetShared();
+};
+
+
+// measures how ParallelFor scales from 1 to maxThreads threads on uniform, skewed and nested workloads
+// results are written to std::wcerr
+void BenchThreadPool(std::uint_fast32_t maxThreads, bool pinThreads);
+
+#endif